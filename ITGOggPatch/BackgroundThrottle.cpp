@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "BackgroundThrottle.h"
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "lowimpact.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+const long BackgroundThrottle::s_systemCheckIntervalMs = 1000;
+const long BackgroundThrottle::s_maxBackOffMs = 30000;
+
+// A quarter second of burst keeps the token buckets from being consulted constantly without letting through
+// enough I/O at once to be noticed.
+BackgroundThrottle::BackgroundThrottle(const PatcherOptions& options)
+	: m_bytes(options.MaxBytesPerSecond(), max(options.MaxBytesPerSecond() / 4, 65536.0)),
+	m_files(options.MaxFilesPerSecond(), 1), m_maxLoad(options.MaxLoad()), m_maxIoPressure(options.MaxIoPressure()),
+	m_nextSystemCheck(pt::microsec_clock::universal_time()), m_systemCheckMutex()
+{
+}
+
+void BackgroundThrottle::BeforeIo(size_t numBytes)
+{
+	BackOffWhileBusy();
+	m_bytes.Take(static_cast<double>(numBytes));
+}
+
+void BackgroundThrottle::BeforeFile()
+{
+	BackOffWhileBusy();
+	m_files.Take(1);
+}
+
+void BackgroundThrottle::BackOffWhileBusy()
+{
+	{
+		boost::mutex::scoped_lock lock(m_systemCheckMutex);
+		pt::ptime now = pt::microsec_clock::universal_time();
+		if(now < m_nextSystemCheck)
+		{
+			return;
+		}
+		m_nextSystemCheck = now + pt::milliseconds(s_systemCheckIntervalMs);
+	}
+
+	long backedOffMs = 0;
+	while(backedOffMs < s_maxBackOffMs)
+	{
+		bool loadTooHigh = m_maxLoad > 0 && GetLoadAverage() > m_maxLoad;
+		bool ioPressureTooHigh = m_maxIoPressure > 0 && GetIoPressure() > m_maxIoPressure;
+		if(!loadTooHigh && !ioPressureTooHigh)
+		{
+			return;
+		}
+
+		boost::this_thread::sleep(pt::milliseconds(s_systemCheckIntervalMs));
+		backedOffMs += s_systemCheckIntervalMs;
+	}
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,85 @@
+#ifndef __BACKGROUND_THROTTLE_H__
+#define __BACKGROUND_THROTTLE_H__
+
+#include <cstddef>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "ogglength.h"
+#include "lowimpact.h"
+#include "PatcherOptions.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Keeps a patcher run in --background mode from disturbing the game: caps bytes and files per second and backs
+// off while the system is busy.
+class BackgroundThrottle : public ogglength::IoThrottle
+{
+private:
+	lhcutilities::TokenBucket m_bytes;
+	lhcutilities::TokenBucket m_files;
+	double m_maxLoad; // Back off while the load average is above this. 0 to ignore load.
+	double m_maxIoPressure; // Back off while the I/O pressure percentage is above this. 0 to ignore I/O pressure.
+	boost::posix_time::ptime m_nextSystemCheck;
+	boost::mutex m_systemCheckMutex;
+
+	// How often to look at the system load. Reading it is cheap but not free.
+	static const long s_systemCheckIntervalMs;
+	// Longest to wait for the system to calm down before doing a little more work anyway, so a system that is
+	// always busy doesn't stop the run completely.
+	static const long s_maxBackOffMs;
+
+	void BackOffWhileBusy();
+
+public:
+	// Creates a throttle using the --background limits in options.
+	explicit BackgroundThrottle(const PatcherOptions& options);
+
+	// Waits until numBytes more bytes are allowed and the system isn't busy.
+	virtual void BeforeIo(size_t numBytes);
+
+	// Waits until another file is allowed and the system isn't busy.
+	void BeforeFile();
+};
+
+// Installs an ogglength I/O throttle, which may be NULL, for as long as it is in scope. The throttle applies to
+// every thread.
+class ScopedIoThrottle
+{
+private:
+	// Not copyable
+	ScopedIoThrottle(const ScopedIoThrottle&);
+	ScopedIoThrottle& operator=(const ScopedIoThrottle&);
+
+public:
+	explicit ScopedIoThrottle(ogglength::IoThrottle* throttle)
+	{
+		ogglength::SetIoThrottle(throttle);
+	}
+
+	~ScopedIoThrottle()
+	{
+		ogglength::SetIoThrottle(NULL);
+	}
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,114 @@
+#include "stdafx.h"
+#include "Catalog.h"
+#include <string>
+#include <vector>
+#include <sstream>
+#include "flatjson.h"
+
+using namespace std;
+using namespace lhcutilities;
+using namespace ogglength;
+
+namespace oggpatcher
+{
+
+namespace
+{
+
+// A length as JSON, or null if it isn't known
+string LengthJson(double length)
+{
+	return length >= 0 ? JsonNumber(length) : "null";
+}
+
+// A header field as JSON, or null if the header doesn't say
+string HeaderFieldJson(long value)
+{
+	return value > 0 ? JsonNumber(static_cast<double>(value)) : "null";
+}
+
+// A comment as JSON, or null if the file doesn't have it
+string CommentJson(const VorbisStreamInfo& info, const string& field)
+{
+	string value = info.GetComment(field);
+	return !value.empty() ? JsonQuote(value) : "null";
+}
+
+} // end anonymous namespace
+
+CatalogWriter::CatalogWriter(const string& catalogPath, bool append)
+	: m_file(OpenOrDie(catalogPath.c_str(), append ? "ab" : "wb"))
+{
+}
+
+string CatalogWriter::ToJson(const CatalogEntry& entry)
+{
+	ostringstream json;
+	json << "{\"path\":" << JsonQuote(entry.path);
+	if(entry.haveInfo)
+	{
+		json << ",\"title\":" << CommentJson(entry.info, "TITLE");
+		json << ",\"artist\":" << CommentJson(entry.info, "ARTIST");
+	}
+	json << ",\"reported_length\":" << LengthJson(entry.reportedLength);
+	json << ",\"real_length\":" << LengthJson(entry.realLength);
+	json << ",\"patched_length\":" << LengthJson(entry.patchedLength);
+	if(entry.haveInfo)
+	{
+		json << ",\"sample_rate\":" << HeaderFieldJson(entry.info.sampleRate);
+		json << ",\"channels\":" << HeaderFieldJson(entry.info.channels);
+		json << ",\"bitrate\":" << HeaderFieldJson(entry.info.bitrateNominal);
+		json << ",\"bitrate_upper\":" << HeaderFieldJson(entry.info.bitrateUpper);
+		json << ",\"bitrate_lower\":" << HeaderFieldJson(entry.info.bitrateLower);
+		json << ",\"vendor\":" << JsonQuote(entry.info.vendor);
+		json << ",\"comments\":[";
+		for(vector<string>::size_type commentIndex = 0; commentIndex < entry.info.comments.size(); commentIndex++)
+		{
+			json << (commentIndex > 0 ? "," : "") << JsonQuote(entry.info.comments[commentIndex]);
+		}
+		json << "]";
+	}
+	if(!entry.error.empty())
+	{
+		json << ",\"error\":" << JsonQuote(entry.error);
+	}
+	json << "}\n";
+	return json.str();
+}
+
+void CatalogWriter::Write(const CatalogEntry& entry)
+{
+	string line = ToJson(entry);
+	WriteBytesOrDie(m_file.get(), vector<unsigned char>(line.begin(), line.end()));
+	if(fflush(m_file.get()) != 0)
+	{
+		throw IoError("Error while writing.");
+	}
+}
+
+void CatalogWriter::Close()
+{
+	if(m_file.get() == NULL)
+	{
+		return;
+	}
+	m_file.CloseOrDie();
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
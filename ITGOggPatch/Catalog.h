@@ -0,0 +1,72 @@
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include <string>
+#include "ogglength.h"
+#include "utilities.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// What a patcher run learned about a file, from the headers and lengths it read while checking and patching it.
+struct CatalogEntry
+{
+	std::string path;
+	bool haveInfo; // Whether info was read
+	ogglength::VorbisStreamInfo info;
+	double reportedLength; // Reported length before patching, -1 if not read
+	double realLength; // -1 if the file wasn't decoded
+	double patchedLength; // Reported length after patching, -1 if not patched
+	std::string error; // Empty if nothing went wrong
+
+	explicit CatalogEntry(const std::string& path_) : path(path_), haveInfo(false), info(), reportedLength(-1),
+		realLength(-1), patchedLength(-1), error()
+	{
+	}
+};
+
+// A song catalog written as one JSON object per line, one line per file. Lines are flushed as they are written so
+// that an interrupted run leaves a usable catalog.
+class CatalogWriter
+{
+private:
+	lhcutilities::ScopedFile m_file;
+
+	// Not copyable
+	CatalogWriter(const CatalogWriter&);
+	CatalogWriter& operator=(const CatalogWriter&);
+
+	static std::string ToJson(const CatalogEntry& entry);
+
+public:
+	// Opens the catalog at catalogPath, adding to the end of it if append is true or starting it over otherwise.
+	// Throws lhcutilities::IoError if the catalog can't be opened.
+	CatalogWriter(const std::string& catalogPath, bool append);
+
+	// Writes a line for the entry. Throws lhcutilities::IoError if there is an error.
+	void Write(const CatalogEntry& entry);
+
+	// Closes the catalog. Throws lhcutilities::IoError if there is an error.
+	void Close();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
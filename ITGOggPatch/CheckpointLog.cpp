@@ -0,0 +1,235 @@
+#include "stdafx.h"
+#include "CheckpointLog.h"
+#include <cstdio>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/system/system_error.hpp>
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace fs = boost::filesystem;
+
+namespace oggpatcher
+{
+
+const unsigned long CheckpointLog::s_compactionInterval = 1000;
+
+CheckpointLog::CheckpointLog(const string& logPath, bool resume) : m_logPath(logPath), m_entries(), m_file(NULL),
+	m_numLines(0), m_numRecordedSinceCompaction(0)
+{
+	if(resume)
+	{
+		Load();
+		m_file.Reset(OpenOrDie(m_logPath.c_str(), "ab"));
+	}
+	else
+	{
+		m_file.Reset(OpenOrDie(m_logPath.c_str(), "wb"));
+	}
+}
+
+void CheckpointLog::Load()
+{
+	ifstream log(m_logPath.c_str(), ios::in | ios::binary);
+	string line;
+	while(getline(log, line))
+	{
+		m_numLines++;
+
+		// Path goes last because it's the only field that could have a tab in it.
+		istringstream fields(line);
+		string outcomeString;
+		Entry entry;
+		string path;
+		if(!getline(fields, outcomeString, '\t') || !(fields >> entry.size) || fields.get() != '\t'
+			|| !(fields >> entry.modificationTime) || fields.get() != '\t' || !getline(fields, path))
+		{
+			continue; // Probably a line that was cut off by a crash
+		}
+		entry.pending = outcomeString == "pending";
+		if(!entry.pending && !StringToOutcome(outcomeString, entry.outcome))
+		{
+			continue;
+		}
+
+		m_entries[path] = entry;
+	}
+}
+
+string CheckpointLog::GetKey(const string& path)
+{
+	return fs::system_complete(path).string();
+}
+
+bool CheckpointLog::FindFinished(const string& path, FileOutcome& outcomeOut) const
+{
+	map<string, Entry>::const_iterator entryIt = m_entries.find(GetKey(path));
+	if(entryIt == m_entries.end() || entryIt->second.pending)
+	{
+		return false;
+	}
+
+	try
+	{
+		FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+		if(identity.size != entryIt->second.size || identity.modificationTime != entryIt->second.modificationTime)
+		{
+			return false;
+		}
+	}
+	catch(IoError&)
+	{
+		return false;
+	}
+
+	outcomeOut = entryIt->second.outcome;
+	return true;
+}
+
+void CheckpointLog::Record(const string& path, FileOutcome outcome)
+{
+	// Take the identity now, after patching changed the modification time.
+	FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+	string key = GetKey(path);
+	Entry& entry = m_entries[key];
+	entry.size = identity.size;
+	entry.modificationTime = identity.modificationTime;
+	entry.outcome = outcome;
+	entry.pending = false;
+
+	// Flush every line so that a crash or ctrl-C loses at most the file that was being worked on.
+	WriteLine(m_file.get(), key, entry);
+	if(fflush(m_file.get()) != 0)
+	{
+		throw IoError("Error while writing.");
+	}
+	m_numLines++;
+
+	m_numRecordedSinceCompaction++;
+	if(m_numRecordedSinceCompaction >= s_compactionInterval)
+	{
+		m_numRecordedSinceCompaction = 0;
+		Compact();
+	}
+}
+
+void CheckpointLog::RecordPending(const string& path)
+{
+	string key = GetKey(path);
+	Entry& entry = m_entries[key];
+	entry.pending = true;
+	try
+	{
+		FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+		entry.size = identity.size;
+		entry.modificationTime = identity.modificationTime;
+	}
+	catch(IoError&)
+	{
+		// It's still pending. The size and time only matter for finished files.
+	}
+
+	WriteLine(m_file.get(), key, entry);
+	if(fflush(m_file.get()) != 0)
+	{
+		throw IoError("Error while writing.");
+	}
+	m_numLines++;
+}
+
+bool CheckpointLog::IsPending(const string& path) const
+{
+	map<string, Entry>::const_iterator entryIt = m_entries.find(GetKey(path));
+	return entryIt != m_entries.end() && entryIt->second.pending;
+}
+
+string CheckpointLog::FormatLine(const string& key, const Entry& entry)
+{
+	ostringstream line;
+	line << (entry.pending ? "pending" : OutcomeToString(entry.outcome)) << '\t' << entry.size << '\t'
+		<< entry.modificationTime << '\t' << key << '\n';
+	return line.str();
+}
+
+void CheckpointLog::WriteLine(FILE* file, const string& key, const Entry& entry)
+{
+	if(file == NULL)
+	{
+		// Reopening it after a failed compaction failed too.
+		throw IoError("The checkpoint log is not open.");
+	}
+	string lineString = FormatLine(key, entry);
+	WriteBytesOrDie(file, vector<unsigned char>(lineString.begin(), lineString.end()));
+}
+
+void CheckpointLog::Compact()
+{
+	if(m_numLines <= m_entries.size())
+	{
+		return; // No duplicates, nothing to gain
+	}
+
+	string text;
+	for(map<string, Entry>::const_iterator entryIt = m_entries.begin(); entryIt != m_entries.end(); ++entryIt)
+	{
+		text += FormatLine(entryIt->first, entryIt->second);
+	}
+
+	string tempPath = m_logPath + ".tmp";
+	WriteFileOrDie(tempPath.c_str(), vector<unsigned char>(text.begin(), text.end()));
+
+	// Windows won't rename over a file that is open. The log is reopened even if the rename fails so that later
+	// records still have somewhere to go.
+	try
+	{
+		m_file.CloseOrDie();
+		RenameOverOrDie(tempPath.c_str(), m_logPath.c_str());
+	}
+	catch(IoError&)
+	{
+		m_file.Reset(OpenOrDie(m_logPath.c_str(), "ab"));
+		throw;
+	}
+	catch(boost::system::system_error&)
+	{
+		m_file.Reset(OpenOrDie(m_logPath.c_str(), "ab"));
+		throw;
+	}
+	m_file.Reset(OpenOrDie(m_logPath.c_str(), "ab"));
+	m_numLines = m_entries.size();
+}
+
+void CheckpointLog::Close()
+{
+	if(m_file.get() == NULL)
+	{
+		return;
+	}
+
+	Compact();
+	m_file.CloseOrDie();
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
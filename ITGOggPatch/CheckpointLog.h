@@ -0,0 +1,96 @@
+#ifndef __CHECKPOINT_LOG_H__
+#define __CHECKPOINT_LOG_H__
+
+#include <string>
+#include <map>
+#include <boost/cstdint.hpp>
+#include "PatchSummary.h"
+#include "utilities.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// A log of files a patcher run has finished with, so that an interrupted run can be resumed without starting
+// over. Each finished file is appended to the log and flushed straight away. Files are identified by path, size,
+// and modification time, so a file that changed since it was logged is not considered done.
+//
+// The log is a text file with one line per file: outcome, size, modification time, and path, separated by tabs.
+// Every so often the log is rewritten without duplicate lines. Files a run didn't get to can be recorded as pending
+// so that the next run can do them first.
+class CheckpointLog
+{
+private:
+	struct Entry
+	{
+		boost::uint64_t size;
+		boost::int64_t modificationTime;
+		FileOutcome outcome;
+		bool pending; // Not done yet; outcome means nothing
+
+		Entry() : size(0), modificationTime(0), outcome(outcome_patched), pending(false)
+		{
+		}
+	};
+
+	std::string m_logPath;
+	std::map<std::string, Entry> m_entries; // Keyed by absolute path
+	lhcutilities::ScopedFile m_file; // Open for appending
+	unsigned long m_numLines; // Number of lines in the log file, including duplicates
+	unsigned long m_numRecordedSinceCompaction;
+
+	// How many files to record between looking at whether the log needs compacting
+	static const unsigned long s_compactionInterval;
+
+	// Not copyable
+	CheckpointLog(const CheckpointLog&);
+	CheckpointLog& operator=(const CheckpointLog&);
+
+	void Load();
+	void Compact();
+	static std::string FormatLine(const std::string& key, const Entry& entry);
+	static void WriteLine(FILE* file, const std::string& key, const Entry& entry);
+	static std::string GetKey(const std::string& path);
+
+public:
+	// Opens the checkpoint log at logPath. If resume is true, the files already in the log are considered done;
+	// otherwise the log is started over. Throws lhcutilities::IoError if the log can't be opened.
+	CheckpointLog(const std::string& logPath, bool resume);
+
+	// Returns true if the file was finished in an earlier run and hasn't changed since, setting outcomeOut to
+	// what happened to it then.
+	bool FindFinished(const std::string& path, FileOutcome& outcomeOut) const;
+
+	// Records that the file is finished. Throws lhcutilities::IoError if the log can't be written.
+	void Record(const std::string& path, FileOutcome outcome);
+
+	// Records that the file still needs to be done, for a run that stopped early. Recording it as finished later
+	// replaces this. Throws lhcutilities::IoError if the log can't be written.
+	void RecordPending(const std::string& path);
+
+	// Returns true if an earlier run recorded the file as pending and it hasn't been finished since.
+	bool IsPending(const std::string& path) const;
+
+	// Compacts and closes the log. Throws lhcutilities::IoError if there is an error.
+	void Close();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
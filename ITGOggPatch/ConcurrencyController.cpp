@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "ConcurrencyController.h"
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+string WorkerRange::ToString() const
+{
+	if(minWorkers == maxWorkers)
+	{
+		return boost::lexical_cast<string>(minWorkers);
+	}
+	return boost::lexical_cast<string>(minWorkers) + "-" + boost::lexical_cast<string>(maxWorkers);
+}
+
+WorkerRange WorkerRange::Parse(const string& text)
+{
+	string::size_type dash = text.find('-');
+	WorkerRange range;
+	try
+	{
+		range.minWorkers = boost::lexical_cast<unsigned int>(boost::trim_copy(text.substr(0, dash)));
+		range.maxWorkers = dash == string::npos ? range.minWorkers
+			: boost::lexical_cast<unsigned int>(boost::trim_copy(text.substr(dash + 1)));
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		throw invalid_argument("A number of workers must be given as a number or as min-max, like 1-8.");
+	}
+
+	if(range.minWorkers == 0 || range.minWorkers > range.maxWorkers)
+	{
+		throw invalid_argument("A number of workers must be at least 1, and min can't be more than max in min-max.");
+	}
+	return range;
+}
+
+const long ConcurrencyController::s_windowMs = 2000;
+const double ConcurrencyController::s_minImprovement = 0.05;
+const unsigned int ConcurrencyController::s_holdWindows = 10;
+// Up to 4 pooled decoders of about 1 MB each for a stereo 44.1 kHz stream, a 64 KB read buffer, and room for the
+// Vorbis setups shared between the workers.
+const boost::uint64_t ConcurrencyController::s_decodeWorkerMemory = 8 * 1024 * 1024;
+
+ConcurrencyController::ConcurrencyController(const WorkerRange& ioWorkers, const WorkerRange& decodeWorkers,
+	boost::uint64_t maxMemory)
+	: m_windowStart(pt::microsec_clock::universal_time()), m_mutex()
+{
+	m_stages[stage_io].range = ioWorkers;
+	m_stages[stage_decode].range = decodeWorkers;
+	if(maxMemory > 0)
+	{
+		WorkerRange& decodeRange = m_stages[stage_decode].range;
+		unsigned int memoryWorkers = static_cast<unsigned int>(
+			max(static_cast<boost::uint64_t>(1), min(maxMemory / s_decodeWorkerMemory,
+			static_cast<boost::uint64_t>(decodeRange.maxWorkers))));
+		decodeRange.maxWorkers = memoryWorkers;
+		decodeRange.minWorkers = min(decodeRange.minWorkers, memoryWorkers);
+	}
+
+	for(int stage = 0; stage < num_worker_stages; stage++)
+	{
+		m_stages[stage].workers = m_stages[stage].range.minWorkers;
+	}
+}
+
+unsigned int ConcurrencyController::Workers(WorkerStage stage)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_stages[stage].workers;
+}
+
+void ConcurrencyController::Record(WorkerStage stage, boost::uint64_t numBytes, double seconds)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_stages[stage].windowFiles++;
+	m_stages[stage].windowBytes += numBytes;
+	m_stages[stage].windowBusySeconds += seconds;
+}
+
+bool ConcurrencyController::Adjust(const size_t queueDepths[num_worker_stages])
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	pt::ptime now = pt::microsec_clock::universal_time();
+	if(now - m_windowStart < pt::milliseconds(s_windowMs))
+	{
+		return false;
+	}
+
+	double windowSeconds = static_cast<double>((now - m_windowStart).total_microseconds()) / 1000000;
+	m_windowStart = now;
+	bool changed = false;
+	for(int stage = 0; stage < num_worker_stages; stage++)
+	{
+		if(AdjustStage(static_cast<WorkerStage>(stage), windowSeconds, queueDepths[stage]))
+		{
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Called with m_mutex locked.
+bool ConcurrencyController::AdjustStage(WorkerStage stage, double windowSeconds, size_t queueDepth)
+{
+	StageState& state = m_stages[stage];
+	if(state.windowFiles == 0)
+	{
+		// Nothing finished, so there's nothing to go on. A stage working on a few long files also ends up here.
+		state.lastStep = 0;
+		state.windowBusySeconds = 0;
+		return false;
+	}
+
+	// I/O is mostly seeking to and reading a couple of blocks per file whatever its size, but decoding time goes by
+	// the size of the file.
+	double throughput = (stage == stage_io ? static_cast<double>(state.windowFiles)
+		: static_cast<double>(state.windowBytes)) / windowSeconds;
+	double latency = state.windowBusySeconds / state.windowFiles;
+	double busyWorkers = state.windowBusySeconds / windowSeconds;
+
+	int step = 0;
+	if(state.holdWindows > 0)
+	{
+		state.holdWindows--;
+	}
+	else if(state.lastStep > 0 && throughput < state.lastThroughput * (1 + s_minImprovement))
+	{
+		// The last worker added didn't help.
+		step = -1;
+		state.holdWindows = s_holdWindows;
+	}
+	else if(queueDepth > 0)
+	{
+		step = 1;
+	}
+	else if(busyWorkers < static_cast<double>(state.workers) - 1)
+	{
+		// Nothing is waiting and one fewer worker could have kept up.
+		step = -1;
+	}
+
+	if((step > 0 && state.workers >= state.range.maxWorkers) || (step < 0 && state.workers <= state.range.minWorkers))
+	{
+		step = 0;
+	}
+
+	state.workers += step;
+	state.lastStep = step;
+	state.lastThroughput = throughput;
+	state.lastLatency = latency;
+	state.windowFiles = 0;
+	state.windowBytes = 0;
+	state.windowBusySeconds = 0;
+	return step != 0;
+}
+
+string ConcurrencyController::Describe()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	const StageState& io = m_stages[stage_io];
+	const StageState& decode = m_stages[stage_decode];
+	ostringstream description;
+	description.setf(ios::fixed);
+	description.precision(1);
+	description << io.workers << " I/O workers";
+	if(io.lastThroughput >= 0)
+	{
+		description << " (" << io.lastThroughput << " files/s, " << io.lastLatency * 1000 << " ms per file)";
+	}
+	description << ", " << decode.workers << " decode workers";
+	if(decode.lastThroughput >= 0)
+	{
+		description << " (" << decode.lastThroughput / (1024 * 1024) << " MB/s)";
+	}
+	return description.str();
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
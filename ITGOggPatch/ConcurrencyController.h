@@ -0,0 +1,132 @@
+#ifndef __CONCURRENCY_CONTROLLER_H__
+#define __CONCURRENCY_CONTROLLER_H__
+
+#include <string>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// The least and most worker threads to run for a stage of patching.
+struct WorkerRange
+{
+	unsigned int minWorkers;
+	unsigned int maxWorkers;
+
+	WorkerRange() : minWorkers(1), maxWorkers(1)
+	{
+	}
+
+	WorkerRange(unsigned int minWorkers_, unsigned int maxWorkers_) : minWorkers(minWorkers_), maxWorkers(maxWorkers_)
+	{
+	}
+
+	// Gets the range as "min-max", or just the number if min and max are the same.
+	std::string ToString() const;
+
+	// Parses "min-max" or a single number for a fixed count. Throws std::invalid_argument if the text isn't that.
+	static WorkerRange Parse(const std::string& text);
+};
+
+// The stages of patching a file that have their own worker threads
+enum WorkerStage
+{
+	stage_io, // Reading the start and end of a file to check whether it meets the length conditions
+	stage_decode, // Decoding a file to get its real length
+	num_worker_stages
+};
+
+// Picks how many worker threads to run for each WorkerStage while patching. Every couple of seconds it looks at how
+// fast each stage went and whether files were waiting for it, and tries one more worker for a stage that has files
+// waiting. If the extra worker didn't make the stage faster - as happens with a hard disk, where more readers just
+// means more seeking - it goes back to the count before and stays there for a while before trying again. Workers are
+// taken away from a stage that is mostly idle. The number of decode workers is also capped so that their memory stays
+// under a budget.
+// Record() can be called from any thread. Adjust() and Describe() are meant to be called from one thread.
+class ConcurrencyController
+{
+private:
+	struct StageState
+	{
+		WorkerRange range;
+		unsigned int workers;
+		unsigned long windowFiles; // Files finished in the current window
+		boost::uint64_t windowBytes; // Size of those files
+		double windowBusySeconds; // Time workers spent on those files
+		double lastThroughput; // Files per second for stage_io, bytes per second for stage_decode. -1 if unmeasured.
+		double lastLatency; // Average seconds per file in the last measured window
+		int lastStep; // 1 or -1 if the last adjustment added or took away a worker, 0 if it left the count alone
+		unsigned int holdWindows; // Windows left to leave the count alone after going back
+
+		StageState() : range(), workers(1), windowFiles(0), windowBytes(0), windowBusySeconds(0), lastThroughput(-1),
+			lastLatency(0), lastStep(0), holdWindows(0)
+		{
+		}
+	};
+
+	StageState m_stages[num_worker_stages];
+	boost::posix_time::ptime m_windowStart;
+	boost::mutex m_mutex;
+
+	// How long each measuring window is
+	static const long s_windowMs;
+	// How much faster a stage has to get with another worker for the worker to be kept
+	static const double s_minImprovement;
+	// Windows to wait after going back to a smaller count before trying a bigger one again
+	static const unsigned int s_holdWindows;
+
+	// Not copyable
+	ConcurrencyController(const ConcurrencyController&);
+	ConcurrencyController& operator=(const ConcurrencyController&);
+
+	bool AdjustStage(WorkerStage stage, double windowSeconds, std::size_t queueDepth);
+
+public:
+	// Rough memory used by a decode worker for its pooled Vorbis decoders and read buffers, in bytes
+	static const boost::uint64_t s_decodeWorkerMemory;
+
+	// maxMemory is the most bytes the decode workers should use between them, 0 for no limit. It lowers the most
+	// decode workers, but never below 1. Each stage starts at its least number of workers.
+	ConcurrencyController(const WorkerRange& ioWorkers, const WorkerRange& decodeWorkers, boost::uint64_t maxMemory);
+
+	// Gets the range of workers for a stage, after capping decode workers for memory.
+	const WorkerRange& Range(WorkerStage stage) const { return m_stages[stage].range; }
+
+	// Gets the number of workers a stage should have running now.
+	unsigned int Workers(WorkerStage stage);
+
+	// Records that a worker of the stage finished a file of numBytes bytes in the given number of seconds.
+	void Record(WorkerStage stage, boost::uint64_t numBytes, double seconds);
+
+	// If a measuring window has gone by, picks new worker counts based on how the stages did in it. queueDepths is
+	// the number of files waiting for each stage. Returns true if a count changed.
+	bool Adjust(const std::size_t queueDepths[num_worker_stages]);
+
+	// Describes the worker counts and how fast the stages went in the last window, for logging, like
+	// "2 I/O workers (85.1 files/s, 11.7 ms per file), 3 decode workers (24.6 MB/s)".
+	std::string Describe();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,524 @@
+#include "stdafx.h"
+#include "Daemon.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <csignal>
+#include <cstdio>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include "ogglength.h"
+#include "lowimpact.h"
+#include "FileFinder.h"
+#include "Manifest.h"
+
+using namespace std;
+using namespace lhcutilities;
+using namespace ogglength;
+namespace fs = boost::filesystem;
+
+namespace oggpatcher
+{
+
+namespace
+{
+
+// Descriptor of the listening socket, for the signal handler to shut down
+volatile int g_listenerFd = -1;
+
+extern "C" void StopListening(int)
+{
+	if(g_listenerFd >= 0)
+	{
+		ShutdownSocketFromSignalHandler(g_listenerFd);
+	}
+}
+
+string ErrorResponse(const string& message)
+{
+	return "\"ok\":false,\"error\":" + JsonQuote(message);
+}
+
+// Gets a required string member of a request. Throws std::invalid_argument if it is missing.
+string GetStringMember(const map<string, JsonValue>& request, const string& name)
+{
+	map<string, JsonValue>::const_iterator member = request.find(name);
+	if(member == request.end() || member->second.type != JsonValue::json_string)
+	{
+		throw invalid_argument("Request needs a \"" + name + "\" string.");
+	}
+	return member->second.text;
+}
+
+// Gets the length a patch request asks for, from its "seconds" or "samples" number, checked the same way as the lengths
+// in a manifest. The type is target_from_options if it has neither. Throws std::invalid_argument if it has a bad one.
+PatchTarget GetPatchTarget(const map<string, JsonValue>& request)
+{
+	PatchTarget target;
+	map<string, JsonValue>::const_iterator seconds = request.find("seconds");
+	map<string, JsonValue>::const_iterator samples = request.find("samples");
+	if(seconds != request.end() && samples != request.end())
+	{
+		throw invalid_argument("Request can't have both \"seconds\" and \"samples\".");
+	}
+	else if(seconds != request.end())
+	{
+		if(seconds->second.type != JsonValue::json_number || !ParsePatchTarget(seconds->second.text, target))
+		{
+			throw invalid_argument("Request's \"seconds\" must be a number of seconds that isn't negative or too long.");
+		}
+	}
+	else if(samples != request.end())
+	{
+		if(samples->second.type != JsonValue::json_number
+			|| !ParsePatchTarget(samples->second.text + " samples", target))
+		{
+			throw invalid_argument("Request's \"samples\" must be a whole number of samples that isn't negative.");
+		}
+	}
+	return target;
+}
+
+} // end anonymous namespace
+
+Daemon::Daemon(const PatcherOptions& options) : m_options(options), m_listener(), m_requests(), m_pageIndex(),
+	m_throttle(), m_lengthCache(), m_lengthCacheMutex(), m_clients(), m_finishedClients(), m_clientsMutex()
+{
+}
+
+void Daemon::Run()
+{
+	if(!PinCurrentThreadToCores(m_options.CpuCores()))
+	{
+		cout << "Could not restrict the daemon to the requested CPU cores. Continuing on any core." << endl;
+	}
+	if(m_options.Background())
+	{
+		if(!UseIdlePriority())
+		{
+			cout << "Could not lower the daemon's priority completely. Continuing with I/O limits only." << endl;
+		}
+		m_throttle.reset(new BackgroundThrottle(m_options));
+	}
+	// Installed before the workers start and removed after they are joined.
+	ScopedIoThrottle ioThrottle(m_throttle.get());
+
+	if(!m_options.PageIndexPath().empty())
+	{
+		m_pageIndex.reset(new OggPageIndex(m_options.PageIndexPath()));
+	}
+
+	const string& socketPath = m_options.DaemonSocketPath();
+	m_listener = UnixSocket::Listen(socketPath);
+	g_listenerFd = m_listener->Descriptor();
+	signal(SIGINT, StopListening);
+	signal(SIGTERM, StopListening);
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	// The workers live as long as the daemon does, so libvorbisfile, the OS cache, and the length cache all stay warm
+	// from one request to the next.
+	boost::thread_group workers;
+	for(unsigned int workerIndex = 0; workerIndex < m_options.WorkerCount(); workerIndex++)
+	{
+		workers.create_thread(boost::bind(&Daemon::Work, this));
+	}
+	cout << "Listening on " << socketPath << " with " << m_options.WorkerCount() << " workers." << endl;
+
+	try
+	{
+		while(boost::shared_ptr<UnixSocket> connection = m_listener->Accept())
+		{
+			boost::shared_ptr<Client> client(new Client(connection));
+			{
+				boost::mutex::scoped_lock lock(m_clientsMutex);
+				m_clients.push_back(client);
+			}
+			client->reader.reset(new boost::thread(boost::bind(&Daemon::ReadRequests, this, client)));
+			JoinFinishedReaders();
+		}
+	}
+	catch(IoError& ex)
+	{
+		// Shut down properly anyway so the workers and readers are done with this object before it goes away.
+		cout << socketPath << "   - " << ex.what() << endl;
+	}
+
+	cout << "Shutting down." << endl;
+	g_listenerFd = -1;
+	DisconnectClients();
+	m_requests.Close();
+	workers.join_all();
+
+	SavePageIndex();
+	remove(socketPath.c_str());
+}
+
+void Daemon::ReadRequests(boost::shared_ptr<Client> client)
+{
+	try
+	{
+		string line;
+		while(client->socket->ReadLine(line))
+		{
+			if(!boost::trim_copy(line).empty() && !m_requests.Push(Request(client, line)))
+			{
+				break; // Shutting down
+			}
+		}
+	}
+	catch(IoError&)
+	{
+		// The client went away in an unfriendly manner. Nothing to do but forget about it.
+	}
+
+	// If the client isn't in m_clients any more, DisconnectClients has taken it and joins this thread itself.
+	boost::mutex::scoped_lock lock(m_clientsMutex);
+	list<boost::shared_ptr<Client> >::iterator clientIt = find(m_clients.begin(), m_clients.end(), client);
+	if(clientIt != m_clients.end())
+	{
+		m_clients.erase(clientIt);
+		m_finishedClients.push_back(client);
+	}
+}
+
+// Joins the readers of clients that have hung up, so their threads don't pile up over a long-running daemon.
+void Daemon::JoinFinishedReaders()
+{
+	list<boost::shared_ptr<Client> > finishedClients;
+	{
+		boost::mutex::scoped_lock lock(m_clientsMutex);
+		finishedClients.swap(m_finishedClients);
+	}
+	for(list<boost::shared_ptr<Client> >::iterator clientIt = finishedClients.begin();
+		clientIt != finishedClients.end(); ++clientIt)
+	{
+		(*clientIt)->reader->join();
+	}
+}
+
+// Stops reading requests from every client and waits for the threads doing the reading to finish.
+// Requests already read are still answered.
+void Daemon::DisconnectClients()
+{
+	list<boost::shared_ptr<Client> > clients;
+	{
+		boost::mutex::scoped_lock lock(m_clientsMutex);
+		for(list<boost::shared_ptr<Client> >::iterator clientIt = m_clients.begin(); clientIt != m_clients.end();
+			++clientIt)
+		{
+			(*clientIt)->socket->ShutdownReading();
+		}
+		// Take both lists so that each reader is joined exactly once, here.
+		clients.swap(m_clients);
+		clients.splice(clients.end(), m_finishedClients);
+	}
+	for(list<boost::shared_ptr<Client> >::iterator clientIt = clients.begin(); clientIt != clients.end(); ++clientIt)
+	{
+		(*clientIt)->reader->join();
+	}
+}
+
+void Daemon::Work()
+{
+	Request request;
+	while(m_requests.Pop(request))
+	{
+		string response = HandleRequest(request.line) + "\n";
+		try
+		{
+			boost::mutex::scoped_lock lock(request.client->writeMutex);
+			request.client->socket->WriteOrDie(response);
+		}
+		catch(IoError&)
+		{
+			// The client went away without waiting for the answer.
+		}
+
+		// Don't keep the connection open while waiting for the next request. Once the client stops sending and
+		// every response has been written, the last reference going away is what hangs up on it.
+		request = Request();
+	}
+}
+
+string Daemon::HandleRequest(const string& requestLine)
+{
+	string id = "null";
+	string body;
+	try
+	{
+		map<string, JsonValue> request = ParseFlatJsonObject(requestLine);
+		if(request.count("id"))
+		{
+			id = request["id"].ToJson();
+		}
+
+		string op = GetStringMember(request, "op");
+		string path = GetStringMember(request, "path");
+		if(op == "reported-length")
+		{
+			body = "\"ok\":true,\"seconds\":" + JsonNumber(GetReportedLength(path));
+		}
+		else if(op == "real-length")
+		{
+			body = "\"ok\":true,\"seconds\":" + JsonNumber(GetRealLength(path));
+		}
+		else if(op == "scan")
+		{
+			body = HandleScan(path);
+		}
+		else if(op == "patch")
+		{
+			body = HandlePatch(path, request);
+		}
+		else
+		{
+			throw invalid_argument("Unknown op \"" + op + "\".");
+		}
+	}
+	catch(invalid_argument& ex)
+	{
+		body = ErrorResponse(ex.what());
+	}
+	catch(IoError& ex)
+	{
+		body = ErrorResponse(ex.what());
+	}
+	catch(OggVorbisError& ex)
+	{
+		body = ErrorResponse(ex.what());
+	}
+	catch(boost::system::system_error& ex)
+	{
+		body = ErrorResponse(ex.what());
+	}
+
+	return "{\"id\":" + id + "," + body + "}";
+}
+
+string Daemon::HandleScan(const string& path)
+{
+	if(!fs::is_directory(path) && !fs::is_regular_file(path))
+	{
+		throw IoError("This path indicates something that is not a file or a directory.");
+	}
+	vector<string> files;
+	vector<pair<string, string> > errors;
+	FindOggFilesInStartingPath(path, files, errors);
+
+	ostringstream body;
+	body << "\"ok\":true,\"files\":[";
+	for(vector<string>::size_type fileIndex = 0; fileIndex < files.size(); fileIndex++)
+	{
+		if(fileIndex > 0)
+		{
+			body << ",";
+		}
+		body << "{\"path\":" << JsonQuote(files[fileIndex]) << ",";
+		try
+		{
+			double reportedLength = GetReportedLength(files[fileIndex]);
+			body << "\"seconds\":" << JsonNumber(reportedLength) << ",\"meets-conditions\":"
+				<< (m_options.LengthMeetsConditions(reportedLength) ? "true" : "false");
+		}
+		catch(IoError& ex)
+		{
+			body << "\"error\":" << JsonQuote(ex.what());
+		}
+		catch(OggVorbisError& ex)
+		{
+			body << "\"error\":" << JsonQuote(ex.what());
+		}
+		body << "}";
+	}
+	for(vector<pair<string, string> >::size_type errorIndex = 0; errorIndex < errors.size(); errorIndex++)
+	{
+		if(errorIndex > 0 || !files.empty())
+		{
+			body << ",";
+		}
+		body << "{\"path\":" << JsonQuote(errors[errorIndex].first) << ",\"error\":"
+			<< JsonQuote(errors[errorIndex].second) << "}";
+	}
+	body << "]";
+	return body.str();
+}
+
+string Daemon::HandlePatch(const string& path, const map<string, JsonValue>& request)
+{
+	map<string, JsonValue>::const_iterator force = request.find("force");
+	bool forced = force != request.end() && force->second.type == JsonValue::json_bool && force->second.text == "true";
+	if(!forced && m_options.LengthConditionType() != condition_none
+		&& !m_options.LengthMeetsConditions(GetReportedLength(path)))
+	{
+		return "\"ok\":true,\"outcome\":\"skipped\"";
+	}
+
+	PatchTarget target = GetPatchTarget(request);
+	if(target.type == target_from_options && m_options.PatchingToRealLength())
+	{
+		target.type = target_seconds;
+		target.seconds = GetRealLength(path);
+	}
+	else if(target.type == target_from_options)
+	{
+		target.type = target_seconds;
+		target.seconds = m_options.TimeInSeconds();
+	}
+
+	FileIdentity identityBefore = GetFileIdentityOrDie(path.c_str());
+	CachedLengths lengths = LookUpLengths(path, identityBefore);
+	if(m_throttle)
+	{
+		m_throttle->BeforeFile();
+	}
+	if(target.type == target_samples && m_pageIndex)
+	{
+		ChangeSongLengthInSamples(path.c_str(), target.samples, *m_pageIndex);
+	}
+	else if(target.type == target_samples)
+	{
+		ChangeSongLengthInSamples(path.c_str(), target.samples);
+	}
+	else if(m_pageIndex)
+	{
+		ChangeSongLength(path.c_str(), target.seconds, *m_pageIndex);
+	}
+	else
+	{
+		ChangeSongLength(path.c_str(), target.seconds);
+	}
+
+	// Patching doesn't change the real length, so that can be kept. The reported length is only known here when
+	// patching to a number of seconds.
+	lengths.identity = GetFileIdentityOrDie(path.c_str());
+	lengths.reportedLength = target.type == target_seconds ? target.seconds : -1;
+	CacheLengths(path, lengths);
+
+	if(target.type == target_samples)
+	{
+		return "\"ok\":true,\"outcome\":\"patched\",\"samples\":" + boost::lexical_cast<string>(target.samples);
+	}
+	return "\"ok\":true,\"outcome\":\"patched\",\"seconds\":" + JsonNumber(target.seconds);
+}
+
+double Daemon::GetReportedLength(const string& path)
+{
+	// Get the identity before reading so that if the file changes while it is being read, the cached length is
+	// thrown away next time.
+	FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+	CachedLengths lengths = LookUpLengths(path, identity);
+	if(lengths.reportedLength >= 0)
+	{
+		return lengths.reportedLength;
+	}
+
+	if(m_throttle)
+	{
+		m_throttle->BeforeFile();
+	}
+	if(m_pageIndex)
+	{
+		lengths.reportedLength = GetReportedTime(path.c_str(), *m_pageIndex);
+	}
+	else
+	{
+		lengths.reportedLength = GetReportedTime(path.c_str());
+	}
+	CacheLengths(path, lengths);
+	return lengths.reportedLength;
+}
+
+double Daemon::GetRealLength(const string& path)
+{
+	FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+	CachedLengths lengths = LookUpLengths(path, identity);
+	if(lengths.realLength >= 0)
+	{
+		return lengths.realLength;
+	}
+
+	if(m_throttle)
+	{
+		m_throttle->BeforeFile();
+	}
+	lengths.realLength = GetRealTime(path.c_str());
+	CacheLengths(path, lengths);
+	return lengths.realLength;
+}
+
+// Returns what is known about the file with the given identity. If the cache has nothing for that version of the
+// file, the lengths come back as unknown.
+Daemon::CachedLengths Daemon::LookUpLengths(const string& path, const FileIdentity& identity)
+{
+	string key = fs::system_complete(path).string();
+	boost::mutex::scoped_lock lock(m_lengthCacheMutex);
+	map<string, CachedLengths>::const_iterator cached = m_lengthCache.find(key);
+	if(cached != m_lengthCache.end() && cached->second.identity == identity)
+	{
+		return cached->second;
+	}
+
+	CachedLengths unknown;
+	unknown.identity = identity;
+	return unknown;
+}
+
+void Daemon::CacheLengths(const string& path, const CachedLengths& lengths)
+{
+	string key = fs::system_complete(path).string();
+	boost::mutex::scoped_lock lock(m_lengthCacheMutex);
+	m_lengthCache[key] = lengths;
+}
+
+void Daemon::SavePageIndex()
+{
+	if(!m_pageIndex)
+	{
+		return;
+	}
+
+	try
+	{
+		m_pageIndex->Save();
+	}
+	catch(IoError& ex)
+	{
+		cout << m_options.PageIndexPath() << "   - " << ex.what() << endl;
+	}
+	catch(boost::system::system_error& ex)
+	{
+		cout << m_options.PageIndexPath() << "   - " << ex.what() << endl;
+	}
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,137 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <string>
+#include <map>
+#include <list>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "PatcherOptions.h"
+#include "BackgroundThrottle.h"
+#include "oggpageindex.h"
+#include "unixsocket.h"
+#include "workqueue.h"
+#include "utilities.h"
+#include "flatjson.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Answers requests from other programs over a Unix domain socket so they don't have to start a new patcher for every
+// file. Requests and responses are single lines of JSON. Every request has an "op" and a "path", and may have an
+// "id" that is echoed back in the response:
+//   {"id":1,"op":"reported-length","path":"/songs/a.ogg"} -> {"id":1,"ok":true,"seconds":105}
+//   {"id":2,"op":"real-length","path":"/songs/a.ogg"}     -> {"id":2,"ok":true,"seconds":151.2}
+//   {"id":3,"op":"scan","path":"/songs"}                  -> {"id":3,"ok":true,"files":[{"path":"/songs/a.ogg",
+//                                                              "seconds":151.2,"meets-conditions":true}]}
+//   {"id":4,"op":"patch","path":"/songs/a.ogg"}           -> {"id":4,"ok":true,"outcome":"patched","seconds":105}
+// A patch request patches the way the daemon's own options say to unless it has a "seconds" or "samples" number to
+// patch to, and skips files that don't meet the length condition unless it has "force":true. Failed requests get
+// {"id":...,"ok":false,"error":"..."}. Requests on one connection are worked on at the same time, so responses can
+// come back in a different order than the requests were sent.
+class Daemon
+{
+private:
+	// A connected client
+	struct Client
+	{
+		boost::shared_ptr<lhcutilities::UnixSocket> socket;
+		boost::mutex writeMutex; // Keeps responses from different workers from interleaving
+		boost::shared_ptr<boost::thread> reader; // Reads requests from the client. Only touched by Run().
+
+		explicit Client(const boost::shared_ptr<lhcutilities::UnixSocket>& socket_) : socket(socket_), writeMutex(),
+			reader()
+		{
+		}
+	};
+
+	// A request line waiting for a worker
+	struct Request
+	{
+		boost::shared_ptr<Client> client;
+		std::string line;
+
+		Request() : client(), line()
+		{
+		}
+
+		Request(const boost::shared_ptr<Client>& client_, const std::string& line_) : client(client_), line(line_)
+		{
+		}
+	};
+
+	// Lengths of a file already worked out, good for as long as the file's identity stays the same
+	struct CachedLengths
+	{
+		lhcutilities::FileIdentity identity;
+		double reportedLength; // -1 if not known yet
+		double realLength; // -1 if not known yet
+
+		CachedLengths() : identity(), reportedLength(-1), realLength(-1)
+		{
+		}
+	};
+
+	PatcherOptions m_options;
+	boost::shared_ptr<lhcutilities::UnixSocket> m_listener;
+	lhcutilities::WorkQueue<Request> m_requests;
+
+	boost::shared_ptr<ogglength::OggPageIndex> m_pageIndex; // NULL if not using a page index
+	boost::shared_ptr<BackgroundThrottle> m_throttle; // NULL if not in background mode
+
+	std::map<std::string, CachedLengths> m_lengthCache; // Keyed by absolute path
+	boost::mutex m_lengthCacheMutex;
+
+	std::list<boost::shared_ptr<Client> > m_clients; // Clients with a thread reading requests from them
+	std::list<boost::shared_ptr<Client> > m_finishedClients; // Clients whose reader is done but hasn't been joined
+	boost::mutex m_clientsMutex;
+
+	// Not copyable
+	Daemon(const Daemon&);
+	Daemon& operator=(const Daemon&);
+
+public:
+	// Creates a daemon with the given options. It does not start listening until Run() is called.
+	explicit Daemon(const PatcherOptions& options);
+
+	// Listens on the options' daemon socket path and answers requests until the process gets SIGINT or SIGTERM.
+	// Requests being worked on are finished before returning. Throws lhcutilities::IoError if the socket could not
+	// be created. If accepting a connection fails, the error is printed and the daemon shuts down the same way.
+	void Run();
+
+private:
+	void ReadRequests(boost::shared_ptr<Client> client);
+	void Work();
+	void JoinFinishedReaders();
+	void DisconnectClients();
+	std::string HandleRequest(const std::string& requestLine);
+	std::string HandleScan(const std::string& path);
+	std::string HandlePatch(const std::string& path, const std::map<std::string, lhcutilities::JsonValue>& request);
+	double GetReportedLength(const std::string& path);
+	double GetRealLength(const std::string& path);
+	CachedLengths LookUpLengths(const std::string& path, const lhcutilities::FileIdentity& identity);
+	void CacheLengths(const std::string& path, const CachedLengths& lengths);
+	void SavePageIndex();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
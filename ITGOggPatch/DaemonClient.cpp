@@ -0,0 +1,87 @@
+#include "stdafx.h"
+#include "DaemonClient.h"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "unixsocket.h"
+#include "flatjson.h"
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace fs = boost::filesystem;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+void RunDaemonClient(const PatcherOptions& options, ostream& output)
+{
+	boost::shared_ptr<UnixSocket> daemon = UnixSocket::Connect(options.ClientSocketPath());
+
+	// The daemon doesn't share our current directory.
+	vector<string> requests;
+	for(vector<string>::size_type pathIndex = 0; pathIndex < options.StartingPaths().size(); pathIndex++)
+	{
+		string path = fs::system_complete(options.StartingPaths()[pathIndex]).string();
+		requests.push_back("{\"id\":" + boost::lexical_cast<string>(pathIndex) + ",\"op\":"
+			+ JsonQuote(options.ClientOp()) + ",\"path\":" + JsonQuote(path) + "}\n");
+	}
+
+	vector<boost::int64_t> latencies; // microseconds
+	pt::ptime start = pt::microsec_clock::universal_time();
+	for(unsigned int round = 0; round < options.ClientRepeat(); round++)
+	{
+		for(vector<string>::size_type requestIndex = 0; requestIndex < requests.size(); requestIndex++)
+		{
+			pt::ptime sent = pt::microsec_clock::universal_time();
+			daemon->WriteOrDie(requests[requestIndex]);
+			string response;
+			if(!daemon->ReadLine(response))
+			{
+				throw IoError("The daemon hung up.");
+			}
+			latencies.push_back((pt::microsec_clock::universal_time() - sent).total_microseconds());
+
+			if(round == 0)
+			{
+				output << response << endl;
+			}
+		}
+	}
+	double totalSeconds = static_cast<double>((pt::microsec_clock::universal_time() - start).total_microseconds()) / 1000000;
+
+	if(latencies.empty())
+	{
+		return;
+	}
+	sort(latencies.begin(), latencies.end());
+	output << latencies.size() << " requests in " << totalSeconds << " seconds. Latency in microseconds: min "
+		<< latencies.front() << ", median " << latencies[latencies.size() / 2] << ", 99th percentile "
+		<< latencies[latencies.size() * 99 / 100] << ", max " << latencies.back() << endl;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,35 @@
+#ifndef __DAEMON_CLIENT_H__
+#define __DAEMON_CLIENT_H__
+
+#include <iostream>
+#include "PatcherOptions.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Sends the options' client op for each starting path to a daemon started with --daemon, one request at a time, and
+// prints the responses followed by how long the requests took to answer. When the options ask for more than one
+// round, only the first round's responses are printed so the rest measure the daemon and not the terminal.
+// Throws lhcutilities::IoError if the daemon can't be reached.
+void RunDaemonClient(const PatcherOptions& options, std::ostream& output);
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,250 @@
+#include "stdafx.h"
+#include "DirectorySnapshot.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/date_time/gregorian/gregorian_types.hpp>
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace fs = boost::filesystem;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+const int DirectorySnapshot::s_formatVersion = 1;
+const boost::int64_t DirectorySnapshot::s_timeGranularity = 2000000000LL;
+
+DirectorySnapshot::DirectorySnapshot(const string& snapshotPath, const string& settings)
+	: m_snapshotPath(snapshotPath), m_settings(settings),
+	m_scanStart((pt::microsec_clock::universal_time() - pt::ptime(boost::gregorian::date(1970, 1, 1)))
+	.total_microseconds() * 1000), m_unchangedBefore(0), m_directories(), m_files(), m_numDirectoriesRead(0),
+	m_numDirectoriesUnchanged(0)
+{
+	Load();
+}
+
+void DirectorySnapshot::Load()
+{
+	ifstream snapshot(m_snapshotPath.c_str(), ios::in | ios::binary);
+	string line;
+	if(!getline(snapshot, line))
+	{
+		return; // No snapshot yet
+	}
+
+	istringstream header(line);
+	string format;
+	int version;
+	boost::int64_t previousScanStart;
+	string settings;
+	if(!getline(header, format, '\t') || format != "itgoggpatch-snapshot" || !(header >> version)
+		|| version != s_formatVersion || header.get() != '\t' || !(header >> previousScanStart) || header.get() != '\t'
+		|| !getline(header, settings) || settings != m_settings)
+	{
+		return; // Decisions made with other settings are no good, so start over.
+	}
+	m_unchangedBefore = previousScanStart - s_timeGranularity;
+
+	map<string, DirectoryState>::iterator directoryIt = m_directories.end();
+	while(getline(snapshot, line))
+	{
+		istringstream fields(line);
+		string type;
+		if(!getline(fields, type, '\t'))
+		{
+			continue;
+		}
+
+		// Paths and names go last because they're the only fields that could have a tab in them.
+		if(type == "D")
+		{
+			DirectoryState directory;
+			string path;
+			if(!(fields >> directory.modificationTime) || fields.get() != '\t' || !(fields >> directory.numEntries)
+				|| fields.get() != '\t' || !getline(fields, path))
+			{
+				directoryIt = m_directories.end();
+				continue;
+			}
+			directoryIt = m_directories.insert(make_pair(path, directory)).first;
+		}
+		else if(directoryIt == m_directories.end())
+		{
+			continue; // Belongs to a directory whose line couldn't be read
+		}
+		else if(type == "S")
+		{
+			string name;
+			if(getline(fields, name))
+			{
+				directoryIt->second.subdirectories.push_back(name);
+			}
+		}
+		else if(type == "F")
+		{
+			string outcomeString;
+			FileState file;
+			string name;
+			if(!getline(fields, outcomeString, '\t') || !(fields >> file.size) || fields.get() != '\t'
+				|| !(fields >> file.modificationTime) || fields.get() != '\t' || !getline(fields, name))
+			{
+				continue;
+			}
+			file.decided = StringToOutcome(outcomeString, file.outcome);
+			directoryIt->second.files.push_back(name);
+			m_files[(fs::path(directoryIt->first) / name).string()] = file;
+		}
+	}
+}
+
+string DirectorySnapshot::GetKey(const string& path)
+{
+	return fs::system_complete(path).string();
+}
+
+bool DirectorySnapshot::FindUnchangedDirectory(const string& directory, vector<string>& subdirectoriesOut,
+	vector<string>& filesOut)
+{
+	map<string, DirectoryState>::iterator directoryIt = m_directories.find(GetKey(directory));
+	if(directoryIt == m_directories.end())
+	{
+		return false;
+	}
+
+	FileIdentity identity = GetFileIdentityOrDie(directory.c_str());
+	if(identity.modificationTime != directoryIt->second.modificationTime || identity.modificationTime >= m_unchangedBefore)
+	{
+		return false;
+	}
+
+	directoryIt->second.seen = true;
+	subdirectoriesOut = directoryIt->second.subdirectories;
+	filesOut = directoryIt->second.files;
+	m_numDirectoriesUnchanged++;
+	return true;
+}
+
+void DirectorySnapshot::RecordDirectory(const string& directory, boost::int64_t modificationTime,
+	unsigned long numEntries, const vector<string>& subdirectories, const vector<string>& files)
+{
+	DirectoryState& state = m_directories[GetKey(directory)];
+	state.modificationTime = modificationTime;
+	state.numEntries = numEntries;
+	state.subdirectories = subdirectories;
+	state.files = files;
+	state.seen = true;
+	m_numDirectoriesRead++;
+}
+
+bool DirectorySnapshot::FindDecision(const string& path, FileOutcome& outcomeOut)
+{
+	map<string, FileState>::iterator fileIt = m_files.find(GetKey(path));
+	if(fileIt == m_files.end() || !fileIt->second.decided)
+	{
+		return false;
+	}
+
+	FileIdentity identity;
+	try
+	{
+		identity = GetFileIdentityOrDie(path.c_str());
+	}
+	catch(IoError&)
+	{
+		return false; // Looking at it properly will report the error.
+	}
+
+	if(identity.size != fileIt->second.size || identity.modificationTime != fileIt->second.modificationTime
+		|| identity.modificationTime >= m_unchangedBefore)
+	{
+		fileIt->second.decided = false;
+		return false;
+	}
+
+	outcomeOut = fileIt->second.outcome;
+	return true;
+}
+
+void DirectorySnapshot::RecordDecision(const string& path, FileOutcome outcome)
+{
+	FileState& file = m_files[GetKey(path)];
+	try
+	{
+		FileIdentity identity = GetFileIdentityOrDie(path.c_str());
+		file.size = identity.size;
+		file.modificationTime = identity.modificationTime;
+		file.outcome = outcome;
+		file.decided = true;
+	}
+	catch(IoError&)
+	{
+		file.decided = false; // It will just be looked at again next time.
+	}
+}
+
+void DirectorySnapshot::Save()
+{
+	ostringstream text;
+	text << "itgoggpatch-snapshot\t" << s_formatVersion << '\t' << m_scanStart << '\t' << m_settings << '\n';
+	for(map<string, DirectoryState>::const_iterator directoryIt = m_directories.begin();
+		directoryIt != m_directories.end(); ++directoryIt)
+	{
+		const DirectoryState& directory = directoryIt->second;
+		if(!directory.seen)
+		{
+			continue; // Gone, or no longer under the paths being patched
+		}
+
+		text << "D\t" << directory.modificationTime << '\t' << directory.numEntries << '\t' << directoryIt->first
+			<< '\n';
+		for(vector<string>::size_type subdirectoryIndex = 0; subdirectoryIndex < directory.subdirectories.size();
+			subdirectoryIndex++)
+		{
+			text << "S\t" << directory.subdirectories[subdirectoryIndex] << '\n';
+		}
+		for(vector<string>::size_type fileIndex = 0; fileIndex < directory.files.size(); fileIndex++)
+		{
+			const string& name = directory.files[fileIndex];
+			FileState file;
+			map<string, FileState>::const_iterator fileIt = m_files.find((fs::path(directoryIt->first) / name).string());
+			if(fileIt != m_files.end())
+			{
+				file = fileIt->second;
+			}
+			text << "F\t" << (file.decided ? OutcomeToString(file.outcome) : string("-")) << '\t' << file.size << '\t'
+				<< file.modificationTime << '\t' << name << '\n';
+		}
+	}
+	string textString = text.str();
+
+	// An interrupted write must not leave a snapshot that is missing directories, or their files would never be
+	// looked at again.
+	ReplaceFileContentsOrDie(m_snapshotPath.c_str(), vector<unsigned char>(textString.begin(), textString.end()));
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
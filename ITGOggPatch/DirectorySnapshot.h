@@ -0,0 +1,127 @@
+#ifndef __DIRECTORY_SNAPSHOT_H__
+#define __DIRECTORY_SNAPSHOT_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/cstdint.hpp>
+#include "PatchSummary.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// What the directories searched by the last run held and what was decided about each .ogg file in them, so that a
+// run that has little or nothing new to do doesn't have to read every directory and open every file again.
+//
+// A directory is taken to be unchanged if its modification time is the same, since adding, removing, or renaming
+// anything in it changes that, and then the subdirectories and files recorded for it are used without reading it.
+// A file's decision is used if its size and modification time are the same. Anything modified within a couple of
+// seconds before the run that took the snapshot started could have been modified again without its modification
+// time changing, so it is always looked at again.
+//
+// The snapshot is a text file. The first line has the format version, when the run that wrote it started, and the
+// settings its decisions were made with. Each directory is a line with its modification time, number of entries,
+// and path, followed by a line for each subdirectory with its name and a line for each .ogg or .zip file with the
+// decision, size, modification time, and name. Fields are separated by tabs.
+class DirectorySnapshot
+{
+private:
+	struct DirectoryState
+	{
+		boost::int64_t modificationTime;
+		unsigned long numEntries; // Everything in the directory, not just what is recorded
+		std::vector<std::string> subdirectories; // Names, not paths
+		std::vector<std::string> files; // Names of .ogg and .zip files
+		bool seen; // Found this run
+
+		DirectoryState() : modificationTime(0), numEntries(0), subdirectories(), files(), seen(false)
+		{
+		}
+	};
+
+	struct FileState
+	{
+		boost::uint64_t size;
+		boost::int64_t modificationTime;
+		bool decided; // Whether outcome is what was decided with the file at this size and modification time
+		FileOutcome outcome;
+
+		FileState() : size(0), modificationTime(0), decided(false), outcome(outcome_patched)
+		{
+		}
+	};
+
+	std::string m_snapshotPath;
+	std::string m_settings;
+	boost::int64_t m_scanStart; // When this run started, in nanoseconds since the epoch
+	boost::int64_t m_unchangedBefore; // Modification times from here on might hide a change
+	std::map<std::string, DirectoryState> m_directories; // Keyed by absolute path
+	std::map<std::string, FileState> m_files; // Keyed by absolute path
+	unsigned long m_numDirectoriesRead;
+	unsigned long m_numDirectoriesUnchanged;
+
+	// Version of the snapshot format. Bump when the format changes; older snapshots are then not used.
+	static const int s_formatVersion;
+	// Longest time after a change that a modification time can still read as before the change. FAT keeps times
+	// to 2 seconds.
+	static const boost::int64_t s_timeGranularity;
+
+	// Not copyable
+	DirectorySnapshot(const DirectorySnapshot&);
+	DirectorySnapshot& operator=(const DirectorySnapshot&);
+
+	void Load();
+	static std::string GetKey(const std::string& path);
+
+public:
+	// Reads the snapshot at snapshotPath if there is one. settings describes whatever decides what happens to a file,
+	// such as the length conditions; a snapshot taken with other settings is not used. A snapshot that is missing or
+	// can't be read just means everything is looked at.
+	DirectorySnapshot(const std::string& snapshotPath, const std::string& settings);
+
+	// If the directory hasn't changed since the snapshot, sets subdirectoriesOut and filesOut to the names recorded
+	// for it and returns true. Can throw lhcutilities::IoError if the directory can't be looked at.
+	bool FindUnchangedDirectory(const std::string& directory, std::vector<std::string>& subdirectoriesOut,
+		std::vector<std::string>& filesOut);
+
+	// Records what a directory that was read holds. modificationTime must be taken before reading it.
+	void RecordDirectory(const std::string& directory, boost::int64_t modificationTime, unsigned long numEntries,
+		const std::vector<std::string>& subdirectories, const std::vector<std::string>& files);
+
+	// Returns true if the file hasn't changed since a run decided what to do with it, setting outcomeOut to what was
+	// decided.
+	bool FindDecision(const std::string& path, FileOutcome& outcomeOut);
+
+	// Records what was decided about a file, along with its size and modification time now, after any patching.
+	void RecordDecision(const std::string& path, FileOutcome outcome);
+
+	// Number of directories read this run because they were new or had changed
+	unsigned long NumDirectoriesRead() const { return m_numDirectoriesRead; }
+	// Number of directories whose recorded contents were used this run
+	unsigned long NumDirectoriesUnchanged() const { return m_numDirectoriesUnchanged; }
+
+	// Writes the snapshot with the directories and files found this run. Directories that weren't found are dropped.
+	// Throws lhcutilities::IoError if the snapshot can't be written.
+	void Save();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "FileFinder.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace oggpatcher
+{
+
+void FindOggFiles(const string& directory, vector<string>& files, vector<pair<string, string> >& errors)
+{
+	fs::directory_iterator endIt;
+	for(fs::directory_iterator dirIt(directory); dirIt != endIt; ++dirIt)
+	{
+		try
+		{
+			// Don't recursively search a directory if it is a symlink to avoid infinite recursion.
+			if(fs::is_directory(dirIt->status()) && !fs::is_symlink(dirIt->status()))
+			{
+				FindOggFiles(dirIt->path().string(), files, errors);
+			}
+			else if(fs::is_regular_file(dirIt->status()) && boost::iends_with(dirIt->path().string(), ".ogg"))
+			{
+				files.push_back(dirIt->path().string());
+			}
+		}
+		catch(boost::system::system_error& ex)
+		{
+			errors.push_back(make_pair(dirIt->path().string(), string(ex.what())));
+		}
+	}
+}
+
+void FindOggFilesInStartingPath(const string& path, vector<string>& files, vector<pair<string, string> >& errors)
+{
+	try
+	{
+		if(fs::is_directory(path))
+		{
+			FindOggFiles(path, files, errors);
+		}
+		else if(fs::is_regular_file(path))
+		{
+			files.push_back(path);
+		}
+		else
+		{
+			errors.push_back(make_pair(path, string("This path indicates something that is not a file or a directory.")));
+		}
+	}
+	catch(boost::system::system_error& ex)
+	{
+		errors.push_back(make_pair(path, string(ex.what())));
+	}
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
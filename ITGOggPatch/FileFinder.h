@@ -0,0 +1,41 @@
+#ifndef __FILE_FINDER_H__
+#define __FILE_FINDER_H__
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Adds the .ogg files in the given directory and its subdirectories to files. Problems with entries inside the
+// directory are added to errors as (path, message) pairs instead of stopping the search.
+// Can throw boost::system::system_error if something goes wrong with the directory itself.
+void FindOggFiles(const std::string& directory, std::vector<std::string>& files,
+	std::vector<std::pair<std::string, std::string> >& errors);
+
+// Adds the .ogg files the given starting path stands for to files: the path itself if it is a file, or the .ogg
+// files under it if it is a directory. Problems are added to errors as (path, message) pairs.
+void FindOggFilesInStartingPath(const std::string& path, std::vector<std::string>& files,
+	std::vector<std::pair<std::string, std::string> >& errors);
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,240 @@
+#include "stdafx.h"
+#include "Manifest.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/path.hpp>
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace fs = boost::filesystem;
+
+namespace oggpatcher
+{
+
+namespace
+{
+
+string ReadAll(istream& input)
+{
+	return string(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+}
+
+IoError BadLine(string::size_type lineNumber, const string& problem)
+{
+	return IoError("Line " + boost::lexical_cast<string>(lineNumber) + " of the manifest " + problem);
+}
+
+ManifestEntry ParseLine(const string& line, string::size_type lineNumber)
+{
+	ManifestEntry entry;
+	if(line[0] == '"')
+	{
+		// "path, with commas and ""quotes""",105
+		string::size_type position = 1;
+		while(true)
+		{
+			if(position >= line.size())
+			{
+				throw BadLine(lineNumber, "has a quoted path with no closing quote.");
+			}
+			else if(line[position] == '"' && position + 1 < line.size() && line[position + 1] == '"')
+			{
+				entry.path += '"';
+				position += 2;
+			}
+			else if(line[position] == '"')
+			{
+				position++;
+				break;
+			}
+			else
+			{
+				entry.path += line[position];
+				position++;
+			}
+		}
+
+		string rest = line.substr(position);
+		if(boost::trim_copy(rest).empty())
+		{
+			return entry;
+		}
+		else if(rest[0] != ',' || !ParsePatchTarget(rest.substr(1), entry.target))
+		{
+			throw BadLine(lineNumber, "does not have a length in seconds or samples after the path.");
+		}
+		return entry;
+	}
+
+	// Only take what's after the last comma as a length if it looks like one, so that most paths with commas in them
+	// work without quoting.
+	string::size_type lastComma = line.rfind(',');
+	if(lastComma != string::npos && ParsePatchTarget(line.substr(lastComma + 1), entry.target))
+	{
+		entry.path = line.substr(0, lastComma);
+	}
+	else
+	{
+		entry.path = line;
+	}
+	return entry;
+}
+
+} // end anonymous namespace
+
+// The most seconds a target can be, about 31 years. Times any Vorbis sample rate, it still fits in a granule position.
+const double s_maxTargetSeconds = 1e9;
+
+bool ParsePatchTarget(const string& text, PatchTarget& targetOut)
+{
+	string trimmed = boost::trim_copy(text);
+	try
+	{
+		if(boost::iends_with(trimmed, "samples"))
+		{
+			string number = boost::trim_copy(trimmed.substr(0, trimmed.size() - 7));
+			ogg_int64_t samples = boost::lexical_cast<ogg_int64_t>(number);
+			if(samples < 0)
+			{
+				return false;
+			}
+			targetOut.type = target_samples;
+			targetOut.samples = samples;
+			return true;
+		}
+		else
+		{
+			double seconds = boost::lexical_cast<double>(trimmed);
+			if(!(seconds >= 0 && seconds <= s_maxTargetSeconds)) // Also false for NaN and infinity
+			{
+				return false;
+			}
+			targetOut.type = target_seconds;
+			targetOut.seconds = seconds;
+			return true;
+		}
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		return false;
+	}
+}
+
+vector<ManifestEntry> ReadManifest(const string& manifestPath)
+{
+	string contents;
+	if(manifestPath == "-")
+	{
+		contents = ReadAll(cin);
+		if(cin.bad())
+		{
+			throw IoError("Error reading the manifest from standard input.");
+		}
+	}
+	else
+	{
+		ifstream manifestFile(manifestPath.c_str(), ios::in | ios::binary);
+		if(!manifestFile)
+		{
+			throw IoError("Could not open the manifest.");
+		}
+		contents = ReadAll(manifestFile);
+		if(manifestFile.bad())
+		{
+			throw IoError("Error reading the manifest.");
+		}
+	}
+
+	vector<ManifestEntry> entries;
+	if(contents.find('\0') != string::npos)
+	{
+		// find -print0 output. Paths can contain anything but NUL, including newlines and commas, so there are no
+		// lengths in this form.
+		vector<string> paths;
+		boost::split(paths, contents, boost::is_any_of(string(1, '\0')));
+		for(vector<string>::size_type pathIndex = 0; pathIndex < paths.size(); pathIndex++)
+		{
+			if(!paths[pathIndex].empty())
+			{
+				ManifestEntry entry;
+				entry.path = paths[pathIndex];
+				entries.push_back(entry);
+			}
+		}
+		return entries;
+	}
+
+	vector<string> lines;
+	boost::split(lines, contents, boost::is_any_of("\n"));
+	for(vector<string>::size_type lineIndex = 0; lineIndex < lines.size(); lineIndex++)
+	{
+		string line = lines[lineIndex];
+		if(!line.empty() && line[line.size() - 1] == '\r')
+		{
+			line.erase(line.size() - 1);
+		}
+		if(!line.empty())
+		{
+			entries.push_back(ParseLine(line, lineIndex + 1));
+		}
+	}
+	return entries;
+}
+
+void SortManifestForLocality(vector<ManifestEntry>& entries)
+{
+	// (directory, inode) for each entry, with the entry's index to keep the sort stable for files that can't be
+	// looked at. Those get reported when they are processed.
+	typedef pair<pair<string, boost::uint64_t>, vector<ManifestEntry>::size_type> SortKey;
+	vector<SortKey> keys;
+	for(vector<ManifestEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+	{
+		boost::uint64_t inode = 0;
+		try
+		{
+			inode = GetFileIdentityOrDie(entries[entryIndex].path.c_str()).inode;
+		}
+		catch(IoError&)
+		{
+		}
+		string directory = fs::path(entries[entryIndex].path).parent_path().string();
+		keys.push_back(make_pair(make_pair(directory, inode), entryIndex));
+	}
+
+	sort(keys.begin(), keys.end());
+
+	vector<ManifestEntry> sorted;
+	sorted.reserve(entries.size());
+	for(vector<SortKey>::size_type keyIndex = 0; keyIndex < keys.size(); keyIndex++)
+	{
+		sorted.push_back(entries[keys[keyIndex].second]);
+	}
+	entries.swap(sorted);
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,77 @@
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <string>
+#include <vector>
+#include <ogg/ogg.h>
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// What length to patch a particular file to
+enum PatchTargetType
+{
+	target_from_options, // Whatever the options say: a fixed number of seconds or the real length
+	target_seconds, // A number of seconds given for the file
+	target_samples // An exact number of samples given for the file
+};
+
+// A length to patch a particular file to
+struct PatchTarget
+{
+	PatchTargetType type;
+	double seconds; // For target_seconds
+	ogg_int64_t samples; // For target_samples
+
+	PatchTarget() : type(target_from_options), seconds(0), samples(0)
+	{
+	}
+};
+
+// A file listed in a manifest
+struct ManifestEntry
+{
+	std::string path;
+	PatchTarget target;
+
+	ManifestEntry() : path(), target()
+	{
+	}
+};
+
+// Parses a length to patch to like "105", "105.5", or "4630500 samples". Returns false if it isn't one, including
+// if it is negative, not finite, or too long to store in a file.
+bool ParsePatchTarget(const std::string& text, PatchTarget& targetOut);
+
+// Reads a list of files to process, from standard input if manifestPath is "-". If the manifest contains a NUL
+// character, it is a list of paths separated by NULs, like find -print0 writes. Otherwise each non-empty line is a
+// path, optionally followed by a comma and the length to patch it to: a number of seconds, or a number of samples
+// followed by "samples". A path containing a comma can be written in double quotes with any double quotes in it
+// doubled, the way CSV does it.
+// Throws lhcutilities::IoError if the manifest can't be read or has a bad line.
+std::vector<ManifestEntry> ReadManifest(const std::string& manifestPath);
+
+// Sorts manifest entries by directory and by inode number within a directory, which is close to the order the files
+// are on disk on most filesystems, instead of whatever order the manifest was written in.
+void SortManifestForLocality(std::vector<ManifestEntry>& entries);
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,164 @@
+#include "stdafx.h"
+#include "PatchMetrics.h"
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/system/system_error.hpp>
+#include "utilities.h"
+#include "ogglength.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+// From checking the last page of a file on a fast disk up to decoding a long song on a slow machine
+const double PatchMetrics::s_bucketBounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5,
+	10, 30, 60 };
+const vector<unsigned long>::size_type PatchMetrics::s_numBucketBounds =
+	sizeof(PatchMetrics::s_bucketBounds) / sizeof(PatchMetrics::s_bucketBounds[0]);
+const long PatchMetrics::s_refreshSeconds = 15;
+
+PatchMetrics::PatchMetrics(const string& metricsPath) : m_metricsPath(metricsPath), m_numFilesSeen(0),
+	m_numIoErrors(0), m_numOggVorbisErrors(0), m_numFilesystemErrors(0), m_numOtherErrors(0), m_lastWriteTime()
+{
+	for(int phase = 0; phase < num_patch_phases; phase++)
+	{
+		m_phaseDurations[phase].bucketCounts.resize(s_numBucketBounds + 1, 0);
+	}
+}
+
+void PatchMetrics::Error(const exception& error)
+{
+	if(dynamic_cast<const IoError*>(&error) != NULL)
+	{
+		m_numIoErrors++;
+	}
+	else if(dynamic_cast<const ogglength::OggVorbisError*>(&error) != NULL)
+	{
+		m_numOggVorbisErrors++;
+	}
+	else if(dynamic_cast<const boost::system::system_error*>(&error) != NULL)
+	{
+		m_numFilesystemErrors++;
+	}
+	else
+	{
+		m_numOtherErrors++;
+	}
+}
+
+void PatchMetrics::ObservePhase(PatchPhase phase, double seconds)
+{
+	DurationHistogram& histogram = m_phaseDurations[phase];
+	vector<unsigned long>::size_type bucket = 0;
+	while(bucket < s_numBucketBounds && seconds > s_bucketBounds[bucket])
+	{
+		bucket++;
+	}
+	histogram.bucketCounts[bucket]++;
+	histogram.count++;
+	histogram.sum += seconds;
+}
+
+bool PatchMetrics::RefreshDue() const
+{
+	return m_lastWriteTime.is_not_a_date_time()
+		|| pt::microsec_clock::universal_time() - m_lastWriteTime >= pt::seconds(s_refreshSeconds);
+}
+
+void PatchMetrics::Write(const PatchSummary& summary, boost::uint64_t bytesRead, boost::uint64_t bytesWritten,
+	bool finished)
+{
+	pt::ptime now = pt::microsec_clock::universal_time();
+	ostringstream text;
+	text.precision(10); // The default of 6 digits would round the sums off on long runs
+
+	text << "# HELP itgoggpatch_files_seen_total Files the patcher started on.\n";
+	text << "# TYPE itgoggpatch_files_seen_total counter\n";
+	text << "itgoggpatch_files_seen_total " << m_numFilesSeen << "\n";
+
+	text << "# HELP itgoggpatch_files_patched_total Files whose length was changed.\n";
+	text << "# TYPE itgoggpatch_files_patched_total counter\n";
+	text << "itgoggpatch_files_patched_total " << summary.numPatched << "\n";
+
+	text << "# HELP itgoggpatch_files_skipped_total Files left alone, by why.\n";
+	text << "# TYPE itgoggpatch_files_skipped_total counter\n";
+	text << "itgoggpatch_files_skipped_total{reason=\"quick_check\"} " << summary.numQuickCheckSkips << "\n";
+	text << "itgoggpatch_files_skipped_total{reason=\"condition\"} " << summary.numConditionSkips << "\n";
+	text << "itgoggpatch_files_skipped_total{reason=\"compressed\"} " << summary.numCompressedSkips << "\n";
+
+	text << "# HELP itgoggpatch_files_resumed_total Files skipped because an earlier run finished them.\n";
+	text << "# TYPE itgoggpatch_files_resumed_total counter\n";
+	text << "itgoggpatch_files_resumed_total " << summary.numResumed << "\n";
+
+	text << "# HELP itgoggpatch_errors_total Errors, by type.\n";
+	text << "# TYPE itgoggpatch_errors_total counter\n";
+	text << "itgoggpatch_errors_total{type=\"io\"} " << m_numIoErrors << "\n";
+	text << "itgoggpatch_errors_total{type=\"ogg_vorbis\"} " << m_numOggVorbisErrors << "\n";
+	text << "itgoggpatch_errors_total{type=\"filesystem\"} " << m_numFilesystemErrors << "\n";
+	text << "itgoggpatch_errors_total{type=\"other\"} " << m_numOtherErrors << "\n";
+
+	text << "# HELP itgoggpatch_read_bytes_total Bytes read from .ogg files.\n";
+	text << "# TYPE itgoggpatch_read_bytes_total counter\n";
+	text << "itgoggpatch_read_bytes_total " << bytesRead << "\n";
+
+	text << "# HELP itgoggpatch_written_bytes_total Bytes written to .ogg files.\n";
+	text << "# TYPE itgoggpatch_written_bytes_total counter\n";
+	text << "itgoggpatch_written_bytes_total " << bytesWritten << "\n";
+
+	text << "# HELP itgoggpatch_phase_duration_seconds Time spent on each part of handling a file.\n";
+	text << "# TYPE itgoggpatch_phase_duration_seconds histogram\n";
+	for(int phase = 0; phase < num_patch_phases; phase++)
+	{
+		const DurationHistogram& histogram = m_phaseDurations[phase];
+		string label = string("phase=\"") + GetPhaseName(static_cast<PatchPhase>(phase)) + "\"";
+		unsigned long cumulativeCount = 0;
+		for(vector<unsigned long>::size_type bucket = 0; bucket < s_numBucketBounds; bucket++)
+		{
+			cumulativeCount += histogram.bucketCounts[bucket];
+			text << "itgoggpatch_phase_duration_seconds_bucket{" << label << ",le=\"" << s_bucketBounds[bucket]
+				<< "\"} " << cumulativeCount << "\n";
+		}
+		text << "itgoggpatch_phase_duration_seconds_bucket{" << label << ",le=\"+Inf\"} " << histogram.count << "\n";
+		text << "itgoggpatch_phase_duration_seconds_sum{" << label << "} " << histogram.sum << "\n";
+		text << "itgoggpatch_phase_duration_seconds_count{" << label << "} " << histogram.count << "\n";
+	}
+
+	text << "# HELP itgoggpatch_run_finished Whether the run is over.\n";
+	text << "# TYPE itgoggpatch_run_finished gauge\n";
+	text << "itgoggpatch_run_finished " << (finished ? 1 : 0) << "\n";
+
+	// Alerting on this going stale catches a run that is stuck.
+	text << "# HELP itgoggpatch_last_update_timestamp_seconds When this file was written.\n";
+	text << "# TYPE itgoggpatch_last_update_timestamp_seconds gauge\n";
+	text << "itgoggpatch_last_update_timestamp_seconds "
+		<< (now - pt::ptime(boost::gregorian::date(1970, 1, 1))).total_seconds() << "\n";
+
+	string textString = text.str();
+
+	// node_exporter only reads files ending in .prom, so it never sees the temporary file.
+	ReplaceFileContentsOrDie(m_metricsPath.c_str(), vector<unsigned char>(textString.begin(), textString.end()));
+	m_lastWriteTime = now;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,86 @@
+#ifndef __PATCH_METRICS_H__
+#define __PATCH_METRICS_H__
+
+#include <exception>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "PatchSummary.h"
+#include "PatchPhase.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Counts and timings of a patcher run, written to a file in the Prometheus text exposition format so that
+// node_exporter's textfile collector can pick them up. The file is replaced in one step each time it is written so
+// that a scrape never sees half of it.
+class PatchMetrics
+{
+private:
+	// Durations in seconds, counted into the buckets in s_bucketBounds
+	struct DurationHistogram
+	{
+		std::vector<unsigned long> bucketCounts; // Not cumulative; the last bucket is everything over the last bound
+		unsigned long count;
+		double sum;
+
+		DurationHistogram() : bucketCounts(), count(0), sum(0)
+		{
+		}
+	};
+
+	std::string m_metricsPath;
+	unsigned long m_numFilesSeen;
+	unsigned long m_numIoErrors;
+	unsigned long m_numOggVorbisErrors;
+	unsigned long m_numFilesystemErrors;
+	unsigned long m_numOtherErrors;
+	DurationHistogram m_phaseDurations[num_patch_phases];
+	boost::posix_time::ptime m_lastWriteTime; // not_a_date_time if never written
+
+	static const double s_bucketBounds[];
+	static const std::vector<unsigned long>::size_type s_numBucketBounds;
+	// Seconds between writes of the file during a run
+	static const long s_refreshSeconds;
+
+public:
+	explicit PatchMetrics(const std::string& metricsPath);
+
+	// Counts a file that the patcher started on.
+	void FileSeen() { m_numFilesSeen++; }
+
+	// Counts an error, by the type of exception.
+	void Error(const std::exception& error);
+
+	// Records how long a phase took for one file.
+	void ObservePhase(PatchPhase phase, double seconds);
+
+	// Returns true if it has been long enough since the file was last written that it should be written again.
+	bool RefreshDue() const;
+
+	// Writes the metrics file with the counts in summary, the I/O counts, and whether the run is finished.
+	// Throws lhcutilities::IoError or boost::system::system_error if the file can't be written.
+	void Write(const PatchSummary& summary, boost::uint64_t bytesRead, boost::uint64_t bytesWritten, bool finished);
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
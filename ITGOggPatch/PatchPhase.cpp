@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "PatchPhase.h"
+#include "PatchMetrics.h"
+#include "PhasePerfCounters.h"
+
+using namespace lhcutilities;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+const char* GetPhaseName(PatchPhase phase)
+{
+	switch(phase)
+	{
+	case phase_condition_check:
+		return "condition_check";
+	case phase_real_length_decode:
+		return "real_length_decode";
+	case phase_patch_write:
+		return "patch_write";
+	default:
+		return "unknown";
+	}
+}
+
+ScopedPhaseTimer::ScopedPhaseTimer(PatchMetrics* metrics, PhasePerfCounters* perfCounters, PatchPhase phase)
+	: m_metrics(metrics), m_perfCounters(perfCounters), m_phase(phase), m_start(), m_startCounts(),
+	m_haveStartCounts(false)
+{
+	if(m_metrics != NULL || m_perfCounters != NULL)
+	{
+		m_start = pt::microsec_clock::universal_time();
+	}
+	if(m_perfCounters != NULL)
+	{
+		m_haveStartCounts = m_perfCounters->Read(m_startCounts);
+	}
+}
+
+ScopedPhaseTimer::~ScopedPhaseTimer()
+{
+	if(m_metrics == NULL && m_perfCounters == NULL)
+	{
+		return;
+	}
+
+	// Counters first so that the clock reading doesn't count toward the phase.
+	PerfCounts endCounts;
+	bool haveCounts = m_perfCounters != NULL && m_haveStartCounts && m_perfCounters->Read(endCounts);
+	double seconds = (pt::microsec_clock::universal_time() - m_start).total_microseconds() / 1000000.0;
+
+	if(m_metrics != NULL)
+	{
+		m_metrics->ObservePhase(m_phase, seconds);
+	}
+	if(m_perfCounters != NULL)
+	{
+		m_perfCounters->AddPhase(m_phase, seconds, haveCounts ? &m_startCounts : NULL, haveCounts ? &endCounts : NULL);
+	}
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,66 @@
+#ifndef __PATCH_PHASE_H__
+#define __PATCH_PHASE_H__
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "perfcounters.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+class PatchMetrics;
+class PhasePerfCounters;
+
+// The parts of handling a file that are measured separately
+enum PatchPhase
+{
+	phase_condition_check, // Finding out whether the file meets the length conditions, which reads its pages
+	phase_real_length_decode, // Decoding the file to get its real length
+	phase_patch_write, // Changing the length of the file
+	num_patch_phases
+};
+
+// Gets the name of a phase as used in metric labels and tables, like "condition_check".
+const char* GetPhaseName(PatchPhase phase);
+
+// Records the time and performance counters spent while it is in scope as a phase, in a PatchMetrics and a
+// PhasePerfCounters, whichever of them there are.
+class ScopedPhaseTimer
+{
+private:
+	PatchMetrics* m_metrics;
+	PhasePerfCounters* m_perfCounters;
+	PatchPhase m_phase;
+	boost::posix_time::ptime m_start;
+	lhcutilities::PerfCounts m_startCounts;
+	bool m_haveStartCounts;
+
+	// Not copyable
+	ScopedPhaseTimer(const ScopedPhaseTimer&);
+	ScopedPhaseTimer& operator=(const ScopedPhaseTimer&);
+
+public:
+	// Either can be NULL, in which case nothing is recorded there.
+	ScopedPhaseTimer(PatchMetrics* metrics, PhasePerfCounters* perfCounters, PatchPhase phase);
+	~ScopedPhaseTimer();
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
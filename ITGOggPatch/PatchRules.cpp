@@ -0,0 +1,521 @@
+#include "stdafx.h"
+#include "PatchRules.h"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include "ogglength.h"
+#include "utilities.h"
+
+using namespace std;
+using namespace ogglength;
+using namespace lhcutilities;
+
+namespace oggpatcher
+{
+
+namespace
+{
+
+IoError BadLine(unsigned long lineNumber, const string& problem)
+{
+	return IoError("Line " + boost::lexical_cast<string>(lineNumber) + " of the rules file " + problem);
+}
+
+// Takes the next field of a rule off the front of rest, skipping whitespace before it. Returns false if there is
+// nothing left.
+bool TakeField(string& rest, string& fieldOut, unsigned long lineNumber)
+{
+	boost::trim_left(rest);
+	if(rest.empty())
+	{
+		return false;
+	}
+
+	if(rest[0] == '"')
+	{
+		string::size_type closingQuote = rest.find('"', 1);
+		if(closingQuote == string::npos)
+		{
+			throw BadLine(lineNumber, "has a quoted glob with no closing quote.");
+		}
+		fieldOut = rest.substr(1, closingQuote - 1);
+		rest = rest.substr(closingQuote + 1);
+		return true;
+	}
+
+	string::size_type end = rest.find_first_of(" \t");
+	fieldOut = rest.substr(0, end);
+	rest = end == string::npos ? string() : rest.substr(end);
+	return true;
+}
+
+string ActionToString(RuleAction action)
+{
+	switch(action)
+	{
+	case action_patch:
+		return "patch";
+	case action_unpatch:
+		return "unpatch";
+	default:
+		return "skip";
+	}
+}
+
+} // end anonymous namespace
+
+bool LengthPredicate::Matches(double length) const
+{
+	switch(comparison)
+	{
+	case compare_less:
+		return length < seconds;
+	case compare_less_equal:
+		return length <= seconds;
+	case compare_equal:
+		return length < seconds + .01 && length > seconds - .01;
+	case compare_greater_equal:
+		return length >= seconds;
+	case compare_greater:
+		return length > seconds;
+	default:
+		return true;
+	}
+}
+
+bool LengthPredicate::RuledOutByUpperBound(double upperBound) const
+{
+	// The length is at most the upper bound, so only the comparisons that need it to be big enough can be ruled out.
+	switch(comparison)
+	{
+	case compare_equal:
+		return upperBound <= seconds - .01;
+	case compare_greater_equal:
+		return upperBound < seconds;
+	case compare_greater:
+		return upperBound <= seconds;
+	default:
+		return false;
+	}
+}
+
+string LengthPredicate::ToString() const
+{
+	ostringstream text;
+	switch(comparison)
+	{
+	case compare_less:
+		text << "<";
+		break;
+	case compare_less_equal:
+		text << "<=";
+		break;
+	case compare_equal:
+		text << "=";
+		break;
+	case compare_greater_equal:
+		text << ">=";
+		break;
+	case compare_greater:
+		text << ">";
+		break;
+	default:
+		return "any";
+	}
+	text << seconds;
+	return text.str();
+}
+
+bool LengthPredicate::Parse(const string& text, LengthPredicate& predicateOut)
+{
+	string trimmed = boost::trim_copy(text);
+	if(boost::iequals(trimmed, "any"))
+	{
+		predicateOut = LengthPredicate();
+		return true;
+	}
+
+	LengthPredicate predicate;
+	string::size_type numberStart;
+	if(boost::starts_with(trimmed, "<="))
+	{
+		predicate.comparison = compare_less_equal;
+		numberStart = 2;
+	}
+	else if(boost::starts_with(trimmed, ">="))
+	{
+		predicate.comparison = compare_greater_equal;
+		numberStart = 2;
+	}
+	else if(boost::starts_with(trimmed, "<"))
+	{
+		predicate.comparison = compare_less;
+		numberStart = 1;
+	}
+	else if(boost::starts_with(trimmed, ">"))
+	{
+		predicate.comparison = compare_greater;
+		numberStart = 1;
+	}
+	else if(boost::starts_with(trimmed, "="))
+	{
+		predicate.comparison = compare_equal;
+		numberStart = 1;
+	}
+	else
+	{
+		return false;
+	}
+
+	try
+	{
+		predicate.seconds = boost::lexical_cast<double>(trimmed.substr(numberStart));
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		return false;
+	}
+	if(!(predicate.seconds >= 0))
+	{
+		return false;
+	}
+	predicateOut = predicate;
+	return true;
+}
+
+PatchRules::PatchRules(const string& rulesPath) : m_rules(), m_fingerprint()
+{
+	ifstream rulesFile(rulesPath.c_str(), ios::in | ios::binary);
+	if(!rulesFile)
+	{
+		throw IoError("Could not open the rules file.");
+	}
+
+	// FNV-1a of the rules as understood, so that comments and spacing don't count
+	boost::uint64_t hash = 14695981039346656037ULL;
+	string line;
+	unsigned long lineNumber = 0;
+	while(getline(rulesFile, line))
+	{
+		lineNumber++;
+		boost::trim(line); // Including the \r of Windows line endings
+		if(line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		CompiledRule compiled;
+		compiled.rule = ParseRule(line, lineNumber);
+		compiled.glob = CompileGlob(compiled.rule.glob);
+		m_rules.push_back(compiled);
+
+		const PatchRule& rule = compiled.rule;
+		ostringstream canonical;
+		canonical << NormalizePath(rule.glob) << '\t' << rule.reportedLength.ToString() << '\t'
+			<< ActionToString(rule.action) << '\t';
+		if(rule.action == action_patch && rule.target.type == target_samples)
+		{
+			canonical << rule.target.samples << " samples";
+		}
+		else if(rule.action == action_patch)
+		{
+			canonical << rule.target.seconds;
+		}
+		else if(rule.action == action_unpatch)
+		{
+			canonical << rule.realLength.ToString();
+		}
+		canonical << '\n';
+
+		string canonicalText = canonical.str();
+		for(string::size_type charIndex = 0; charIndex < canonicalText.size(); charIndex++)
+		{
+			hash ^= static_cast<unsigned char>(canonicalText[charIndex]);
+			hash *= 1099511628211ULL;
+		}
+	}
+	if(rulesFile.bad())
+	{
+		throw IoError("Error reading the rules file.");
+	}
+	if(m_rules.empty())
+	{
+		throw IoError("The rules file has no rules in it.");
+	}
+
+	ostringstream fingerprint;
+	fingerprint << hex << setw(16) << setfill('0') << hash;
+	m_fingerprint = fingerprint.str();
+}
+
+PatchRule PatchRules::ParseRule(const string& line, unsigned long lineNumber)
+{
+	PatchRule rule;
+	rule.lineNumber = lineNumber;
+
+	string rest = line;
+	string reportedLength;
+	string action;
+	TakeField(rest, rule.glob, lineNumber);
+	if(!TakeField(rest, reportedLength, lineNumber) || !TakeField(rest, action, lineNumber))
+	{
+		throw BadLine(lineNumber, "needs a glob, a reported length, and an action.");
+	}
+	if(!LengthPredicate::Parse(reportedLength, rule.reportedLength))
+	{
+		throw BadLine(lineNumber, "has a reported length that isn't \"any\" or a comparison like >120.");
+	}
+
+	string target = boost::trim_copy(rest);
+	if(boost::iequals(action, "patch"))
+	{
+		rule.action = action_patch;
+		if(target.empty())
+		{
+			rule.target.type = target_seconds;
+			rule.target.seconds = 105;
+		}
+		else if(!ParsePatchTarget(target, rule.target))
+		{
+			throw BadLine(lineNumber, "does not have a length in seconds or samples to patch to.");
+		}
+	}
+	else if(boost::iequals(action, "unpatch"))
+	{
+		rule.action = action_unpatch;
+		if(!target.empty() && !LengthPredicate::Parse(target, rule.realLength))
+		{
+			throw BadLine(lineNumber, "has a real length that isn't a comparison like <120.");
+		}
+	}
+	else if(boost::iequals(action, "skip"))
+	{
+		rule.action = action_skip;
+		if(!target.empty())
+		{
+			throw BadLine(lineNumber, "has something after skip.");
+		}
+	}
+	else
+	{
+		throw BadLine(lineNumber, "has an action that isn't patch, unpatch, or skip.");
+	}
+	return rule;
+}
+
+string PatchRules::NormalizePath(const string& path)
+{
+	string normalized = boost::to_lower_copy(path);
+	replace(normalized.begin(), normalized.end(), '\\', '/');
+	return normalized;
+}
+
+vector<PatchRules::GlobToken> PatchRules::CompileGlob(const string& glob)
+{
+	string normalized = NormalizePath(glob);
+	vector<GlobToken> tokens;
+	string::size_type position = 0;
+	while(position < normalized.size())
+	{
+		if(normalized.compare(position, 3, "**/") == 0)
+		{
+			tokens.push_back(GlobToken(GlobToken::token_any_directories, string()));
+			position += 3;
+		}
+		else if(normalized.compare(position, 2, "**") == 0)
+		{
+			tokens.push_back(GlobToken(GlobToken::token_anything, string()));
+			position += 2;
+		}
+		else if(normalized[position] == '*')
+		{
+			tokens.push_back(GlobToken(GlobToken::token_within_directory, string()));
+			position++;
+		}
+		else if(normalized[position] == '?')
+		{
+			tokens.push_back(GlobToken(GlobToken::token_one_character, string()));
+			position++;
+		}
+		else
+		{
+			string::size_type end = normalized.find_first_of("*?", position);
+			if(end == string::npos)
+			{
+				end = normalized.size();
+			}
+			tokens.push_back(GlobToken(GlobToken::token_text, normalized.substr(position, end - position)));
+			position = end;
+		}
+	}
+	return tokens;
+}
+
+bool PatchRules::GlobMatches(const vector<GlobToken>& glob, const string& normalizedPath)
+{
+	// The whole path, or the part after any slash
+	if(GlobMatchesFrom(glob, 0, normalizedPath, 0))
+	{
+		return true;
+	}
+	for(string::size_type slash = normalizedPath.find('/'); slash != string::npos;
+		slash = normalizedPath.find('/', slash + 1))
+	{
+		if(GlobMatchesFrom(glob, 0, normalizedPath, slash + 1))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PatchRules::GlobMatchesFrom(const vector<GlobToken>& glob, vector<GlobToken>::size_type tokenIndex,
+	const string& path, string::size_type position)
+{
+	if(tokenIndex == glob.size())
+	{
+		return position == path.size();
+	}
+
+	const GlobToken& token = glob[tokenIndex];
+	switch(token.type)
+	{
+	case GlobToken::token_text:
+		return path.compare(position, token.text.size(), token.text) == 0
+			&& GlobMatchesFrom(glob, tokenIndex + 1, path, position + token.text.size());
+	case GlobToken::token_one_character:
+		return position < path.size() && path[position] != '/'
+			&& GlobMatchesFrom(glob, tokenIndex + 1, path, position + 1);
+	case GlobToken::token_within_directory:
+		for(string::size_type end = position; ; end++)
+		{
+			if(GlobMatchesFrom(glob, tokenIndex + 1, path, end))
+			{
+				return true;
+			}
+			if(end == path.size() || path[end] == '/')
+			{
+				return false;
+			}
+		}
+	case GlobToken::token_anything:
+		for(string::size_type end = position; end <= path.size(); end++)
+		{
+			if(GlobMatchesFrom(glob, tokenIndex + 1, path, end))
+			{
+				return true;
+			}
+		}
+		return false;
+	default: // token_any_directories
+		if(GlobMatchesFrom(glob, tokenIndex + 1, path, position))
+		{
+			return true;
+		}
+		for(string::size_type slash = path.find('/', position); slash != string::npos; slash = path.find('/', slash + 1))
+		{
+			if(GlobMatchesFrom(glob, tokenIndex + 1, path, slash + 1))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+const PatchRule* PatchRules::Match(const string& path, OggPageIndex* pageIndex, bool quickCheck,
+	double knownReportedLength, LengthLookup& lookupOut) const
+{
+	string normalizedPath = NormalizePath(path);
+	double reportedLength = knownReportedLength;
+	lookupOut = reportedLength >= 0 ? lookup_full : lookup_none;
+	bool haveUpperBound = false;
+	double upperBound = -1;
+
+	for(vector<CompiledRule>::size_type ruleIndex = 0; ruleIndex < m_rules.size(); ruleIndex++)
+	{
+		const CompiledRule& compiled = m_rules[ruleIndex];
+		if(!GlobMatches(compiled.glob, normalizedPath))
+		{
+			continue;
+		}
+
+		const LengthPredicate& condition = compiled.rule.reportedLength;
+		if(condition.IsAny())
+		{
+			return &compiled.rule;
+		}
+
+		if(reportedLength < 0 && quickCheck)
+		{
+			if(!haveUpperBound)
+			{
+				upperBound = GetReportedTimeUpperBound(path.c_str());
+				haveUpperBound = true;
+				lookupOut = lookup_quick;
+			}
+			if(upperBound >= 0 && condition.RuledOutByUpperBound(upperBound))
+			{
+				continue;
+			}
+		}
+
+		if(reportedLength < 0)
+		{
+			reportedLength = pageIndex != NULL ? GetReportedTime(path.c_str(), *pageIndex)
+				: GetReportedTime(path.c_str());
+			lookupOut = lookup_full;
+		}
+		if(condition.Matches(reportedLength))
+		{
+			return &compiled.rule;
+		}
+	}
+	return NULL;
+}
+
+bool PatchRules::MayUnpatch(const string& path) const
+{
+	string normalizedPath = NormalizePath(path);
+	for(vector<CompiledRule>::size_type ruleIndex = 0; ruleIndex < m_rules.size(); ruleIndex++)
+	{
+		const CompiledRule& compiled = m_rules[ruleIndex];
+		if(!GlobMatches(compiled.glob, normalizedPath))
+		{
+			continue;
+		}
+		if(compiled.rule.action == action_unpatch)
+		{
+			return true;
+		}
+		if(compiled.rule.reportedLength.IsAny())
+		{
+			return false;
+		}
+	}
+	return false;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
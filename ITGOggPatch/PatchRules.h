@@ -0,0 +1,174 @@
+#ifndef __PATCH_RULES_H__
+#define __PATCH_RULES_H__
+
+#include <string>
+#include <vector>
+#include "Manifest.h"
+#include "oggpageindex.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// A condition on a length in seconds
+struct LengthPredicate
+{
+	enum Comparison
+	{
+		compare_any, // Any length, without having to know it
+		compare_less,
+		compare_less_equal,
+		compare_equal, // Within .01 seconds, like --unpatch's condition
+		compare_greater_equal,
+		compare_greater
+	};
+
+	Comparison comparison;
+	double seconds;
+
+	LengthPredicate() : comparison(compare_any), seconds(0)
+	{
+	}
+
+	bool IsAny() const { return comparison == compare_any; }
+	bool Matches(double length) const;
+
+	// Returns true if no length at or below upperBound could match, so a file whose reported length is known to be
+	// at most upperBound doesn't have to be opened properly.
+	bool RuledOutByUpperBound(double upperBound) const;
+
+	std::string ToString() const;
+
+	// Parses "any", or a comparison and a number of seconds like ">120", "<=90", or "=105". Returns false if the
+	// text isn't one.
+	static bool Parse(const std::string& text, LengthPredicate& predicateOut);
+};
+
+// What a rule does to the files it matches
+enum RuleAction
+{
+	action_patch, // Patch to the rule's target
+	action_unpatch, // Patch to the real length, if the real length matches the rule's real length predicate
+	action_skip // Leave alone
+};
+
+// One line of a rules file
+struct PatchRule
+{
+	std::string glob; // As written in the rules file
+	LengthPredicate reportedLength;
+	RuleAction action;
+	PatchTarget target; // For action_patch
+	LengthPredicate realLength; // For action_unpatch
+	unsigned long lineNumber;
+
+	PatchRule() : glob(), reportedLength(), action(action_skip), target(), realLength(), lineNumber(0)
+	{
+	}
+};
+
+// How much of a file PatchRules::Match() had to read to find its rule
+enum LengthLookup
+{
+	lookup_none, // Only the path was needed
+	lookup_quick, // Only the first and last pages were read, by GetReportedTimeUpperBound()
+	lookup_full // The reported length was read properly
+};
+
+// An ordered list of rules that say what to do with each file based on its path and reported length, loaded from a
+// rules file. The first rule a file matches decides what happens to it, and a file that matches no rule is skipped.
+// Each file's reported length is read at most once however many rules there are, and not at all if the rules that
+// match its path don't need it.
+//
+// Each non-empty line of a rules file that doesn't start with # is a rule written as
+//     glob reported-length action [target]
+// separated by spaces or tabs. The glob is matched against the file's path without regard to case, with backslashes
+// taken as slashes. * matches anything but a slash, ** matches anything, and ? matches one character other than a
+// slash. A glob matches if it matches the whole path or the end of it starting after a slash, so "*.ogg" matches every
+// .ogg file and "Pack/**" matches everything in any directory named Pack. A glob with spaces in it can be written in
+// double quotes. The reported length is "any" or a comparison like ">120", "<=90", or "=105". The action is patch,
+// unpatch, or skip. patch takes the length to patch to, in seconds or as a number followed by "samples", and defaults
+// to 105. unpatch can take a condition on the real length that has to be met too, like "<120".
+class PatchRules
+{
+private:
+	struct GlobToken
+	{
+		enum Type
+		{
+			token_text,
+			token_one_character, // ?
+			token_within_directory, // *
+			token_anything, // **
+			token_any_directories // **/ - nothing, or anything ending in a slash
+		};
+
+		Type type;
+		std::string text; // For token_text
+
+		GlobToken(Type type_, const std::string& text_) : type(type_), text(text_)
+		{
+		}
+	};
+
+	struct CompiledRule
+	{
+		PatchRule rule;
+		std::vector<GlobToken> glob;
+
+		CompiledRule() : rule(), glob()
+		{
+		}
+	};
+
+	std::vector<CompiledRule> m_rules;
+	std::string m_fingerprint;
+
+	static std::vector<GlobToken> CompileGlob(const std::string& glob);
+	static std::string NormalizePath(const std::string& path);
+	static bool GlobMatches(const std::vector<GlobToken>& glob, const std::string& normalizedPath);
+	static bool GlobMatchesFrom(const std::vector<GlobToken>& glob, std::vector<GlobToken>::size_type tokenIndex,
+		const std::string& path, std::string::size_type position);
+	static PatchRule ParseRule(const std::string& line, unsigned long lineNumber);
+
+public:
+	// Reads a rules file. Throws lhcutilities::IoError if it can't be read or has a bad line.
+	explicit PatchRules(const std::string& rulesPath);
+
+	// Finds the first rule that matches a file, or returns NULL if none do. knownReportedLength is the file's
+	// reported length if the caller already read it, or negative if not. Otherwise it is read only if a rule whose
+	// glob matches needs it, from pageIndex if that isn't NULL, after trying GetReportedTimeUpperBound() if
+	// quickCheck is true. lookupOut is set to how much of the file was read.
+	// Can throw ogglength::OggVorbisError if the file can't be read. Safe to call from several threads at once.
+	const PatchRule* Match(const std::string& path, ogglength::OggPageIndex* pageIndex, bool quickCheck,
+		double knownReportedLength, LengthLookup& lookupOut) const;
+
+	// Guesses whether a file will be unpatched, which means decoding it, without reading it. True if a rule whose
+	// glob matches the file unpatches, unless an earlier rule that matches any length decides it first.
+	bool MayUnpatch(const std::string& path) const;
+
+	// Gets a short string that is different for rules files that could decide differently.
+	const std::string& Fingerprint() const { return m_fingerprint; }
+
+	size_t NumRules() const { return m_rules.size(); }
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,256 @@
+#include "stdafx.h"
+#include "PatchSummary.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/lexical_cast.hpp>
+#include "utilities.h"
+#include "flatjson.h"
+
+using namespace std;
+using namespace lhcutilities;
+
+namespace oggpatcher
+{
+
+void PatchSummary::Add(FileOutcome outcome)
+{
+	if(outcome == outcome_patched)
+	{
+		numPatched++;
+	}
+	else if(outcome == outcome_skipped_quick_check)
+	{
+		numQuickCheckSkips++;
+	}
+	else if(outcome == outcome_skipped_condition)
+	{
+		numConditionSkips++;
+	}
+	else if(outcome == outcome_skipped_compressed)
+	{
+		numCompressedSkips++;
+	}
+	else
+	{
+		throw std::runtime_error("Oops, missed a file outcome.");
+	}
+}
+
+void PatchSummary::Merge(const PatchSummary& other)
+{
+	numPatched += other.numPatched;
+	numQuickCheckSkips += other.numQuickCheckSkips;
+	numConditionSkips += other.numConditionSkips;
+	numCompressedSkips += other.numCompressedSkips;
+	numErrors += other.numErrors;
+	numResumed += other.numResumed;
+	numPending += other.numPending;
+}
+
+string OutcomeToString(FileOutcome outcome)
+{
+	if(outcome == outcome_patched)
+	{
+		return "patched";
+	}
+	else if(outcome == outcome_skipped_quick_check)
+	{
+		return "quick-skipped";
+	}
+	else if(outcome == outcome_skipped_compressed)
+	{
+		return "compressed-skipped";
+	}
+	else
+	{
+		return "skipped";
+	}
+}
+
+bool StringToOutcome(const string& outcomeString, FileOutcome& outcomeOut)
+{
+	if(outcomeString == "patched")
+	{
+		outcomeOut = outcome_patched;
+	}
+	else if(outcomeString == "quick-skipped")
+	{
+		outcomeOut = outcome_skipped_quick_check;
+	}
+	else if(outcomeString == "skipped")
+	{
+		outcomeOut = outcome_skipped_condition;
+	}
+	else if(outcomeString == "compressed-skipped")
+	{
+		outcomeOut = outcome_skipped_compressed;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+void PatchSummary::Print(ostream& output) const
+{
+	output << "Patched " << numPatched << " files. Skipped " << numQuickCheckSkips + numConditionSkips + numCompressedSkips
+		<< " files (" << numQuickCheckSkips << " from a quick look at their first and last pages, " << numConditionSkips
+		<< " after checking their length fully";
+	if(numCompressedSkips > 0)
+	{
+		output << ", " << numCompressedSkips << " because they are compressed in a zip file";
+	}
+	output << "). " << numErrors << " errors." << endl;
+	if(numResumed > 0)
+	{
+		output << numResumed << " of those files were done in an earlier run." << endl;
+	}
+	if(numPending > 0)
+	{
+		output << "Ran out of time. " << numPending << " files were left for the next run." << endl;
+	}
+}
+
+namespace
+{
+
+unsigned long GetCount(const map<string, JsonValue>& fields, const string& name)
+{
+	map<string, JsonValue>::const_iterator fieldIt = fields.find(name);
+	if(fieldIt == fields.end())
+	{
+		throw invalid_argument("Missing " + name + ".");
+	}
+	double count = fieldIt->second.AsNumber();
+	if(count < 0)
+	{
+		throw invalid_argument(name + " is negative.");
+	}
+	return static_cast<unsigned long>(count);
+}
+
+} // end anonymous namespace
+
+void SavePatchSummary(const string& summaryPath, const PatchSummary& summary, const ShardSpec& shard)
+{
+	ostringstream json;
+	json << "{\"shard\":" << JsonQuote(shard.ToString()) << ",\"patched\":" << summary.numPatched
+		<< ",\"quick_check_skips\":" << summary.numQuickCheckSkips << ",\"condition_skips\":"
+		<< summary.numConditionSkips << ",\"compressed_skips\":" << summary.numCompressedSkips << ",\"errors\":"
+		<< summary.numErrors << ",\"resumed\":" << summary.numResumed << ",\"pending\":" << summary.numPending << "}\n";
+	string jsonString = json.str();
+
+	// Write to a temporary file and rename it over the old summary so that whatever is merging the summaries
+	// never sees half of one.
+	ReplaceFileContentsOrDie(summaryPath.c_str(), vector<unsigned char>(jsonString.begin(), jsonString.end()));
+}
+
+PatchSummary LoadPatchSummary(const string& summaryPath, ShardSpec& shardOut)
+{
+	ifstream summaryFile(summaryPath.c_str());
+	if(!summaryFile)
+	{
+		throw IoError("Could not open the summary file.");
+	}
+	string line;
+	getline(summaryFile, line);
+
+	PatchSummary summary;
+	try
+	{
+		map<string, JsonValue> fields = ParseFlatJsonObject(line);
+		map<string, JsonValue>::const_iterator shardIt = fields.find("shard");
+		if(shardIt == fields.end() || shardIt->second.type != JsonValue::json_string)
+		{
+			throw invalid_argument("Missing shard.");
+		}
+		shardOut = ShardSpec::Parse(shardIt->second.text);
+		summary.numPatched = GetCount(fields, "patched");
+		summary.numQuickCheckSkips = GetCount(fields, "quick_check_skips");
+		summary.numConditionSkips = GetCount(fields, "condition_skips");
+		if(fields.count("compressed_skips") > 0) // Not in summaries from before zip files could be patched
+		{
+			summary.numCompressedSkips = GetCount(fields, "compressed_skips");
+		}
+		summary.numErrors = GetCount(fields, "errors");
+		summary.numResumed = GetCount(fields, "resumed");
+		summary.numPending = GetCount(fields, "pending");
+	}
+	catch(invalid_argument& ex)
+	{
+		throw IoError(string("This is not a summary file. ") + ex.what());
+	}
+	return summary;
+}
+
+bool MergePatchSummaryFiles(const vector<string>& summaryPaths, ostream& output)
+{
+	bool ok = true;
+	PatchSummary merged;
+	unsigned int shardCount = 0;
+	map<unsigned int, unsigned int> timesSeen; // shard index -> number of summaries for it
+	for(vector<string>::size_type pathIndex = 0; pathIndex < summaryPaths.size(); pathIndex++)
+	{
+		const string& path = summaryPaths[pathIndex];
+		try
+		{
+			ShardSpec shard;
+			PatchSummary summary = LoadPatchSummary(path, shard);
+			if(shardCount != 0 && shard.count != shardCount)
+			{
+				throw IoError("This summary is for shard " + shard.ToString() + " but others are out of "
+					+ boost::lexical_cast<string>(shardCount) + ".");
+			}
+			shardCount = shard.count;
+			timesSeen[shard.index]++;
+			merged.Merge(summary);
+		}
+		catch(IoError& ex)
+		{
+			output << path << "   - " << ex.what() << endl;
+			ok = false;
+		}
+	}
+
+	for(unsigned int shardIndex = 1; shardIndex <= shardCount; shardIndex++)
+	{
+		if(timesSeen[shardIndex] == 0)
+		{
+			output << "Shard " << ShardSpec(shardIndex, shardCount).ToString() << " is missing." << endl;
+			ok = false;
+		}
+		else if(timesSeen[shardIndex] > 1)
+		{
+			output << "Shard " << ShardSpec(shardIndex, shardCount).ToString() << " was given "
+				<< timesSeen[shardIndex] << " times." << endl;
+			ok = false;
+		}
+	}
+
+	merged.Print(output);
+	return ok;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,85 @@
+#ifndef __PATCH_SUMMARY_H__
+#define __PATCH_SUMMARY_H__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Shard.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// What happened to a file the patcher looked at
+enum FileOutcome
+{
+	outcome_patched, // The file's length was changed
+	outcome_skipped_quick_check, // Skipped because a look at its first and last pages ruled it out
+	outcome_skipped_condition, // Skipped because its length did not meet the length condition
+	outcome_skipped_compressed // Skipped because it is compressed or encrypted inside a zip file
+};
+
+// Gets the name an outcome is saved as in checkpoint logs and snapshots, like "quick-skipped".
+std::string OutcomeToString(FileOutcome outcome);
+
+// Parses a name written by OutcomeToString(). Returns false if it isn't one.
+bool StringToOutcome(const std::string& outcomeString, FileOutcome& outcomeOut);
+
+// Counts of what happened during a patcher run
+struct PatchSummary
+{
+	unsigned long numPatched;
+	unsigned long numQuickCheckSkips;
+	unsigned long numConditionSkips;
+	unsigned long numCompressedSkips;
+	unsigned long numErrors;
+	unsigned long numResumed; // Files done in an earlier run. These are also counted by their outcome.
+	unsigned long numPending; // Files left for the next run because the time budget ran out
+
+	PatchSummary() : numPatched(0), numQuickCheckSkips(0), numConditionSkips(0), numCompressedSkips(0), numErrors(0),
+		numResumed(0), numPending(0)
+	{
+	}
+
+	// Counts a file with the given outcome
+	void Add(FileOutcome outcome);
+
+	// Adds the counts from another run, such as another shard of the same library.
+	void Merge(const PatchSummary& other);
+
+	// Prints the summary for people to read
+	void Print(std::ostream& output) const;
+};
+
+// Writes a summary file for the given shard of a run, as a line of JSON.
+// Throws lhcutilities::IoError if the file can't be written.
+void SavePatchSummary(const std::string& summaryPath, const PatchSummary& summary, const ShardSpec& shard);
+
+// Reads a summary file written by SavePatchSummary(). Throws lhcutilities::IoError if the file can't be read or
+// isn't a summary file.
+PatchSummary LoadPatchSummary(const std::string& summaryPath, ShardSpec& shardOut);
+
+// Reads the summary files written by the shards of a run and prints their combined summary. Also prints which
+// shards are missing or were given more than once. Returns false if any summary file couldn't be read or the
+// shards don't add up to exactly one whole library.
+bool MergePatchSummaryFiles(const std::vector<std::string>& summaryPaths, std::ostream& output);
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
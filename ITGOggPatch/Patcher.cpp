@@ -3,129 +3,1706 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <utility>
+#include <boost/cstdint.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
 #include "utilities.h"
 #include "ogglength.h"
+#include "oggio.h"
+#include "oggzip.h"
+#include "lowimpact.h"
+#include "filecopy.h"
+#include "workqueue.h"
+#include "workerlimit.h"
+#include "ConcurrencyController.h"
 
 using namespace std;
 using namespace lhcutilities;
 using namespace ogglength;
 namespace fs = boost::filesystem;
+namespace pt = boost::posix_time;
 
 
 namespace oggpatcher
 {
 
+namespace
+{
+
+// Installs an ogglength I/O backend for as long as it is in scope, then puts back the one that was there before.
+class ScopedIoBackend
+{
+private:
+	IoBackend* m_previousBackend;
+
+	// Not copyable
+	ScopedIoBackend(const ScopedIoBackend&);
+	ScopedIoBackend& operator=(const ScopedIoBackend&);
+
+public:
+	explicit ScopedIoBackend(IoBackend* backend) : m_previousBackend(GetIoBackend())
+	{
+		SetIoBackend(backend);
+	}
+
+	~ScopedIoBackend()
+	{
+		SetIoBackend(m_previousBackend);
+	}
+};
+
+// Prints the problems ogglength works around, like junk between Ogg pages, for as long as it is in scope.
+class ScopedWarningPrinter : public WarningListener
+{
+private:
+	boost::mutex m_mutex; // Worker threads can warn at the same time
+
+	// Not copyable
+	ScopedWarningPrinter(const ScopedWarningPrinter&);
+	ScopedWarningPrinter& operator=(const ScopedWarningPrinter&);
+
+public:
+	ScopedWarningPrinter() : m_mutex()
+	{
+		SetWarningListener(this);
+	}
+
+	~ScopedWarningPrinter()
+	{
+		SetWarningListener(NULL);
+	}
+
+	void Warn(const char* filePath, const string& message)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		cout << filePath << "   - Warning: " << message << endl;
+	}
+};
+
+// Keeps track of how much of a --time-budget is left and how fast files decode, to tell whether there is time to
+// start on another file. Once a file is started it is finished, so a file is only started if it should be done
+// before the deadline.
+class TimeBudget
+{
+private:
+	bool m_limited;
+	pt::ptime m_deadline;
+	double m_decodeSeconds; // Time spent on files that were decoded so far
+	boost::uint64_t m_decodeBytes; // Size of the files that were decoded so far
+
+public:
+	// A budget of seconds starting at start, or no limit if seconds is 0.
+	TimeBudget(double seconds, const pt::ptime& start) : m_limited(seconds > 0),
+		m_deadline(start + pt::microseconds(static_cast<boost::int64_t>(seconds * 1000000))), m_decodeSeconds(0),
+		m_decodeBytes(0)
+	{
+	}
+
+	bool Limited() const { return m_limited; }
+
+	// Returns true if there is time to start on a file. If the file has to be decoded, the time it will take is
+	// guessed from its size and how fast files have decoded so far.
+	bool HaveTimeFor(bool decode, boost::uint64_t fileSize) const
+	{
+		if(!m_limited)
+		{
+			return true;
+		}
+
+		pt::ptime finish = pt::microsec_clock::universal_time();
+		if(decode && m_decodeBytes > 0)
+		{
+			finish += pt::microseconds(static_cast<boost::int64_t>(
+				m_decodeSeconds * 1000000 * static_cast<double>(fileSize) / m_decodeBytes));
+		}
+		return finish < m_deadline;
+	}
+
+	// Records how long a file of the given size took to decode.
+	void RecordDecode(double seconds, boost::uint64_t fileSize)
+	{
+		m_decodeSeconds += seconds;
+		m_decodeBytes += fileSize;
+	}
+};
+
+// Returns true if path is directory or something under it. Both must be absolute.
+bool IsInDirectory(const fs::path& path, const fs::path& directory)
+{
+	fs::path::iterator pathIt = path.begin();
+	for(fs::path::iterator directoryIt = directory.begin(); directoryIt != directory.end(); ++directoryIt)
+	{
+		if(*directoryIt == "." || directoryIt->empty())
+		{
+			continue; // From a trailing slash
+		}
+		if(pathIt == path.end() || *pathIt != *directoryIt)
+		{
+			return false;
+		}
+		++pathIt;
+	}
+	return true;
+}
+
+// Gets the size of the file, or 0 if it can't be found out. Only for guesses.
+boost::uint64_t FileSizeOrZero(const string& path)
+{
+	try
+	{
+		return fs::file_size(path);
+	}
+	catch(boost::system::system_error&)
+	{
+		return 0;
+	}
+}
+
+// Gets the number of seconds from start until now.
+double SecondsSince(const pt::ptime& start)
+{
+	return static_cast<double>((pt::microsec_clock::universal_time() - start).total_microseconds()) / 1000000;
+}
+
+} // end anonymous namespace
+
+const vector<Patcher::PatchCandidate>::size_type Patcher::s_sweepBatchSize = 64;
+const unsigned int Patcher::s_fileEndReadSize = 65536;
+
+struct Patcher::WorkerJob
+{
+	PatchCandidate candidate;
+	bool readInfo; // Read the file's headers for the catalog while checking it
+	bool decode; // Get the file's real length if it meets the conditions. Decided by the rule instead if there is one.
+	CatalogEntry catalogEntry;
+	FileCheck check;
+	const PatchRule* rule; // The rule the file matched, if going by rules
+	double realLength; // -1 if the file wasn't decoded
+	double checkSeconds;
+	double decodeSeconds; // 0 if the file wasn't decoded
+	boost::shared_ptr<std::exception> error; // What went wrong with the file. NULL if nothing did.
+
+	WorkerJob(const PatchCandidate& candidate_, bool readInfo_, bool decode_) : candidate(candidate_),
+		readInfo(readInfo_), decode(decode_), catalogEntry(candidate_.path), check(check_failed), rule(NULL), realLength(-1),
+		checkSeconds(0), decodeSeconds(0), error()
+	{
+	}
+
+private:
+	// Not copyable
+	WorkerJob(const WorkerJob&);
+	WorkerJob& operator=(const WorkerJob&);
+};
+
+// Checks files on I/O worker threads and decodes the ones that need it on decode worker threads, then hands them back
+// to be patched by the thread that submitted them. Threads for the most workers of each stage are started up front and
+// the ConcurrencyController decides how many of them work at a time.
+class Patcher::WorkerPipeline
+{
+private:
+	const PatcherOptions& m_options;
+	const PatchRules* m_rules; // NULL if going by the length condition
+	ConcurrencyController m_controller;
+	WorkQueue<boost::shared_ptr<WorkerJob> > m_ioQueue;
+	WorkQueue<boost::shared_ptr<WorkerJob> > m_decodeQueue;
+	WorkQueue<boost::shared_ptr<WorkerJob> > m_finishedQueue;
+	WorkerLimit m_ioLimit;
+	WorkerLimit m_decodeLimit;
+	boost::thread_group m_threads;
+
+	// Not copyable
+	WorkerPipeline(const WorkerPipeline&);
+	WorkerPipeline& operator=(const WorkerPipeline&);
+
+	void IoWork(unsigned int workerIndex);
+	void DecodeWork(unsigned int workerIndex);
+
+public:
+	WorkerPipeline(const PatcherOptions& options, const PatchRules* rules);
+
+	// Stops the workers. Jobs that haven't been taken with TakeFinished() are dropped.
+	~WorkerPipeline();
+
+	const ConcurrencyController& Controller() const { return m_controller; }
+
+	// Gets how many files should be in the pipeline at once: enough that every worker that could be running has
+	// something to do and something waiting, so the controller can see which stage files are waiting for.
+	size_t Capacity() const
+	{
+		return 2 * (m_controller.Range(stage_io).maxWorkers + m_controller.Range(stage_decode).maxWorkers);
+	}
+
+	void Submit(const boost::shared_ptr<WorkerJob>& job) { m_ioQueue.Push(job); }
+
+	// Waits for a submitted file to be done with.
+	boost::shared_ptr<WorkerJob> TakeFinished();
+
+	// Lets the controller pick new numbers of workers if it's time to. Returns true if they changed.
+	bool Adjust();
+
+	std::string Describe() { return m_controller.Describe(); }
+};
+
+Patcher::WorkerPipeline::WorkerPipeline(const PatcherOptions& options, const PatchRules* rules)
+	: m_options(options), m_rules(rules), m_controller(options.IoWorkers(), options.DecodeWorkers(),
+	static_cast<boost::uint64_t>(options.MaxMemory())), m_ioQueue(), m_decodeQueue(), m_finishedQueue(),
+	m_ioLimit(m_controller.Workers(stage_io)), m_decodeLimit(m_controller.Workers(stage_decode)), m_threads()
+{
+	for(unsigned int workerIndex = 0; workerIndex < m_controller.Range(stage_io).maxWorkers; workerIndex++)
+	{
+		m_threads.create_thread(boost::bind(&WorkerPipeline::IoWork, this, workerIndex));
+	}
+	for(unsigned int workerIndex = 0; workerIndex < m_controller.Range(stage_decode).maxWorkers; workerIndex++)
+	{
+		m_threads.create_thread(boost::bind(&WorkerPipeline::DecodeWork, this, workerIndex));
+	}
+}
+
+Patcher::WorkerPipeline::~WorkerPipeline()
+{
+	m_ioQueue.Close();
+	m_decodeQueue.Close();
+	m_ioLimit.Release();
+	m_decodeLimit.Release();
+	m_threads.join_all();
+}
+
+boost::shared_ptr<Patcher::WorkerJob> Patcher::WorkerPipeline::TakeFinished()
+{
+	boost::shared_ptr<WorkerJob> job;
+	m_finishedQueue.Pop(job);
+	return job;
+}
+
+bool Patcher::WorkerPipeline::Adjust()
+{
+	size_t queueDepths[num_worker_stages];
+	queueDepths[stage_io] = m_ioQueue.Size();
+	queueDepths[stage_decode] = m_decodeQueue.Size();
+	if(!m_controller.Adjust(queueDepths))
+	{
+		return false;
+	}
+	m_ioLimit.Set(m_controller.Workers(stage_io));
+	m_decodeLimit.Set(m_controller.Workers(stage_decode));
+	return true;
+}
+
+void Patcher::WorkerPipeline::IoWork(unsigned int workerIndex)
+{
+	boost::shared_ptr<WorkerJob> job;
+	while(m_ioLimit.WaitForTurn(workerIndex) && m_ioQueue.Pop(job))
+	{
+		pt::ptime start = pt::microsec_clock::universal_time();
+		try
+		{
+			// Checking through the page index walks every page of a file it doesn't know yet, which is much more
+			// reading than a check needs when the workers are there to read files fast. Patching still uses it.
+			job->check = CheckFile(m_options, m_rules, job->candidate.path, NULL, job->readInfo, job->catalogEntry,
+				job->rule);
+			if(job->rule != NULL)
+			{
+				job->decode = job->rule->action == action_unpatch;
+			}
+		}
+		catch(IoError& ex)
+		{
+			job->error.reset(new IoError(ex));
+		}
+		catch(OggVorbisError& ex)
+		{
+			job->error.reset(new OggVorbisError(ex));
+		}
+		catch(boost::system::system_error& ex)
+		{
+			job->error.reset(new boost::system::system_error(ex));
+		}
+		job->checkSeconds = SecondsSince(start);
+		m_controller.Record(stage_io, 0, job->checkSeconds);
+
+		if(!job->error && job->check == check_passed && job->decode)
+		{
+			m_decodeQueue.Push(job);
+		}
+		else
+		{
+			m_finishedQueue.Push(job);
+		}
+	}
+}
+
+void Patcher::WorkerPipeline::DecodeWork(unsigned int workerIndex)
+{
+	boost::shared_ptr<WorkerJob> job;
+	while(m_decodeLimit.WaitForTurn(workerIndex) && m_decodeQueue.Pop(job))
+	{
+		pt::ptime start = pt::microsec_clock::universal_time();
+		try
+		{
+			job->realLength = GetRealTime(job->candidate.path.c_str());
+			job->catalogEntry.realLength = job->realLength;
+		}
+		catch(IoError& ex)
+		{
+			job->error.reset(new IoError(ex));
+		}
+		catch(OggVorbisError& ex)
+		{
+			job->error.reset(new OggVorbisError(ex));
+		}
+		catch(boost::system::system_error& ex)
+		{
+			job->error.reset(new boost::system::system_error(ex));
+		}
+		job->decodeSeconds = SecondsSince(start);
+		m_controller.Record(stage_decode, FileSizeOrZero(job->candidate.path), job->decodeSeconds);
+		m_finishedQueue.Push(job);
+	}
+}
+
 void Patcher::Patch()
 {	
+	// The budget counts from the very start because at boot, time spent finding files is time too.
+	TimeBudget timeBudget(m_options.TimeBudget(), pt::microsec_clock::universal_time());
+
+	if(!m_options.PageIndexPath().empty())
+	{
+		m_pageIndex.reset(new OggPageIndex(m_options.PageIndexPath()));
+	}
+
+	m_summary = PatchSummary();
+	m_zipPacks.clear();
+
+	m_metrics.reset();
+	m_ioCounter.reset();
+	if(!m_options.MetricsPath().empty())
+	{
+		m_metrics.reset(new PatchMetrics(m_options.MetricsPath()));
+		m_ioCounter.reset(new CountingIoBackend(GetIoBackend()));
+	}
+	ScopedIoBackend countIo(m_ioCounter ? m_ioCounter.get() : GetIoBackend());
+	WriteMetrics(false);
+
+	m_perfCounters.reset();
+	if(m_options.PerfCounters())
+	{
+		m_perfCounters.reset(new PhasePerfCounters());
+		if(!m_perfCounters->AnyAvailable())
+		{
+			cout << "Could not open any performance counters (" << m_perfCounters->Error()
+				<< "). Only times will be shown." << endl;
+		}
+		else if(!m_perfCounters->Error().empty())
+		{
+			cout << "Could not open all performance counters (" << m_perfCounters->Error() << ")." << endl;
+		}
+	}
+
+	m_rules.reset();
+	if(!m_options.RulesPath().empty())
+	{
+		try
+		{
+			m_rules.reset(new PatchRules(m_options.RulesPath()));
+		}
+		catch(IoError& ex)
+		{
+			PrintError(m_options.RulesPath(), ex);
+			WriteMetrics(true);
+			return;
+		}
+	}
+
+	if(!m_options.CheckpointPath().empty())
+	{
+		try
+		{
+			m_checkpoint.reset(new CheckpointLog(m_options.CheckpointPath(), m_options.Resume()));
+		}
+		catch(IoError& ex)
+		{
+			// Carrying on without the checkpoint would leave the user thinking they can resume.
+			PrintError(m_options.CheckpointPath(), ex);
+			WriteMetrics(true);
+			return;
+		}
+	}
+
+	if(!m_options.CatalogPath().empty())
+	{
+		try
+		{
+			// When resuming, the files finished before are already in the catalog.
+			m_catalog.reset(new CatalogWriter(m_options.CatalogPath(), m_options.Resume()));
+		}
+		catch(IoError& ex)
+		{
+			PrintError(m_options.CatalogPath(), ex);
+			CloseCheckpoint();
+			WriteMetrics(true);
+			return;
+		}
+	}
+
+	m_snapshot.reset();
+	if(!m_options.SnapshotPath().empty())
+	{
+		m_snapshot.reset(new DirectorySnapshot(m_options.SnapshotPath(), GetDecisionSettings()));
+	}
+
+	StartBackgroundMode();
+	ScopedIoThrottle ioThrottle(m_throttle.get());
+	ScopedWarningPrinter warningPrinter;
+
+	if(!StartOutputDirectory())
+	{
+		CloseCheckpoint();
+		CloseCatalog();
+		WriteMetrics(true);
+		return;
+	}
+
+	// Find everything first so that it can be put in a good order before doing anything to the files.
+	vector<PatchCandidate> candidates;
+	if(!m_options.ManifestPath().empty())
+	{
+		if(!ReadManifestCandidates(candidates))
+		{
+			CloseCheckpoint();
+			CloseCatalog();
+			WriteMetrics(true);
+			return;
+		}
+	}
+	else
+	{
+		FindCandidates(m_options.StartingPaths(), candidates);
+	}
+
+	// When short on time, getting the most important files done comes before getting the most files done.
+	bool diskOrder = m_options.DiskOrder() && !timeBudget.Limited();
+	if(timeBudget.Limited())
+	{
+		SortForTimeBudget(candidates);
+	}
+	else if(diskOrder)
+	{
+		SortByDiskLocation(candidates);
+	}
+
+	// How long each file takes is too hard to guess when working on several at once to fit them into a time budget.
+	bool outOfTime = false;
+	if(m_options.UseWorkers() && !timeBudget.Limited())
+	{
+		PatchWithWorkers(candidates);
+	}
+	else
+	{
+		// Keep the next few files on their way into the OS cache while the current one is worked on, so that each file
+		// doesn't start with a cold read.
+		vector<PatchCandidate>::size_type prefetchCount = m_options.PrefetchCount();
+		for(vector<PatchCandidate>::size_type candidateIndex = 0;
+			candidateIndex < prefetchCount && candidateIndex < candidates.size(); candidateIndex++)
+		{
+			Prefetch(candidates[candidateIndex]);
+		}
+
+		for(vector<PatchCandidate>::size_type candidateIndex = 0; candidateIndex < candidates.size(); candidateIndex++)
+		{
+			if(prefetchCount > 0 && candidateIndex + prefetchCount < candidates.size())
+			{
+				Prefetch(candidates[candidateIndex + prefetchCount]);
+			}
+
+			if(diskOrder && candidateIndex % s_sweepBatchSize == 0)
+			{
+				SweepBatch(candidates, candidateIndex, min(candidateIndex + s_sweepBatchSize, candidates.size()));
+			}
+
+			if(m_throttle)
+			{
+				m_throttle->BeforeFile();
+			}
+
+			// After the throttle, which can wait a while
+			const string& path = candidates[candidateIndex].path;
+			bool decode = timeBudget.Limited() && NeedsDecode(candidates[candidateIndex]);
+			boost::uint64_t fileSize = decode ? FileSizeOrZero(path) : 0;
+			if(!timeBudget.HaveTimeFor(decode, fileSize))
+			{
+				RecordPending(candidates, candidateIndex);
+				outOfTime = true;
+				break;
+			}
+
+			if(m_metrics)
+			{
+				m_metrics->FileSeen();
+			}
+
+			CatalogEntry catalogEntry(path);
+			bool resumed = false;
+			try
+			{
+				FileOutcome outcome;
+				if(m_checkpoint && m_checkpoint->FindFinished(path, outcome))
+				{
+					m_summary.numResumed++;
+					resumed = true;
+				}
+				else
+				{
+					pt::ptime fileStart = pt::microsec_clock::universal_time();
+					outcome = LengthPatchFile(candidates[candidateIndex], catalogEntry);
+					if(decode && outcome == outcome_patched)
+					{
+						timeBudget.RecordDecode(
+							(pt::microsec_clock::universal_time() - fileStart).total_microseconds() / 1000000.0, fileSize);
+					}
+					if(m_checkpoint)
+					{
+						m_checkpoint->Record(path, outcome);
+					}
+				}
+				if(m_snapshot)
+				{
+					m_snapshot->RecordDecision(path, outcome);
+				}
+				m_summary.Add(outcome);
+			}
+			catch(IoError& ex)
+			{
+				PrintError(path, ex);
+				catalogEntry.error = ex.what();
+			}
+			catch(OggVorbisError& ex)
+			{
+				PrintError(path, ex);
+				catalogEntry.error = ex.what();
+			}
+			catch(boost::system::system_error& ex)
+			{
+				PrintError(path, ex);
+				catalogEntry.error = ex.what();
+			}
+
+			if(!resumed)
+			{
+				WriteCatalogEntry(catalogEntry);
+			}
+
+			if(prefetchCount > 0)
+			{
+				// We won't need it again, so don't let it push the game's own files out of the cache.
+				EvictFileFromCache(path.c_str());
+			}
+
+			WriteMetrics(false);
+		}
+	}
+
+	vector<string>::size_type packIndex = 0;
+	for(; packIndex < m_zipPacks.size() && !outOfTime && timeBudget.HaveTimeFor(false, 0); packIndex++)
+	{
+		PatchZipPack(m_zipPacks[packIndex]);
+	}
+	// Zip files aren't in the checkpoint log, so the next run goes through the ones not gotten to from the start.
+	m_summary.numPending += m_zipPacks.size() - packIndex;
+
+	if(m_pageIndex)
+	{
+		try
+		{
+			m_pageIndex->Save();
+		}
+		catch(IoError& ex)
+		{
+			PrintError(m_options.PageIndexPath(), ex);
+		}
+		catch(boost::system::system_error& ex)
+		{
+			PrintError(m_options.PageIndexPath(), ex);
+		}
+	}
+
+	CloseCheckpoint();
+	CloseCatalog();
+	SaveSnapshot();
+	SaveSummary();
+	WriteMetrics(true);
+	PrintCopies();
+	m_summary.Print(cout);
+	if(m_perfCounters)
+	{
+		m_perfCounters->Print(cout);
+	}
+}
+
+// Like the loop in Patch(), but files are checked and decoded on worker threads while this thread patches the ones
+// that are ready and keeps the checkpoint log, catalog, and summary. Files are finished in whatever order they are
+// ready in. The numbers of workers are adjusted as it goes, and printed each time they change so that the best ones
+// for a machine can be found.
+void Patcher::PatchWithWorkers(const vector<PatchCandidate>& candidates)
+{
+	WorkerPipeline pipeline(m_options, m_rules.get());
+	const WorkerRange& decodeRange = pipeline.Controller().Range(stage_decode);
+	if(decodeRange.maxWorkers < m_options.DecodeWorkers().maxWorkers)
+	{
+		cout << "Using at most " << decodeRange.maxWorkers << " decode workers to stay within --max-memory." << endl;
+	}
+	if(m_perfCounters)
+	{
+		cout << "Performance counters only count patching files when checking and decoding them on worker threads."
+			<< endl;
+	}
+	cout << "Starting with " << pipeline.Describe() << "." << endl;
+
+	vector<PatchCandidate>::size_type prefetchCount = m_options.PrefetchCount();
+	for(vector<PatchCandidate>::size_type candidateIndex = 0;
+		candidateIndex < prefetchCount && candidateIndex < candidates.size(); candidateIndex++)
+	{
+		Prefetch(candidates[candidateIndex]);
+	}
+
+	vector<PatchCandidate>::size_type candidateIndex = 0;
+	size_t numInPipeline = 0;
+	while(candidateIndex < candidates.size() || numInPipeline > 0)
+	{
+		if(candidateIndex < candidates.size() && numInPipeline < pipeline.Capacity())
+		{
+			const PatchCandidate& candidate = candidates[candidateIndex];
+			if(prefetchCount > 0 && candidateIndex + prefetchCount < candidates.size())
+			{
+				Prefetch(candidates[candidateIndex + prefetchCount]);
+			}
+			candidateIndex++;
+
+			if(m_throttle)
+			{
+				m_throttle->BeforeFile();
+			}
+
+			if(m_metrics)
+			{
+				m_metrics->FileSeen();
+			}
+
+			FileOutcome outcome;
+			if(m_checkpoint && m_checkpoint->FindFinished(candidate.path, outcome))
+			{
+				m_summary.numResumed++;
+				if(m_snapshot)
+				{
+					m_snapshot->RecordDecision(candidate.path, outcome);
+				}
+				m_summary.Add(outcome);
+				if(prefetchCount > 0)
+				{
+					EvictFileFromCache(candidate.path.c_str());
+				}
+				WriteMetrics(false);
+			}
+			else
+			{
+				pipeline.Submit(boost::shared_ptr<WorkerJob>(
+					new WorkerJob(candidate, m_catalog.get() != NULL, NeedsDecode(candidate))));
+				numInPipeline++;
+			}
+			continue;
+		}
+
+		boost::shared_ptr<WorkerJob> job = pipeline.TakeFinished();
+		numInPipeline--;
+		FinishWorkerJob(*job);
+		if(pipeline.Adjust())
+		{
+			cout << "Now using " << pipeline.Describe() << "." << endl;
+		}
+	}
+
+	cout << "Finished with " << pipeline.Describe() << "." << endl;
+}
+
+// Does the rest of what the loop in Patch() does for a file that came out of the WorkerPipeline.
+void Patcher::FinishWorkerJob(WorkerJob& job)
+{
+	const string& path = job.candidate.path;
+	if(m_metrics)
+	{
+		m_metrics->ObservePhase(phase_condition_check, job.checkSeconds);
+		if(job.realLength >= 0)
+		{
+			m_metrics->ObservePhase(phase_real_length_decode, job.decodeSeconds);
+		}
+	}
+
+	try
+	{
+		if(job.error)
+		{
+			PrintError(path, *job.error);
+			job.catalogEntry.error = job.error->what();
+		}
+		else
+		{
+			FileOutcome outcome = job.check == check_passed
+				? PatchFile(job.candidate, job.rule, job.realLength, job.catalogEntry)
+				: SkipFile(path, job.check);
+			if(m_checkpoint)
+			{
+				m_checkpoint->Record(path, outcome);
+			}
+			if(m_snapshot)
+			{
+				m_snapshot->RecordDecision(path, outcome);
+			}
+			m_summary.Add(outcome);
+		}
+	}
+	catch(IoError& ex)
+	{
+		PrintError(path, ex);
+		job.catalogEntry.error = ex.what();
+	}
+	catch(OggVorbisError& ex)
+	{
+		PrintError(path, ex);
+		job.catalogEntry.error = ex.what();
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(path, ex);
+		job.catalogEntry.error = ex.what();
+	}
+
+	WriteCatalogEntry(job.catalogEntry);
+	if(m_options.PrefetchCount() > 0)
+	{
+		// We won't need it again, so don't let it push the game's own files out of the cache.
+		EvictFileFromCache(path.c_str());
+	}
+	WriteMetrics(false);
+}
+
+// Makes the output directory if there is one. Returns false if it can't be used, in which case nothing should be
+// done.
+bool Patcher::StartOutputDirectory()
+{
+	fill(m_numCopies, m_numCopies + 3, 0);
+	if(m_options.OutputDirectory().empty())
+	{
+		return true;
+	}
+
+	try
+	{
+		// Copying a directory into itself would never end.
+		fs::path outputDirectory = fs::system_complete(m_options.OutputDirectory());
+		for(vector<string>::size_type pathIndex = 0; pathIndex < m_options.StartingPaths().size(); pathIndex++)
+		{
+			if(m_options.ManifestPath().empty()
+				&& IsInDirectory(outputDirectory, fs::system_complete(m_options.StartingPaths()[pathIndex])))
+			{
+				throw IoError("The output directory can't be inside a directory being patched.");
+			}
+		}
+		fs::create_directories(outputDirectory);
+		return true;
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.OutputDirectory(), ex);
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(m_options.OutputDirectory(), ex);
+	}
+	return false;
+}
+
+// Copies the file to relativePath under the output directory and returns the copy's path.
+// Can throw lhcutilities::IoError or boost::system::system_error.
+string Patcher::CopyToOutputDirectory(const string& path, const string& relativePath)
+{
+	fs::path copyPath = fs::path(m_options.OutputDirectory()) / relativePath;
+	fs::create_directories(copyPath.parent_path());
+	FileCopyMethod method = CloneFile(path.c_str(), copyPath.string().c_str());
+	m_numCopies[method]++;
+	if(m_throttle && method != copy_reflink)
+	{
+		// The copy is done by now, but charging for it still keeps the average rate down.
+		m_throttle->BeforeIo(static_cast<size_t>(fs::file_size(copyPath)));
+	}
+	return copyPath.string();
+}
+
+void Patcher::PrintCopies()
+{
+	if(m_options.OutputDirectory().empty())
+	{
+		return;
+	}
+
+	cout << "Copied " << m_numCopies[copy_reflink] + m_numCopies[copy_in_kernel] + m_numCopies[copy_plain]
+		<< " files to " << m_options.OutputDirectory() << " (" << m_numCopies[copy_reflink]
+		<< " sharing data with the originals, " << m_numCopies[copy_in_kernel] << " copied by the kernel, "
+		<< m_numCopies[copy_plain] << " copied normally)." << endl;
+}
+
+void Patcher::SaveSummary()
+{
+	if(m_options.SummaryPath().empty())
+	{
+		return;
+	}
+
+	try
+	{
+		SavePatchSummary(m_options.SummaryPath(), m_summary, m_options.Shard());
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.SummaryPath(), ex);
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(m_options.SummaryPath(), ex);
+	}
+}
+
+// Writes the metrics file if it is time to, or at the end of the run whether it is time or not. If it can't be
+// written, that is reported once and it isn't tried again.
+void Patcher::WriteMetrics(bool finished)
+{
+	if(!m_metrics || (!finished && !m_metrics->RefreshDue()))
+	{
+		return;
+	}
+
+	try
+	{
+		m_metrics->Write(m_summary, m_ioCounter->BytesRead(), m_ioCounter->BytesWritten(), finished);
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.MetricsPath(), ex);
+		m_metrics.reset();
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(m_options.MetricsPath(), ex);
+		m_metrics.reset();
+	}
+}
+
+void Patcher::CloseCheckpoint()
+{
+	if(!m_checkpoint)
+	{
+		return;
+	}
+
+	try
+	{
+		m_checkpoint->Close();
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.CheckpointPath(), ex);
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(m_options.CheckpointPath(), ex);
+	}
+	m_checkpoint.reset();
+}
+
+void Patcher::WriteCatalogEntry(const CatalogEntry& catalogEntry)
+{
+	if(!m_catalog)
+	{
+		return;
+	}
+
+	try
+	{
+		m_catalog->Write(catalogEntry);
+	}
+	catch(IoError& ex)
+	{
+		// Stop writing rather than leave holes in the middle of the catalog.
+		PrintError(m_options.CatalogPath(), ex);
+		m_catalog.reset();
+	}
+}
+
+void Patcher::CloseCatalog()
+{
+	if(!m_catalog)
+	{
+		return;
+	}
+
+	try
+	{
+		m_catalog->Close();
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.CatalogPath(), ex);
+	}
+	m_catalog.reset();
+}
+
+void Patcher::StartBackgroundMode()
+{
+	if(!PinCurrentThreadToCores(m_options.CpuCores()))
+	{
+		cout << "Could not restrict the patcher to the requested CPU cores. Continuing on any core." << endl;
+	}
+
+	if(!m_options.Background())
+	{
+		return;
+	}
+
+	if(!UseIdlePriority())
+	{
+		cout << "Could not lower the patcher's priority completely. Continuing with I/O limits only." << endl;
+	}
+	m_throttle.reset(new BackgroundThrottle(m_options));
+}
+
+// Errors with the starting paths are handled locally by printing an error message.
+void Patcher::FindCandidates(const vector<string>& startingPaths, vector<PatchCandidate>& candidates)
+{
 	// For each path that we were told to patch
-	for(vector<string>::size_type pathIndex = 0; pathIndex < m_options.StartingPaths().size(); pathIndex++)
+	for(vector<string>::size_type pathIndex = 0; pathIndex < startingPaths.size(); pathIndex++)
+	{
+		const string& path = startingPaths[pathIndex];
+		try
+		{
+			if(!fs::exists(path))
+			{
+				throw IoError("No file or directory with this path exists.");
+			}
+			
+			if(fs::is_directory(path) && m_snapshot)
+			{
+				FindSnapshotCandidates(path, "", candidates);
+			}
+			else if(fs::is_directory(path))
+			{
+				FindCandidates(path, "", candidates);
+			}
+			else if(fs::is_regular_file(path))
+			{
+				string relativePath = fs::path(path).filename().string();
+				if(m_options.Shard().Contains(relativePath))
+				{
+					string patchPath = !m_options.OutputDirectory().empty()
+						? CopyToOutputDirectory(path, relativePath) : path;
+					if(m_options.ZipPacks() && boost::iends_with(patchPath, ".zip"))
+					{
+						m_zipPacks.push_back(patchPath);
+					}
+					else
+					{
+						candidates.push_back(PatchCandidate(patchPath));
+					}
+				}
+			}
+			else
+			{
+				throw IoError("This path indicates something that is not a file or a directory.");
+			}
+		}
+		catch(IoError& ex)
+		{
+			// ITG Ogg Patch code can throw IoError. It doesn't throw boost::system::system_error because an error code
+			// must be provided. Although I think I could just use any error code I like...oh well, what's done is done.
+			PrintError(path, ex);
+		}
+		catch(boost::system::system_error& ex)
+		{
+			PrintError(path, ex);
+		}
+	}
+}
+
+// Can throw boost::system::system_error if something goes wrong with the directory specified.
+// Errors with files contained in the directory are handled locally by printing an error message.
+// relativeDirectory is the directory's path relative to the starting path it is under, for sharding.
+void Patcher::FindCandidates(const string& directory, const string& relativeDirectory,
+	vector<PatchCandidate>& candidates)
+{
+	fs::directory_iterator endIt;
+	for(fs::directory_iterator dirIt(directory); dirIt != endIt; ++dirIt)
+	{
+		try
+		{
+			string relativePath = relativeDirectory.empty() ? dirIt->path().filename().string()
+				: relativeDirectory + "/" + dirIt->path().filename().string();
+
+			// Don't recursively search a directory if it is a symlink to avoid infinite recursion.
+			if(fs::is_directory(dirIt->status()) && !fs::is_symlink(dirIt->status()))
+			{
+				FindCandidates(dirIt->path().string(), relativePath, candidates);
+			}
+			else if(fs::is_regular_file(dirIt->status()) && !m_options.OutputDirectory().empty())
+			{
+				// Copy everything so the output directory has complete songs, but only patch the .ogg files.
+				if(m_options.Shard().Contains(relativePath))
+				{
+					string copyPath = CopyToOutputDirectory(dirIt->path().string(), relativePath);
+					if(boost::iends_with(copyPath, ".ogg"))
+					{
+						candidates.push_back(PatchCandidate(copyPath));
+					}
+					else if(m_options.ZipPacks() && boost::iends_with(copyPath, ".zip"))
+					{
+						m_zipPacks.push_back(copyPath);
+					}
+				}
+			}
+			else if(fs::is_regular_file(dirIt->status()) && boost::iends_with(dirIt->path().string(), ".ogg"))
+			{
+				// Files in other shards are dropped here, before anything else looks at them.
+				if(m_options.Shard().Contains(relativePath))
+				{
+					candidates.push_back(PatchCandidate(dirIt->path().string()));
+				}
+			}
+			else if(m_options.ZipPacks() && fs::is_regular_file(dirIt->status())
+				&& boost::iends_with(dirIt->path().string(), ".zip"))
+			{
+				// A pack goes in one shard as a whole.
+				if(m_options.Shard().Contains(relativePath))
+				{
+					m_zipPacks.push_back(dirIt->path().string());
+				}
+			}
+		}
+		catch(IoError& ex)
+		{
+			PrintError(dirIt->path().string(), ex);
+		}
+		catch(boost::system::system_error& ex)
+		{
+			PrintError(dirIt->path().string(), ex);
+		}
+	}
+}
+
+// Like FindCandidates(), but a directory that hasn't changed since the last run isn't read; the subdirectories and
+// files the snapshot recorded for it are used instead. Files that haven't changed since a run decided what to do with
+// them are counted as done in an earlier run instead of becoming candidates.
+// Can throw lhcutilities::IoError or boost::system::system_error if something goes wrong with the directory.
+void Patcher::FindSnapshotCandidates(const string& directory, const string& relativeDirectory,
+	vector<PatchCandidate>& candidates)
+{
+	vector<string> subdirectories;
+	vector<string> fileNames;
+	if(!m_snapshot->FindUnchangedDirectory(directory, subdirectories, fileNames))
 	{
-		const string& path = m_options.StartingPaths()[pathIndex];
-		try
+		// Take the modification time first so that anything added while reading makes the directory look changed
+		// next time.
+		boost::int64_t modificationTime = GetFileIdentityOrDie(directory.c_str()).modificationTime;
+		unsigned long numEntries = 0;
+		fs::directory_iterator endIt;
+		for(fs::directory_iterator dirIt(directory); dirIt != endIt; ++dirIt)
 		{
-			if(!fs::exists(path))
+			numEntries++;
+			try
 			{
-				throw IoError("No file or directory with this path exists.");
+				string name = dirIt->path().filename().string();
+				// Don't recursively search a directory if it is a symlink to avoid infinite recursion.
+				if(fs::is_directory(dirIt->status()) && !fs::is_symlink(dirIt->status()))
+				{
+					subdirectories.push_back(name);
+				}
+				else if(fs::is_regular_file(dirIt->status())
+					&& (boost::iends_with(name, ".ogg") || boost::iends_with(name, ".zip")))
+				{
+					// Zip files are recorded even without --zip-packs so that the snapshot works for runs with it.
+					fileNames.push_back(name);
+				}
 			}
-			
-			if(fs::is_directory(path))
+			catch(boost::system::system_error& ex)
 			{
-				LengthPatchDirectory(path);
+				PrintError(dirIt->path().string(), ex);
 			}
-			else if(fs::is_regular_file(path))
+		}
+		m_snapshot->RecordDirectory(directory, modificationTime, numEntries, subdirectories, fileNames);
+	}
+
+	for(vector<string>::size_type fileIndex = 0; fileIndex < fileNames.size(); fileIndex++)
+	{
+		string path = (fs::path(directory) / fileNames[fileIndex]).string();
+		string relativePath = relativeDirectory.empty() ? fileNames[fileIndex]
+			: relativeDirectory + "/" + fileNames[fileIndex];
+		if(!m_options.Shard().Contains(relativePath))
+		{
+			continue;
+		}
+
+		FileOutcome outcome;
+		if(boost::iends_with(path, ".zip"))
+		{
+			if(m_options.ZipPacks())
 			{
-				LengthPatchFile(path);
+				m_zipPacks.push_back(path);
 			}
-			else
+		}
+		else if(m_snapshot->FindDecision(path, outcome))
+		{
+			if(m_metrics)
 			{
-				throw IoError("This path indicates something that is not a file or a directory.");
+				m_metrics->FileSeen();
 			}
+			m_summary.numResumed++;
+			m_summary.Add(outcome);
 		}
-		catch(IoError& ex)
+		else
 		{
-			// ITG Ogg Patch code can throw IoError. It doesn't throw boost::system::system_error because an error code
-			// must be provided. Although I think I could just use any error code I like...oh well, what's done is done.
-			PrintError(path, ex);
+			candidates.push_back(PatchCandidate(path));
 		}
-		catch(OggVorbisError& ex)
+	}
+
+	for(vector<string>::size_type subdirectoryIndex = 0; subdirectoryIndex < subdirectories.size(); subdirectoryIndex++)
+	{
+		string subdirectory = (fs::path(directory) / subdirectories[subdirectoryIndex]).string();
+		try
 		{
-			PrintError(path, ex);
+			FindSnapshotCandidates(subdirectory, relativeDirectory.empty() ? subdirectories[subdirectoryIndex]
+				: relativeDirectory + "/" + subdirectories[subdirectoryIndex], candidates);
+		}
+		catch(IoError& ex)
+		{
+			PrintError(subdirectory, ex);
 		}
 		catch(boost::system::system_error& ex)
 		{
-			PrintError(path, ex);
+			PrintError(subdirectory, ex);
 		}
 	}
 }
 
-// Can throw boost::system::system_error if something goes wrong with the directory specified.
-// Errors with files contained in the directory are handled locally by printing an error message.
-void Patcher::LengthPatchDirectory(const string& directory)
+// Describes the settings that decide what happens to a file, so that a snapshot's decisions are only used by runs
+// that would decide the same way.
+string Patcher::GetDecisionSettings() const
 {
-	fs::directory_iterator endIt;
-	for(fs::directory_iterator dirIt(directory); dirIt != endIt; ++dirIt)
+	if(m_rules)
 	{
-		try
+		return "rules " + m_rules->Fingerprint();
+	}
+
+	ostringstream settings;
+	if(m_options.PatchingToRealLength())
+	{
+		settings << "unpatch";
+	}
+	else
+	{
+		settings << "patch to " << m_options.TimeInSeconds();
+	}
+
+	if(m_options.LengthConditionType() == condition_equal)
+	{
+		settings << " if equal to " << m_options.LengthCondition();
+	}
+	else if(m_options.LengthConditionType() == condition_greater)
+	{
+		settings << " if greater than " << m_options.LengthCondition();
+	}
+	return settings.str();
+}
+
+void Patcher::SaveSnapshot()
+{
+	if(!m_snapshot)
+	{
+		return;
+	}
+
+	cout << "Read " << m_snapshot->NumDirectoriesRead() << " new or changed directories. "
+		<< m_snapshot->NumDirectoriesUnchanged() << " had not changed since the last run." << endl;
+	try
+	{
+		m_snapshot->Save();
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.SnapshotPath(), ex);
+	}
+	catch(boost::system::system_error& ex)
+	{
+		PrintError(m_options.SnapshotPath(), ex);
+	}
+}
+
+// The manifest says exactly which files to look at, so nothing is searched. Files that don't exist are reported
+// when they are processed. Returns false if the manifest can't be read, in which case nothing should be done.
+bool Patcher::ReadManifestCandidates(vector<PatchCandidate>& candidates)
+{
+	vector<ManifestEntry> entries;
+	try
+	{
+		entries = ReadManifest(m_options.ManifestPath());
+	}
+	catch(IoError& ex)
+	{
+		PrintError(m_options.ManifestPath(), ex);
+		return false;
+	}
+
+	if(m_options.Shard().IsSharded())
+	{
+		// Drop other shards' files before sorting, which has to look at every file.
+		vector<ManifestEntry> shardEntries;
+		for(vector<ManifestEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
 		{
-			// Don't recursively search a directory if it is a symlink to avoid infinite recursion.
-			if(fs::is_directory(dirIt->status()) && !fs::is_symlink(dirIt->status()))
+			if(m_options.Shard().Contains(entries[entryIndex].path))
 			{
-				LengthPatchDirectory(dirIt->path().string());
+				shardEntries.push_back(entries[entryIndex]);
 			}
-			else if(fs::is_regular_file(dirIt->status()) && boost::iends_with(dirIt->path().string(), ".ogg"))
+		}
+		entries.swap(shardEntries);
+	}
+
+	if(!m_options.OutputDirectory().empty())
+	{
+		// There's no tree to mirror, so each file goes where its full path says under the output directory.
+		vector<ManifestEntry> copiedEntries;
+		for(vector<ManifestEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+		{
+			const string& path = entries[entryIndex].path;
+			try
+			{
+				ManifestEntry copiedEntry = entries[entryIndex];
+				copiedEntry.path = CopyToOutputDirectory(path, fs::canonical(path).relative_path().string());
+				copiedEntries.push_back(copiedEntry);
+			}
+			catch(IoError& ex)
 			{
-				LengthPatchFile(dirIt->path().string());
+				PrintError(path, ex);
+			}
+			catch(boost::system::system_error& ex)
+			{
+				PrintError(path, ex);
 			}
 		}
-		catch(IoError& ex)
+		entries.swap(copiedEntries);
+	}
+
+	SortManifestForLocality(entries);
+
+	candidates.reserve(entries.size());
+	for(vector<ManifestEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+	{
+		candidates.push_back(PatchCandidate(entries[entryIndex].path, entries[entryIndex].target));
+	}
+	return true;
+}
+
+// On a spinning disk, going through files in the order they are on the disk instead of directory order turns a
+// run that is mostly seeking into one that is mostly reading.
+void Patcher::SortByDiskLocation(vector<PatchCandidate>& candidates)
+{
+	for(vector<PatchCandidate>::size_type candidateIndex = 0; candidateIndex < candidates.size(); candidateIndex++)
+	{
+		PatchCandidate& candidate = candidates[candidateIndex];
+		try
 		{
-			PrintError(dirIt->path().string(), ex);
+			candidate.location = GetPhysicalLocation(candidate.path.c_str());
 		}
-		catch(OggVorbisError& ex)
+		catch(IoError&)
 		{
-			PrintError(dirIt->path().string(), ex);
+			// Leave it at the default location. Patching it will report the error.
 		}
-		catch(boost::system::system_error& ex)
+	}
+
+	stable_sort(candidates.begin(), candidates.end());
+}
+
+// Boot scripts give a --time-budget. Files that only need their last page patched are done before any that need
+// decoding, since a few decodes could use up the whole budget. Within those, files left over from the last run come
+// first, then the newest files, since those are the ones most likely to be played soon.
+void Patcher::SortForTimeBudget(vector<PatchCandidate>& candidates)
+{
+	// ((needs decoding?, not pending?), (-modification time, candidate index))
+	typedef pair<pair<bool, bool>, pair<boost::int64_t, vector<PatchCandidate>::size_type> > SortKey;
+	vector<SortKey> keys;
+	for(vector<PatchCandidate>::size_type candidateIndex = 0; candidateIndex < candidates.size(); candidateIndex++)
+	{
+		const PatchCandidate& candidate = candidates[candidateIndex];
+		boost::int64_t modificationTime = 0;
+		try
 		{
-			PrintError(dirIt->path().string(), ex);
+			modificationTime = GetFileIdentityOrDie(candidate.path.c_str()).modificationTime;
+		}
+		catch(IoError&)
+		{
+			// Leave it for last. Patching it will report the error.
 		}
+		bool pending = m_checkpoint && m_checkpoint->IsPending(candidate.path);
+		keys.push_back(make_pair(make_pair(NeedsDecode(candidate), !pending),
+			make_pair(-modificationTime, candidateIndex)));
+	}
+
+	sort(keys.begin(), keys.end());
+
+	vector<PatchCandidate> sorted;
+	sorted.reserve(candidates.size());
+	for(vector<SortKey>::size_type keyIndex = 0; keyIndex < keys.size(); keyIndex++)
+	{
+		sorted.push_back(candidates[keys[keyIndex].second.second]);
 	}
+	candidates.swap(sorted);
 }
 
-// Can throw ogglength::OggVorbisError if there was an error patching the file.
-void Patcher::LengthPatchFile(const string& file)
+// Records the files from begin on as pending in the checkpoint log so that the next run does them first.
+void Patcher::RecordPending(const vector<PatchCandidate>& candidates, vector<PatchCandidate>::size_type begin)
+{
+	bool logOk = true;
+	for(vector<PatchCandidate>::size_type candidateIndex = begin; candidateIndex < candidates.size(); candidateIndex++)
+	{
+		const string& path = candidates[candidateIndex].path;
+		FileOutcome outcome;
+		if(m_checkpoint && m_checkpoint->FindFinished(path, outcome))
+		{
+			continue;
+		}
+
+		m_summary.numPending++;
+		if(m_checkpoint && logOk)
+		{
+			try
+			{
+				m_checkpoint->RecordPending(path);
+			}
+			catch(IoError& ex)
+			{
+				PrintError(m_options.CheckpointPath(), ex);
+				logOk = false;
+			}
+		}
+	}
+}
+
+// With rules, this is a guess from the globs until CheckFile has picked the file's rule.
+bool Patcher::NeedsDecode(const PatchCandidate& candidate) const
+{
+	if(m_rules)
+	{
+		return m_rules->MayUnpatch(candidate.path);
+	}
+	return m_options.PatchingToRealLength() && candidate.target.type == target_from_options;
+}
+
+void Patcher::Prefetch(const PatchCandidate& candidate)
+{
+	if(NeedsDecode(candidate))
+	{
+		// Getting the real length decodes the whole file.
+		PrefetchFile(candidate.path.c_str());
+	}
+	else
+	{
+		PrefetchFileEnds(candidate.path.c_str(), s_fileEndReadSize);
+	}
+}
+
+// Checking and patching a file reads its start and its end. Reading those parts of a batch of files in order of
+// where they are on the disk gets them into the OS cache with a single sweep of the disk head instead of
+// jumping between the start and end of each file in turn.
+void Patcher::SweepBatch(const vector<PatchCandidate>& candidates, vector<PatchCandidate>::size_type begin,
+	vector<PatchCandidate>::size_type end)
 {
-	// Skip the file if it does not meet the conditions for processing it.
-	if(m_options.FileMeetsConditions(file))
+	// (physical location, (candidate index, read the end of the file?))
+	vector<pair<boost::uint64_t, pair<vector<PatchCandidate>::size_type, bool> > > reads;
+	for(vector<PatchCandidate>::size_type candidateIndex = begin; candidateIndex < end; candidateIndex++)
+	{
+		const PhysicalLocation& location = candidates[candidateIndex].location;
+		reads.push_back(make_pair(location.head, make_pair(candidateIndex, false)));
+		reads.push_back(make_pair(location.tail, make_pair(candidateIndex, true)));
+	}
+	sort(reads.begin(), reads.end());
+
+	for(vector<pair<boost::uint64_t, pair<vector<PatchCandidate>::size_type, bool> > >::size_type readIndex = 0;
+		readIndex < reads.size(); readIndex++)
 	{
-		double lengthToPatchTo;
-		if(m_options.PatchingToRealLength())
+		const string& path = candidates[reads[readIndex].second.first].path;
+		bool readEnd = reads[readIndex].second.second;
+		if(m_throttle)
+		{
+			m_throttle->BeforeIo(s_fileEndReadSize);
+		}
+		if(!readEnd)
 		{
-			cout << file << "   - " << "getting actual song length..." << endl;
-			lengthToPatchTo = GetRealTime(file.c_str());
+			WarmFileRange(path.c_str(), 0, s_fileEndReadSize);
 		}
 		else
 		{
-			lengthToPatchTo = m_options.TimeInSeconds();
+			try
+			{
+				boost::uint64_t size = fs::file_size(path);
+				boost::uint64_t offset = size > s_fileEndReadSize ? size - s_fileEndReadSize : 0;
+				WarmFileRange(path.c_str(), offset, s_fileEndReadSize);
+			}
+			catch(boost::system::system_error&)
+			{
+				// It's only a hint. Patching the file will report the error.
+			}
+		}
+	}
+}
+
+// Checks whether the file meets the conditions for processing it, or finds the rule for it if rules is not NULL.
+// Doesn't bother opening it properly if a quick look shows it's too short, unless it has to be opened to read its
+// headers for the catalog anyway. When reading the headers, the file is always opened with libvorbisfile, even if the
+// page index knows its length. ruleOut is set to the rule if the check passed because of one, or NULL.
+// Only reads the file, so it is safe to call from several threads at once.
+Patcher::FileCheck Patcher::CheckFile(const PatcherOptions& options, const PatchRules* rules, const string& path,
+	OggPageIndex* pageIndex, bool readInfo, CatalogEntry& catalogEntry, const PatchRule*& ruleOut)
+{
+	ruleOut = NULL;
+	if(rules != NULL)
+	{
+		double reportedLength = -1;
+		if(readInfo)
+		{
+			catalogEntry.reportedLength = GetReportedTime(path.c_str(), catalogEntry.info);
+			catalogEntry.haveInfo = true;
+			reportedLength = catalogEntry.reportedLength;
+		}
+
+		LengthLookup lookup;
+		const PatchRule* rule = rules->Match(path, pageIndex, options.QuickCheck(), reportedLength, lookup);
+		if(rule != NULL && rule->action != action_skip)
+		{
+			ruleOut = rule;
+			return check_passed;
+		}
+		// Only reading the upper bound means every rule whose glob matched was ruled out by it alone.
+		return rule == NULL && lookup == lookup_quick ? check_ruled_out : check_failed;
+	}
+
+	if(!readInfo)
+	{
+		if(options.FileRuledOutByQuickCheck(path))
+		{
+			return check_ruled_out;
+		}
+		return options.FileMeetsConditions(path, pageIndex) ? check_passed : check_failed;
+	}
+
+	catalogEntry.reportedLength = GetReportedTime(path.c_str(), catalogEntry.info);
+	catalogEntry.haveInfo = true;
+	return options.LengthMeetsConditions(catalogEntry.reportedLength) ? check_passed : check_failed;
+}
+
+// Can throw ogglength::OggVorbisError if there was an error patching the file.
+// catalogEntry is filled in with whatever is learned about the file along the way.
+FileOutcome Patcher::LengthPatchFile(const PatchCandidate& candidate, CatalogEntry& catalogEntry)
+{
+	const string& file = candidate.path;
+	FileCheck check;
+	const PatchRule* rule;
+	{
+		ScopedPhaseTimer timer(m_metrics.get(), m_perfCounters.get(), phase_condition_check);
+		check = CheckFile(m_options, m_rules.get(), file, candidate.inZip ? NULL : m_pageIndex.get(),
+			m_catalog.get() != NULL, catalogEntry, rule);
+	}
+
+	if(check != check_passed)
+	{
+		return SkipFile(file, check);
+	}
+
+	double realLength = -1;
+	if(rule != NULL ? rule->action == action_unpatch : NeedsDecode(candidate))
+	{
+		cout << file << "   - " << "getting actual song length..." << endl;
+		ScopedPhaseTimer timer(m_metrics.get(), m_perfCounters.get(), phase_real_length_decode);
+		realLength = GetRealTime(file.c_str());
+		catalogEntry.realLength = realLength;
+	}
+	return PatchFile(candidate, rule, realLength, catalogEntry);
+}
+
+FileOutcome Patcher::SkipFile(const string& path, FileCheck check)
+{
+	// Perhaps we should be more clear to the user about why we are skipping the file.
+	cout << path << "   - " << "skipping." << endl;
+	return check == check_ruled_out ? outcome_skipped_quick_check : outcome_skipped_condition;
+}
+
+// Patches a file that meets the conditions, or that matched rule if it isn't NULL. realLength is the file's real
+// length if it was decoded to get it.
+// Can throw ogglength::OggVorbisError if there was an error patching the file.
+FileOutcome Patcher::PatchFile(const PatchCandidate& candidate, const PatchRule* rule, double realLength,
+	CatalogEntry& catalogEntry)
+{
+	const string& file = candidate.path;
+	OggPageIndex* pageIndex = candidate.inZip ? NULL : m_pageIndex.get(); // The index goes by file identity
+	PatchTarget target = candidate.target;
+	bool toRealLength = m_options.PatchingToRealLength();
+	if(rule != NULL)
+	{
+		target = rule->action == action_patch ? rule->target : PatchTarget();
+		toRealLength = rule->action == action_unpatch;
+		if(toRealLength && !rule->realLength.Matches(realLength))
+		{
+			cout << file << "   - " << "skipping, its real length is " << realLength << " seconds." << endl;
+			return outcome_skipped_condition;
 		}
+	}
 
-		cout << file << "   - " << "patching to " << lengthToPatchTo << " seconds." << endl; // TODO: minutes:second formatting?
-		ChangeSongLength(file.c_str(), lengthToPatchTo);
+	if(target.type == target_samples)
+	{
+		cout << file << "   - " << "patching to " << target.samples << " samples." << endl;
+		{
+			ScopedPhaseTimer timer(m_metrics.get(), m_perfCounters.get(), phase_patch_write);
+			if(pageIndex != NULL)
+			{
+				ChangeSongLengthInSamples(file.c_str(), target.samples, *pageIndex);
+			}
+			else
+			{
+				ChangeSongLengthInSamples(file.c_str(), target.samples);
+			}
+		}
+		if(catalogEntry.haveInfo && catalogEntry.info.sampleRate > 0)
+		{
+			catalogEntry.patchedLength = static_cast<double>(target.samples) / catalogEntry.info.sampleRate;
+		}
 		cout << file << "   - " << "patched." << endl;
+		return outcome_patched;
+	}
+
+	double lengthToPatchTo;
+	if(target.type == target_seconds)
+	{
+		lengthToPatchTo = target.seconds;
+	}
+	else if(toRealLength)
+	{
+		lengthToPatchTo = realLength;
 	}
 	else
 	{
-		// Perhaps we should be more clear to the user about why we are skipping the file.
-		cout << file << "   - " << "skipping." << endl;
+		lengthToPatchTo = m_options.TimeInSeconds();
+	}
+
+	cout << file << "   - " << "patching to " << lengthToPatchTo << " seconds." << endl; // TODO: minutes:second formatting?
+	{
+		ScopedPhaseTimer timer(m_metrics.get(), m_perfCounters.get(), phase_patch_write);
+		if(pageIndex != NULL)
+		{
+			ChangeSongLength(file.c_str(), lengthToPatchTo, *pageIndex);
+		}
+		else
+		{
+			ChangeSongLength(file.c_str(), lengthToPatchTo);
+		}
+	}
+	catalogEntry.patchedLength = lengthToPatchTo;
+	cout << file << "   - " << "patched." << endl;
+	return outcome_patched;
+}
+
+// The .ogg files in a zip file are opened through a ZipIoBackend, so the ogglength functions patch them in place the
+// same as loose files. The page index and checkpoint log go by the identity of real files, so they aren't used.
+void Patcher::PatchZipPack(const string& zipPath)
+{
+	ZipIoBackend zipBackend(GetIoBackend());
+	vector<ZipEntry> entries;
+	try
+	{
+		entries = zipBackend.AddArchive(zipPath);
+	}
+	catch(IoError& ex)
+	{
+		PrintError(zipPath, ex);
+		return;
+	}
+
+	ScopedIoBackend useZipBackend(&zipBackend);
+	for(vector<ZipEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+	{
+		const ZipEntry& entry = entries[entryIndex];
+		if(entry.IsDirectory() || !boost::iends_with(entry.name, ".ogg"))
+		{
+			continue;
+		}
+
+		if(m_throttle)
+		{
+			m_throttle->BeforeFile();
+		}
+
+		if(m_metrics)
+		{
+			m_metrics->FileSeen();
+		}
+
+		PatchCandidate candidate(ZipIoBackend::GetEntryPath(zipPath, entry));
+		candidate.inZip = true;
+		CatalogEntry catalogEntry(candidate.path);
+		try
+		{
+			if(entry.IsEncrypted())
+			{
+				cout << candidate.path << "   - " << "skipping, it is encrypted in the zip file." << endl;
+				m_summary.Add(outcome_skipped_compressed);
+			}
+			else if(!entry.IsStored())
+			{
+				cout << candidate.path << "   - " << "skipping, it is compressed in the zip file." << endl;
+				m_summary.Add(outcome_skipped_compressed);
+			}
+			else
+			{
+				m_summary.Add(LengthPatchFile(candidate, catalogEntry));
+			}
+		}
+		catch(IoError& ex)
+		{
+			PrintError(candidate.path, ex);
+			catalogEntry.error = ex.what();
+		}
+		catch(OggVorbisError& ex)
+		{
+			PrintError(candidate.path, ex);
+			catalogEntry.error = ex.what();
+		}
+		catch(boost::system::system_error& ex)
+		{
+			PrintError(candidate.path, ex);
+			catalogEntry.error = ex.what();
+		}
+
+		WriteCatalogEntry(catalogEntry);
+		WriteMetrics(false);
 	}
 }
 
 void Patcher::PrintError(const string& path, const std::exception& error)
 {
+	m_summary.numErrors++;
+	if(m_metrics)
+	{
+		m_metrics->Error(error);
+	}
 	cout << path << "   - " << error.what() << endl;
 }
 
@@ -2,8 +2,23 @@
 #define __PATCHER_H__
 
 #include <string>
+#include <vector>
 #include <exception>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
 #include "PatcherOptions.h"
+#include "oggpageindex.h"
+#include "diskorder.h"
+#include "BackgroundThrottle.h"
+#include "CheckpointLog.h"
+#include "PatchSummary.h"
+#include "Manifest.h"
+#include "Catalog.h"
+#include "PatchMetrics.h"
+#include "PhasePerfCounters.h"
+#include "DirectorySnapshot.h"
+#include "PatchRules.h"
+#include "oggio.h"
 
 // namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
 namespace oggpatcher
@@ -14,21 +29,109 @@ class Patcher
 {
 private:
 	PatcherOptions m_options;
+	boost::shared_ptr<ogglength::OggPageIndex> m_pageIndex; // NULL if not using a page index
+	boost::shared_ptr<BackgroundThrottle> m_throttle; // NULL if not in background mode
+	boost::shared_ptr<CheckpointLog> m_checkpoint; // NULL if not keeping a checkpoint log
+	boost::shared_ptr<CatalogWriter> m_catalog; // NULL if not writing a catalog
+	boost::shared_ptr<PatchMetrics> m_metrics; // NULL if not writing metrics
+	boost::shared_ptr<ogglength::CountingIoBackend> m_ioCounter; // NULL if not writing metrics
+	boost::shared_ptr<PhasePerfCounters> m_perfCounters; // NULL if not counting
+	boost::shared_ptr<DirectorySnapshot> m_snapshot; // NULL if not keeping a snapshot
+	boost::shared_ptr<PatchRules> m_rules; // NULL if going by the length condition
+	PatchSummary m_summary;
+	std::vector<std::string> m_zipPacks; // Zip files found while searching, patched after everything else
+	unsigned long m_numCopies[3]; // Number of files copied to the output directory, by lhcutilities::FileCopyMethod
 
 public:
 	// Creates a new patcher with the given options.
-	explicit Patcher(const PatcherOptions& options) : m_options(options)
+	explicit Patcher(const PatcherOptions& options) : m_options(options), m_pageIndex(), m_throttle(),
+		m_checkpoint(), m_catalog(), m_metrics(), m_ioCounter(), m_perfCounters(), m_snapshot(), m_rules(), m_summary(),
+		m_zipPacks()
 	{
+		std::fill(m_numCopies, m_numCopies + 3, 0);
 	}
 
 	// Runs the patcher. No exceptions are thrown other than bad_alloc and such.
-	// As such, there's no way to know how many or what types of errors occurred.
-	// Errors are printed to stdout.
+	// Errors are printed to stdout and counted in the summary.
 	void Patch();
 
+	// Gets what happened during the last call to Patch().
+	const PatchSummary& Summary() const { return m_summary; }
+
 private:
-	void LengthPatchDirectory(const std::string& directory);
-	void LengthPatchFile(const std::string& file);
+	// A file found in the starting paths or listed in the manifest that will be looked at
+	struct PatchCandidate
+	{
+		std::string path;
+		PatchTarget target; // From the manifest, if there is one
+		lhcutilities::PhysicalLocation location; // Only filled in when ordering by disk location
+		bool inZip; // Stored in a zip file and opened through an ogglength::ZipIoBackend. Not a file of its own.
+
+		explicit PatchCandidate(const std::string& path_) : path(path_), target(), location(), inZip(false)
+		{
+		}
+
+		PatchCandidate(const std::string& path_, const PatchTarget& target_) : path(path_), target(target_),
+			location(), inZip(false)
+		{
+		}
+
+		bool operator<(const PatchCandidate& other) const { return location < other.location; }
+	};
+
+	// What checking a file against the length conditions found
+	enum FileCheck
+	{
+		check_ruled_out, // Too short, going by a quick look at its first and last pages
+		check_failed, // Doesn't meet the conditions or matched a rule that skips it
+		check_passed // Meets the conditions or matched a rule that patches or unpatches it
+	};
+
+	// A file on its way through a WorkerPipeline. Defined in Patcher.cpp.
+	struct WorkerJob;
+	// Checks and decodes files on worker threads for PatchWithWorkers(). Defined in Patcher.cpp.
+	class WorkerPipeline;
+	friend class WorkerPipeline;
+
+	// Number of files whose first and last blocks are read in one sweep when ordering by disk location
+	static const std::vector<PatchCandidate>::size_type s_sweepBatchSize;
+	// Number of bytes at the start and at the end of a file that checking and patching it reads.
+	// libvorbisfile reads 64 KB chunks.
+	static const unsigned int s_fileEndReadSize;
+
+	void StartBackgroundMode();
+	void FindCandidates(const std::vector<std::string>& startingPaths, std::vector<PatchCandidate>& candidates);
+	void FindCandidates(const std::string& directory, const std::string& relativeDirectory,
+		std::vector<PatchCandidate>& candidates);
+	void FindSnapshotCandidates(const std::string& directory, const std::string& relativeDirectory,
+		std::vector<PatchCandidate>& candidates);
+	std::string GetDecisionSettings() const;
+	void SaveSnapshot();
+	bool ReadManifestCandidates(std::vector<PatchCandidate>& candidates);
+	bool StartOutputDirectory();
+	std::string CopyToOutputDirectory(const std::string& path, const std::string& relativePath);
+	void PrintCopies();
+	void SortByDiskLocation(std::vector<PatchCandidate>& candidates);
+	void SortForTimeBudget(std::vector<PatchCandidate>& candidates);
+	void RecordPending(const std::vector<PatchCandidate>& candidates, std::vector<PatchCandidate>::size_type begin);
+	bool NeedsDecode(const PatchCandidate& candidate) const;
+	void SweepBatch(const std::vector<PatchCandidate>& candidates, std::vector<PatchCandidate>::size_type begin,
+		std::vector<PatchCandidate>::size_type end);
+	void Prefetch(const PatchCandidate& candidate);
+	void CloseCheckpoint();
+	void CloseCatalog();
+	void SaveSummary();
+	void WriteMetrics(bool finished);
+	void WriteCatalogEntry(const CatalogEntry& catalogEntry);
+	void PatchZipPack(const std::string& zipPath);
+	void PatchWithWorkers(const std::vector<PatchCandidate>& candidates);
+	void FinishWorkerJob(WorkerJob& job);
+	static FileCheck CheckFile(const PatcherOptions& options, const PatchRules* rules, const std::string& path,
+		ogglength::OggPageIndex* pageIndex, bool readInfo, CatalogEntry& catalogEntry, const PatchRule*& ruleOut);
+	FileOutcome LengthPatchFile(const PatchCandidate& candidate, CatalogEntry& catalogEntry);
+	FileOutcome SkipFile(const std::string& path, FileCheck check);
+	FileOutcome PatchFile(const PatchCandidate& candidate, const PatchRule* rule, double realLength,
+		CatalogEntry& catalogEntry);
 	void PrintError(const std::string& path, const std::exception& error);
 };
 
@@ -8,6 +8,9 @@
 #include <boost/program_options/variables_map.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
 #include "ogglength.h"
 #include "version.h"
 
@@ -19,6 +22,44 @@ namespace fs = boost::filesystem;
 namespace oggpatcher
 {
 
+// 8 MB/s is far more than patching needs and little enough for a hard disk to keep serving the game.
+const double PatcherOptions::s_defaultMaxBytesPerSecond = 8 * 1024 * 1024;
+const double PatcherOptions::s_defaultMaxIoPressure = 10;
+const unsigned int PatcherOptions::s_defaultPrefetchCount = 4;
+const char* const PatcherOptions::s_defaultClientOp = "reported-length";
+
+double PatcherOptions::DefaultMaxLoad()
+{
+	unsigned int numCores = boost::thread::hardware_concurrency();
+	return numCores > 0 ? numCores : 1;
+}
+
+unsigned int PatcherOptions::DefaultWorkerCount()
+{
+	unsigned int numCores = boost::thread::hardware_concurrency();
+	return numCores > 0 ? numCores : 1;
+}
+
+vector<int> PatcherOptions::ParseCpuCores(const string& coreList)
+{
+	vector<string> coreStrings;
+	boost::split(coreStrings, coreList, boost::is_any_of(","));
+
+	vector<int> cores;
+	for(vector<string>::size_type coreIndex = 0; coreIndex < coreStrings.size(); coreIndex++)
+	{
+		try
+		{
+			cores.push_back(boost::lexical_cast<int>(boost::trim_copy(coreStrings[coreIndex])));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw invalid_argument("--cpus must be a comma-separated list of CPU core numbers, like 0,1.");
+		}
+	}
+	return cores;
+}
+
 bool PatcherOptions::LengthMeetsConditions(double reportedSongLength) const
 {
 	if(m_lengthConditionType == condition_none)
@@ -40,11 +81,11 @@ bool PatcherOptions::LengthMeetsConditions(double reportedSongLength) const
 	}
 }
 
-bool PatcherOptions::FileMeetsConditions(const string& file) const
+bool PatcherOptions::FileMeetsConditions(const string& file, OggPageIndex* pageIndex /* = NULL */) const
 {
 	if(m_lengthConditionType != condition_none)
 	{
-		double reportedLength = GetReportedTime(file.c_str());
+		double reportedLength = pageIndex != NULL ? GetReportedTime(file.c_str(), *pageIndex) : GetReportedTime(file.c_str());
 		return LengthMeetsConditions(reportedLength);
 	}
 	else
@@ -53,6 +94,34 @@ bool PatcherOptions::FileMeetsConditions(const string& file) const
 	}
 }
 
+bool PatcherOptions::FileRuledOutByQuickCheck(const string& file) const
+{
+	if(!m_quickCheck || m_lengthConditionType == condition_none)
+	{
+		return false;
+	}
+
+	double reportedLengthUpperBound = GetReportedTimeUpperBound(file.c_str());
+	if(reportedLengthUpperBound < 0)
+	{
+		return false; // Couldn't tell
+	}
+
+	// The real reported length is at most the upper bound, so these mirror LengthMeetsConditions() from below.
+	if(m_lengthConditionType == condition_equal)
+	{
+		return reportedLengthUpperBound <= m_lengthCondition - .01;
+	}
+	else if(m_lengthConditionType == condition_greater)
+	{
+		return reportedLengthUpperBound <= m_lengthCondition;
+	}
+	else
+	{
+		return false;
+	}
+}
+
 void PatcherOptions::PrintVersion(ostream& output) const
 {
 	output << g_programName << " " << g_programVersionString << endl;
@@ -88,6 +157,40 @@ po::options_description PatcherOptions::GetCmdOptionsForHelp() const
 		("unpatch", "Reverse the length patching process by setting the length of .ogg files to their true length. Files that do not have a reported length of 1:45 are skipped. The unpatching process is significantly slower than the patching process and depends on how long the song is.")
 		("patchall", "Patches all .ogg files found. If patching, this means even files shorter than 2:00 will be patched. If unpatching, even files that do not have a reported length of 1:45 will be processed.")
 		("not-interactive", "Suppresses the requests for user input when starting and finishing.")
+		("page-index", po::value<string>(), "Path of a page index file to use. The index remembers where the pages of each .ogg file are so that later runs can skip straight to the page they need. It is created if it does not exist and updated as files are patched.")
+		("background", "Run at idle priority and limit how fast files are read and written, so the patcher can run while the game is running without making its audio stutter. The limits can be changed with --max-bytes-per-second, --max-files-per-second, --max-load, and --max-io-pressure.")
+		("max-bytes-per-second", po::value<double>(), "With --background, the most bytes per second to read and write. Default: 8388608 (8 MB). 0 means no limit.")
+		("max-files-per-second", po::value<double>(), "With --background, the most files per second to process. Default: no limit.")
+		("max-load", po::value<double>(), "With --background, wait while the system load average is above this. Default: the number of CPU cores. 0 means never wait because of load.")
+		("max-io-pressure", po::value<double>(), "With --background, wait while processes have been stalled on I/O more than this percentage of the time over the last 10 seconds (Linux only). Default: 10. 0 means never wait because of I/O.")
+		("cpus", po::value<string>(), "Comma-separated list of CPU cores to run on, for example 2,3.")
+		("prefetch", po::value<unsigned int>(), "Number of upcoming files to have the operating system read ahead while working on the current file (Linux only). Files are dropped from the operating system's cache when done so they don't push out the game's files. 0 turns this off. Default: 4.")
+		("no-quick-check", "Check every file's length with libvorbisfile instead of first ruling out files that are too short by looking at their first and last pages.")
+		("checkpoint", po::value<string>(), "Path of a file to record finished files in as they are finished, so that an interrupted run can be continued with --resume.")
+		("resume", "Continue an interrupted run by skipping the files that the --checkpoint file says are finished and have not changed since. Without this, the checkpoint file is started over.")
+		("manifest", po::value<string>(), "Instead of searching for .ogg files, process the files listed in this file, or in standard input if it is -. The list can be paths separated by NUL characters, like find -print0 writes, or one path per line. A line can end with a comma and a length to patch that file to, in seconds or as a number followed by \"samples\". Files are processed in order of directory and inode. Files still have to meet the usual length conditions unless --patchall is used.")
+		("catalog", po::value<string>(), "Write a line of JSON for each .ogg file to this file with its title, artist, reported length, real length, sample rate, channels, bitrate, and Vorbis comments, collected from what is read while checking and patching the file. The real length is only known for files that get decoded, as when unpatching. Files skipped with --resume are not added again.")
+		("output-dir", po::value<string>(), "Leave the original files alone and patch copies of them in this directory instead. Everything under the paths to patch is copied, not just .ogg files, so the copy is a complete set of songs. On filesystems that can do it (btrfs, XFS, and others on Linux), the copies share their data with the originals and only the changed pages take up more disk space.")
+		("shard", po::value<string>(), "Only work on one part of the files found, given as index/count, like 2/4, so that several processes or machines can split a library between them. Each file goes in the same shard every time based on its path relative to the path it was found under, or its path as written in the --manifest.")
+		("summary-file", po::value<string>(), "Write the counts of patched, skipped, and failed files to this file when done, so the summaries of all the shards of a library can be combined with --merge-summaries.")
+		("merge-summaries", "Instead of patching, combine the --summary-file files given in place of paths to patch and print the totals. The exit code is 1 if a shard is missing or given twice.")
+		("time-budget", po::value<double>(), "Stop after this many seconds, for running at boot. Files are done newest first, and files that only need patching are done before files that have to be decoded. A file is never left half done. Needs --checkpoint, which records the files that were not gotten to so that the next run does them first; --resume is implied. Overrides --disk-order.")
+		("io", po::value<string>(), "How to read .ogg files: pread reads them a piece at a time, mmap maps them into memory, which saves copying when they are already in the operating system's cache. Default: pread.")
+		("zip-packs", "Also patch the .ogg files inside .zip files found in the paths to patch, in place, without extracting them. Only .ogg files stored in the zip file without compression can be patched; compressed ones are skipped. Zip files are done after all other files, without the --page-index or --checkpoint.")
+		("metrics-file", po::value<string>(), "Write counts of files seen, patched, skipped, and failed, bytes read and written, and how long checking, decoding, and patching files took to this file in the Prometheus text format, for node_exporter's textfile collector. The file is replaced every 15 seconds during the run and when it ends.")
+		("perf-counters", "At the end, print a table of the CPU cycles, instructions, cache misses, branch misses, and context switches spent checking, decoding, and patching files, from the kernel's performance counters (Linux only). Counters the kernel doesn't allow are left out.")
+		("io-workers", po::value<string>(), "Number of files to check the lengths of at once while patching, as a number or as min-max, like 1-4. With a range, the number is adjusted while running to whatever reads files fastest, and each change is printed. Files are checked without the --page-index. Not used with --time-budget. Default: 1.")
+		("decode-workers", po::value<string>(), "Number of files to decode at once while unpatching, as a number or as min-max, like 1-8. With a range, the number is adjusted while running like --io-workers. Default: 1.")
+		("max-memory", po::value<double>(), "The most bytes of memory for the --decode-workers to use between them. Each is counted as 8388608 (8 MB). Default: no limit.")
+		("snapshot", po::value<string>(), "Path of a file to keep a snapshot of the directories searched in, with what was decided about each .ogg file. The next run with the same length settings only reads directories that changed since and only looks at files that changed since, so a run with nothing new to do finishes quickly. Files not looked at are counted as done in an earlier run and not added to the --catalog. Can't be used with --manifest or --output-dir.")
+		("rules", po::value<string>(), "Path of a rules file that says what to do with each file instead of --unpatch and --patchall. Each line is a glob matched against the end of the file's path, a condition on the reported length like >120 or =105 or any, and an action: patch followed by the length to patch to, unpatch optionally followed by a condition on the real length like <120, or skip. The first rule a file matches is used and files that match none are skipped. Each file is read once however many rules there are. Can't be used with --manifest.")
+		("disk-order", "Process files in order of where they are on the disk instead of the order they are found in. This makes patching a lot faster on hard disks but does not help on solid state disks.")
+		("daemon", po::value<string>(), "Instead of patching, stay running and answer reported-length, real-length, scan, and patch requests from other programs on the Unix domain socket at this path. Requests and responses are lines of JSON. Stop it with Ctrl+C or SIGTERM. Lengths are remembered until a file changes.")
+		("verify", "Instead of patching, check that every page of every .ogg file has a good checksum, that no pages are missing, and that the file ends properly, and print where the first bad page of each bad file is. Nothing is changed. The exit code is 1 if any file is bad.")
+		("workers", po::value<unsigned int>(), "With --daemon, the number of requests to work on at once. With --verify, the number of files to check at once; use 1 with --disk-order for a hard disk. Default: the number of CPU cores.")
+		("client", po::value<string>(), "Instead of patching, send a request for each path to the --daemon listening on the Unix domain socket at this path, print the responses, and print how long the daemon took to answer.")
+		("client-op", po::value<string>(), "With --client, what to ask for: reported-length, real-length, scan, or patch. Default: reported-length.")
+		("client-repeat", po::value<unsigned int>(), "With --client, send the requests this many times and only print the first responses, to measure how fast the daemon answers. Default: 1.")
 	;
 
 	return desc;
@@ -95,7 +198,14 @@ po::options_description PatcherOptions::GetCmdOptionsForHelp() const
 
 PatcherOptions::PatcherOptions(int argc, char* argv[]) : m_displayHelp(false), m_displayVersion(false),
 	m_interactive(true), m_patchToRealLength(false), m_timeInSeconds(105),
-	m_lengthConditionType(condition_none), m_lengthCondition(120), m_startingPaths()
+	m_lengthConditionType(condition_none), m_lengthCondition(120), m_startingPaths(), m_manifestPath(),
+	m_pageIndexPath(), m_diskOrder(false), m_background(false), m_maxBytesPerSecond(s_defaultMaxBytesPerSecond),
+	m_maxFilesPerSecond(0), m_maxLoad(DefaultMaxLoad()), m_maxIoPressure(s_defaultMaxIoPressure), m_cpuCores(),
+	m_prefetchCount(s_defaultPrefetchCount), m_quickCheck(true), m_checkpointPath(), m_resume(false),
+	m_daemonSocketPath(), m_workerCount(DefaultWorkerCount()), m_verify(false), m_clientSocketPath(), m_clientOp(s_defaultClientOp),
+	m_clientRepeat(1), m_catalogPath(), m_shard(), m_summaryPath(), m_mergeSummaries(false),
+	m_timeBudget(0), m_outputDirectory(), m_ioMethod(io_pread), m_zipPacks(false), m_metricsPath(), m_perfCounters(false),
+	m_ioWorkers(), m_decodeWorkers(), m_maxMemory(0), m_snapshotPath(), m_rulesPath()
 {
 	po::options_description desc = GetCmdOptions();
 
@@ -109,11 +219,194 @@ PatcherOptions::PatcherOptions(int argc, char* argv[]) : m_displayHelp(false), m
 	DisplayHelp(vm.count("help") > 0);
 	DisplayVersion(vm.count("version") > 0);
 	Interactive(vm.count("not-interactive") == 0);
+	DiskOrder(vm.count("disk-order") > 0);
+	Background(vm.count("background") > 0);
+	QuickCheck(vm.count("no-quick-check") == 0);
+	Resume(vm.count("resume") > 0);
+	Verify(vm.count("verify") > 0);
+	ZipPacks(vm.count("zip-packs") > 0);
+	PerfCounters(vm.count("perf-counters") > 0);
+
+	if(vm.count("time-budget"))
+	{
+		TimeBudget(vm["time-budget"].as<double>());
+		if(!(TimeBudget() > 0))
+		{
+			throw invalid_argument("--time-budget must be more than 0 seconds.");
+		}
+		if(!vm.count("checkpoint"))
+		{
+			throw invalid_argument("--time-budget needs a --checkpoint file to record the files it didn't get to.");
+		}
+		Resume(true);
+	}
+
+	if(vm.count("checkpoint"))
+	{
+		CheckpointPath(vm["checkpoint"].as<string>());
+	}
+	else if(Resume())
+	{
+		throw invalid_argument("--resume needs a --checkpoint file to resume from.");
+	}
+
+	if(vm.count("catalog"))
+	{
+		CatalogPath(vm["catalog"].as<string>());
+	}
+	if(vm.count("metrics-file"))
+	{
+		MetricsPath(vm["metrics-file"].as<string>());
+	}
+	if(vm.count("io-workers"))
+	{
+		IoWorkers(WorkerRange::Parse(vm["io-workers"].as<string>()));
+	}
+	if(vm.count("decode-workers"))
+	{
+		DecodeWorkers(WorkerRange::Parse(vm["decode-workers"].as<string>()));
+	}
+	if(vm.count("max-memory"))
+	{
+		MaxMemory(vm["max-memory"].as<double>());
+		if(!(MaxMemory() >= 0))
+		{
+			throw invalid_argument("--max-memory can't be negative.");
+		}
+	}
+	if(vm.count("output-dir"))
+	{
+		OutputDirectory(vm["output-dir"].as<string>());
+	}
+	if(vm.count("snapshot"))
+	{
+		// A manifest isn't searched, and the output directory needs every file copied every time.
+		if(vm.count("manifest") || vm.count("output-dir"))
+		{
+			throw invalid_argument("--snapshot can't be used with --manifest or --output-dir.");
+		}
+		SnapshotPath(vm["snapshot"].as<string>());
+	}
+	if(vm.count("rules"))
+	{
+		// The manifest's lengths and the conditions of --unpatch and --patchall would fight with the rules.
+		if(vm.count("manifest") || vm.count("unpatch") || vm.count("patchall"))
+		{
+			throw invalid_argument("--rules can't be used with --manifest, --unpatch, or --patchall.");
+		}
+		RulesPath(vm["rules"].as<string>());
+	}
+	if(vm.count("io"))
+	{
+		string ioMethod = vm["io"].as<string>();
+		if(ioMethod == "pread")
+		{
+			IoMethod(io_pread);
+		}
+		else if(ioMethod == "mmap")
+		{
+			IoMethod(io_mmap);
+		}
+		else
+		{
+			throw invalid_argument("--io must be pread or mmap.");
+		}
+	}
+	if(vm.count("shard"))
+	{
+		Shard(ShardSpec::Parse(vm["shard"].as<string>()));
+	}
+	if(vm.count("summary-file"))
+	{
+		SummaryPath(vm["summary-file"].as<string>());
+	}
+	if(vm.count("merge-summaries"))
+	{
+		if(!vm.count("patchpaths"))
+		{
+			throw invalid_argument("--merge-summaries needs the summary files to merge.");
+		}
+		MergeSummaries(true);
+		Interactive(false);
+	}
+
+	if(vm.count("max-bytes-per-second"))
+	{
+		MaxBytesPerSecond(vm["max-bytes-per-second"].as<double>());
+	}
+	if(vm.count("max-files-per-second"))
+	{
+		MaxFilesPerSecond(vm["max-files-per-second"].as<double>());
+	}
+	if(vm.count("max-load"))
+	{
+		MaxLoad(vm["max-load"].as<double>());
+	}
+	if(vm.count("max-io-pressure"))
+	{
+		MaxIoPressure(vm["max-io-pressure"].as<double>());
+	}
+	if(vm.count("prefetch"))
+	{
+		PrefetchCount(vm["prefetch"].as<unsigned int>());
+	}
+	if(vm.count("cpus"))
+	{
+		CpuCores(ParseCpuCores(vm["cpus"].as<string>()));
+	}
+
+	if(vm.count("daemon") && vm.count("client"))
+	{
+		throw invalid_argument("--daemon and --client can't be used together.");
+	}
+	if(vm.count("daemon"))
+	{
+		DaemonSocketPath(vm["daemon"].as<string>());
+		Interactive(false); // Nobody is there to answer
+	}
+	if(vm.count("workers"))
+	{
+		WorkerCount(vm["workers"].as<unsigned int>());
+		if(WorkerCount() == 0)
+		{
+			throw invalid_argument("--workers must be at least 1.");
+		}
+	}
+	if(vm.count("client"))
+	{
+		ClientSocketPath(vm["client"].as<string>());
+		Interactive(false);
+	}
+	if(vm.count("client-op"))
+	{
+		ClientOp(vm["client-op"].as<string>());
+	}
+	if(vm.count("client-repeat"))
+	{
+		ClientRepeat(vm["client-repeat"].as<unsigned int>());
+	}
 
 	bool unpatch = vm.count("unpatch") > 0;
 	bool patchall = vm.count("patchall") > 0;
 
-	if(vm.count("patchpaths"))
+	if(vm.count("page-index"))
+	{
+		PageIndexPath(vm["page-index"].as<string>());
+	}
+
+	if(vm.count("manifest"))
+	{
+		if(vm.count("patchpaths"))
+		{
+			throw invalid_argument("--manifest can't be used together with paths to search.");
+		}
+		ManifestPath(vm["manifest"].as<string>());
+		if(ManifestPath() == "-")
+		{
+			Interactive(false); // Standard input is the manifest, not the user
+		}
+	}
+	else if(vm.count("patchpaths"))
 	{
 		SetStartingPaths(vm["patchpaths"].as<vector<string> >());
 	}
@@ -9,6 +9,9 @@
 #include <boost/program_options/variables_map.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include "oggpageindex.h"
+#include "Shard.h"
+#include "ConcurrencyController.h"
 
 // namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
 namespace oggpatcher
@@ -22,6 +25,13 @@ enum PatcherLengthCondition
 	condition_greater // Process the file if its length is greater than some length
 };
 
+// How .ogg files are read and written
+enum PatcherIoMethod
+{
+	io_pread, // With pread and pwrite
+	io_mmap // Mapped into memory
+};
+
 class PatcherOptions
 {
 private:
@@ -33,6 +43,40 @@ private:
 	PatcherLengthCondition m_lengthConditionType; // The condition type to use when deciding whether to process a file
 	double m_lengthCondition; // The number of seconds corresponding to the condition
 	std::vector<std::string> m_startingPaths;
+	std::string m_manifestPath; // List of files to process instead of searching the starting paths, empty for none
+	std::string m_pageIndexPath; // Empty if not using a page index
+	bool m_diskOrder; // Process files in order of where they are on disk
+	bool m_background; // Run at idle priority and throttle I/O so as not to disturb other programs
+	double m_maxBytesPerSecond; // I/O limit in background mode, 0 for no limit
+	double m_maxFilesPerSecond; // File limit in background mode, 0 for no limit
+	double m_maxLoad; // Back off while the load average is above this in background mode, 0 to ignore
+	double m_maxIoPressure; // Back off while I/O pressure is above this percentage in background mode, 0 to ignore
+	std::vector<int> m_cpuCores; // CPU cores to run on, empty for any
+	unsigned int m_prefetchCount; // Number of upcoming files to prefetch
+	bool m_quickCheck; // Rule out files by their first and last pages before opening them with libvorbisfile
+	std::string m_checkpointPath; // Log of finished files for resuming, empty for none
+	bool m_resume; // Skip files already finished according to the checkpoint log
+	std::string m_daemonSocketPath; // Socket to answer requests on instead of patching, empty for a normal run
+	unsigned int m_workerCount; // Number of requests the daemon or files the verifier works on at once
+	bool m_verify; // Check the pages of every file instead of patching
+	std::string m_clientSocketPath; // Daemon socket to send requests to instead of patching, empty for a normal run
+	std::string m_clientOp; // What to ask the daemon about each starting path
+	unsigned int m_clientRepeat; // Number of times to send each client request
+	std::string m_catalogPath; // File to write a line of JSON about each file to, empty for none
+	ShardSpec m_shard; // The part of the library to work on
+	std::string m_summaryPath; // File to write the summary to for merging with other shards' summaries, empty for none
+	bool m_mergeSummaries; // Combine the summary files given as the starting paths instead of patching
+	double m_timeBudget; // Seconds to stop patching after, 0 for no limit
+	std::string m_outputDirectory; // Directory to patch copies in instead of the originals, empty to patch in place
+	PatcherIoMethod m_ioMethod;
+	bool m_zipPacks; // Also patch the .ogg files stored inside .zip files
+	std::string m_metricsPath; // File to write Prometheus metrics to, empty for none
+	bool m_perfCounters; // Print CPU performance counters for each phase of handling files at the end
+	WorkerRange m_ioWorkers; // Threads checking files while patching
+	WorkerRange m_decodeWorkers; // Threads decoding files while patching
+	double m_maxMemory; // Most bytes for the decode workers to use, 0 for no limit
+	std::string m_snapshotPath; // File to keep the directory snapshot in, empty for none
+	std::string m_rulesPath; // Rules file saying what to do with each file, empty to go by the length condition
 
 	// Get the command-line options object to use for processing command-line args
 	boost::program_options::options_description GetCmdOptions() const;
@@ -40,12 +84,31 @@ private:
 	// Get the command-line options object to use for displaying program usage
 	boost::program_options::options_description GetCmdOptionsForHelp() const;
 
+	static const double s_defaultMaxBytesPerSecond;
+	static const double s_defaultMaxIoPressure;
+	static const unsigned int s_defaultPrefetchCount;
+	static const char* const s_defaultClientOp;
+	// Default number of daemon workers: one per core
+	static unsigned int DefaultWorkerCount();
+	// Default maximum load average for background mode: one runnable task per core
+	static double DefaultMaxLoad();
+	// Parses a comma-separated list of CPU core numbers. Throws std::invalid_argument if it isn't one.
+	static std::vector<int> ParseCpuCores(const std::string& coreList);
+
 public:
 	// Constructs default patcher options - patch to 105 seconds
 	// Might throw boost::system::system_error if the starting CWD couldn't be determined
 	PatcherOptions() : m_displayHelp(false), m_displayVersion(false), m_interactive(true),
 		m_patchToRealLength(false), m_timeInSeconds(105), m_lengthConditionType(condition_none),
-		m_lengthCondition(120), m_startingPaths(1, boost::filesystem::initial_path().string())
+		m_lengthCondition(120), m_startingPaths(1, boost::filesystem::initial_path().string()),
+		m_manifestPath(), m_pageIndexPath(), m_diskOrder(false), m_background(false), m_maxBytesPerSecond(s_defaultMaxBytesPerSecond),
+		m_maxFilesPerSecond(0), m_maxLoad(DefaultMaxLoad()), m_maxIoPressure(s_defaultMaxIoPressure), m_cpuCores(),
+		m_prefetchCount(s_defaultPrefetchCount), m_quickCheck(true),
+		m_checkpointPath(), m_resume(false), m_daemonSocketPath(), m_workerCount(DefaultWorkerCount()),
+		m_verify(false), m_clientSocketPath(), m_clientOp(s_defaultClientOp), m_clientRepeat(1),
+		m_catalogPath(), m_shard(), m_summaryPath(), m_mergeSummaries(false),
+		m_timeBudget(0), m_outputDirectory(), m_ioMethod(io_pread), m_zipPacks(false), m_metricsPath(), m_perfCounters(false),
+		m_ioWorkers(), m_decodeWorkers(), m_maxMemory(0), m_snapshotPath(), m_rulesPath()
 	{
 	}
 
@@ -84,6 +147,128 @@ public:
 	const std::vector<std::string>& StartingPaths() const { return m_startingPaths; }
 	// Gets the paths to patch, allowing modification
 	std::vector<std::string>& StartingPaths() { return m_startingPaths; }
+	// Gets or sets the path of a manifest listing the files to process, and optionally what length to patch each
+	// to, instead of searching the starting paths. "-" means standard input. Empty for no manifest.
+	void ManifestPath(const std::string& manifestPath) { m_manifestPath = manifestPath; }
+	const std::string& ManifestPath() const { return m_manifestPath; }
+	
+	// Gets or sets the path of the page index file to use to speed up repeated runs. Empty for no page index.
+	void PageIndexPath(const std::string& pageIndexPath) { m_pageIndexPath = pageIndexPath; }
+	const std::string& PageIndexPath() const { return m_pageIndexPath; }
+	// Gets or sets the DiskOrder property - whether files are processed in order of where they are on disk rather
+	// than directory order. This speeds things up a lot on spinning disks.
+	void DiskOrder(bool diskOrder) { m_diskOrder = diskOrder; }
+	bool DiskOrder() const { return m_diskOrder; }
+	// Gets or sets the Background property - whether to run at idle priority with throttled I/O so that the
+	// patcher can run alongside the game without making it stutter.
+	void Background(bool background) { m_background = background; }
+	bool Background() const { return m_background; }
+	// Gets or sets the maximum bytes per second of file I/O in background mode. 0 means no limit.
+	void MaxBytesPerSecond(double maxBytesPerSecond) { m_maxBytesPerSecond = maxBytesPerSecond; }
+	double MaxBytesPerSecond() const { return m_maxBytesPerSecond; }
+	// Gets or sets the maximum files per second processed in background mode. 0 means no limit.
+	void MaxFilesPerSecond(double maxFilesPerSecond) { m_maxFilesPerSecond = maxFilesPerSecond; }
+	double MaxFilesPerSecond() const { return m_maxFilesPerSecond; }
+	// Gets or sets the load average above which background mode waits for the system to calm down. 0 to ignore load.
+	void MaxLoad(double maxLoad) { m_maxLoad = maxLoad; }
+	double MaxLoad() const { return m_maxLoad; }
+	// Gets or sets the I/O pressure percentage above which background mode waits for the system to calm down.
+	// 0 to ignore I/O pressure.
+	void MaxIoPressure(double maxIoPressure) { m_maxIoPressure = maxIoPressure; }
+	double MaxIoPressure() const { return m_maxIoPressure; }
+	// Gets or sets the CPU cores the patcher runs on. Empty for any core.
+	void CpuCores(const std::vector<int>& cpuCores) { m_cpuCores = cpuCores; }
+	const std::vector<int>& CpuCores() const { return m_cpuCores; }
+	// Gets or sets the number of upcoming files to ask the OS to read ahead while working on the current one.
+	// Patched files are dropped from the OS cache afterwards when this is not 0.
+	void PrefetchCount(unsigned int prefetchCount) { m_prefetchCount = prefetchCount; }
+	unsigned int PrefetchCount() const { return m_prefetchCount; }
+	// Gets or sets the QuickCheck property - whether to rule out files that are obviously too short by reading only
+	// their first and last pages before checking them properly with libvorbisfile.
+	void QuickCheck(bool quickCheck) { m_quickCheck = quickCheck; }
+	bool QuickCheck() const { return m_quickCheck; }
+	// Gets or sets the path of the checkpoint log that finished files are recorded in. Empty for no checkpoint log.
+	void CheckpointPath(const std::string& checkpointPath) { m_checkpointPath = checkpointPath; }
+	const std::string& CheckpointPath() const { return m_checkpointPath; }
+	// Gets or sets the Resume property - whether files the checkpoint log says are finished should be skipped
+	// instead of starting the checkpoint log over.
+	void Resume(bool resume) { m_resume = resume; }
+	bool Resume() const { return m_resume; }
+	// Gets or sets the path of the Unix domain socket to answer requests on as a daemon instead of patching.
+	// Empty for a normal run.
+	void DaemonSocketPath(const std::string& daemonSocketPath) { m_daemonSocketPath = daemonSocketPath; }
+	const std::string& DaemonSocketPath() const { return m_daemonSocketPath; }
+	// Gets or sets the number of worker threads the daemon answers requests with or the verifier checks files with.
+	void WorkerCount(unsigned int workerCount) { m_workerCount = workerCount; }
+	unsigned int WorkerCount() const { return m_workerCount; }
+	// Gets or sets the Verify property - whether to check every page of every file instead of patching.
+	void Verify(bool verify) { m_verify = verify; }
+	bool Verify() const { return m_verify; }
+	// Gets or sets the path of a daemon's socket to send requests to instead of patching. Empty for a normal run.
+	void ClientSocketPath(const std::string& clientSocketPath) { m_clientSocketPath = clientSocketPath; }
+	const std::string& ClientSocketPath() const { return m_clientSocketPath; }
+	// Gets or sets the op the client asks the daemon to do on each starting path, like reported-length.
+	void ClientOp(const std::string& clientOp) { m_clientOp = clientOp; }
+	const std::string& ClientOp() const { return m_clientOp; }
+	// Gets or sets the number of times the client sends each request.
+	void ClientRepeat(unsigned int clientRepeat) { m_clientRepeat = clientRepeat; }
+	unsigned int ClientRepeat() const { return m_clientRepeat; }
+	// Gets or sets the path of the song catalog to write while patching. Empty for no catalog.
+	void CatalogPath(const std::string& catalogPath) { m_catalogPath = catalogPath; }
+	const std::string& CatalogPath() const { return m_catalogPath; }
+	// Gets or sets which shard of the files found to work on. The default is all of them.
+	void Shard(const ShardSpec& shard) { m_shard = shard; }
+	const ShardSpec& Shard() const { return m_shard; }
+	// Gets or sets the path of a file to write the summary of the run to, for merging the summaries of the shards of
+	// a library. Empty for none.
+	void SummaryPath(const std::string& summaryPath) { m_summaryPath = summaryPath; }
+	const std::string& SummaryPath() const { return m_summaryPath; }
+	// Gets or sets the MergeSummaries property - whether the starting paths are summary files from shards to combine
+	// instead of files to patch.
+	void MergeSummaries(bool mergeSummaries) { m_mergeSummaries = mergeSummaries; }
+	bool MergeSummaries() const { return m_mergeSummaries; }
+	// Gets or sets the number of seconds a patcher run may take before it stops and leaves the rest of the files for
+	// the next run. 0 for no limit.
+	void TimeBudget(double timeBudget) { m_timeBudget = timeBudget; }
+	double TimeBudget() const { return m_timeBudget; }
+	// Gets or sets the directory to copy the files being patched to and patch them there, leaving the originals
+	// alone. Empty to patch the originals.
+	void OutputDirectory(const std::string& outputDirectory) { m_outputDirectory = outputDirectory; }
+	const std::string& OutputDirectory() const { return m_outputDirectory; }
+	// Gets or sets how .ogg files are read and written.
+	void IoMethod(PatcherIoMethod ioMethod) { m_ioMethod = ioMethod; }
+	PatcherIoMethod IoMethod() const { return m_ioMethod; }
+	// Gets or sets whether .zip files found while searching are opened and the .ogg files stored in them patched in
+	// place.
+	void ZipPacks(bool zipPacks) { m_zipPacks = zipPacks; }
+	bool ZipPacks() const { return m_zipPacks; }
+	// Gets or sets the file to write counts and timings to in the Prometheus text format. Empty for none.
+	void MetricsPath(const std::string& metricsPath) { m_metricsPath = metricsPath; }
+	const std::string& MetricsPath() const { return m_metricsPath; }
+	// Gets or sets whether to count CPU cycles, cache misses, and such for each phase of handling files and print
+	// them at the end.
+	void PerfCounters(bool perfCounters) { m_perfCounters = perfCounters; }
+	bool PerfCounters() const { return m_perfCounters; }
+	// Gets or sets the range of threads to check files with while patching. The number used is adjusted within the
+	// range while running.
+	void IoWorkers(const WorkerRange& ioWorkers) { m_ioWorkers = ioWorkers; }
+	const WorkerRange& IoWorkers() const { return m_ioWorkers; }
+	// Gets or sets the range of threads to decode files with while patching.
+	void DecodeWorkers(const WorkerRange& decodeWorkers) { m_decodeWorkers = decodeWorkers; }
+	const WorkerRange& DecodeWorkers() const { return m_decodeWorkers; }
+	// Gets or sets the most bytes of memory the decode workers should use between them. 0 for no limit.
+	void MaxMemory(double maxMemory) { m_maxMemory = maxMemory; }
+	double MaxMemory() const { return m_maxMemory; }
+	// Gets or sets the file to keep a snapshot of the directories searched and the decisions made about their files
+	// in, so the next run only looks at what changed. Empty for none.
+	void SnapshotPath(const std::string& snapshotPath) { m_snapshotPath = snapshotPath; }
+	const std::string& SnapshotPath() const { return m_snapshotPath; }
+	// Gets or sets the rules file that decides what to do with each file instead of the length condition. Empty for
+	// none.
+	void RulesPath(const std::string& rulesPath) { m_rulesPath = rulesPath; }
+	const std::string& RulesPath() const { return m_rulesPath; }
+	// Returns true if files are to be checked or decoded on worker threads instead of one at a time.
+	bool UseWorkers() const { return m_ioWorkers.maxWorkers > 1 || m_decodeWorkers.maxWorkers > 1; }
 	
 	// Only process files with length equal to the given number of seconds. Only one condition may be used.
 	void UseLengthEqualCondition(double lengthCondition)
@@ -111,9 +296,15 @@ public:
 	// Returns true if a song with the given reported song length meets the conditions of this options object
 	bool LengthMeetsConditions(double reportedSongLength) const;
 
+	// Returns true if a quick look at the first and last pages of the given file proves that it can't meet the
+	// conditions of this options object. Never returns true for a file FileMeetsConditions() would accept.
+	// Errors are not thrown; the file just isn't ruled out.
+	bool FileRuledOutByQuickCheck(const std::string& file) const;
+
 	// Returns true if the given Ogg Vorbis file meets the conditions of this options object.
+	// If pageIndex is not NULL, it is used to get the file's reported length and updated if needed.
 	// Can throw ogglength::OggVorbisError if there is an error opening or reading the file.
-	bool FileMeetsConditions(const std::string& file) const;
+	bool FileMeetsConditions(const std::string& file, ogglength::OggPageIndex* pageIndex = NULL) const;
 };
 
 } // end namespace oggpatcher
@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "PhasePerfCounters.h"
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+using namespace lhcutilities;
+
+namespace oggpatcher
+{
+
+PhasePerfCounters::PhasePerfCounters() : m_counters()
+{
+}
+
+void PhasePerfCounters::AddPhase(PatchPhase phase, double seconds, const PerfCounts* start, const PerfCounts* end)
+{
+	PhaseTotals& totals = m_totals[phase];
+	totals.numTimes++;
+	totals.seconds += seconds;
+	if(start == NULL || end == NULL)
+	{
+		return;
+	}
+	for(int counter = 0; counter < num_perf_counters; counter++)
+	{
+		// Scaling for time the counters were shared can make a later reading come out a little lower.
+		if(end->values[counter] > start->values[counter])
+		{
+			totals.counts.values[counter] += end->values[counter] - start->values[counter];
+		}
+	}
+}
+
+void PhasePerfCounters::Print(ostream& output) const
+{
+	output << left << setw(20) << "Phase" << right << setw(8) << "Times" << setw(12) << "Seconds";
+	for(int counter = 0; counter < num_perf_counters; counter++)
+	{
+		output << setw(18) << GetPerfCounterName(static_cast<PerfCounter>(counter));
+	}
+	output << setw(8) << "IPC" << endl;
+
+	for(int phase = 0; phase < num_patch_phases; phase++)
+	{
+		const PhaseTotals& totals = m_totals[phase];
+		output << left << setw(20) << GetPhaseName(static_cast<PatchPhase>(phase)) << right << setw(8)
+			<< totals.numTimes << setw(12) << fixed << setprecision(3) << totals.seconds;
+		for(int counter = 0; counter < num_perf_counters; counter++)
+		{
+			if(m_counters.Available(static_cast<PerfCounter>(counter)))
+			{
+				output << setw(18) << totals.counts.values[counter];
+			}
+			else
+			{
+				output << setw(18) << "-";
+			}
+		}
+
+		// Instructions per cycle. Below 1 usually means waiting on memory.
+		if(m_counters.Available(perf_cycles) && m_counters.Available(perf_instructions)
+			&& totals.counts.values[perf_cycles] > 0)
+		{
+			output << setw(8) << setprecision(2) << static_cast<double>(totals.counts.values[perf_instructions])
+				/ totals.counts.values[perf_cycles];
+		}
+		else
+		{
+			output << setw(8) << "-";
+		}
+		output.unsetf(ios::fixed);
+		output << setprecision(6) << endl;
+	}
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
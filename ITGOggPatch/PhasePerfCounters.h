@@ -0,0 +1,75 @@
+#ifndef __PHASE_PERF_COUNTERS_H__
+#define __PHASE_PERF_COUNTERS_H__
+
+#include <iostream>
+#include "perfcounters.h"
+#include "PatchPhase.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Adds up CPU performance counters by the phase of handling a file they were spent in, so that a run can show
+// whether decoding or reading pages is held back by cache misses, branch misses, or waiting on the kernel. The
+// counters count the thread that creates this object, which must be the thread the phases run on.
+class PhasePerfCounters
+{
+private:
+	struct PhaseTotals
+	{
+		unsigned long numTimes;
+		double seconds;
+		lhcutilities::PerfCounts counts;
+
+		PhaseTotals() : numTimes(0), seconds(0), counts()
+		{
+		}
+	};
+
+	lhcutilities::PerfCounterGroup m_counters;
+	PhaseTotals m_totals[num_patch_phases];
+
+	// Not copyable
+	PhasePerfCounters(const PhasePerfCounters&);
+	PhasePerfCounters& operator=(const PhasePerfCounters&);
+
+public:
+	// Opens the counters. Counters the kernel won't allow are left out, and the phases are still timed if none
+	// can be opened.
+	PhasePerfCounters();
+
+	// Whether the kernel gave access to any counters, and if not all of them, why not.
+	bool AnyAvailable() const { return m_counters.AnyAvailable(); }
+	const std::string& Error() const { return m_counters.Error(); }
+
+	// Reads the counters. Returns false if they can't be read.
+	bool Read(lhcutilities::PerfCounts& countsOut) const { return m_counters.Read(countsOut); }
+
+	// Adds a phase that took the given time, with the counter readings from its start and end, or NULL if they
+	// couldn't be read.
+	void AddPhase(PatchPhase phase, double seconds, const lhcutilities::PerfCounts* start,
+		const lhcutilities::PerfCounts* end);
+
+	// Prints a table of the totals for each phase. Counters that weren't available are shown as -.
+	void Print(std::ostream& output) const;
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "Shard.h"
+#include <string>
+#include <stdexcept>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+namespace oggpatcher
+{
+
+bool ShardSpec::Contains(const string& relativePath) const
+{
+	if(count <= 1)
+	{
+		return true;
+	}
+
+	// 64-bit FNV-1a. boost::hash is not guaranteed to be the same across Boost versions or platforms, and every
+	// machine splitting a library has to agree. Backslashes are hashed as slashes so Windows and Linux agree too.
+	boost::uint64_t hash = 14695981039346656037ULL;
+	for(string::size_type charIndex = 0; charIndex < relativePath.size(); charIndex++)
+	{
+		unsigned char c = static_cast<unsigned char>(relativePath[charIndex]);
+		hash ^= c == '\\' ? '/' : c;
+		hash *= 1099511628211ULL;
+	}
+	return hash % count == index - 1;
+}
+
+string ShardSpec::ToString() const
+{
+	return boost::lexical_cast<string>(index) + "/" + boost::lexical_cast<string>(count);
+}
+
+ShardSpec ShardSpec::Parse(const string& text)
+{
+	string::size_type slash = text.find('/');
+	if(slash == string::npos)
+	{
+		throw invalid_argument("A shard must be given as index/count, like 1/4.");
+	}
+
+	ShardSpec shard;
+	try
+	{
+		shard.index = boost::lexical_cast<unsigned int>(boost::trim_copy(text.substr(0, slash)));
+		shard.count = boost::lexical_cast<unsigned int>(boost::trim_copy(text.substr(slash + 1)));
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		throw invalid_argument("A shard must be given as index/count, like 1/4.");
+	}
+
+	if(shard.count == 0 || shard.index == 0 || shard.index > shard.count)
+	{
+		throw invalid_argument("A shard index must be from 1 to the number of shards, like 1/4 through 4/4.");
+	}
+	return shard;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
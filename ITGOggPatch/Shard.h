@@ -0,0 +1,57 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <string>
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// One of N disjoint parts of a library, for splitting the work between several processes or machines. Files are
+// assigned to shards by a hash of their path relative to the starting path they were found under, so every
+// process given the same starting paths agrees on which shard a file is in, whatever the order it finds files in
+// and wherever the library is mounted.
+struct ShardSpec
+{
+	unsigned int index; // 1 to count
+	unsigned int count; // 1 if the library isn't split
+
+	ShardSpec() : index(1), count(1)
+	{
+	}
+
+	ShardSpec(unsigned int index_, unsigned int count_) : index(index_), count(count_)
+	{
+	}
+
+	bool IsSharded() const { return count > 1; }
+
+	// Returns true if the file with the given path relative to its starting path belongs to this shard.
+	bool Contains(const std::string& relativePath) const;
+
+	// Gets the shard as "index/count".
+	std::string ToString() const;
+
+	// Parses "index/count", where index is from 1 to count. Throws std::invalid_argument if the text isn't that.
+	static ShardSpec Parse(const std::string& text);
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "Verifier.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "ogglength.h"
+#include "diskorder.h"
+#include "utilities.h"
+#include "FileFinder.h"
+#include "Manifest.h"
+
+using namespace std;
+using namespace lhcutilities;
+using namespace ogglength;
+namespace pt = boost::posix_time;
+
+namespace oggpatcher
+{
+
+bool Verifier::Verify()
+{
+	m_numVerified = 0;
+	m_numBad = 0;
+	m_numErrors = 0;
+	m_numBytes = 0;
+
+	vector<string> files;
+	vector<pair<string, string> > errors;
+	if(!m_options.ManifestPath().empty())
+	{
+		try
+		{
+			vector<ManifestEntry> entries = ReadManifest(m_options.ManifestPath());
+			SortManifestForLocality(entries);
+			for(vector<ManifestEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+			{
+				files.push_back(entries[entryIndex].path);
+			}
+		}
+		catch(IoError& ex)
+		{
+			errors.push_back(make_pair(m_options.ManifestPath(), string(ex.what())));
+		}
+	}
+	else
+	{
+		for(vector<string>::size_type pathIndex = 0; pathIndex < m_options.StartingPaths().size(); pathIndex++)
+		{
+			FindOggFilesInStartingPath(m_options.StartingPaths()[pathIndex], files, errors);
+		}
+	}
+	for(vector<pair<string, string> >::size_type errorIndex = 0; errorIndex < errors.size(); errorIndex++)
+	{
+		PrintError(errors[errorIndex].first, errors[errorIndex].second);
+	}
+
+	if(m_options.DiskOrder())
+	{
+		SortByDiskLocation(files);
+	}
+
+	pt::ptime start = pt::microsec_clock::universal_time();
+
+	for(vector<string>::size_type fileIndex = 0; fileIndex < files.size(); fileIndex++)
+	{
+		m_files.Push(files[fileIndex]);
+	}
+	m_files.Close();
+
+	boost::thread_group workers;
+	for(unsigned int workerIndex = 0; workerIndex < m_options.WorkerCount(); workerIndex++)
+	{
+		workers.create_thread(boost::bind(&Verifier::Work, this));
+	}
+	workers.join_all();
+
+	double seconds = static_cast<double>((pt::microsec_clock::universal_time() - start).total_microseconds()) / 1000000;
+	double megabytes = static_cast<double>(m_numBytes) / (1024 * 1024);
+	cout << "Verified " << m_numVerified << " files (" << megabytes << " MB";
+	if(seconds > 0)
+	{
+		cout << " at " << megabytes / seconds << " MB/s";
+	}
+	cout << "). " << m_numBad << " files have bad pages. " << m_numErrors << " errors." << endl;
+
+	return m_numBad == 0 && m_numErrors == 0;
+}
+
+void Verifier::Work()
+{
+	string path;
+	while(m_files.Pop(path))
+	{
+		try
+		{
+			OggVerifyResult result = VerifyPages(path.c_str());
+
+			boost::mutex::scoped_lock lock(m_resultsMutex);
+			m_numVerified++;
+			m_numBytes += result.numBytes;
+			if(!result.Ok())
+			{
+				m_numBad++;
+				cout << path << "   - " << "bad page at byte " << result.badPageOffset << ": " << result.problem << endl;
+			}
+		}
+		catch(OggVorbisError& ex)
+		{
+			PrintError(path, ex.what());
+		}
+
+		if(m_options.PrefetchCount() > 0)
+		{
+			// Don't let a whole library of songs push the game's own files out of the cache.
+			EvictFileFromCache(path.c_str());
+		}
+	}
+}
+
+// Several threads reading files in directory order would keep a hard disk seeking, so with --disk-order the files are
+// handed out in the order they are on the disk.
+void Verifier::SortByDiskLocation(vector<string>& files)
+{
+	vector<pair<PhysicalLocation, string> > locatedFiles;
+	for(vector<string>::size_type fileIndex = 0; fileIndex < files.size(); fileIndex++)
+	{
+		PhysicalLocation location;
+		try
+		{
+			location = GetPhysicalLocation(files[fileIndex].c_str());
+		}
+		catch(IoError&)
+		{
+			// Leave it at the default location. Verifying it will report the error.
+		}
+		locatedFiles.push_back(make_pair(location, files[fileIndex]));
+	}
+
+	stable_sort(locatedFiles.begin(), locatedFiles.end());
+	for(vector<string>::size_type fileIndex = 0; fileIndex < files.size(); fileIndex++)
+	{
+		files[fileIndex] = locatedFiles[fileIndex].second;
+	}
+}
+
+void Verifier::PrintError(const string& path, const string& message)
+{
+	boost::mutex::scoped_lock lock(m_resultsMutex);
+	cout << path << "   - " << message << endl;
+	m_numErrors++;
+}
+
+} // end namespace oggpatcher
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,67 @@
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include "PatcherOptions.h"
+#include "workqueue.h"
+
+// namespace oggpatcher is stuff specific to ITG Ogg Patcher and is not intended to be reusable.
+namespace oggpatcher
+{
+
+// Checks every page of the .ogg files in the options' starting paths, several files at a time, and reports the first
+// bad page of each file that has one.
+class Verifier
+{
+private:
+	PatcherOptions m_options;
+	lhcutilities::WorkQueue<std::string> m_files;
+	boost::mutex m_resultsMutex; // Guards the counts below and stdout
+	unsigned long m_numVerified;
+	unsigned long m_numBad;
+	unsigned long m_numErrors;
+	boost::uint64_t m_numBytes;
+
+	// Not copyable
+	Verifier(const Verifier&);
+	Verifier& operator=(const Verifier&);
+
+public:
+	// Creates a new verifier with the given options.
+	explicit Verifier(const PatcherOptions& options) : m_options(options), m_files(), m_resultsMutex(),
+		m_numVerified(0), m_numBad(0), m_numErrors(0), m_numBytes(0)
+	{
+	}
+
+	// Verifies the files, printing bad pages, errors, and a summary to stdout. No exceptions are thrown other than
+	// bad_alloc and such. Returns true if every file was read and is fine.
+	bool Verify();
+
+private:
+	void Work();
+	void SortByDiskLocation(std::vector<std::string>& files);
+	void PrintError(const std::string& path, const std::string& message);
+};
+
+} // end namespace oggpatcher
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include "diskorder.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <boost/cstdint.hpp>
+#include "utilities.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+using namespace std;
+
+namespace lhcutilities
+{
+
+bool PhysicalLocation::operator<(const PhysicalLocation& other) const
+{
+	if(device != other.device)
+	{
+		return device < other.device;
+	}
+	if(fromExtentMap != other.fromExtentMap)
+	{
+		return fromExtentMap;
+	}
+	return head < other.head;
+}
+
+#ifdef __linux__
+namespace
+{
+
+// Gets the physical byte offset of the given logical byte offset in the file open as fd.
+// Returns false if the filesystem can't tell us.
+bool GetPhysicalOffset(int fd, boost::uint64_t logicalOffset, boost::uint64_t& physicalOffsetOut)
+{
+	// struct fiemap ends in a flexible array of extents. We only want one.
+	vector<unsigned char> buffer(sizeof(struct fiemap) + sizeof(struct fiemap_extent), 0);
+	struct fiemap* extentMap = reinterpret_cast<struct fiemap*>(&buffer[0]);
+	extentMap->fm_start = logicalOffset;
+	extentMap->fm_length = 1;
+	extentMap->fm_flags = FIEMAP_FLAG_SYNC;
+	extentMap->fm_extent_count = 1;
+
+	if(ioctl(fd, FS_IOC_FIEMAP, extentMap) != 0 || extentMap->fm_mapped_extents == 0)
+	{
+		return false;
+	}
+
+	const struct fiemap_extent& extent = extentMap->fm_extents[0];
+	if((extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)) != 0)
+	{
+		return false;
+	}
+
+	physicalOffsetOut = extent.fe_physical + (logicalOffset - extent.fe_logical);
+	return true;
+}
+
+} // end anonymous namespace
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996) // 'stat': The POSIX name for this item is deprecated.
+#endif
+PhysicalLocation GetPhysicalLocation(const char* filename)
+{
+	struct stat fileStatus;
+	if(stat(filename, &fileStatus) != 0)
+	{
+		throw IoError(string("Could not get information about file ") + filename + ".");
+	}
+
+	PhysicalLocation location;
+	location.device = static_cast<boost::uint64_t>(fileStatus.st_dev);
+	location.head = static_cast<boost::uint64_t>(fileStatus.st_ino);
+	location.tail = location.head;
+
+#ifdef __linux__
+	int fd = open(filename, O_RDONLY);
+	if(fd != -1)
+	{
+		boost::uint64_t head;
+		boost::uint64_t tail;
+		boost::uint64_t size = static_cast<boost::uint64_t>(fileStatus.st_size);
+		if(size > 0 && GetPhysicalOffset(fd, 0, head) && GetPhysicalOffset(fd, size - 1, tail))
+		{
+			location.head = head;
+			location.tail = tail;
+			location.fromExtentMap = true;
+		}
+		close(fd);
+	}
+#endif
+
+	return location;
+
+	#ifdef _MSC_VER
+	#pragma warning(default:4996)
+	#endif
+}
+
+void WarmFileRange(const char* filename, boost::uint64_t offset, boost::uint64_t length)
+{
+	FILE* file = fopen(filename, "rb");
+	if(file == NULL)
+	{
+		return;
+	}
+	ScopedFile scopedFile(file);
+
+	if(fseek(file, static_cast<long>(offset), SEEK_SET) != 0)
+	{
+		return;
+	}
+
+	char buffer[65536];
+	while(length > 0)
+	{
+		size_t toRead = length < sizeof(buffer) ? static_cast<size_t>(length) : sizeof(buffer);
+		size_t bytesRead = fread(buffer, 1, toRead, file);
+		if(bytesRead < toRead)
+		{
+			return;
+		}
+		length -= bytesRead;
+	}
+}
+
+#ifdef __linux__
+namespace
+{
+
+// Gives the file the given posix_fadvise advice for each (offset, length) range. A length of 0 means to the end.
+void AdviseFile(const char* filename, const vector<pair<boost::uint64_t, boost::uint64_t> >& ranges, int advice)
+{
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1)
+	{
+		return;
+	}
+
+	for(vector<pair<boost::uint64_t, boost::uint64_t> >::size_type rangeIndex = 0; rangeIndex < ranges.size();
+		rangeIndex++)
+	{
+		posix_fadvise(fd, static_cast<off_t>(ranges[rangeIndex].first), static_cast<off_t>(ranges[rangeIndex].second),
+			advice);
+	}
+
+	// The advice is about the file's pages in the cache, not this descriptor, so it still applies after closing.
+	close(fd);
+}
+
+} // end anonymous namespace
+#endif
+
+void PrefetchFile(const char* filename)
+{
+#ifdef __linux__
+	AdviseFile(filename, vector<pair<boost::uint64_t, boost::uint64_t> >(1, make_pair(0, 0)), POSIX_FADV_WILLNEED);
+#else
+	(void)filename;
+#endif
+}
+
+void PrefetchFileEnds(const char* filename, boost::uint64_t numBytes)
+{
+#ifdef __linux__
+	struct stat fileStatus;
+	if(stat(filename, &fileStatus) != 0)
+	{
+		return;
+	}
+
+	boost::uint64_t size = static_cast<boost::uint64_t>(fileStatus.st_size);
+	vector<pair<boost::uint64_t, boost::uint64_t> > ranges;
+	if(size <= numBytes * 2)
+	{
+		ranges.push_back(make_pair(0, 0));
+	}
+	else
+	{
+		ranges.push_back(make_pair(0, numBytes));
+		ranges.push_back(make_pair(size - numBytes, numBytes));
+	}
+	AdviseFile(filename, ranges, POSIX_FADV_WILLNEED);
+#else
+	(void)filename;
+	(void)numBytes;
+#endif
+}
+
+void EvictFileFromCache(const char* filename)
+{
+#ifdef __linux__
+	AdviseFile(filename, vector<pair<boost::uint64_t, boost::uint64_t> >(1, make_pair(0, 0)), POSIX_FADV_DONTNEED);
+#else
+	(void)filename;
+#endif
+}
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
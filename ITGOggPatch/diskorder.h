@@ -0,0 +1,69 @@
+#ifndef __DISKORDER_H__
+#define __DISKORDER_H__
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// Where a file's data lives on disk, for ordering work on spinning disks so the head sweeps across once instead
+// of seeking back and forth. Only useful for comparing files with each other.
+struct PhysicalLocation
+{
+	boost::uint64_t device; // Device the file is on. Locations on different devices aren't comparable.
+	boost::uint64_t head; // Physical byte offset of the start of the file, or the inode number if not known
+	boost::uint64_t tail; // Physical byte offset of the end of the file, or the inode number if not known
+	bool fromExtentMap; // true if head and tail are real physical offsets, false if they are inode numbers
+
+	PhysicalLocation() : device(0), head(0), tail(0), fromExtentMap(false)
+	{
+	}
+
+	// Orders by device, then files with real offsets before files with only inode numbers, then by head.
+	bool operator<(const PhysicalLocation& other) const;
+};
+
+// Gets the physical location of a file. On Linux this asks the filesystem for the file's extents (FIEMAP).
+// If the filesystem doesn't support that, or on other platforms, the inode number is used instead because
+// filesystems tend to allocate blocks near their inodes. Throws lhcutilities::IoError if the file can't be
+// stat'ed.
+PhysicalLocation GetPhysicalLocation(const char* filename);
+
+// Reads the given range of a file and throws the data away so that it will be in the operating system's cache
+// when it is needed. Ranges past the end of the file are ignored. Errors are ignored; it's only a hint.
+void WarmFileRange(const char* filename, boost::uint64_t offset, boost::uint64_t length);
+
+// Asks the operating system to start reading the whole file into its cache in the background (posix_fadvise
+// WILLNEED on Linux). Returns immediately. Does nothing on platforms without a way to do that, and errors are
+// ignored since it's only a hint.
+void PrefetchFile(const char* filename);
+
+// Like PrefetchFile(), but only the first and last numBytes bytes of the file.
+void PrefetchFileEnds(const char* filename, boost::uint64_t numBytes);
+
+// Tells the operating system the file's data won't be needed again soon, so it can drop it from its cache instead
+// of something more useful (posix_fadvise DONTNEED on Linux). Errors are ignored.
+void EvictFileFromCache(const char* filename);
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,221 @@
+#include "stdafx.h"
+#include "filecopy.h"
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include "utilities.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+using namespace std;
+
+namespace lhcutilities
+{
+
+namespace
+{
+
+#ifdef __linux__
+// Closes a file descriptor when it goes out of scope.
+class ScopedDescriptor
+{
+private:
+	int m_fd;
+
+	// Not copyable
+	ScopedDescriptor(const ScopedDescriptor&);
+	ScopedDescriptor& operator=(const ScopedDescriptor&);
+
+public:
+	explicit ScopedDescriptor(int fd) : m_fd(fd)
+	{
+	}
+
+	~ScopedDescriptor()
+	{
+		if(m_fd >= 0)
+		{
+			close(m_fd);
+		}
+	}
+
+	int get() const { return m_fd; }
+
+	// Closes the descriptor. Throws lhcutilities::IoError if closing reports an error, which for a file being
+	// written can mean the data didn't make it.
+	void CloseOrDie()
+	{
+		int fd = m_fd;
+		m_fd = -1;
+		if(close(fd) != 0)
+		{
+			throw IoError("Error while writing the copy.");
+		}
+	}
+};
+
+// Copies the rest of in to out with copy_file_range. Returns false without copying anything if the kernel or
+// filesystem can't do it, so the caller can fall back to a plain copy.
+bool CopyInKernel(int in, int out)
+{
+#ifdef SYS_copy_file_range
+	bool copiedAny = false;
+	while(true)
+	{
+		// Called through syscall() because the glibc wrapper is newer than the system call.
+		long result = syscall(SYS_copy_file_range, in, NULL, out, NULL, static_cast<size_t>(1 << 30), 0u);
+		if(result > 0)
+		{
+			copiedAny = true;
+		}
+		else if(result == 0)
+		{
+			return true;
+		}
+		else if(errno == EINTR)
+		{
+			continue;
+		}
+		else if(!copiedAny && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+		{
+			return false;
+		}
+		else
+		{
+			throw IoError("Error while copying.");
+		}
+	}
+#else
+	(void)in;
+	(void)out;
+	return false;
+#endif
+}
+
+void CopyPlain(int in, int out)
+{
+	vector<char> buffer(1024 * 1024);
+	while(true)
+	{
+		ssize_t bytesRead = read(in, &buffer[0], buffer.size());
+		if(bytesRead < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(bytesRead < 0)
+		{
+			throw IoError("Error while reading the original.");
+		}
+		else if(bytesRead == 0)
+		{
+			return;
+		}
+
+		ssize_t bytesWritten = 0;
+		while(bytesWritten < bytesRead)
+		{
+			ssize_t result = write(out, &buffer[bytesWritten], bytesRead - bytesWritten);
+			if(result < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			else if(result < 0)
+			{
+				throw IoError("Error while writing the copy.");
+			}
+			bytesWritten += result;
+		}
+	}
+}
+#endif
+
+} // end anonymous namespace
+
+#ifdef __linux__
+FileCopyMethod CloneFile(const char* source, const char* destination)
+{
+	ScopedDescriptor in(open(source, O_RDONLY));
+	if(in.get() < 0)
+	{
+		throw IoError(string("Could not open ") + source + ".");
+	}
+	struct stat sourceStatus;
+	if(fstat(in.get(), &sourceStatus) != 0)
+	{
+		throw IoError(string("Could not get information about file ") + source + ".");
+	}
+
+	ScopedDescriptor out(open(destination, O_WRONLY | O_CREAT | O_TRUNC, sourceStatus.st_mode & 07777));
+	if(out.get() < 0)
+	{
+		throw IoError(string("Could not create ") + destination + ".");
+	}
+	// The mode given to open() only applies if the file is new.
+	fchmod(out.get(), sourceStatus.st_mode & 07777);
+
+	FileCopyMethod method;
+#ifdef FICLONE
+	if(ioctl(out.get(), FICLONE, in.get()) == 0)
+	{
+		method = copy_reflink;
+	}
+	else
+#endif
+	if(CopyInKernel(in.get(), out.get()))
+	{
+		method = copy_in_kernel;
+	}
+	else
+	{
+		CopyPlain(in.get(), out.get());
+		method = copy_plain;
+	}
+
+	out.CloseOrDie();
+	return method;
+}
+#else
+FileCopyMethod CloneFile(const char* source, const char* destination)
+{
+	ScopedFile in(OpenOrDie(source, "rb"));
+	ScopedFile out(OpenOrDie(destination, "wb"));
+	while(true)
+	{
+		vector<unsigned char> buffer = ReadBytes(in.get(), 1024 * 1024);
+		if(buffer.empty())
+		{
+			break;
+		}
+		WriteBytesOrDie(out.get(), buffer);
+	}
+	out.CloseOrDie();
+	return copy_plain;
+}
+#endif
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
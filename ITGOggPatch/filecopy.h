@@ -0,0 +1,41 @@
+#ifndef __FILECOPY_H__
+#define __FILECOPY_H__
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// How CloneFile() copied a file
+enum FileCopyMethod
+{
+	copy_reflink, // The copy shares the original's blocks until one of them is changed (FICLONE)
+	copy_in_kernel, // Copied by the kernel with copy_file_range, which shares blocks on some filesystems too
+	copy_plain // Read and written the ordinary way
+};
+
+// Makes destination a copy of source with the same permissions, replacing destination if it exists. On Linux the
+// copy shares the original's disk blocks if the filesystem can do that (btrfs, XFS, and others), so that it costs
+// almost nothing until it is changed, and only the blocks that are changed are written. Otherwise the data is
+// copied. Throws lhcutilities::IoError if there is an error.
+FileCopyMethod CloneFile(const char* source, const char* destination);
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,312 @@
+#include "stdafx.h"
+#include "flatjson.h"
+#include <string>
+#include <map>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+namespace lhcutilities
+{
+
+namespace
+{
+
+// Walks through JSON text. Throws std::invalid_argument on anything unexpected.
+class JsonParser
+{
+private:
+	const string& m_json;
+	string::size_type m_position;
+
+	void AppendUtf8(string& output, unsigned long codePoint)
+	{
+		if(codePoint < 0x80)
+		{
+			output += static_cast<char>(codePoint);
+		}
+		else if(codePoint < 0x800)
+		{
+			output += static_cast<char>(0xC0 | (codePoint >> 6));
+			output += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+		else if(codePoint < 0x10000)
+		{
+			output += static_cast<char>(0xE0 | (codePoint >> 12));
+			output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+			output += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+		else
+		{
+			output += static_cast<char>(0xF0 | (codePoint >> 18));
+			output += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+			output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+			output += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+	}
+
+	unsigned long ReadHex4()
+	{
+		if(m_json.size() - m_position < 4)
+		{
+			throw invalid_argument("Unexpected end of JSON.");
+		}
+		string hex = m_json.substr(m_position, 4);
+		m_position += 4;
+		char* end;
+		unsigned long value = strtoul(hex.c_str(), &end, 16);
+		if(*end != '\0')
+		{
+			throw invalid_argument("Bad \\u escape in JSON string.");
+		}
+		return value;
+	}
+
+public:
+	explicit JsonParser(const string& json) : m_json(json), m_position(0)
+	{
+	}
+
+	void SkipWhitespace()
+	{
+		while(m_position < m_json.size() && (m_json[m_position] == ' ' || m_json[m_position] == '\t'
+			|| m_json[m_position] == '\r' || m_json[m_position] == '\n'))
+		{
+			m_position++;
+		}
+	}
+
+	bool AtEnd()
+	{
+		SkipWhitespace();
+		return m_position >= m_json.size();
+	}
+
+	char Peek()
+	{
+		SkipWhitespace();
+		if(m_position >= m_json.size())
+		{
+			throw invalid_argument("Unexpected end of JSON.");
+		}
+		return m_json[m_position];
+	}
+
+	void Expect(char expected)
+	{
+		if(Peek() != expected)
+		{
+			throw invalid_argument(string("Expected '") + expected + "' in JSON.");
+		}
+		m_position++;
+	}
+
+	string ReadString()
+	{
+		Expect('"');
+		string value;
+		while(true)
+		{
+			if(m_position >= m_json.size())
+			{
+				throw invalid_argument("Unterminated JSON string.");
+			}
+			char c = m_json[m_position++];
+			if(c == '"')
+			{
+				return value;
+			}
+			else if(c != '\\')
+			{
+				value += c;
+				continue;
+			}
+
+			if(m_position >= m_json.size())
+			{
+				throw invalid_argument("Unterminated JSON string.");
+			}
+			char escaped = m_json[m_position++];
+			switch(escaped)
+			{
+				case '"': value += '"'; break;
+				case '\\': value += '\\'; break;
+				case '/': value += '/'; break;
+				case 'b': value += '\b'; break;
+				case 'f': value += '\f'; break;
+				case 'n': value += '\n'; break;
+				case 'r': value += '\r'; break;
+				case 't': value += '\t'; break;
+				case 'u':
+				{
+					unsigned long codePoint = ReadHex4();
+					// A high surrogate should be followed by a low surrogate, making one code point between them.
+					if(codePoint >= 0xD800 && codePoint < 0xDC00 && m_json.compare(m_position, 2, "\\u") == 0)
+					{
+						m_position += 2;
+						unsigned long lowSurrogate = ReadHex4();
+						codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+					}
+					AppendUtf8(value, codePoint);
+					break;
+				}
+				default:
+					throw invalid_argument("Bad escape in JSON string.");
+			}
+		}
+	}
+
+	JsonValue ReadValue()
+	{
+		char first = Peek();
+		if(first == '"')
+		{
+			return JsonValue(JsonValue::json_string, ReadString());
+		}
+
+		// Anything else is a bare token: a number, true, false, or null.
+		string::size_type tokenStart = m_position;
+		while(m_position < m_json.size() && m_json[m_position] != ',' && m_json[m_position] != '}'
+			&& m_json[m_position] != ' ' && m_json[m_position] != '\t' && m_json[m_position] != '\r'
+			&& m_json[m_position] != '\n')
+		{
+			m_position++;
+		}
+		string token = m_json.substr(tokenStart, m_position - tokenStart);
+
+		if(token == "true" || token == "false")
+		{
+			return JsonValue(JsonValue::json_bool, token);
+		}
+		else if(token == "null")
+		{
+			return JsonValue(JsonValue::json_null, token);
+		}
+		else if(first == '{' || first == '[')
+		{
+			throw invalid_argument("Nested JSON objects and arrays are not supported.");
+		}
+
+		JsonValue number(JsonValue::json_number, token);
+		number.AsNumber(); // Make sure it really is one
+		return number;
+	}
+};
+
+} // end anonymous namespace
+
+double JsonValue::AsNumber() const
+{
+	if(type != json_number)
+	{
+		throw invalid_argument("Expected a number in JSON.");
+	}
+
+	const char* begin = text.c_str();
+	char* end;
+	double number = strtod(begin, &end);
+	if(end == begin || *end != '\0')
+	{
+		throw invalid_argument("Bad number in JSON.");
+	}
+	return number;
+}
+
+string JsonValue::ToJson() const
+{
+	return type == json_string ? JsonQuote(text) : text;
+}
+
+map<string, JsonValue> ParseFlatJsonObject(const string& json)
+{
+	JsonParser parser(json);
+	map<string, JsonValue> object;
+
+	parser.Expect('{');
+	if(parser.Peek() == '}')
+	{
+		parser.Expect('}');
+	}
+	else
+	{
+		while(true)
+		{
+			string key = parser.ReadString();
+			parser.Expect(':');
+			object[key] = parser.ReadValue();
+			if(parser.Peek() == ',')
+			{
+				parser.Expect(',');
+				continue;
+			}
+			parser.Expect('}');
+			break;
+		}
+	}
+
+	if(!parser.AtEnd())
+	{
+		throw invalid_argument("Unexpected text after JSON object.");
+	}
+	return object;
+}
+
+string JsonQuote(const string& text)
+{
+	ostringstream quoted;
+	quoted << '"';
+	for(string::size_type charIndex = 0; charIndex < text.size(); charIndex++)
+	{
+		unsigned char c = static_cast<unsigned char>(text[charIndex]);
+		switch(c)
+		{
+			case '"': quoted << "\\\""; break;
+			case '\\': quoted << "\\\\"; break;
+			case '\b': quoted << "\\b"; break;
+			case '\f': quoted << "\\f"; break;
+			case '\n': quoted << "\\n"; break;
+			case '\r': quoted << "\\r"; break;
+			case '\t': quoted << "\\t"; break;
+			default:
+				if(c < 0x20)
+				{
+					quoted << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec;
+				}
+				else
+				{
+					quoted << text[charIndex];
+				}
+		}
+	}
+	quoted << '"';
+	return quoted.str();
+}
+
+string JsonNumber(double number)
+{
+	ostringstream text;
+	text << setprecision(15) << number;
+	return text.str();
+}
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,69 @@
+#ifndef __FLATJSON_H__
+#define __FLATJSON_H__
+
+#include <string>
+#include <map>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// A value in a flat JSON object: a string, number, boolean, or null. Nested objects and arrays aren't supported.
+struct JsonValue
+{
+	enum Type
+	{
+		json_string,
+		json_number,
+		json_bool,
+		json_null
+	};
+
+	Type type;
+	std::string text; // The contents of a string (unescaped), or the JSON text of any other type of value
+
+	JsonValue() : type(json_null), text("null")
+	{
+	}
+
+	JsonValue(Type type_, const std::string& text_) : type(type_), text(text_)
+	{
+	}
+
+	// Gets the value as a number. Throws std::invalid_argument if it isn't one.
+	double AsNumber() const;
+
+	// Gets the value as JSON text, suitable for echoing back.
+	std::string ToJson() const;
+};
+
+// Parses a JSON object whose values are all strings, numbers, booleans, or null, like a line of a line-delimited
+// JSON protocol. Throws std::invalid_argument if the text isn't one.
+std::map<std::string, JsonValue> ParseFlatJsonObject(const std::string& json);
+
+// Returns the text as a quoted and escaped JSON string.
+std::string JsonQuote(const std::string& text);
+
+// Returns the number as JSON text.
+std::string JsonNumber(double number);
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
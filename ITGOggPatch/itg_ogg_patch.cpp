@@ -6,6 +6,11 @@
 #include <boost/algorithm/string.hpp>
 #include "PatcherOptions.h"
 #include "Patcher.h"
+#include "Daemon.h"
+#include "DaemonClient.h"
+#include "Verifier.h"
+#include "PatchSummary.h"
+#include "oggio.h"
 
 
 using namespace std;
@@ -41,20 +46,57 @@ int main(int argc, char* argv[])
 			return 0;
 		}
 
-		userChickenedOut = !UserWantsToContinue(options);
+		// Everything from here on opens .ogg files through this.
+		ogglength::MmapIoBackend mmapBackend;
+		if(options.IoMethod() == io_mmap)
+		{
+			ogglength::SetIoBackend(&mmapBackend);
+		}
 
-		if(!userChickenedOut)
+		if(!options.DaemonSocketPath().empty())
+		{
+			Daemon daemon(options);
+			daemon.Run();
+			return 0;
+		}
+		if(!options.ClientSocketPath().empty())
 		{
-			Patcher patcher(options);
-			patcher.Patch();
+			RunDaemonClient(options, cout);
+			return 0;
+		}
 
-			if(interactive)
+		if(options.MergeSummaries())
+		{
+			if(!MergePatchSummaryFiles(options.StartingPaths(), cout))
 			{
-				cout << "Done. Press enter to exit." << endl;
-				string line;
-				getline(cin, line);
+				exitCode = 1;
 			}
 		}
+		else if(options.Verify())
+		{
+			// Verifying doesn't change anything, so there's no need to ask first.
+			Verifier verifier(options);
+			if(!verifier.Verify())
+			{
+				exitCode = 1;
+			}
+		}
+		else
+		{
+			userChickenedOut = !UserWantsToContinue(options);
+			if(!userChickenedOut)
+			{
+				Patcher patcher(options);
+				patcher.Patch();
+			}
+		}
+
+		if(!userChickenedOut && interactive)
+		{
+			cout << "Done. Press enter to exit." << endl;
+			string line;
+			getline(cin, line);
+		}
 	}
 	catch(std::exception& ex)
 	{
@@ -82,18 +124,33 @@ bool UserWantsToContinue(const PatcherOptions& options)
 		return true;
 	}
 	
-	if(options.PatchingToRealLength())
+	if(!options.ManifestPath().empty())
 	{
-		cout << "You have chosen to patch the following files and directories to the song's true length:";
+		cout << "You have chosen to patch the files listed in " << options.ManifestPath() << " to the lengths listed there";
+		if(options.PatchingToRealLength())
+		{
+			cout << " or to the song's true length.";
+		}
+		else
+		{
+			cout << " or to " << options.TimeInSeconds() << " seconds.";
+		}
 	}
 	else
 	{
-		cout << "You have chosen to patch the following files and directories to " << options.TimeInSeconds() << " seconds:";
-	}
+		if(options.PatchingToRealLength())
+		{
+			cout << "You have chosen to patch the following files and directories to the song's true length:";
+		}
+		else
+		{
+			cout << "You have chosen to patch the following files and directories to " << options.TimeInSeconds() << " seconds:";
+		}
 
-	for(vector<string>::size_type pathIndex = 0; pathIndex < options.StartingPaths().size(); pathIndex++)
-	{
-		cout << " " << options.StartingPaths()[pathIndex];
+		for(vector<string>::size_type pathIndex = 0; pathIndex < options.StartingPaths().size(); pathIndex++)
+		{
+			cout << " " << options.StartingPaths()[pathIndex];
+		}
 	}
 	cout << endl << endl;
 
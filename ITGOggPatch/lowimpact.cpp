@@ -0,0 +1,184 @@
+#include "stdafx.h"
+#include "lowimpact.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+namespace lhcutilities
+{
+
+TokenBucket::TokenBucket(double ratePerSecond, double capacity) : m_rate(ratePerSecond), m_capacity(capacity),
+	m_tokens(capacity), m_lastRefill(pt::microsec_clock::universal_time()), m_mutex()
+{
+}
+
+void TokenBucket::Take(double tokens)
+{
+	if(m_rate <= 0)
+	{
+		return;
+	}
+
+	double secondsToWait;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		pt::ptime now = pt::microsec_clock::universal_time();
+		double secondsElapsed = static_cast<double>((now - m_lastRefill).total_microseconds()) / 1000000;
+		m_lastRefill = now;
+		m_tokens += secondsElapsed * m_rate;
+		if(m_tokens > m_capacity)
+		{
+			m_tokens = m_capacity;
+		}
+
+		// Take the tokens now even if that goes into debt. Whoever comes next waits for the debt to be paid off,
+		// so threads get served in order without anyone holding the lock while sleeping.
+		m_tokens -= tokens;
+		secondsToWait = m_tokens < 0 ? -m_tokens / m_rate : 0;
+	}
+
+	if(secondsToWait > 0)
+	{
+		boost::this_thread::sleep(pt::microseconds(static_cast<boost::int64_t>(secondsToWait * 1000000)));
+	}
+}
+
+#ifdef __linux__
+namespace
+{
+// glibc has no wrapper or header for ioprio_set, so these come from linux/ioprio.h.
+const int s_ioprioWhoProcess = 1;
+const int s_ioprioClassIdle = 3;
+const int s_ioprioClassShift = 13;
+}
+#endif
+
+bool UseIdlePriority()
+{
+#if defined(__linux__)
+	bool succeeded = true;
+
+	// Despite the name, IOPRIO_WHO_PROCESS with 0 means the calling thread.
+	if(syscall(SYS_ioprio_set, s_ioprioWhoProcess, 0, s_ioprioClassIdle << s_ioprioClassShift) != 0)
+	{
+		succeeded = false;
+	}
+
+	struct sched_param param;
+	param.sched_priority = 0;
+	if(sched_setscheduler(0, SCHED_IDLE, &param) != 0)
+	{
+		succeeded = false;
+	}
+
+	return succeeded;
+#elif defined(_WIN32)
+	// Windows XP has no I/O priorities, but idle priority class at least keeps us off the CPU.
+	return SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS) != 0;
+#else
+	return false;
+#endif
+}
+
+bool PinCurrentThreadToCores(const vector<int>& cores)
+{
+	if(cores.empty())
+	{
+		return true;
+	}
+
+#if defined(__linux__)
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for(vector<int>::size_type coreIndex = 0; coreIndex < cores.size(); coreIndex++)
+	{
+		if(cores[coreIndex] < 0 || cores[coreIndex] >= CPU_SETSIZE)
+		{
+			return false;
+		}
+		CPU_SET(cores[coreIndex], &cpuSet);
+	}
+	return sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for(vector<int>::size_type coreIndex = 0; coreIndex < cores.size(); coreIndex++)
+	{
+		if(cores[coreIndex] < 0 || cores[coreIndex] >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+		{
+			return false;
+		}
+		mask |= static_cast<DWORD_PTR>(1) << cores[coreIndex];
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	return false;
+#endif
+}
+
+double GetLoadAverage()
+{
+#ifdef __linux__
+	double loadAverage;
+	if(getloadavg(&loadAverage, 1) == 1)
+	{
+		return loadAverage;
+	}
+#endif
+	return -1;
+}
+
+double GetIoPressure()
+{
+#ifdef __linux__
+	// First line looks like "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+	FILE* pressureFile = fopen("/proc/pressure/io", "r");
+	if(pressureFile == NULL)
+	{
+		return -1;
+	}
+
+	double pressure;
+	int fieldsRead = fscanf(pressureFile, "some avg10=%lf", &pressure);
+	fclose(pressureFile);
+	if(fieldsRead == 1)
+	{
+		return pressure;
+	}
+#endif
+	return -1;
+}
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,71 @@
+#ifndef __LOWIMPACT_H__
+#define __LOWIMPACT_H__
+
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// Limits the rate of something (bytes, files, whatever) to a number of tokens per second, allowing short bursts.
+// Safe to use from multiple threads.
+class TokenBucket
+{
+private:
+	double m_rate; // Tokens per second. 0 means unlimited.
+	double m_capacity; // Most tokens that can be saved up for a burst
+	double m_tokens; // Tokens available right now. Can go negative when a request is bigger than what's available.
+	boost::posix_time::ptime m_lastRefill;
+	boost::mutex m_mutex;
+
+	// Not copyable
+	TokenBucket(const TokenBucket&);
+	TokenBucket& operator=(const TokenBucket&);
+
+public:
+	// Creates a token bucket that starts full. A rate of 0 means no limit.
+	TokenBucket(double ratePerSecond, double capacity);
+
+	// Takes the given number of tokens, sleeping until they are available.
+	// Taking more than the capacity is allowed; it just means a longer wait.
+	void Take(double tokens);
+};
+
+// Lowers the priority of the calling thread (and threads it creates afterwards) as far as it goes: idle CPU
+// scheduling and idle I/O priority on Linux, idle priority class on Windows. Returns false if any of it couldn't
+// be done.
+bool UseIdlePriority();
+
+// Restricts the calling thread to the given CPU cores. Returns false if it couldn't be done or the platform doesn't
+// support it. An empty list does nothing and returns true.
+bool PinCurrentThreadToCores(const std::vector<int>& cores);
+
+// Gets the 1 minute system load average, or -1 if it isn't available.
+double GetLoadAverage();
+
+// Gets the percentage of the last 10 seconds some task was stalled waiting on I/O, from Linux pressure stall
+// information. Returns -1 if it isn't available.
+double GetIoPressure();
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
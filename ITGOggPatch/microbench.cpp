@@ -0,0 +1,504 @@
+// Micro-benchmarks for the Ogg parsing, checksum, and decoding code, built with "make microbench". Not part of
+// itgoggpatch. Each benchmark prints a line of JSON with how long an operation takes, how many bytes per second that
+// is, and how many heap allocations it does, so runs before and after a change can be compared by a script.
+//
+// Usage: microbench [--min-time seconds] [--filter text] [song.ogg]
+//
+// Files are read from memory through a MemoryIoBackend so that only CPU time is measured. The page walking
+// benchmarks use a made-up Ogg file. GetRealTime() needs a real Vorbis stream, so it is only measured when a .ogg
+// file is given.
+
+#include "stdafx.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "ogglength.h"
+#include "oggio.h"
+#include "oggcrc.h"
+#include "oggsync.h"
+#include "utilities.h"
+#include "flatjson.h"
+
+using namespace std;
+using namespace lhcutilities;
+using namespace ogglength;
+namespace pt = boost::posix_time;
+
+// Every heap allocation goes through here so benchmarks can report allocations per operation.
+namespace
+{
+boost::uint64_t g_numAllocations = 0;
+}
+
+#if __cplusplus >= 201103L
+#define MICROBENCH_NEW_THROWS
+#define MICROBENCH_NOTHROW noexcept
+#else
+#define MICROBENCH_NEW_THROWS throw(std::bad_alloc)
+#define MICROBENCH_NOTHROW throw()
+#endif
+
+void* operator new(std::size_t size) MICROBENCH_NEW_THROWS
+{
+	g_numAllocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if(memory == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) MICROBENCH_NOTHROW
+{
+	free(memory);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* memory, std::size_t) MICROBENCH_NOTHROW
+{
+	free(memory);
+}
+#endif
+
+namespace
+{
+
+// Results are added into this so the compiler can't throw away the work being timed.
+volatile boost::uint64_t g_sink = 0;
+
+// The path the made-up file is stored under in the MemoryIoBackend
+const char* const s_fixturePath = "fixture.ogg";
+
+// What the benchmarks work on
+struct Fixtures
+{
+	vector<unsigned char> oggFile; // The made-up file
+	boost::uint64_t numPages; // Number of pages in the made-up file
+	vector<unsigned char> randomBytes; // 1 MB with no capture pattern in it
+	vector<unsigned char> page; // A full-size page body to checksum
+	vector<unsigned char> segmentTable; // A full segment table
+	FILE* file; // The made-up file, for the FILE* functions
+	string realFilePath; // A real .ogg file given on the command line, empty if none
+	boost::uint64_t realFileSize;
+
+	Fixtures() : oggFile(), numPages(0), randomBytes(), page(), segmentTable(), file(NULL), realFilePath(),
+		realFileSize(0)
+	{
+	}
+
+private:
+	// Not copyable
+	Fixtures(const Fixtures&);
+	Fixtures& operator=(const Fixtures&);
+};
+
+Fixtures g_fixtures;
+
+// A benchmark does its operation numOps times.
+typedef void (*BenchmarkFunction)(boost::uint64_t numOps);
+
+struct Benchmark
+{
+	string name;
+	BenchmarkFunction function;
+	boost::uint64_t bytesPerOp; // For the bytes per second figure. 0 if it doesn't mean anything.
+
+	Benchmark(const string& name_, BenchmarkFunction function_, boost::uint64_t bytesPerOp_) : name(name_),
+		function(function_), bytesPerOp(bytesPerOp_)
+	{
+	}
+};
+
+// Simple deterministic random numbers so every run works on the same bytes.
+boost::uint32_t NextRandom(boost::uint32_t& state)
+{
+	state = state * 1664525 + 1013904223;
+	return state >> 8;
+}
+
+// Appends an Ogg page with the given body and a correct checksum.
+void AppendPage(vector<unsigned char>& file, unsigned char headerType, ogg_int64_t granulePosition,
+	ogg_int32_t sequenceNumber, const vector<unsigned char>& body)
+{
+	vector<unsigned char> header;
+	header.push_back('O');
+	header.push_back('g');
+	header.push_back('g');
+	header.push_back('S');
+	header.push_back(0);
+	header.push_back(headerType);
+	AppendBytes(header, granulePosition);
+	AppendBytes(header, static_cast<ogg_int32_t>(0x1234)); // Serial number
+	AppendBytes(header, sequenceNumber);
+	AppendBytes(header, static_cast<ogg_uint32_t>(0)); // Checksum, filled in below
+	vector<unsigned char> segments(body.size() / 255, 255);
+	segments.push_back(static_cast<unsigned char>(body.size() % 255));
+	header.push_back(static_cast<unsigned char>(segments.size()));
+	header.insert(header.end(), segments.begin(), segments.end());
+
+	ogg_uint32_t checksum = ComputePageChecksum(&(header[0]), header.size(), body.empty() ? NULL : &(body[0]),
+		body.size());
+	for(int byteIndex = 0; byteIndex < 4; byteIndex++)
+	{
+		header[22 + byteIndex] = static_cast<unsigned char>(checksum >> (8 * byteIndex));
+	}
+	file.insert(file.end(), header.begin(), header.end());
+	file.insert(file.end(), body.begin(), body.end());
+}
+
+// Makes a 4 minute 44.1 kHz file of 4 KB pages, about what a 128 kbit/s song is. Only the identification header is
+// real Vorbis; the rest is random bytes, which is all that walking pages looks at.
+void MakeFixtures(MemoryIoBackend& backend)
+{
+	boost::uint32_t randomState = 1;
+	const boost::uint32_t sampleRate = 44100;
+	const ogg_int64_t numSeconds = 240;
+	const ogg_int64_t numSamples = numSeconds * sampleRate;
+	const ogg_int64_t bitsPerSecond = 128000;
+	const size_t pageBodySize = 4096;
+
+	vector<unsigned char> identification;
+	identification.push_back(1);
+	const char* vorbis = "vorbis";
+	identification.insert(identification.end(), vorbis, vorbis + 6);
+	AppendBytes(identification, static_cast<ogg_uint32_t>(0)); // Vorbis version
+	identification.push_back(2); // Channels
+	AppendBytes(identification, sampleRate);
+	AppendBytes(identification, static_cast<ogg_int32_t>(0)); // Maximum bitrate
+	AppendBytes(identification, static_cast<ogg_int32_t>(bitsPerSecond)); // Nominal bitrate
+	AppendBytes(identification, static_cast<ogg_int32_t>(0)); // Minimum bitrate
+	identification.push_back(0xb8); // Block sizes
+	identification.push_back(1); // Framing bit
+
+	ogg_int32_t sequenceNumber = 0;
+	AppendPage(g_fixtures.oggFile, 2, 0, sequenceNumber++, identification);
+	const ogg_int64_t numAudioPages = numSeconds * bitsPerSecond / 8 / static_cast<ogg_int64_t>(pageBodySize);
+	for(ogg_int64_t pageIndex = 0; pageIndex <= numAudioPages; pageIndex++)
+	{
+		vector<unsigned char> body(pageBodySize);
+		for(size_t byteIndex = 0; byteIndex < body.size(); byteIndex++)
+		{
+			body[byteIndex] = static_cast<unsigned char>(NextRandom(randomState));
+		}
+		bool last = pageIndex == numAudioPages;
+		AppendPage(g_fixtures.oggFile, last ? 4 : 0, numSamples * pageIndex / numAudioPages, sequenceNumber++, body);
+	}
+	g_fixtures.numPages = sequenceNumber;
+	backend.AddFile(s_fixturePath, g_fixtures.oggFile);
+
+	g_fixtures.randomBytes.resize(1024 * 1024);
+	for(size_t byteIndex = 0; byteIndex < g_fixtures.randomBytes.size(); byteIndex++)
+	{
+		// No 'O', so there is never a capture pattern and the whole buffer is searched.
+		g_fixtures.randomBytes[byteIndex] = static_cast<unsigned char>(NextRandom(randomState) % 'O');
+	}
+	g_fixtures.page.assign(g_fixtures.randomBytes.begin(), g_fixtures.randomBytes.begin() + 255 * 255);
+	g_fixtures.segmentTable.assign(255, 0);
+	for(size_t segmentIndex = 0; segmentIndex < g_fixtures.segmentTable.size(); segmentIndex++)
+	{
+		g_fixtures.segmentTable[segmentIndex] = static_cast<unsigned char>(NextRandom(randomState));
+	}
+
+	g_fixtures.file = tmpfile();
+	if(g_fixtures.file == NULL)
+	{
+		throw IoError("Could not create a temporary file.");
+	}
+	WriteBytesOrDie(g_fixtures.file, g_fixtures.oggFile);
+}
+
+void BenchReadTemplate(boost::uint64_t numOps)
+{
+	// Reads 4 bytes at a time through stdio like the old page walk did.
+	SeekOrDie(g_fixtures.file, 0, Seek_Set);
+	long fileSize = static_cast<long>(g_fixtures.oggFile.size());
+	long position = 0;
+	boost::uint64_t sum = 0;
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		if(position + 4 > fileSize)
+		{
+			SeekOrDie(g_fixtures.file, 0, Seek_Set);
+			position = 0;
+		}
+		sum += ReadOrDie<ogg_uint32_t>(g_fixtures.file);
+		position += 4;
+	}
+	g_sink += sum;
+}
+
+void BenchGetFromBytes(boost::uint64_t numOps)
+{
+	const vector<unsigned char>& bytes = g_fixtures.randomBytes;
+	size_t lastOffset = bytes.size() - sizeof(ogg_int64_t);
+	size_t offset = 0;
+	boost::uint64_t sum = 0;
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		sum += static_cast<boost::uint64_t>(GetFromBytes<ogg_int64_t>(bytes, offset));
+		offset = offset < lastOffset ? offset + 8 : 0;
+	}
+	g_sink += sum;
+}
+
+void BenchAppendBytes(boost::uint64_t numOps)
+{
+	// Builds the fixed part of a page header the way OggPageHeader::ToBytes() does.
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		vector<unsigned char> header;
+		header.push_back('O');
+		header.push_back('g');
+		header.push_back('g');
+		header.push_back('S');
+		header.push_back(0);
+		header.push_back(0);
+		AppendBytes(header, static_cast<ogg_int64_t>(op));
+		AppendBytes(header, static_cast<ogg_int32_t>(0x1234));
+		AppendBytes(header, static_cast<ogg_int32_t>(op));
+		AppendBytes(header, static_cast<ogg_int32_t>(0));
+		header.push_back(0);
+		g_sink += header.size();
+	}
+}
+
+void BenchSegmentSum(boost::uint64_t numOps)
+{
+	boost::uint64_t sum = 0;
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		sum += SumSegmentSizes(&(g_fixtures.segmentTable[0]), g_fixtures.segmentTable.size());
+	}
+	g_sink += sum;
+}
+
+void BenchChecksum(boost::uint64_t numOps, size_t pageSize)
+{
+	// 27 byte header and the rest body, like a real page
+	const unsigned char* page = &(g_fixtures.page[0]);
+	boost::uint64_t sum = 0;
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		sum += ComputePageChecksum(page, 27, page + 27, pageSize - 27);
+	}
+	g_sink += sum;
+}
+
+void BenchChecksumSmall(boost::uint64_t numOps)
+{
+	BenchChecksum(numOps, 256);
+}
+
+void BenchChecksumTypical(boost::uint64_t numOps)
+{
+	BenchChecksum(numOps, 4096);
+}
+
+void BenchChecksumLargest(boost::uint64_t numOps)
+{
+	BenchChecksum(numOps, 255 * 255);
+}
+
+void BenchCaptureSearchForward(boost::uint64_t numOps)
+{
+	const unsigned char* begin = &(g_fixtures.randomBytes[0]);
+	const unsigned char* end = begin + g_fixtures.randomBytes.size();
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		g_sink += FindCapturePattern(begin, end) - begin;
+	}
+}
+
+void BenchCaptureSearchBackward(boost::uint64_t numOps)
+{
+	const unsigned char* begin = &(g_fixtures.randomBytes[0]);
+	const unsigned char* end = begin + g_fixtures.randomBytes.size();
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		g_sink += FindLastCapturePattern(begin, end) - begin;
+	}
+}
+
+void BenchPageLayout(boost::uint64_t numOps)
+{
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		g_sink += GetPageLayout(s_fixturePath).pages.size();
+	}
+}
+
+void BenchLastPageSearch(boost::uint64_t numOps)
+{
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		g_sink += static_cast<boost::uint64_t>(GetReportedTimeUpperBound(s_fixturePath));
+	}
+}
+
+void BenchRealTime(boost::uint64_t numOps)
+{
+	for(boost::uint64_t op = 0; op < numOps; op++)
+	{
+		g_sink += static_cast<boost::uint64_t>(GetRealTime(g_fixtures.realFilePath.c_str()));
+	}
+}
+
+// Runs a benchmark with more and more operations until a run takes at least minSeconds, then prints that run.
+void RunBenchmark(const Benchmark& benchmark, double minSeconds, ostream& output)
+{
+	benchmark.function(1); // Warm up caches and pools
+
+	boost::uint64_t numOps = 1;
+	while(true)
+	{
+		boost::uint64_t allocationsBefore = g_numAllocations;
+		pt::ptime start = pt::microsec_clock::universal_time();
+		benchmark.function(numOps);
+		double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+		boost::uint64_t numAllocations = g_numAllocations - allocationsBefore;
+
+		if(seconds >= minSeconds)
+		{
+			output << "{\"benchmark\":" << JsonQuote(benchmark.name)
+				<< ",\"iterations\":" << numOps
+				<< ",\"ns_per_op\":" << JsonNumber(seconds * 1e9 / numOps)
+				<< ",\"bytes_per_second\":"
+				<< (benchmark.bytesPerOp > 0 ? JsonNumber(benchmark.bytesPerOp * static_cast<double>(numOps) / seconds)
+					: "null")
+				<< ",\"allocs_per_op\":" << JsonNumber(static_cast<double>(numAllocations) / numOps)
+				<< "}" << endl;
+			return;
+		}
+
+		// Aim a bit past the minimum time based on this run, but at most 100 times as many operations.
+		boost::uint64_t nextNumOps = numOps * 100;
+		if(seconds > 0)
+		{
+			double estimate = numOps * minSeconds * 1.2 / seconds;
+			if(estimate < nextNumOps)
+			{
+				nextNumOps = static_cast<boost::uint64_t>(estimate) + 1;
+			}
+		}
+		numOps = nextNumOps > numOps ? nextNumOps : numOps + 1;
+	}
+}
+
+void PrintUsage(const char* programName)
+{
+	cerr << "Usage: " << programName << " [--min-time seconds] [--filter text] [song.ogg]" << endl;
+	cerr << "Prints a line of JSON for each benchmark whose name contains the filter text. GetRealTime() is only"
+		<< " measured on the given .ogg file." << endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	double minSeconds = 0.5;
+	string filter;
+	for(int argIndex = 1; argIndex < argc; argIndex++)
+	{
+		string arg = argv[argIndex];
+		if(arg == "--help")
+		{
+			PrintUsage(argv[0]);
+			return 0;
+		}
+		else if(arg == "--min-time" && argIndex + 1 < argc)
+		{
+			minSeconds = boost::lexical_cast<double>(argv[++argIndex]);
+		}
+		else if(arg == "--filter" && argIndex + 1 < argc)
+		{
+			filter = argv[++argIndex];
+		}
+		else if(arg.empty() || arg[0] == '-' || !g_fixtures.realFilePath.empty())
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		else
+		{
+			g_fixtures.realFilePath = arg;
+		}
+	}
+
+	try
+	{
+		MemoryIoBackend backend;
+		MakeFixtures(backend);
+		if(!g_fixtures.realFilePath.empty())
+		{
+			// Read it into memory and decode it from there, so disk speed doesn't count.
+			ScopedFile file(OpenOrDie(g_fixtures.realFilePath.c_str(), "rb"));
+			SeekOrDie(file.get(), 0, Seek_End);
+			long fileSize = TellOrDie(file.get());
+			SeekOrDie(file.get(), 0, Seek_Set);
+			backend.AddFile(g_fixtures.realFilePath, ReadBytesOrDie(file.get(), fileSize));
+			g_fixtures.realFileSize = fileSize;
+		}
+		SetIoBackend(&backend);
+
+		boost::uint64_t fixtureSize = g_fixtures.oggFile.size();
+		vector<Benchmark> benchmarks;
+		benchmarks.push_back(Benchmark("utilities/ReadOrDie<uint32>", BenchReadTemplate, 4));
+		benchmarks.push_back(Benchmark("utilities/GetFromBytes<int64>", BenchGetFromBytes, 8));
+		benchmarks.push_back(Benchmark("utilities/AppendBytes/page-header", BenchAppendBytes, 27));
+		benchmarks.push_back(Benchmark("page/segment-sum/255", BenchSegmentSum, 255));
+		benchmarks.push_back(Benchmark("page/crc/256", BenchChecksumSmall, 256));
+		benchmarks.push_back(Benchmark("page/crc/4096", BenchChecksumTypical, 4096));
+		benchmarks.push_back(Benchmark("page/crc/65025", BenchChecksumLargest, 255 * 255));
+		benchmarks.push_back(Benchmark("sync/forward/1MB", BenchCaptureSearchForward, g_fixtures.randomBytes.size()));
+		benchmarks.push_back(Benchmark("sync/backward/1MB", BenchCaptureSearchBackward,
+			g_fixtures.randomBytes.size()));
+		benchmarks.push_back(Benchmark("file/page-layout/" + boost::lexical_cast<string>(g_fixtures.numPages)
+			+ "-pages", BenchPageLayout, fixtureSize));
+		benchmarks.push_back(Benchmark("file/last-page-search", BenchLastPageSearch, 0));
+		if(!g_fixtures.realFilePath.empty())
+		{
+			benchmarks.push_back(Benchmark("file/real-time", BenchRealTime, g_fixtures.realFileSize));
+		}
+
+		for(vector<Benchmark>::size_type benchmarkIndex = 0; benchmarkIndex < benchmarks.size(); benchmarkIndex++)
+		{
+			if(benchmarks[benchmarkIndex].name.find(filter) != string::npos)
+			{
+				RunBenchmark(benchmarks[benchmarkIndex], minSeconds, cout);
+			}
+		}
+
+		SetIoBackend(NULL);
+		fclose(g_fixtures.file);
+	}
+	catch(std::exception& ex)
+	{
+		cerr << ex.what() << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
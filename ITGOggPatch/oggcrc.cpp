@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include "oggcrc.h"
+#include <cstddef>
+#include <ogg/ogg.h>
+
+using namespace std;
+
+namespace ogglength
+{
+
+namespace
+{
+
+// Lookup tables for slicing-by-8. table[0] is the usual byte-at-a-time table. table[k][b] is the CRC of byte b
+// followed by k zero bytes, which lets 8 bytes be folded in with independent lookups.
+class CrcTables
+{
+public:
+	ogg_uint32_t table[8][256];
+
+	CrcTables()
+	{
+		for(ogg_uint32_t byte = 0; byte < 256; byte++)
+		{
+			ogg_uint32_t crc = byte << 24;
+			for(int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc & 0x80000000) != 0 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+			}
+			table[0][byte] = crc;
+		}
+
+		for(int slice = 1; slice < 8; slice++)
+		{
+			for(int byte = 0; byte < 256; byte++)
+			{
+				ogg_uint32_t previous = table[slice - 1][byte];
+				table[slice][byte] = (previous << 8) ^ table[0][previous >> 24];
+			}
+		}
+	}
+};
+
+// Built during static initialization, before any threads that might use it exist.
+const CrcTables s_crcTables;
+
+} // end anonymous namespace
+
+ogg_uint32_t UpdateOggCrc(ogg_uint32_t crc, const unsigned char* data, size_t size)
+{
+	const ogg_uint32_t (*table)[256] = s_crcTables.table;
+
+	while(size >= 8)
+	{
+		crc ^= (static_cast<ogg_uint32_t>(data[0]) << 24) | (static_cast<ogg_uint32_t>(data[1]) << 16)
+			| (static_cast<ogg_uint32_t>(data[2]) << 8) | data[3];
+		crc = table[7][crc >> 24] ^ table[6][(crc >> 16) & 0xff] ^ table[5][(crc >> 8) & 0xff] ^ table[4][crc & 0xff]
+			^ table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+		data += 8;
+		size -= 8;
+	}
+
+	while(size > 0)
+	{
+		crc = (crc << 8) ^ table[0][(crc >> 24) ^ *data];
+		data++;
+		size--;
+	}
+
+	return crc;
+}
+
+ogg_uint32_t ComputePageChecksum(const unsigned char* headerBytes, size_t headerSize, const unsigned char* bodyBytes,
+	size_t bodySize)
+{
+	// The checksum field is bytes 22-25 of the header.
+	static const unsigned char zeroChecksum[4] = { 0, 0, 0, 0 };
+	ogg_uint32_t crc = UpdateOggCrc(0, headerBytes, 22);
+	crc = UpdateOggCrc(crc, zeroChecksum, 4);
+	crc = UpdateOggCrc(crc, headerBytes + 26, headerSize - 26);
+	return UpdateOggCrc(crc, bodyBytes, bodySize);
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
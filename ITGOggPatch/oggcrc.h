@@ -0,0 +1,39 @@
+#ifndef __OGGCRC_H__
+#define __OGGCRC_H__
+
+#include <cstddef>
+#include <ogg/ogg.h>
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// Continues the Ogg CRC-32 (polynomial 0x04c11db7, no reflection, no final xor) over the given bytes.
+// Start with a crc of 0. Works 8 bytes at a time, so it is several times faster than libogg's byte-at-a-time
+// version on older libogg releases.
+ogg_uint32_t UpdateOggCrc(ogg_uint32_t crc, const unsigned char* data, std::size_t size);
+
+// Computes the checksum an Ogg page should have. The checksum field in the header is treated as 0 as the Ogg spec
+// says, whatever it actually contains.
+ogg_uint32_t ComputePageChecksum(const unsigned char* headerBytes, std::size_t headerSize,
+	const unsigned char* bodyBytes, std::size_t bodySize);
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,517 @@
+#include "stdafx.h"
+#include "oggio.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include "utilities.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+using namespace lhcutilities;
+
+namespace ogglength
+{
+
+namespace
+{
+
+IoBackend* g_ioBackend = NULL;
+
+#ifndef _WIN32
+
+// Opens a file descriptor for an OggFile. Throws lhcutilities::IoError if it can't.
+int OpenDescriptorOrDie(const char* filePath, bool writable)
+{
+	int fd;
+	do
+	{
+		fd = open(filePath, writable ? O_RDWR : O_RDONLY);
+	} while(fd < 0 && errno == EINTR);
+
+	if(fd < 0)
+	{
+		throw IoError(string("Could not open file ") + filePath + ".");
+	}
+	return fd;
+}
+
+ogg_int64_t DescriptorSizeOrDie(int fd)
+{
+	struct stat fileInfo;
+	if(fstat(fd, &fileInfo) != 0)
+	{
+		throw IoError("Error reading from file.");
+	}
+	return static_cast<ogg_int64_t>(fileInfo.st_size);
+}
+
+void PwriteOrDie(int fd, ogg_int64_t offset, const void* data, size_t numBytes)
+{
+	const char* bytes = static_cast<const char*>(data);
+	while(numBytes > 0)
+	{
+		ssize_t written = pwrite(fd, bytes, numBytes, static_cast<off_t>(offset));
+		if(written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(written <= 0)
+		{
+			throw IoError("Error while writing.");
+		}
+		bytes += written;
+		offset += written;
+		numBytes -= static_cast<size_t>(written);
+	}
+}
+
+void CloseDescriptorOrDie(int& fd)
+{
+	int closing = fd;
+	fd = -1;
+	if(close(closing) != 0)
+	{
+		throw IoError("Error while closing file.");
+	}
+}
+
+class PreadFile : public OggFile
+{
+private:
+	int m_fd;
+
+	// Not copyable
+	PreadFile(const PreadFile&);
+	PreadFile& operator=(const PreadFile&);
+
+public:
+	PreadFile(const char* filePath, bool writable) : m_fd(OpenDescriptorOrDie(filePath, writable))
+	{
+	}
+
+	~PreadFile()
+	{
+		if(m_fd >= 0)
+		{
+			close(m_fd);
+		}
+	}
+
+	ogg_int64_t Size()
+	{
+		return DescriptorSizeOrDie(m_fd);
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		char* bytes = static_cast<char*>(buffer);
+		size_t totalRead = 0;
+		while(totalRead < numBytes)
+		{
+			ssize_t bytesRead = pread(m_fd, bytes + totalRead, numBytes - totalRead,
+				static_cast<off_t>(offset + totalRead));
+			if(bytesRead < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(bytesRead < 0)
+			{
+				throw IoError("Error reading from file.");
+			}
+			if(bytesRead == 0)
+			{
+				break; // End of file
+			}
+			totalRead += static_cast<size_t>(bytesRead);
+		}
+		return totalRead;
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		PwriteOrDie(m_fd, offset, data, numBytes);
+	}
+
+	void Close()
+	{
+		if(m_fd >= 0)
+		{
+			CloseDescriptorOrDie(m_fd);
+		}
+	}
+};
+
+class MappedFile : public OggFile
+{
+private:
+	int m_fd;
+	const unsigned char* m_contents; // NULL for an empty file, which can't be mapped
+	size_t m_size; // Size of the mapping, which stays the size the file was when opened
+
+	// Not copyable
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void Unmap()
+	{
+		if(m_contents != NULL)
+		{
+			munmap(const_cast<unsigned char*>(m_contents), m_size);
+			m_contents = NULL;
+		}
+	}
+
+public:
+	MappedFile(const char* filePath, bool writable) : m_fd(OpenDescriptorOrDie(filePath, writable)), m_contents(NULL),
+		m_size(0)
+	{
+		try
+		{
+			m_size = static_cast<size_t>(DescriptorSizeOrDie(m_fd));
+		}
+		catch(IoError&)
+		{
+			close(m_fd);
+			throw;
+		}
+		if(m_size == 0)
+		{
+			return;
+		}
+
+		void* mapping = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if(mapping == MAP_FAILED)
+		{
+			close(m_fd);
+			throw IoError(string("Could not map ") + filePath + " into memory.");
+		}
+		m_contents = static_cast<const unsigned char*>(mapping);
+
+		// Most reads walk the file front to back, so have the kernel read well ahead.
+		madvise(mapping, m_size, MADV_SEQUENTIAL);
+	}
+
+	~MappedFile()
+	{
+		Unmap();
+		if(m_fd >= 0)
+		{
+			close(m_fd);
+		}
+	}
+
+	ogg_int64_t Size()
+	{
+		return static_cast<ogg_int64_t>(m_size);
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		if(offset < 0 || static_cast<boost::uint64_t>(offset) >= m_size)
+		{
+			return 0;
+		}
+		size_t numToCopy = min(numBytes, m_size - static_cast<size_t>(offset));
+		memcpy(buffer, m_contents + offset, numToCopy);
+		return numToCopy;
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		// The mapping is shared, so it sees what is written.
+		PwriteOrDie(m_fd, offset, data, numBytes);
+	}
+
+	void Close()
+	{
+		Unmap();
+		if(m_fd >= 0)
+		{
+			CloseDescriptorOrDie(m_fd);
+		}
+	}
+};
+
+#else
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996) // 'fopen': This function or variable may be unsafe. Consider using fopen_s instead.
+#endif
+// Stands in for PreadFile where there is no pread.
+class StdioFile : public OggFile
+{
+private:
+	ScopedFile m_file;
+
+public:
+	StdioFile(const char* filePath, bool writable) : m_file(OpenOrDie(filePath, writable ? "r+b" : "rb"))
+	{
+	}
+
+	ogg_int64_t Size()
+	{
+		if(_fseeki64(m_file.get(), 0, SEEK_END) != 0)
+		{
+			throw IoError("Error reading from file.");
+		}
+		return _ftelli64(m_file.get());
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		if(_fseeki64(m_file.get(), offset, SEEK_SET) != 0)
+		{
+			throw IoError("Error reading from file.");
+		}
+		size_t bytesRead = fread(buffer, 1, numBytes, m_file.get());
+		if(bytesRead < numBytes && ferror(m_file.get()))
+		{
+			throw IoError("Error reading from file.");
+		}
+		return bytesRead;
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		if(_fseeki64(m_file.get(), offset, SEEK_SET) != 0 || fwrite(data, 1, numBytes, m_file.get()) < numBytes)
+		{
+			throw IoError("Error while writing.");
+		}
+	}
+
+	void Close()
+	{
+		m_file.CloseOrDie();
+	}
+};
+#ifdef _MSC_VER
+#pragma warning(default:4996)
+#endif
+
+#endif // _WIN32
+
+// A file in a MemoryIoBackend, or a whole file read into memory. Shares its bytes with the backend.
+class MemoryFile : public OggFile
+{
+private:
+	boost::shared_ptr<vector<unsigned char> > m_contents;
+	bool m_writable;
+
+public:
+	MemoryFile(boost::shared_ptr<vector<unsigned char> > contents, bool writable) : m_contents(contents),
+		m_writable(writable)
+	{
+	}
+
+	ogg_int64_t Size()
+	{
+		return static_cast<ogg_int64_t>(m_contents->size());
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		if(offset < 0 || static_cast<boost::uint64_t>(offset) >= m_contents->size())
+		{
+			return 0;
+		}
+		size_t numToCopy = min(numBytes, m_contents->size() - static_cast<size_t>(offset));
+		memcpy(buffer, &((*m_contents)[static_cast<size_t>(offset)]), numToCopy);
+		return numToCopy;
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		if(!m_writable)
+		{
+			throw IoError("The file was opened read-only.");
+		}
+		size_t end = static_cast<size_t>(offset) + numBytes;
+		if(end > m_contents->size())
+		{
+			m_contents->resize(end);
+		}
+		memcpy(&((*m_contents)[static_cast<size_t>(offset)]), data, numBytes);
+	}
+
+	void Close()
+	{
+	}
+};
+
+// A file opened by a CountingIoBackend. Passes everything through to the real file and counts the bytes.
+class CountedFile : public OggFile
+{
+private:
+	boost::shared_ptr<OggFile> m_file;
+	CountingIoBackend& m_backend;
+
+public:
+	CountedFile(boost::shared_ptr<OggFile> file, CountingIoBackend& backend) : m_file(file), m_backend(backend)
+	{
+	}
+
+	ogg_int64_t Size()
+	{
+		return m_file->Size();
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		size_t bytesRead = m_file->ReadAt(offset, buffer, numBytes);
+		m_backend.Count(bytesRead, 0);
+		return bytesRead;
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		m_file->WriteAt(offset, data, numBytes);
+		m_backend.Count(0, numBytes);
+	}
+
+	void Close()
+	{
+		m_file->Close();
+	}
+};
+
+} // end anonymous namespace
+
+boost::shared_ptr<OggFile> PreadIoBackend::Open(const char* filePath, bool writable)
+{
+#ifndef _WIN32
+	return boost::shared_ptr<OggFile>(new PreadFile(filePath, writable));
+#else
+	return boost::shared_ptr<OggFile>(new StdioFile(filePath, writable));
+#endif
+}
+
+boost::shared_ptr<OggFile> MmapIoBackend::Open(const char* filePath, bool writable)
+{
+#ifndef _WIN32
+	return boost::shared_ptr<OggFile>(new MappedFile(filePath, writable));
+#else
+	if(writable)
+	{
+		// Writes have to reach the disk, so this is no different from reading through stdio.
+		return boost::shared_ptr<OggFile>(new StdioFile(filePath, writable));
+	}
+	StdioFile file(filePath, false);
+	boost::shared_ptr<vector<unsigned char> > contents(new vector<unsigned char>(
+		static_cast<size_t>(file.Size())));
+	if(!contents->empty() && file.ReadAt(0, &((*contents)[0]), contents->size()) < contents->size())
+	{
+		throw IoError("Unexpected end of file.");
+	}
+	return boost::shared_ptr<OggFile>(new MemoryFile(contents, false));
+#endif
+}
+
+void MemoryIoBackend::AddFile(const string& filePath, const vector<unsigned char>& contents)
+{
+	boost::shared_ptr<vector<unsigned char> > copy(new vector<unsigned char>(contents));
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_files[filePath] = copy;
+}
+
+bool MemoryIoBackend::GetFile(const string& filePath, vector<unsigned char>& contentsOut) const
+{
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	map<string, boost::shared_ptr<vector<unsigned char> > >::const_iterator file = m_files.find(filePath);
+	if(file == m_files.end())
+	{
+		return false;
+	}
+	contentsOut = *(file->second);
+	return true;
+}
+
+boost::shared_ptr<OggFile> MemoryIoBackend::Open(const char* filePath, bool writable)
+{
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	map<string, boost::shared_ptr<vector<unsigned char> > >::const_iterator file = m_files.find(filePath);
+	if(file == m_files.end())
+	{
+		throw IoError(string("Could not open file ") + filePath + ".");
+	}
+	return boost::shared_ptr<OggFile>(new MemoryFile(file->second, writable));
+}
+
+CountingIoBackend::CountingIoBackend(IoBackend* backend) : m_defaultBackend(),
+	m_backend(backend != NULL ? backend : &m_defaultBackend), m_mutex(), m_bytesRead(0), m_bytesWritten(0)
+{
+}
+
+boost::uint64_t CountingIoBackend::BytesRead() const
+{
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_bytesRead;
+}
+
+boost::uint64_t CountingIoBackend::BytesWritten() const
+{
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_bytesWritten;
+}
+
+void CountingIoBackend::Count(boost::uint64_t bytesRead, boost::uint64_t bytesWritten)
+{
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_bytesRead += bytesRead;
+	m_bytesWritten += bytesWritten;
+}
+
+boost::shared_ptr<OggFile> CountingIoBackend::Open(const char* filePath, bool writable)
+{
+	return boost::shared_ptr<OggFile>(new CountedFile(m_backend->Open(filePath, writable), *this));
+}
+
+void SetIoBackend(IoBackend* backend)
+{
+	g_ioBackend = backend;
+}
+
+IoBackend* GetIoBackend()
+{
+	return g_ioBackend;
+}
+
+boost::shared_ptr<OggFile> OpenOggFile(const char* filePath, bool writable)
+{
+	if(g_ioBackend != NULL)
+	{
+		return g_ioBackend->Open(filePath, writable);
+	}
+	PreadIoBackend defaultBackend;
+	return defaultBackend.Open(filePath, writable);
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
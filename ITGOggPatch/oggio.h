@@ -0,0 +1,148 @@
+#ifndef __OGGIO_H__
+#define __OGGIO_H__
+
+#include <ogg/ogg.h>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// A file opened by an IoBackend. Reads and writes are by offset, so one file can be read by libvorbisfile and
+// ogglength's own page walking without them fighting over a file position. Errors throw lhcutilities::IoError.
+class OggFile
+{
+public:
+	virtual ~OggFile()
+	{
+	}
+
+	// Gets the size of the file in bytes.
+	virtual ogg_int64_t Size() = 0;
+
+	// Reads up to numBytes bytes starting at offset into buffer. Returns the number of bytes read, which is only
+	// less than numBytes at the end of the file.
+	virtual std::size_t ReadAt(ogg_int64_t offset, void* buffer, std::size_t numBytes) = 0;
+
+	// Writes numBytes bytes from data starting at offset. Throws if the file was opened read-only.
+	virtual void WriteAt(ogg_int64_t offset, const void* data, std::size_t numBytes) = 0;
+
+	// Closes the file, throwing if something written didn't make it. Destroying the file without calling this
+	// closes it without reporting errors.
+	virtual void Close() = 0;
+};
+
+// Opens files for the ogglength functions. See SetIoBackend().
+class IoBackend
+{
+public:
+	virtual ~IoBackend()
+	{
+	}
+
+	// Opens a file for reading, and for writing too if writable is true. Throws lhcutilities::IoError if it can't.
+	virtual boost::shared_ptr<OggFile> Open(const char* filePath, bool writable) = 0;
+};
+
+// Reads and writes files with pread and pwrite, one system call per read. This is the default. On Windows, which
+// has no pread, it seeks and reads with stdio instead.
+class PreadIoBackend : public IoBackend
+{
+public:
+	boost::shared_ptr<OggFile> Open(const char* filePath, bool writable);
+};
+
+// Maps files into memory so that reading them is copying from the page cache with no system calls. Writes go
+// through pwrite and show up in the mapping. On Windows the whole file is read into memory instead.
+class MmapIoBackend : public IoBackend
+{
+public:
+	boost::shared_ptr<OggFile> Open(const char* filePath, bool writable);
+};
+
+// Files that only exist in memory, looked up by the exact path string they were added with. Lets the cost of
+// parsing and decoding be measured without any disk I/O, and lets files be patched without touching the disk.
+// Safe to use from multiple threads.
+class MemoryIoBackend : public IoBackend
+{
+private:
+	mutable boost::mutex m_mutex;
+	std::map<std::string, boost::shared_ptr<std::vector<unsigned char> > > m_files;
+
+public:
+	MemoryIoBackend() : m_mutex(), m_files()
+	{
+	}
+
+	// Adds a file, replacing any file already at filePath.
+	void AddFile(const std::string& filePath, const std::vector<unsigned char>& contents);
+
+	// Gets the current contents of a file, including anything written to it. Returns false if there is no such file.
+	bool GetFile(const std::string& filePath, std::vector<unsigned char>& contentsOut) const;
+
+	boost::shared_ptr<OggFile> Open(const char* filePath, bool writable);
+};
+
+// Counts the bytes read and written through another backend, for reporting how much I/O was done. Safe to use from
+// multiple threads if the other backend is.
+class CountingIoBackend : public IoBackend
+{
+private:
+	PreadIoBackend m_defaultBackend;
+	IoBackend* m_backend;
+	mutable boost::mutex m_mutex;
+	boost::uint64_t m_bytesRead;
+	boost::uint64_t m_bytesWritten;
+
+	// Not copyable
+	CountingIoBackend(const CountingIoBackend&);
+	CountingIoBackend& operator=(const CountingIoBackend&);
+
+public:
+	// Files are opened with backend, or with a PreadIoBackend if it is NULL. The backend must outlive this one.
+	explicit CountingIoBackend(IoBackend* backend);
+
+	boost::uint64_t BytesRead() const;
+	boost::uint64_t BytesWritten() const;
+
+	// Adds to the counts. Called by the files this backend opens.
+	void Count(boost::uint64_t bytesRead, boost::uint64_t bytesWritten);
+
+	boost::shared_ptr<OggFile> Open(const char* filePath, bool writable);
+};
+
+// Sets the backend that all ogglength functions open files with, or NULL for a PreadIoBackend (the default).
+// The backend must outlive any ogglength calls that use it.
+void SetIoBackend(IoBackend* backend);
+
+// Gets the backend set with SetIoBackend(), or NULL if the default is being used.
+IoBackend* GetIoBackend();
+
+// Opens a file with the backend set with SetIoBackend(). Throws lhcutilities::IoError if it can't.
+boost::shared_ptr<OggFile> OpenOggFile(const char* filePath, bool writable);
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -2,11 +2,25 @@
 #include "ogglength.h"
 #include <vorbis/vorbisfile.h>
 #include "utilities.h"
+#include "oggpageindex.h"
+#include "vorbisdecoder.h"
+#include "oggcrc.h"
+#include "oggsync.h"
+#include "oggio.h"
 #include <vector>
 #include <cstdio>
+#include <cerrno>
 #include <string>
 #include <exception>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <sstream>
+#include <iomanip>
+#include <limits>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 // gcc can issue warnings for unused variables. It is common to read fields that are not otherwise needed
 // when reading a file format. Those variables are marked with the gcc "unused" attribute to suppress
@@ -42,317 +56,1499 @@ using namespace lhcutilities;
 namespace ogglength
 {
 
-OggVorbisFile::OggVorbisFile(const char* filePath) : m_handle(new _OggVorbisFile())
+// What libvorbisfile reads an OggVorbisFile from: a file from the I/O backend and libvorbisfile's position in it.
+struct OggVorbisFileSource
 {
-	// ov_fopen taking a char* instead of a const char* is an acknowledged bug in the API, so the cast is ok.
-	int openResult = ov_fopen(const_cast<char*>(filePath), &(m_handle->file));
-	if(openResult != 0)
+	boost::shared_ptr<OggFile> file;
+	ogg_int64_t position;
+
+	explicit OggVorbisFileSource(boost::shared_ptr<OggFile> file_) : file(file_), position(0)
 	{
-		throw OggVorbisError("Error opening Ogg Vorbis file.");
 	}
-	
-	m_handle->opened = true;
-}
+};
 
-OggVorbis_File* OggVorbisFile::get()
+namespace
 {
-	return &(m_handle->file);
+
+IoThrottle* g_ioThrottle = NULL;
+WarningListener* g_warningListener = NULL;
+
+void ThrottleIo(size_t numBytes)
+{
+	if(g_ioThrottle != NULL)
+	{
+		g_ioThrottle->BeforeIo(numBytes);
+	}
 }
 
-double GetReportedTime(const char* filePath)
+void Warn(const char* filePath, const string& message)
 {
-	OggVorbisFile oggFile(filePath);
-	double reportedTime = ov_time_total(oggFile.get(), -1);
-	if(reportedTime == OV_EINVAL) // I think this can happen if the file is marked as unseekable in the Vorbis headers?
+	if(g_warningListener != NULL)
 	{
-		throw OggVorbisError("Ogg Vorbis file is not seekable."); 
+		g_warningListener->Warn(filePath, message);
 	}
-	return reportedTime;
 }
 
-double GetRealTime(const char* filePath)
+// libvorbisfile callbacks for reading from an OggVorbisFileSource. Going through callbacks instead of ov_fopen lets
+// us throttle reads and read through whichever I/O backend is set, so decoding a mapped or in-memory file reads
+// straight from memory.
+size_t ReadCallback(void* buffer, size_t size, size_t count, void* datasource)
 {
-	// Get the real song length by decoding the vorbis stream and doing the math with the number of samples
-	// each ov_read gives.
-	
-	OggVorbisFile oggFile(filePath);
-	double totalTimeRead = 0; // in seconds
-	char buffer[4096];
-	int logicalBitstreamRead = -555; // Number of the logical bitstream of the current page
-	
-	// Number of the logical bitstream we've been reading the whole time, -1 if we're on the first page.
-	// If different from logicalBistreamRead, there's more than one logical bitstream so we bail.
-	int logicalBitstreamReading = -1;
+	OggVorbisFileSource* source = static_cast<OggVorbisFileSource*>(datasource);
+	ThrottleIo(size * count);
+	try
+	{
+		size_t bytesRead = source->file->ReadAt(source->position, buffer, size * count);
+		source->position += bytesRead;
+		errno = 0;
+		return bytesRead / size;
+	}
+	catch(IoError&)
+	{
+		errno = EIO; // libvorbisfile tells a read error from the end of the file by errno
+		return 0;
+	}
+}
 
-	long bytesRead;
-	int pcmWordSize = 2; // 16-bit samples
-	while((bytesRead = ov_read(oggFile.get(), buffer, 4096, 0, pcmWordSize, 1, &logicalBitstreamRead)) > 0)
+int SeekCallback(void* datasource, ogg_int64_t offset, int whence)
+{
+	OggVorbisFileSource* source = static_cast<OggVorbisFileSource*>(datasource);
+	try
 	{
-		if(logicalBitstreamReading == -1)
+		ogg_int64_t origin = 0;
+		if(whence == SEEK_CUR)
 		{
-			// First Ogg page - this should be the logical bitstream all pages are in.
-			logicalBitstreamReading = logicalBitstreamRead;
+			origin = source->position;
 		}
-		else if(logicalBitstreamReading != logicalBitstreamRead)
+		else if(whence == SEEK_END)
 		{
-			// A page in a logical bitstream different from the one we've been reading
-			throw OggVorbisError("More than one logical bitstream in the file. Can't handle that.");
+			origin = source->file->Size();
 		}
-		long samplesRead = bytesRead / pcmWordSize; // actually this is samples * channels
-		int numChannels = oggFile.get()->vi[logicalBitstreamRead].channels;
-		if(numChannels <= 0) // Don't crash with a divide by 0
+		if(origin + offset < 0)
 		{
-			throw OggVorbisError("Number of channels is not a positive number.");
+			return -1;
 		}
-		long samplesPerChannel = samplesRead / numChannels;
-		double timeRead = static_cast<double>(samplesPerChannel) / oggFile.get()->vi[logicalBitstreamRead].rate;
+		source->position = origin + offset;
+		return 0;
+	}
+	catch(IoError&)
+	{
+		return -1;
+	}
+}
+
+long TellCallback(void* datasource)
+{
+	return static_cast<long>(static_cast<OggVorbisFileSource*>(datasource)->position);
+}
+
+// Reads an OggFile front to back like a FILE*, for code that reads a file a field at a time.
+// lhcutilities::IoError is thrown for errors, the same as the FILE* functions in utilities.h.
+class FileCursor
+{
+private:
+	OggFile& m_file;
+	ogg_int64_t m_position;
 
-		totalTimeRead += timeRead;
+public:
+	explicit FileCursor(OggFile& file) : m_file(file), m_position(0)
+	{
 	}
 
-	if(bytesRead < 0)
+	OggFile& File() { return m_file; }
+	ogg_int64_t Tell() const { return m_position; }
+	void Seek(ogg_int64_t position) { m_position = position; }
+	void Skip(ogg_int64_t numBytes) { m_position += numBytes; }
+
+	// Reads numBytes, or fewer at the end of the file.
+	vector<unsigned char> ReadBytes(size_t numBytes)
 	{
-		throw OggVorbisError("Error while decoding. The file may be corrupt.");
+		vector<unsigned char> bytes(numBytes);
+		size_t bytesRead = numBytes == 0 ? 0 : m_file.ReadAt(m_position, &(bytes[0]), numBytes);
+		bytes.resize(bytesRead);
+		m_position += static_cast<ogg_int64_t>(bytesRead);
+		return bytes;
 	}
 
-	return totalTimeRead;
-}
+	// Reads numBytes. Throws lhcutilities::IoError if the file ends first.
+	vector<unsigned char> ReadBytesOrDie(size_t numBytes)
+	{
+		vector<unsigned char> bytes = ReadBytes(numBytes);
+		if(bytes.size() < numBytes)
+		{
+			throw IoError("Unexpected end of file.");
+		}
+		return bytes;
+	}
 
-void ChangeSongLength(const char* filePath, double numSeconds)
+	template<typename T>
+	T ReadOrDie()
+	{
+		return GetFromBytes<T>(ReadBytesOrDie(sizeof(T)));
+	}
+
+	// Writes bytes at the current position.
+	void WriteBytesOrDie(const vector<unsigned char>& bytes)
+	{
+		if(!bytes.empty())
+		{
+			m_file.WriteAt(m_position, &(bytes[0]), bytes.size());
+			m_position += static_cast<ogg_int64_t>(bytes.size());
+		}
+	}
+
+	template<typename T>
+	void WriteOrDie(T data)
+	{
+		vector<unsigned char> bytes;
+		AppendBytes(bytes, data);
+		WriteBytesOrDie(bytes);
+	}
+};
+
+// Reads the packets of an Ogg file that has a single logical bitstream, using libogg.
+class OggPacketReader
 {
-	// For details of the Ogg format, see http://xiph.org/ogg/doc/, http://xiph.org/ogg/doc/oggstream.html,
-	// http://xiph.org/ogg/doc/framing.html, http://en.wikipedia.org/wiki/Ogg
-	//
-	// For details of the Vorbis format, see http://xiph.org/vorbis/doc/Vorbis_I_spec.html
-	
-	FILE* file = NULL;
-	try
+private:
+	OggFile& m_file;
+	ogg_int64_t m_position; // Where to read the next bytes from
+	ogg_int64_t m_lastPageOffset; // Byte offset of the page NextPage() last returned
+	ogg_sync_state m_syncState;
+	ogg_stream_state m_streamState;
+	bool m_streamStarted; // Whether the first page has been read and m_streamState initialized
+	bool m_endOfFile;
+	ogg_int64_t m_resumePacketNumber; // Number of the first packet after a Seek(), -1 if not starting after one
+
+	static const long s_readSize = 65536;
+
+	// Not copyable
+	OggPacketReader(const OggPacketReader&);
+	OggPacketReader& operator=(const OggPacketReader&);
+
+public:
+	explicit OggPacketReader(OggFile& file) : m_file(file), m_position(0), m_lastPageOffset(0), m_syncState(),
+		m_streamState(), m_streamStarted(false), m_endOfFile(false), m_resumePacketNumber(-1)
 	{
-		// Ehhhh, can't be bothered to make an RAII class for FILE*'s, so just catch exceptions and close then and at the end.
-		file = OpenOrDie(filePath, "r+b");
+		ogg_sync_init(&m_syncState);
+	}
 
-		unsigned char version; // Version field of an Ogg page
-		unsigned char headerType; // Header type field of an Ogg page.
-		ogg_uint32_t sampleRate = 0;
-		ogg_int32_t savedBitstreamSerialNumber = 0; // assignment stops a gcc warning. I know that it will have been initialized when it's used.
+	~OggPacketReader()
+	{
+		if(m_streamStarted)
+		{
+			ogg_stream_clear(&m_streamState);
+		}
+		ogg_sync_clear(&m_syncState);
+	}
 
-		// Read Ogg pages until we get to the last page (indicated by the "end of stream" bit set in the Ogg page header).
-		// Have the seek pointer at granule position then.
-		// Special care if given to the first page, because that is the primary Vorbis header and contains
-		// the sample rate, which is needed to calculate what we should set the granule position of the last page to.
+	// Gets the next page, skipping over anything that isn't one. Returns false at the end of the file. The page is
+	// only good until the next call. It isn't given to the stream until AddPage() is called with it.
+	bool NextPage(ogg_page& page)
+	{
 		while(true)
 		{
-			// All Ogg pages begin with the bytes "OggS"
-			vector<unsigned char> buffer = ReadBytesOrDie(file, 4);
-			if(buffer[0] != 'O' || buffer[1] != 'g' || buffer[2] != 'g' || buffer[3] != 'S')
+			int result = ogg_sync_pageout(&m_syncState, &page);
+			if(result > 0)
 			{
-				throw OggVorbisError("File does not appear to be an Ogg file.");
+				ogg_int64_t bytesNotTaken = m_syncState.fill - m_syncState.returned;
+				m_lastPageOffset = m_position - bytesNotTaken - page.header_len - page.body_len;
+				return true;
 			}
-
-			// Ogg version field. Currently should always be 0.
-			version = ReadOrDie<unsigned char>(file);
-			if(version != 0)
+			else if(result < 0)
 			{
-				throw OggVorbisError("The file is corrupt.");
+				continue; // Skipped some garbage
+			}
+			else if(m_endOfFile)
+			{
+				return false;
 			}
 
-			// Header type field indicates if this page is the beginning,
-			// end, or middle of an Ogg logical bitstream.
-			// It is permitted for a page to be both beginning and end - that means it's the only page.
-			headerType = ReadOrDie<unsigned char>(file);
-			UNUSED bool continuation = CheckBit(headerType, 0);
-			UNUSED bool beginningOfStream = CheckBit(headerType, 1);
-			bool endOfStream = CheckBit(headerType, 2);
-
-			// End of stream bit was set in the header type field - this is the last page of the logical bitstream
-			if(endOfStream)
+			char* buffer = ogg_sync_buffer(&m_syncState, s_readSize);
+			ThrottleIo(s_readSize);
+			size_t bytesRead;
+			try
 			{
-				break;
+				bytesRead = m_file.ReadAt(m_position, buffer, s_readSize);
 			}
-			
-			// In Vorbis logical bitstreams, the granule position is the number of the last sample
-			// contained in this frame.
-			UNUSED ogg_int64_t granulePosition = ReadOrDie<ogg_int64_t>(file);
-			// Bitstream serial number might be of interest if we wanted to be able to handle Ogg files with
-			// multiple logical bitstreams...but we don't care.
-			ogg_int32_t bitstreamSerialNumber = ReadOrDie<ogg_int32_t>(file);
-			if(sampleRate != 0 && bitstreamSerialNumber != savedBitstreamSerialNumber)
+			catch(IoError&)
 			{
-				throw OggVorbisError("The file is not a simple Ogg Vorbis file.");
+				throw OggVorbisError("Error while reading the file.");
 			}
-			savedBitstreamSerialNumber = bitstreamSerialNumber;
-
-			UNUSED ogg_int32_t pageSequenceNumber = ReadOrDie<ogg_int32_t>(file);
-			UNUSED ogg_int32_t checksum = ReadOrDie<ogg_int32_t>(file);
-			unsigned char numSegments = ReadOrDie<unsigned char>(file);
+			m_position += static_cast<ogg_int64_t>(bytesRead);
+			m_endOfFile = bytesRead == 0;
+			ogg_sync_wrote(&m_syncState, static_cast<long>(bytesRead));
+		}
+	}
 
-			if(sampleRate == 0)
+	// Gives a page from NextPage() to the stream so its packets can be gotten with NextBufferedPacket().
+	// Throws ogglength::OggVorbisError if there is more than one logical bitstream.
+	void AddPage(ogg_page& page)
+	{
+		if(!m_streamStarted)
+		{
+			ogg_stream_init(&m_streamState, ogg_page_serialno(&page));
+			m_streamStarted = true;
+			if(m_resumePacketNumber >= 0)
 			{
-				// This is the first Ogg page, so it's the primary Vorbis header.
-				vector<unsigned char> segmentSizes = ReadBytesOrDie(file, numSegments);
-				ogg_uint32_t vorbisHeaderPacketSize = 0;
-				for(int segIndex = 0; segIndex < numSegments; segIndex++)
-				{
-					vorbisHeaderPacketSize += segmentSizes[segIndex];
-					if(segmentSizes[segIndex] < 255)
-					{
-						break; // a segment size of less than 255 indicates the end of a packet.
-					}
-				}
-
-				if(vorbisHeaderPacketSize < 16)
-				{
-					throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
-				}
-
-				unsigned char packetType = ReadOrDie<unsigned char>(file);
-				if(packetType != 1)
-				{
-					throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
-				}
-				
-				vector<unsigned char> vorbisString = ReadBytesOrDie(file, 6);
-				if(vorbisString[0] != 'v' || vorbisString[1] != 'o' || vorbisString[2] != 'r' 
-				|| vorbisString[3] != 'b' || vorbisString[4] != 'i' || vorbisString[5] != 's')
-				{
-					throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
-				}
-
-				ogg_uint32_t vorbisVersion = ReadOrDie<ogg_uint32_t>(file);
-				if(vorbisVersion != 0)
-				{
-					throw OggVorbisError("The file is corrupt.");
-				}
-
-				UNUSED unsigned char numChannels = ReadOrDie<unsigned char>(file);
-				sampleRate = ReadOrDie<ogg_uint32_t>(file);
-				if(sampleRate == 0)
-				{
-					throw OggVorbisError("The file is corrupt.");
-				}
+				// Carry on the numbering from before the Seek() so that libogg doesn't take the jump for lost pages
+				// and libvorbis doesn't take it for lost packets.
+				m_streamState.pageno = ogg_page_pageno(&page);
+				m_streamState.packetno = m_resumePacketNumber;
+				m_resumePacketNumber = -1;
+			}
+		}
+		else if(ogg_page_serialno(&page) != m_streamState.serialno)
+		{
+			// A page in a logical bitstream different from the one we've been reading
+			throw OggVorbisError("More than one logical bitstream in the file. Can't handle that.");
+		}
+		ogg_stream_pagein(&m_streamState, &page);
+	}
 
-				ogg_int32_t pageDataSize = 0;
-				for(unsigned char segmentIndex = 0; segmentIndex < numSegments; segmentIndex++)
-				{
-					unsigned char segmentSize = segmentSizes[segmentIndex];
-					pageDataSize += segmentSize;
-				}
+	// Gets the next packet from the pages added so far. The packet's data is only good until the next call.
+	// Returns false if another page is needed. Throws ogglength::OggVorbisError if pages are missing.
+	bool NextBufferedPacket(ogg_packet& packet)
+	{
+		if(!m_streamStarted)
+		{
+			return false;
+		}
+		int result = ogg_stream_packetout(&m_streamState, &packet);
+		if(result < 0)
+		{
+			throw OggVorbisError("Error while decoding. The file may be corrupt.");
+		}
+		return result > 0;
+	}
 
-				// Skip the rest of the page, we're not interested in it.
-				ogg_int32_t unreadDataBytes = pageDataSize - 16;
-				SeekOrDie(file, unreadDataBytes, Seek_Cur);
-			}
-			else
+	// Gets the next packet. The packet's data is only good until the next call. Returns false at the end of the
+	// file. Throws ogglength::OggVorbisError if pages are missing or there is more than one logical bitstream.
+	bool NextPacket(ogg_packet& packet)
+	{
+		while(!NextBufferedPacket(packet))
+		{
+			ogg_page page;
+			if(!NextPage(page))
 			{
-				// We're not reading the data portion of the page, so we don't need to know how
-				// large each segment is, just the total size.
-				ogg_int32_t pageDataSize = 0;
-				for(unsigned char segmentIndex = 0; segmentIndex < numSegments; segmentIndex++)
-				{
-					unsigned char segmentSize = ReadOrDie<unsigned char>(file);
-					pageDataSize += segmentSize;
-				}
-
-				// Skip the data of the page, we're not interested in it.
-				SeekOrDie(file, pageDataSize, Seek_Cur);
+				return false;
 			}
-			
+			AddPage(page);
 		}
+		return true;
+	}
 
-		if(sampleRate == 0)
+	// Starts reading again from the page at pageOffset, which is taken to be in the stream already being read with
+	// its first packet numbered packetNumber.
+	void Seek(ogg_int64_t pageOffset, ogg_int64_t packetNumber)
+	{
+		ogg_sync_reset(&m_syncState);
+		if(m_streamStarted)
 		{
-			throw OggVorbisError("The file is corrupt.");
+			ogg_stream_clear(&m_streamState);
+			m_streamStarted = false;
 		}
+		m_position = pageOffset;
+		m_endOfFile = false;
+		m_resumePacketNumber = packetNumber;
+	}
 
-		// Converting from seconds to samples might cause the result to be off be 1 if the number of seconds
-		// came from GetRealTime().
-		ogg_int64_t numSamples = static_cast<ogg_int64_t>(numSeconds * sampleRate);
+	// Gets the number that the next packet to come out of the stream will have.
+	ogg_int64_t NextPacketNumber() const { return m_streamStarted ? m_streamState.packetno : 0; }
 
-		// Remember where the granule position field is, we're going to edit it later.
-		// For now, we're reading the entire page so we can calculate what the checksum
-		// should be after we change the granule position field.
-		long granulePositionPosition = TellOrDie(file);
+	ogg_int64_t LastPageOffset() const { return m_lastPageOffset; }
 
-		ogg_int64_t granulePosition = ReadOrDie<ogg_int64_t>(file);
-		granulePosition = numSamples; // Set to what it will be for checksum calculation
+	// Gets the byte offset of the next bytes to read from the file.
+	ogg_int64_t Position() const { return m_position; }
+};
 
-		ogg_int32_t bitstreamSerialNumber = ReadOrDie<ogg_int32_t>(file);
-		ogg_int32_t pageSequenceNumber = ReadOrDie<ogg_int32_t>(file);
+} // end anonymous namespace
 
-		ogg_int32_t checksum = ReadOrDie<ogg_int32_t>(file);
-		checksum = 0; // Set to 0 for checksum calculation
+void SetIoThrottle(IoThrottle* throttle)
+{
+	g_ioThrottle = throttle;
+}
 
-		unsigned char numSegments = ReadOrDie<unsigned char>(file);
+void SetWarningListener(WarningListener* listener)
+{
+	g_warningListener = listener;
+}
 
-		vector<unsigned char> segmentSizes = ReadBytesOrDie(file, numSegments);
+OggVorbisFile::OggVorbisFile(const char* filePath) : m_handle(new _OggVorbisFile())
+{
+	try
+	{
+		m_handle->source.reset(new OggVorbisFileSource(OpenOggFile(filePath, false)));
+	}
+	catch(IoError&)
+	{
+		throw OggVorbisError("Error opening Ogg Vorbis file.");
+	}
 
-		// Reconstruct the header (with the new granule position) as a byte vector for checksumming
-		vector<unsigned char> headerBytes;
-		headerBytes.push_back('O');
-		headerBytes.push_back('g');
-		headerBytes.push_back('g');
-		headerBytes.push_back('S');
-		headerBytes.push_back(version);
-		headerBytes.push_back(headerType);
-		AppendBytes(headerBytes, granulePosition);
-		AppendBytes(headerBytes, bitstreamSerialNumber);
-		AppendBytes(headerBytes, pageSequenceNumber);
-		AppendBytes(headerBytes, checksum);
-		headerBytes.push_back(numSegments);
-		headerBytes.insert(headerBytes.end(), segmentSizes.begin(), segmentSizes.end());
+	// No close callback; the source is closed when m_handle is done with it.
+	ov_callbacks callbacks = { ReadCallback, SeekCallback, NULL, TellCallback };
+	int openResult = ov_open_callbacks(m_handle->source.get(), &(m_handle->file), NULL, 0, callbacks);
+	if(openResult != 0)
+	{
+		throw OggVorbisError("Error opening Ogg Vorbis file.");
+	}
+	
+	m_handle->opened = true;
+}
+
+OggVorbis_File* OggVorbisFile::get()
+{
+	return &(m_handle->file);
+}
+
+namespace
+{
+
+void CopyStreamInfo(const vorbis_info* info, const vorbis_comment* comment, VorbisStreamInfo& infoOut)
+{
+	infoOut.sampleRate = info->rate;
+	infoOut.channels = info->channels;
+	infoOut.bitrateNominal = info->bitrate_nominal;
+	infoOut.bitrateUpper = info->bitrate_upper;
+	infoOut.bitrateLower = info->bitrate_lower;
+	infoOut.vendor = comment->vendor != NULL ? comment->vendor : "";
+	infoOut.comments.clear();
+	for(int commentIndex = 0; commentIndex < comment->comments; commentIndex++)
+	{
+		infoOut.comments.push_back(string(comment->user_comments[commentIndex], comment->comment_lengths[commentIndex]));
+	}
+}
+
+double GetReportedTime(OggVorbisFile& oggFile)
+{
+	double reportedTime = ov_time_total(oggFile.get(), -1);
+	if(reportedTime == OV_EINVAL) // I think this can happen if the file is marked as unseekable in the Vorbis headers?
+	{
+		throw OggVorbisError("Ogg Vorbis file is not seekable."); 
+	}
+	return reportedTime;
+}
 
-		
-		// Calculate the size of the data part of the page
-		ogg_int32_t pageDataSize = 0;
-		for(unsigned char segmentIndex = 0; segmentIndex < numSegments; segmentIndex++)
+} // end anonymous namespace
+
+string VorbisStreamInfo::GetComment(const string& field) const
+{
+	string prefix = field + "=";
+	for(vector<string>::size_type commentIndex = 0; commentIndex < comments.size(); commentIndex++)
+	{
+		if(boost::istarts_with(comments[commentIndex], prefix))
 		{
-			unsigned char segmentSize = segmentSizes[segmentIndex];
-			pageDataSize += segmentSize;
+			return comments[commentIndex].substr(prefix.size());
 		}
+	}
+	return "";
+}
+
+double GetReportedTime(const char* filePath)
+{
+	OggVorbisFile oggFile(filePath);
+	return GetReportedTime(oggFile);
+}
+
+double GetReportedTime(const char* filePath, VorbisStreamInfo& infoOut)
+{
+	OggVorbisFile oggFile(filePath);
+	double reportedTime = GetReportedTime(oggFile);
+	CopyStreamInfo(ov_info(oggFile.get(), -1), ov_comment(oggFile.get(), -1), infoOut);
+	return reportedTime;
+}
 
-		// Read the entire data part of the page into a byte vector for checksumming
-		vector<unsigned char> dataBytes = ReadBytesOrDie(file, pageDataSize);
+double GetRealTime(const char* filePath)
+{
+	RealLengthComputation computation(filePath);
+	computation.Step(numeric_limits<unsigned int>::max());
+	return computation.RealTime();
+}
 
+string RealLengthCheckpoint::ToString() const
+{
+	ostringstream text;
+	text << fileSize << " " << pageOffset << " " << packetNumber << " " << samplesDecoded << " " << granulePosition
+		<< " " << hex << setfill('0');
+	for(vector<unsigned char>::size_type byteIndex = 0; byteIndex < lastPacket.size(); byteIndex++)
+	{
+		text << setw(2) << static_cast<unsigned int>(lastPacket[byteIndex]);
+	}
+	return text.str();
+}
 
-		// Create an ogg_page structure using the header and body byte vectors so that libogg can do the checksum
-		ogg_page page;
-		page.header_len = headerBytes.size();
-		page.header = &(headerBytes[0]);
-		page.body_len = dataBytes.size();
-		if(dataBytes.size() > 0)
+RealLengthCheckpoint RealLengthCheckpoint::Parse(const string& text)
+{
+	RealLengthCheckpoint checkpoint;
+	istringstream fields(text);
+	string packetHex;
+	if(!(fields >> checkpoint.fileSize >> checkpoint.pageOffset >> checkpoint.packetNumber
+		>> checkpoint.samplesDecoded >> checkpoint.granulePosition))
+	{
+		throw OggVorbisError("Not a real length checkpoint.");
+	}
+	fields >> packetHex; // Empty for a checkpoint at the start
+	if(packetHex.size() % 2 != 0 || (checkpoint.pageOffset >= 0) == packetHex.empty())
+	{
+		throw OggVorbisError("Not a real length checkpoint.");
+	}
+	for(string::size_type charIndex = 0; charIndex < packetHex.size(); charIndex += 2)
+	{
+		unsigned int byte;
+		istringstream byteText(packetHex.substr(charIndex, 2));
+		if(!(byteText >> hex >> byte) || !byteText.eof())
 		{
-			page.body = &(dataBytes[0]);
+			throw OggVorbisError("Not a real length checkpoint.");
 		}
+		checkpoint.lastPacket.push_back(static_cast<unsigned char>(byte));
+	}
+	return checkpoint;
+}
 
-		// Let libogg do the tricky CRC stuff
-		ogg_page_checksum_set(&page);
-		checksum = GetFromBytes<ogg_int32_t>(headerBytes, 22);
+// Everything a RealLengthComputation keeps between steps.
+struct RealLengthComputation::State
+{
+	boost::shared_ptr<OggFile> file;
+	ogg_int64_t fileSize;
+	OggPacketReader reader;
+	boost::shared_ptr<VorbisSetup> setup;
+	boost::shared_ptr<PooledVorbisDecoder> decoder;
+	ogg_int64_t samplesRead; // per channel
+	vector<unsigned char> lastPacket; // The last audio packet decoded
+	RealLengthCheckpoint checkpoint; // The last page boundary decoding could be continued from
+	bool done;
+	boost::mutex cancelMutex;
+	bool canceled;
 
-		// Finally, write the updated granule position and checksum. We're not changing the file
-		// size or moving anything around, so we can just edit the file in place.
-		SeekOrDie(file, granulePositionPosition, Seek_Set);
-		WriteOrDie(file, granulePosition);
-		SeekOrDie(file, 8, Seek_Cur);
-		WriteOrDie(file, checksum);
+	explicit State(const boost::shared_ptr<OggFile>& file_) : file(file_), fileSize(file_->Size()), reader(*file_),
+		setup(), decoder(), samplesRead(0), lastPacket(), checkpoint(), done(false), cancelMutex(), canceled(false)
+	{
 	}
-	catch(IoError& ex)
+
+	// Decodes an audio packet and counts the samples that come out. Other packets are skipped like libvorbisfile
+	// skips them.
+	void Decode(ogg_packet& packet)
 	{
-		if(file != NULL)
+		if(vorbis_synthesis(decoder->Block(), &packet) != 0)
 		{
-			fclose(file); // Clean up if something went wrong
+			return;
 		}
-		throw OggVorbisError(ex.what()); // Repackage as an OggVorbisError to keep the exception specification clean.
+		vorbis_synthesis_blockin(decoder->DspState(), decoder->Block());
+
+		int samplesAvailable;
+		while((samplesAvailable = vorbis_synthesis_pcmout(decoder->DspState(), NULL)) > 0)
+		{
+			samplesRead += samplesAvailable;
+			vorbis_synthesis_read(decoder->DspState(), samplesAvailable);
+		}
+		lastPacket.assign(packet.packet, packet.packet + packet.bytes);
 	}
-	catch(OggVorbisError&)
+
+private:
+	// Not copyable
+	State(const State&);
+	State& operator=(const State&);
+};
+
+RealLengthComputation::RealLengthComputation(const char* filePath) : m_state()
+{
+	Start(filePath);
+}
+
+RealLengthComputation::RealLengthComputation(const char* filePath, const RealLengthCheckpoint& checkpoint)
+	: m_state()
+{
+	Start(filePath);
+	if(checkpoint.AtStart())
+	{
+		return;
+	}
+
+	if(checkpoint.lastPacket.empty())
+	{
+		throw OggVorbisError("Not a real length checkpoint.");
+	}
+	State& state = *m_state;
+	if(state.fileSize != checkpoint.fileSize)
+	{
+		throw OggVorbisError("The file has changed since the real length checkpoint was taken.");
+	}
+
+	state.reader.Seek(checkpoint.pageOffset, checkpoint.packetNumber);
+	ogg_page page;
+	if(!state.reader.NextPage(page) || state.reader.LastPageOffset() != checkpoint.pageOffset
+		|| ogg_page_continued(&page))
+	{
+		throw OggVorbisError("The file has changed since the real length checkpoint was taken.");
+	}
+
+	// A decoder only puts out samples for a packet once it has the packet before it, because neighboring blocks
+	// overlap. Feed it the packet from before the checkpoint and throw away what that puts out, since those samples
+	// were already counted, then put back the granule position it would have had so the end of the stream is trimmed
+	// the same as when decoding the whole file.
+	vector<unsigned char> primingBytes = checkpoint.lastPacket;
+	ogg_packet primingPacket;
+	primingPacket.packet = &(primingBytes[0]);
+	primingPacket.bytes = static_cast<long>(primingBytes.size());
+	primingPacket.b_o_s = 0;
+	primingPacket.e_o_s = 0;
+	primingPacket.granulepos = -1;
+	primingPacket.packetno = checkpoint.packetNumber - 1;
+	if(vorbis_synthesis(state.decoder->Block(), &primingPacket) == 0)
 	{
-		if(file != NULL)
+		vorbis_synthesis_blockin(state.decoder->DspState(), state.decoder->Block());
+		int samplesAvailable;
+		while((samplesAvailable = vorbis_synthesis_pcmout(state.decoder->DspState(), NULL)) > 0)
 		{
-			fclose(file); // Clean up if something went wrong
+			vorbis_synthesis_read(state.decoder->DspState(), samplesAvailable);
 		}
-		throw;
 	}
+	state.decoder->DspState()->granulepos = checkpoint.granulePosition;
+
+	state.samplesRead = checkpoint.samplesDecoded;
+	state.lastPacket = checkpoint.lastPacket;
+	state.checkpoint = checkpoint;
+	state.reader.AddPage(page);
+}
+
+void RealLengthComputation::Start(const char* filePath)
+{
+	// Get the real song length by decoding the vorbis stream and counting the samples that come out. This uses
+	// libvorbis directly instead of libvorbisfile so that the parsed headers and the decoder can be reused from an
+	// earlier file with the same encoder settings instead of being built again for every file.
+
+	boost::shared_ptr<OggFile> file;
+	try
+	{
+		file = OpenOggFile(filePath, false);
+		m_state.reset(new State(file));
+	}
+	catch(IoError&)
+	{
+		throw OggVorbisError("Error opening Ogg Vorbis file.");
+	}
+	OggPacketReader& reader = m_state->reader;
 
-	fclose(file); // Clean up
+	// Reading more pages can move the packet data libogg handed out, so keep copies of the headers.
+	ogg_packet headers[3];
+	vector<unsigned char> headerBytes[3];
+	for(int headerIndex = 0; headerIndex < 3; headerIndex++)
+	{
+		if(!reader.NextPacket(headers[headerIndex]))
+		{
+			throw OggVorbisError("Error opening Ogg Vorbis file.");
+		}
+		headerBytes[headerIndex].assign(headers[headerIndex].packet,
+			headers[headerIndex].packet + headers[headerIndex].bytes);
+	}
+	for(int headerIndex = 0; headerIndex < 3; headerIndex++)
+	{
+		headers[headerIndex].packet = headerBytes[headerIndex].empty() ? NULL : &(headerBytes[headerIndex][0]);
+	}
+	if(vorbis_synthesis_idheader(&(headers[0])) != 1)
+	{
+		throw OggVorbisError("Error opening Ogg Vorbis file.");
+	}
+
+	m_state->setup = GetVorbisSetup(headers[0], headers[1], headers[2]);
+	m_state->decoder.reset(new PooledVorbisDecoder(m_state->setup));
+	m_state->checkpoint.fileSize = m_state->fileSize;
+}
+
+bool RealLengthComputation::Step(unsigned int maxPages)
+{
+	State& state = *m_state;
+	unsigned int numPagesRead = 0;
+	while(!state.done)
+	{
+		if(Canceled())
+		{
+			return true;
+		}
+
+		ogg_packet packet;
+		while(state.reader.NextBufferedPacket(packet))
+		{
+			state.Decode(packet);
+		}
+		if(numPagesRead == maxPages)
+		{
+			return false;
+		}
+
+		ogg_page page;
+		if(!state.reader.NextPage(page))
+		{
+			state.done = true;
+			break;
+		}
+		numPagesRead++;
+
+		// Decoding can only be picked up again where a page starts a new packet, and only once there is a packet
+		// before it to prime the decoder with and the decoder knows where it is in the stream.
+		if(!ogg_page_continued(&page) && !state.lastPacket.empty() && state.decoder->DspState()->granulepos != -1)
+		{
+			RealLengthCheckpoint& checkpoint = state.checkpoint;
+			checkpoint.pageOffset = state.reader.LastPageOffset();
+			checkpoint.packetNumber = state.reader.NextPacketNumber();
+			checkpoint.samplesDecoded = state.samplesRead;
+			checkpoint.granulePosition = state.decoder->DspState()->granulepos;
+			checkpoint.lastPacket = state.lastPacket;
+		}
+		state.reader.AddPage(page);
+	}
+
+	if(state.setup->Info()->rate <= 0) // Don't crash with a divide by 0
+	{
+		throw OggVorbisError("Sample rate is not a positive number.");
+	}
+	return true;
+}
+
+bool RealLengthComputation::Done() const
+{
+	return m_state->done;
+}
+
+double RealLengthComputation::Progress() const
+{
+	if(m_state->done)
+	{
+		return 1;
+	}
+	if(m_state->fileSize <= 0)
+	{
+		return 0;
+	}
+	double progress = static_cast<double>(m_state->reader.Position()) / m_state->fileSize;
+	return progress < 1 ? progress : 1;
+}
+
+double RealLengthComputation::SecondsDecoded() const
+{
+	long sampleRate = m_state->setup->Info()->rate;
+	return sampleRate > 0 ? static_cast<double>(m_state->samplesRead) / sampleRate : 0;
+}
+
+void RealLengthComputation::Cancel()
+{
+	boost::mutex::scoped_lock lock(m_state->cancelMutex);
+	m_state->canceled = true;
+}
+
+bool RealLengthComputation::Canceled() const
+{
+	boost::mutex::scoped_lock lock(m_state->cancelMutex);
+	return m_state->canceled;
+}
+
+RealLengthCheckpoint RealLengthComputation::Checkpoint() const
+{
+	return m_state->checkpoint;
+}
+
+double RealLengthComputation::RealTime() const
+{
+	if(Canceled())
+	{
+		throw OggVorbisError("Getting the real length was canceled.");
+	}
+	if(!m_state->done)
+	{
+		throw OggVorbisError("Getting the real length isn't done yet.");
+	}
+	return static_cast<double>(m_state->samplesRead) / m_state->setup->Info()->rate;
+}
+
+namespace
+{
+
+// The header of an Ogg page, including the segment table.
+struct OggPageHeader
+{
+	unsigned char version; // Version field of an Ogg page
+	unsigned char headerType; // Header type field of an Ogg page
+	ogg_int64_t granulePosition;
+	ogg_int32_t bitstreamSerialNumber;
+	ogg_int32_t pageSequenceNumber;
+	ogg_int32_t checksum;
+	vector<unsigned char> segmentSizes;
+
+	OggPageHeader() : version(0), headerType(0), granulePosition(0), bitstreamSerialNumber(0),
+		pageSequenceNumber(0), checksum(0), segmentSizes()
+	{
+	}
+
+	// End of stream bit set in the header type field - this is the last page of the logical bitstream
+	bool EndOfStream() const { return CheckBit(headerType, 2); }
+
+	// Gets the size of the data part of the page
+	ogg_int32_t DataSize() const
+	{
+		if(segmentSizes.empty())
+		{
+			return 0;
+		}
+		return static_cast<ogg_int32_t>(SumSegmentSizes(&(segmentSizes[0]), segmentSizes.size()));
+	}
+
+	// Reconstructs the header as a byte vector, as it would appear in the file.
+	vector<unsigned char> ToBytes() const
+	{
+		vector<unsigned char> headerBytes;
+		headerBytes.push_back('O');
+		headerBytes.push_back('g');
+		headerBytes.push_back('g');
+		headerBytes.push_back('S');
+		headerBytes.push_back(version);
+		headerBytes.push_back(headerType);
+		AppendBytes(headerBytes, granulePosition);
+		AppendBytes(headerBytes, bitstreamSerialNumber);
+		AppendBytes(headerBytes, pageSequenceNumber);
+		AppendBytes(headerBytes, checksum);
+		headerBytes.push_back(static_cast<unsigned char>(segmentSizes.size()));
+		headerBytes.insert(headerBytes.end(), segmentSizes.begin(), segmentSizes.end());
+		return headerBytes;
+	}
+};
+
+// The most bytes an Ogg page header can take up: the fixed part and a full segment table.
+const size_t s_maxPageHeaderSize = 27 + 255;
+
+// Reads an Ogg page header starting at the current position of file. The file position is left at the start of
+// the data part of the page.
+OggPageHeader ReadPageHeaderOrDie(FileCursor& file)
+{
+	OggPageHeader header;
+	ogg_int64_t pageOffset = file.Tell();
+
+	// Read as much as the header could be in one go, so walking pages is one read per page.
+	vector<unsigned char> bytes = file.ReadBytes(s_maxPageHeaderSize);
+	const size_t minHeaderSize = 27;
+	if(bytes.size() < minHeaderSize)
+	{
+		throw IoError("Unexpected end of file.");
+	}
+
+	// All Ogg pages begin with the bytes "OggS"
+	if(bytes[0] != 'O' || bytes[1] != 'g' || bytes[2] != 'g' || bytes[3] != 'S')
+	{
+		throw OggVorbisError("File does not appear to be an Ogg file.");
+	}
+
+	// Ogg version field. Currently should always be 0.
+	header.version = bytes[4];
+	if(header.version != 0)
+	{
+		throw OggVorbisError("The file is corrupt.");
+	}
+
+	// Header type field indicates if this page is the beginning,
+	// end, or middle of an Ogg logical bitstream.
+	// It is permitted for a page to be both beginning and end - that means it's the only page.
+	header.headerType = bytes[5];
+
+	// In Vorbis logical bitstreams, the granule position is the number of the last sample
+	// contained in this frame.
+	header.granulePosition = GetFromBytes<ogg_int64_t>(bytes, 6);
+	// Bitstream serial number might be of interest if we wanted to be able to handle Ogg files with
+	// multiple logical bitstreams...but we don't care.
+	header.bitstreamSerialNumber = GetFromBytes<ogg_int32_t>(bytes, 14);
+	header.pageSequenceNumber = GetFromBytes<ogg_int32_t>(bytes, 18);
+	header.checksum = GetFromBytes<ogg_int32_t>(bytes, 22);
+	unsigned char numSegments = bytes[26];
+	if(bytes.size() < minHeaderSize + numSegments)
+	{
+		throw IoError("Unexpected end of file.");
+	}
+	header.segmentSizes.assign(bytes.begin() + minHeaderSize, bytes.begin() + minHeaderSize + numSegments);
+	file.Seek(pageOffset + minHeaderSize + numSegments);
+
+	// The data part of the page is usually skipped, but the disk reads most of it anyway, so charge for the
+	// whole page.
+	ThrottleIo(minHeaderSize + numSegments + header.DataSize());
+
+	return header;
+}
+
+// Reads the primary Vorbis header from the data part of the first Ogg page and returns the sample rate.
+// The file position must be at the start of the page data and is left at the start of the next page.
+ogg_uint32_t ReadSampleRateOrDie(FileCursor& file, const OggPageHeader& firstPage)
+{
+	ogg_uint32_t vorbisHeaderPacketSize = 0;
+	for(vector<unsigned char>::size_type segIndex = 0; segIndex < firstPage.segmentSizes.size(); segIndex++)
+	{
+		vorbisHeaderPacketSize += firstPage.segmentSizes[segIndex];
+		if(firstPage.segmentSizes[segIndex] < 255)
+		{
+			break; // a segment size of less than 255 indicates the end of a packet.
+		}
+	}
+
+	if(vorbisHeaderPacketSize < 16)
+	{
+		throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
+	}
+
+	unsigned char packetType = file.ReadOrDie<unsigned char>();
+	if(packetType != 1)
+	{
+		throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
+	}
+	
+	vector<unsigned char> vorbisString = file.ReadBytesOrDie(6);
+	if(vorbisString[0] != 'v' || vorbisString[1] != 'o' || vorbisString[2] != 'r' 
+	|| vorbisString[3] != 'b' || vorbisString[4] != 'i' || vorbisString[5] != 's')
+	{
+		throw OggVorbisError("Does not appear to be an Ogg Vorbis file.");
+	}
+
+	ogg_uint32_t vorbisVersion = file.ReadOrDie<ogg_uint32_t>();
+	if(vorbisVersion != 0)
+	{
+		throw OggVorbisError("The file is corrupt.");
+	}
+
+	UNUSED unsigned char numChannels = file.ReadOrDie<unsigned char>();
+	ogg_uint32_t sampleRate = file.ReadOrDie<ogg_uint32_t>();
+	if(sampleRate == 0)
+	{
+		throw OggVorbisError("The file is corrupt.");
+	}
+
+	// Skip the rest of the page, we're not interested in it.
+	ogg_int32_t unreadDataBytes = firstPage.DataSize() - 16;
+	file.Skip(unreadDataBytes);
+
+	return sampleRate;
+}
+
+// The biggest an Ogg page can be: a 27 byte header, 255 segment sizes, and 255 segments of 255 bytes.
+const size_t s_maxPageSize = 27 + 255 + 255 * 255;
+
+// How far FindNextPage() searches at a time. Each read also takes in enough after that to check a whole page.
+const size_t s_resyncReadSize = 65536;
+
+// Searches forward from fromOffset for the first Ogg page with a good checksum. Used to get past junk where a page
+// should have started. Returns false if there are no good pages after fromOffset.
+bool FindNextPage(FileCursor& file, ogg_int64_t fromOffset, ogg_int64_t& pageOffsetOut)
+{
+	for(ogg_int64_t windowOffset = fromOffset; ; windowOffset += s_resyncReadSize)
+	{
+		file.Seek(windowOffset);
+		ThrottleIo(s_resyncReadSize + s_maxPageSize);
+		vector<unsigned char> window = file.ReadBytes(s_resyncReadSize + s_maxPageSize);
+		if(window.empty())
+		{
+			return false;
+		}
+
+		// Only pages starting in the first s_resyncReadSize bytes are looked at; the rest is there so they can be
+		// checked. Pages starting later are looked at with the next window.
+		const unsigned char* begin = &(window[0]);
+		const unsigned char* end = begin + window.size();
+		const unsigned char* searchEnd = begin + min(window.size(), s_resyncReadSize + 3);
+		for(const unsigned char* candidate = FindCapturePattern(begin, searchEnd); candidate != searchEnd;
+			candidate = FindCapturePattern(candidate + 1, searchEnd))
+		{
+			if(GetValidPageSize(candidate, end - candidate) != 0)
+			{
+				pageOffsetOut = windowOffset + (candidate - begin);
+				return true;
+			}
+		}
+
+		if(window.size() < s_resyncReadSize + s_maxPageSize)
+		{
+			return false; // That was the end of the file
+		}
+	}
+}
+
+// Called from a catch block when what should be a page header at pageOffset isn't one. Moves the file position to
+// the next good page and warns about the junk skipped, or rethrows the exception being handled if there is none.
+void SkipJunkOrRethrow(FileCursor& file, const char* filePath, ogg_int64_t pageOffset)
+{
+	ogg_int64_t nextPageOffset;
+	if(!FindNextPage(file, pageOffset, nextPageOffset))
+	{
+		throw;
+	}
+	Warn(filePath, "Skipped " + lexical_cast<string>(nextPageOffset - pageOffset) + " bytes of junk at byte offset "
+		+ lexical_cast<string>(pageOffset) + " that are not Ogg pages.");
+	file.Seek(nextPageOffset);
+}
+
+// Reads Ogg pages from the beginning of the file until we get to the last page (indicated by the "end of stream"
+// bit set in the Ogg page header), recording where each page is.
+// Special care if given to the first page, because that is the primary Vorbis header and contains
+// the sample rate, which is needed to calculate what we should set the granule position of the last page to.
+// Page checksums aren't checked while walking the pages because that would mean reading all of every page. Only if
+// something other than a page header is where a page should start does this search for the next good page, warning
+// about the junk skipped. filePath is only used for the warnings.
+OggPageLayout ReadPageLayoutOrDie(FileCursor& file, const char* filePath)
+{
+	OggPageLayout layout;
+	ogg_int32_t savedBitstreamSerialNumber = 0;
+
+	file.Seek(0);
+	while(true)
+	{
+		ogg_int64_t pageOffset = file.Tell();
+		OggPageHeader header;
+		try
+		{
+			header = ReadPageHeaderOrDie(file);
+		}
+		catch(OggVorbisError&)
+		{
+			SkipJunkOrRethrow(file, filePath, pageOffset);
+			continue;
+		}
+		catch(IoError&)
+		{
+			// The file ended partway through what should have been a page header.
+			SkipJunkOrRethrow(file, filePath, pageOffset);
+			continue;
+		}
+
+		if(!layout.pages.empty() && header.bitstreamSerialNumber != savedBitstreamSerialNumber)
+		{
+			throw OggVorbisError("The file is not a simple Ogg Vorbis file.");
+		}
+		savedBitstreamSerialNumber = header.bitstreamSerialNumber;
+		layout.pages.push_back(OggPageEntry(pageOffset, header.granulePosition));
+
+		if(header.EndOfStream())
+		{
+			break;
+		}
+
+		if(layout.sampleRate == 0)
+		{
+			// This is the first Ogg page, so it's the primary Vorbis header.
+			layout.sampleRate = ReadSampleRateOrDie(file, header);
+		}
+		else
+		{
+			// Skip the data of the page, we're not interested in it.
+			file.Skip(header.DataSize());
+		}
+	}
+
+	if(layout.sampleRate == 0)
+	{
+		throw OggVorbisError("The file is corrupt.");
+	}
+
+	return layout;
+}
+
+// Returns true if the page made of the given header and body bytes has the right checksum.
+bool PageChecksumIsValid(const unsigned char* headerBytes, long headerSize, const unsigned char* bodyBytes,
+	long bodySize)
+{
+	ogg_uint32_t storedChecksum = static_cast<ogg_uint32_t>(headerBytes[22])
+		| (static_cast<ogg_uint32_t>(headerBytes[23]) << 8) | (static_cast<ogg_uint32_t>(headerBytes[24]) << 16)
+		| (static_cast<ogg_uint32_t>(headerBytes[25]) << 24);
+	return ComputePageChecksum(headerBytes, headerSize, bodyBytes, bodySize) == storedChecksum;
+}
+
+// The most bytes FindLastGranulePosition() looks through. The last page of a normal Vorbis file is far smaller.
+const ogg_int64_t s_backwardSearchSize = 65536;
+
+// Searches backwards from the end of the file for the last page of the given logical bitstream that has a granule
+// position, the same way libvorbisfile finds the length of a file. Candidate pages are checked by CRC so that
+// "OggS" appearing in audio data isn't taken for a page. Returns false if no such page is found near the end.
+bool FindLastGranulePosition(FileCursor& file, ogg_int32_t bitstreamSerialNumber, ogg_int64_t& granulePositionOut)
+{
+	ogg_int64_t fileSize = file.File().Size();
+	size_t searchSize = static_cast<size_t>(min(fileSize, s_backwardSearchSize));
+	file.Seek(fileSize - static_cast<ogg_int64_t>(searchSize));
+	ThrottleIo(searchSize);
+	vector<unsigned char> tail = file.ReadBytesOrDie(searchSize);
+
+	// Check each capture pattern from the back until one is a good page.
+	const unsigned char* begin = &(tail[0]);
+	const unsigned char* candidatesEnd = begin + searchSize;
+	while(true)
+	{
+		const unsigned char* page = FindLastCapturePattern(begin, candidatesEnd);
+		if(page == candidatesEnd)
+		{
+			break;
+		}
+		candidatesEnd = page + 3; // Next search is for patterns starting before this one
+		if(GetValidPageSize(page, begin + searchSize - page) == 0)
+		{
+			continue;
+		}
+
+		size_t pageStart = page - begin;
+		ogg_int64_t granulePosition = GetFromBytes<ogg_int64_t>(tail, pageStart + 6);
+		ogg_int32_t serialNumber = GetFromBytes<ogg_int32_t>(tail, pageStart + 14);
+		if(serialNumber != bitstreamSerialNumber)
+		{
+			return false; // A chained file. Leave that to libvorbisfile.
+		}
+		if(granulePosition != -1)
+		{
+			granulePositionOut = granulePosition;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns true if the page at the given offset looks like an end of stream page.
+// Used to make sure a page layout from an index really does match the file before writing to it.
+bool IsEndOfStreamPage(FileCursor& file, ogg_int64_t pageOffset)
+{
+	try
+	{
+		file.Seek(pageOffset);
+		return ReadPageHeaderOrDie(file).EndOfStream();
+	}
+	catch(IoError&)
+	{
+		return false;
+	}
+	catch(OggVorbisError&)
+	{
+		return false;
+	}
+}
+
+// Converts a number of seconds to a granule position for a Vorbis stream with the given sample rate.
+ogg_int64_t SecondsToSamples(double numSeconds, ogg_uint32_t sampleRate)
+{
+	// Converting from seconds to samples might cause the result to be off be 1 if the number of seconds
+	// came from GetRealTime().
+	double numSamples = numSeconds * sampleRate;
+	if(!(numSamples >= 0 && numSamples < 9.2e18)) // Also false for NaN
+	{
+		throw OggVorbisError("The length is not a number of seconds that can be stored in an Ogg Vorbis file.");
+	}
+	return static_cast<ogg_int64_t>(numSamples);
+}
+
+// Sets the granule position of the page at the given offset and recalculates its checksum.
+void SetPageGranulePosition(FileCursor& file, ogg_int64_t pageOffset, ogg_int64_t granulePosition)
+{
+	file.Seek(pageOffset);
+
+	// We're reading the entire page so we can calculate what the checksum
+	// should be after we change the granule position field.
+	OggPageHeader header = ReadPageHeaderOrDie(file);
+	header.granulePosition = granulePosition; // Set to what it will be for checksum calculation
+	header.checksum = 0; // Set to 0 for checksum calculation
+
+	// Reconstruct the header (with the new granule position) as a byte vector for checksumming
+	vector<unsigned char> headerBytes = header.ToBytes();
+
+	// Read the entire data part of the page into a byte vector for checksumming
+	vector<unsigned char> dataBytes = file.ReadBytesOrDie(header.DataSize());
+
+	// Create an ogg_page structure using the header and body byte vectors so that libogg can do the checksum
+	ogg_page page;
+	page.header_len = headerBytes.size();
+	page.header = &(headerBytes[0]);
+	page.body_len = dataBytes.size();
+	page.body = NULL;
+	if(dataBytes.size() > 0)
+	{
+		page.body = &(dataBytes[0]);
+	}
+
+	// Let libogg do the tricky CRC stuff
+	ogg_page_checksum_set(&page);
+	ogg_int32_t checksum = GetFromBytes<ogg_int32_t>(headerBytes, 22);
+
+	// Finally, write the updated granule position and checksum. We're not changing the file
+	// size or moving anything around, so we can just edit the file in place.
+	// The granule position field is 6 bytes into the page.
+	ThrottleIo(sizeof(granulePosition) + sizeof(checksum));
+	file.Seek(pageOffset + 6);
+	file.WriteOrDie(granulePosition);
+	file.Skip(8);
+	file.WriteOrDie(checksum);
+}
+
+} // end anonymous namespace
+
+double OggPageLayout::ReportedTime() const
+{
+	for(vector<OggPageEntry>::size_type pageIndex = pages.size(); pageIndex > 0; pageIndex--)
+	{
+		if(pages[pageIndex - 1].granulePosition != -1)
+		{
+			return static_cast<double>(pages[pageIndex - 1].granulePosition) / sampleRate;
+		}
+	}
+	return 0;
+}
+
+vector<OggPageEntry>::size_type OggPageLayout::FindPageBeforeSample(ogg_int64_t sample) const
+{
+	// A page's granule position is the last sample finished on it, so the page after the last page with a granule
+	// position less than sample is the earliest one that can contain it. Starting one page before that lets the
+	// decoder overlap into it.
+	vector<OggPageEntry>::size_type found = 0;
+	for(vector<OggPageEntry>::size_type pageIndex = 0; pageIndex < pages.size(); pageIndex++)
+	{
+		if(pages[pageIndex].granulePosition != -1 && pages[pageIndex].granulePosition < sample)
+		{
+			found = pageIndex;
+		}
+		else if(pages[pageIndex].granulePosition >= sample)
+		{
+			break;
+		}
+	}
+	return found;
+}
+
+double GetReportedTimeUpperBound(const char* filePath)
+{
+	try
+	{
+		boost::shared_ptr<OggFile> oggFile = OpenOggFile(filePath, false);
+		FileCursor file(*oggFile);
+		OggPageHeader firstPage = ReadPageHeaderOrDie(file);
+		ogg_uint32_t sampleRate = ReadSampleRateOrDie(file, firstPage);
+
+		ogg_int64_t lastGranulePosition;
+		if(!FindLastGranulePosition(file, firstPage.bitstreamSerialNumber, lastGranulePosition))
+		{
+			return -1;
+		}
+
+		// libvorbisfile subtracts the granule position the stream starts at, which is never negative, so this can
+		// only be more than what GetReportedTime() says.
+		return static_cast<double>(lastGranulePosition) / sampleRate;
+	}
+	catch(IoError&)
+	{
+		return -1;
+	}
+	catch(OggVorbisError&)
+	{
+		return -1;
+	}
+}
+
+OggPageLayout GetPageLayout(const char* filePath)
+{
+	try
+	{
+		boost::shared_ptr<OggFile> oggFile = OpenOggFile(filePath, false);
+		FileCursor file(*oggFile);
+		return ReadPageLayoutOrDie(file, filePath);
+	}
+	catch(IoError& ex)
+	{
+		throw OggVorbisError(ex.what()); // Repackage as an OggVorbisError to keep the exception specification clean.
+	}
+}
+
+namespace
+{
+
+// How much of a file VerifyPages() reads at once. Big sequential reads keep a disk streaming instead of seeking.
+const size_t s_verifyReadSize = 1024 * 1024;
+
+// What VerifyPages() knows about a logical bitstream so far
+struct VerifiedStream
+{
+	ogg_uint32_t nextSequenceNumber;
+	ogg_int64_t lastPageOffset;
+	bool ended; // Whether its end of stream page has been seen
+
+	VerifiedStream() : nextSequenceNumber(0), lastPageOffset(0), ended(false)
+	{
+	}
+};
+
+ogg_uint32_t GetLittleEndian32(const unsigned char* bytes)
+{
+	return static_cast<ogg_uint32_t>(bytes[0]) | (static_cast<ogg_uint32_t>(bytes[1]) << 8)
+		| (static_cast<ogg_uint32_t>(bytes[2]) << 16) | (static_cast<ogg_uint32_t>(bytes[3]) << 24);
+}
+
+OggVerifyResult BadPage(OggVerifyResult result, ogg_int64_t pageOffset, const string& problem)
+{
+	result.badPageOffset = pageOffset;
+	result.problem = problem;
+	return result;
+}
+
+// Checks the page at the start of page, which has all of its bytes available. Returns an empty string if it is fine.
+string CheckPage(const unsigned char* page, size_t headerSize, size_t bodySize, ogg_int64_t pageOffset,
+	map<ogg_uint32_t, VerifiedStream>& streams)
+{
+	if(page[4] != 0)
+	{
+		return "Unknown Ogg page version.";
+	}
+	if(!PageChecksumIsValid(page, static_cast<long>(headerSize), page + headerSize, static_cast<long>(bodySize)))
+	{
+		return "Bad checksum.";
+	}
+
+	unsigned char headerType = page[5];
+	bool beginningOfStream = CheckBit(headerType, 1);
+	bool endOfStream = CheckBit(headerType, 2);
+	ogg_uint32_t serialNumber = GetLittleEndian32(page + 14);
+	ogg_uint32_t sequenceNumber = GetLittleEndian32(page + 18);
+
+	map<ogg_uint32_t, VerifiedStream>::iterator stream = streams.find(serialNumber);
+	if(stream == streams.end())
+	{
+		if(!beginningOfStream)
+		{
+			return "The first page of a logical bitstream is missing its beginning of stream flag.";
+		}
+		stream = streams.insert(make_pair(serialNumber, VerifiedStream())).first;
+		stream->second.nextSequenceNumber = sequenceNumber;
+	}
+	else if(stream->second.ended)
+	{
+		return "Page after the end of stream page.";
+	}
+	else if(beginningOfStream)
+	{
+		return "Beginning of stream flag on a page that isn't the first of its logical bitstream.";
+	}
+
+	if(sequenceNumber != stream->second.nextSequenceNumber)
+	{
+		return "Page sequence number " + lexical_cast<string>(sequenceNumber) + " where "
+			+ lexical_cast<string>(stream->second.nextSequenceNumber) + " was expected. Pages are missing.";
+	}
+
+	stream->second.nextSequenceNumber = sequenceNumber + 1;
+	stream->second.lastPageOffset = pageOffset;
+	stream->second.ended = endOfStream;
+	return string();
+}
+
+} // end anonymous namespace
+
+OggVerifyResult VerifyPages(const char* filePath)
+{
+	try
+	{
+		boost::shared_ptr<OggFile> file = OpenOggFile(filePath, false);
+		OggVerifyResult result;
+		map<ogg_uint32_t, VerifiedStream> streams;
+
+		// Pages are checked straight out of the read buffer. Bytes before bufferStart have been checked.
+		vector<unsigned char> buffer(s_verifyReadSize);
+		size_t bufferStart = 0;
+		size_t bufferEnd = 0;
+		ogg_int64_t bufferOffset = 0; // File offset of buffer[0]
+		bool endOfFile = false;
+
+		const size_t minHeaderSize = 27;
+		while(true)
+		{
+			const unsigned char* page = &(buffer[bufferStart]);
+			size_t available = bufferEnd - bufferStart;
+			ogg_int64_t pageOffset = bufferOffset + static_cast<ogg_int64_t>(bufferStart);
+
+			// Work out how many bytes the page needs as far as can be seen so far.
+			size_t headerSize = minHeaderSize;
+			size_t bodySize = 0;
+			if(available >= minHeaderSize)
+			{
+				if(page[0] != 'O' || page[1] != 'g' || page[2] != 'g' || page[3] != 'S')
+				{
+					return BadPage(result, pageOffset, "Expected an Ogg page here but found something else.");
+				}
+				headerSize += page[26];
+				if(available >= headerSize)
+				{
+					bodySize = SumSegmentSizes(page + minHeaderSize, headerSize - minHeaderSize);
+				}
+			}
+
+			if(available < headerSize + bodySize)
+			{
+				if(endOfFile)
+				{
+					if(available == 0)
+					{
+						break;
+					}
+					return BadPage(result, pageOffset, "The file ends in the middle of a page.");
+				}
+
+				// Move the partial page to the front of the buffer and fill up the rest.
+				copy(buffer.begin() + bufferStart, buffer.begin() + bufferEnd, buffer.begin());
+				bufferOffset += static_cast<ogg_int64_t>(bufferStart);
+				bufferEnd = available;
+				bufferStart = 0;
+
+				size_t bytesToRead = buffer.size() - bufferEnd;
+				ThrottleIo(bytesToRead);
+				size_t bytesRead = file->ReadAt(bufferOffset + static_cast<ogg_int64_t>(bufferEnd), &(buffer[bufferEnd]),
+					bytesToRead);
+				endOfFile = bytesRead == 0;
+				bufferEnd += bytesRead;
+				result.numBytes += bytesRead;
+				continue;
+			}
+
+			string problem = CheckPage(page, headerSize, bodySize, pageOffset, streams);
+			if(!problem.empty())
+			{
+				return BadPage(result, pageOffset, problem);
+			}
+			result.numPages++;
+			bufferStart += headerSize + bodySize;
+		}
+
+		if(streams.empty())
+		{
+			return BadPage(result, 0, "No Ogg pages found.");
+		}
+
+		// Every logical bitstream has to finish with an end of stream page. Report the earliest one that doesn't.
+		ogg_int64_t unfinishedPageOffset = -1;
+		for(map<ogg_uint32_t, VerifiedStream>::const_iterator stream = streams.begin(); stream != streams.end(); ++stream)
+		{
+			if(!stream->second.ended && (unfinishedPageOffset < 0 || stream->second.lastPageOffset < unfinishedPageOffset))
+			{
+				unfinishedPageOffset = stream->second.lastPageOffset;
+			}
+		}
+		if(unfinishedPageOffset >= 0)
+		{
+			return BadPage(result, unfinishedPageOffset,
+				"The last page of a logical bitstream is missing its end of stream flag.");
+		}
+
+		return result;
+	}
+	catch(IoError& ex)
+	{
+		throw OggVorbisError(ex.what()); // Repackage as an OggVorbisError to keep the exception specification clean.
+	}
+}
+
+double GetReportedTime(const char* filePath, OggPageIndex& index)
+{
+	OggPageLayout layout;
+	if(index.Find(filePath, layout))
+	{
+		return layout.ReportedTime();
+	}
+
+	try
+	{
+		layout = GetPageLayout(filePath);
+	}
+	catch(OggVorbisError&)
+	{
+		// libvorbisfile is more forgiving than our page walk, so let it have a go before giving up.
+		return GetReportedTime(filePath);
+	}
+
+	index.Update(filePath, layout);
+	return layout.ReportedTime();
+}
+
+namespace
+{
+
+// A length to patch a song to, either in seconds or exactly in samples
+struct SongLength
+{
+	double seconds;
+	ogg_int64_t samples; // -1 if the length is in seconds
+
+	explicit SongLength(double seconds_) : seconds(seconds_), samples(-1)
+	{
+	}
+
+	explicit SongLength(ogg_int64_t samples_) : seconds(0), samples(samples_)
+	{
+	}
+
+	ogg_int64_t ToSamples(ogg_uint32_t sampleRate) const
+	{
+		return samples >= 0 ? samples : SecondsToSamples(seconds, sampleRate);
+	}
+};
+
+void ChangeSongLengthTo(const char* filePath, const SongLength& length)
+{
+	// For details of the Ogg format, see http://xiph.org/ogg/doc/, http://xiph.org/ogg/doc/oggstream.html,
+	// http://xiph.org/ogg/doc/framing.html, http://en.wikipedia.org/wiki/Ogg
+	//
+	// For details of the Vorbis format, see http://xiph.org/vorbis/doc/Vorbis_I_spec.html
+	
+	try
+	{
+		boost::shared_ptr<OggFile> oggFile = OpenOggFile(filePath, true);
+		FileCursor file(*oggFile);
+		OggPageLayout layout = ReadPageLayoutOrDie(file, filePath);
+		SetPageGranulePosition(file, layout.LastPageOffset(), length.ToSamples(layout.sampleRate));
+		oggFile->Close();
+	}
+	catch(IoError& ex)
+	{
+		throw OggVorbisError(ex.what()); // Repackage as an OggVorbisError to keep the exception specification clean.
+	}
+}
+
+void ChangeSongLengthTo(const char* filePath, const SongLength& length, OggPageIndex& index)
+{
+	try
+	{
+		boost::shared_ptr<OggFile> oggFile = OpenOggFile(filePath, true);
+		FileCursor file(*oggFile);
+
+		OggPageLayout layout;
+		if(!index.Find(filePath, layout) || !IsEndOfStreamPage(file, layout.LastPageOffset()))
+		{
+			layout = ReadPageLayoutOrDie(file, filePath);
+		}
+
+		ogg_int64_t numSamples = length.ToSamples(layout.sampleRate);
+		SetPageGranulePosition(file, layout.LastPageOffset(), numSamples);
+		oggFile->Close();
+
+		// Closing the file changed its modification time, so this has to come after.
+		layout.pages.back().granulePosition = numSamples;
+		index.Update(filePath, layout);
+	}
+	catch(IoError& ex)
+	{
+		throw OggVorbisError(ex.what()); // Repackage as an OggVorbisError to keep the exception specification clean.
+	}
+}
+
+} // end anonymous namespace
+
+void ChangeSongLength(const char* filePath, double numSeconds)
+{
+	ChangeSongLengthTo(filePath, SongLength(numSeconds));
+}
+
+void ChangeSongLength(const char* filePath, double numSeconds, OggPageIndex& index)
+{
+	ChangeSongLengthTo(filePath, SongLength(numSeconds), index);
+}
+
+void ChangeSongLengthInSamples(const char* filePath, ogg_int64_t numSamples)
+{
+	ChangeSongLengthTo(filePath, SongLength(numSamples));
+}
+
+void ChangeSongLengthInSamples(const char* filePath, ogg_int64_t numSamples, OggPageIndex& index)
+{
+	ChangeSongLengthTo(filePath, SongLength(numSamples), index);
 }
 
 } // end namespace ogglength
@@ -4,28 +4,250 @@
 #include <vorbis/vorbisfile.h>
 #include <boost/shared_ptr.hpp>
 #include <stdexcept>
+#include <vector>
+#include <string>
 
-// ogglength is reusable code.
+// ogglength is reusable code. Files are opened through the I/O backend set with SetIoBackend() in oggio.h.
 namespace ogglength
 {
 
+class OggPageIndex;
+struct OggVorbisFileSource;
+
+// The location of an Ogg page within a file.
+struct OggPageEntry
+{
+	ogg_int64_t offset; // Byte offset of the "OggS" that starts the page
+	ogg_int64_t granulePosition; // Granule position field of the page. -1 if no packet finishes on the page.
+
+	OggPageEntry(ogg_int64_t offset_, ogg_int64_t granulePosition_) : offset(offset_), granulePosition(granulePosition_)
+	{
+	}
+};
+
+// The page layout of a simple Ogg Vorbis file (1 logical bitstream).
+struct OggPageLayout
+{
+	ogg_uint32_t sampleRate; // From the primary Vorbis header
+	
+	// Pages in file order. The first entry is always the first page and the last entry is always the end of stream
+	// page. A layout read straight from a file has every page; a layout stored in an OggPageIndex only keeps
+	// enough pages to seek with.
+	std::vector<OggPageEntry> pages;
+
+	OggPageLayout() : sampleRate(0), pages()
+	{
+	}
+
+	// Gets the byte offset of the end of stream page.
+	ogg_int64_t LastPageOffset() const { return pages.back().offset; }
+
+	// Gets the length in seconds reported by the granule position of the last page that has one. This is the same
+	// as what GetReportedTime() returns for files whose first sample is sample 0, which is all of the normal ones.
+	double ReportedTime() const;
+
+	// Gets the index into pages of the last known page that starts at or before the given sample.
+	// Decoding from that page's offset will get to the sample without missing it.
+	std::vector<OggPageEntry>::size_type FindPageBeforeSample(ogg_int64_t sample) const;
+};
+
+// Interface for slowing down the file I/O done by ogglength functions so that they don't get in the way of other
+// programs. See SetIoThrottle().
+class IoThrottle
+{
+public:
+	virtual ~IoThrottle()
+	{
+	}
+
+	// Called before ogglength reads or writes about numBytes bytes. Implementations can block to slow things down.
+	virtual void BeforeIo(size_t numBytes) = 0;
+};
+
+// Sets the throttle that all ogglength functions call before doing file I/O, or NULL for none (the default).
+// The throttle must outlive any ogglength calls that use it.
+void SetIoThrottle(IoThrottle* throttle);
+
+// Interface for hearing about problems in a file that ogglength functions worked around instead of failing, like
+// junk before the first Ogg page or a damaged page. See SetWarningListener().
+class WarningListener
+{
+public:
+	virtual ~WarningListener()
+	{
+	}
+
+	// Called with the file the problem is in and a sentence describing it, including the byte offset.
+	virtual void Warn(const char* filePath, const std::string& message) = 0;
+};
+
+// Sets the listener that ogglength functions tell about problems they worked around, or NULL for none (the default).
+// The listener must outlive any ogglength calls that use it.
+void SetWarningListener(WarningListener* listener);
+
+// What the identification and comment headers of an Ogg Vorbis file say about it.
+struct VorbisStreamInfo
+{
+	long sampleRate;
+	int channels;
+	long bitrateNominal; // Bits per second. 0 or less if the encoder didn't say.
+	long bitrateUpper; // 0 or less if the encoder didn't say
+	long bitrateLower; // 0 or less if the encoder didn't say
+	std::string vendor; // The encoder
+	std::vector<std::string> comments; // "FIELD=value" as stored in the file, in file order
+
+	VorbisStreamInfo() : sampleRate(0), channels(0), bitrateNominal(0), bitrateUpper(0), bitrateLower(0), vendor(),
+		comments()
+	{
+	}
+
+	// Gets the value of the first comment with the given field name, ignoring case. Returns an empty string if
+	// there is none.
+	std::string GetComment(const std::string& field) const;
+};
+
 // Gets the length in seconds of an Ogg Vorbis file that will be reported by most media players and utilities.
 // Can throw ogglength::OggVorbisError if there is a problem opening or reading the file.
 double GetReportedTime(const char* filePath);
 
+// Like GetReportedTime(const char*), but also fills in infoOut from the headers that have to be read anyway.
+double GetReportedTime(const char* filePath, VorbisStreamInfo& infoOut);
+
+// Like GetReportedTime(const char*), but uses the page layout stored in index if it is still current for the file.
+// Otherwise the file's pages are read and index is updated.
+double GetReportedTime(const char* filePath, OggPageIndex& index);
+
+// Gets an upper bound on what GetReportedTime() returns by reading only the primary Vorbis header on the first page
+// and the granule position of the last page, without having libvorbisfile parse the rest of the Vorbis headers.
+// For normal files it is exactly what GetReportedTime() returns. Returns a negative number instead of throwing if
+// the file can't be handled this way, for example if it is not an Ogg Vorbis file or is chained.
+double GetReportedTimeUpperBound(const char* filePath);
+
 // Gets the real length in seconds of an Ogg Vorbis file. This can differ from the reported length if the file has
-// been tampered with.
+// been tampered with. See RealLengthComputation for doing it a piece at a time.
 // Can throw ogglength::OggVorbisError if there is a problem opening or reading the file.
 double GetRealTime(const char* filePath);
 
+// Where a RealLengthComputation got to, so that it can be carried on later by another one, even in another process.
+// It is always at the start of a page, so it can be a few pages behind where the computation actually is.
+struct RealLengthCheckpoint
+{
+	ogg_int64_t fileSize; // To tell if the file changed
+	ogg_int64_t pageOffset; // Byte offset of the page to carry on from. -1 to start from the beginning.
+	ogg_int64_t packetNumber; // Sequence number of the first packet on that page
+	ogg_int64_t samplesDecoded; // Samples per channel that came out before that page
+	ogg_int64_t granulePosition; // Where libvorbis thought it was in the stream before that page
+	std::vector<unsigned char> lastPacket; // The last audio packet before that page, to get the decoder going again
+
+	RealLengthCheckpoint() : fileSize(0), pageOffset(-1), packetNumber(0), samplesDecoded(0), granulePosition(-1),
+		lastPacket()
+	{
+	}
+
+	bool AtStart() const { return pageOffset < 0; }
+
+	// Gets the checkpoint as a line of text that can be saved and given to Parse() later.
+	std::string ToString() const;
+
+	// Throws ogglength::OggVorbisError if text isn't something ToString() returned.
+	static RealLengthCheckpoint Parse(const std::string& text);
+};
+
+// Gets the real length of an Ogg Vorbis file like GetRealTime(), but a bounded number of pages at a time, so that the
+// caller can do other things in between, show progress, give up partway, or save where it got to and carry on later.
+// Any number can be stepped in turn on one thread. A computation can be stepped from different threads, but only one
+// at a time.
+class RealLengthComputation
+{
+private:
+	struct State; // Defined in ogglength.cpp
+	boost::shared_ptr<State> m_state;
+
+	// Not copyable
+	RealLengthComputation(const RealLengthComputation&);
+	RealLengthComputation& operator=(const RealLengthComputation&);
+
+	void Start(const char* filePath);
+
+public:
+	// Opens the file and reads its headers, which is about as much work as a step.
+	// Throws ogglength::OggVorbisError if there is a problem opening or reading the file.
+	explicit RealLengthComputation(const char* filePath);
+
+	// Like RealLengthComputation(const char*), but carries on from where the computation that took the checkpoint
+	// got to. The checkpoint must be from the same file. Throws ogglength::OggVorbisError if the file is a different
+	// size or doesn't have a page where the checkpoint says.
+	RealLengthComputation(const char* filePath, const RealLengthCheckpoint& checkpoint);
+
+	// Decodes up to maxPages more pages. Returns true if the computation is done or was canceled, false if there is
+	// more to do. Can throw ogglength::OggVorbisError if there is a problem reading the file.
+	bool Step(unsigned int maxPages);
+
+	bool Done() const;
+
+	// Gets how far through the file the computation is, from 0 to 1.
+	double Progress() const;
+
+	// Gets the number of seconds of audio decoded so far.
+	double SecondsDecoded() const;
+
+	// Stops the computation. Can be called from any thread, even while another is in Step(), which returns at the
+	// next page.
+	void Cancel();
+	bool Canceled() const;
+
+	// Gets the latest point the computation can be carried on from.
+	RealLengthCheckpoint Checkpoint() const;
+
+	// Gets the real length in seconds once Done(). Throws ogglength::OggVorbisError if it is not done or was canceled.
+	double RealTime() const;
+};
+
 // Sets the length of an Ogg Vorbis file in seconds.
 // This is done by changing the granule position field of the last Ogg page.
-// The file must be a normal Ogg Vorbis file (1 logical bitstream).
+// The file must be a normal Ogg Vorbis file (1 logical bitstream). Junk before, between, or in place of pages is
+// skipped by searching for the next page with a good checksum, and reported to the WarningListener.
 // ogglength::OggVorbisError can be thrown for various error conditions, including being unable to open
 // the file, the file not being an Ogg Vorbis file, or the file appearing to be corrupt.
 // If the function returns without throwing an exception, it succeeded.
 void ChangeSongLength(const char* filePath, double numSeconds);
 
+// Like ChangeSongLength(const char*, double), but jumps straight to the last page if index has a current layout
+// for the file. The index is updated with the new granule position and file identity afterwards.
+void ChangeSongLength(const char* filePath, double numSeconds, OggPageIndex& index);
+
+// Like ChangeSongLength(const char*, double), but sets the length to an exact number of samples per channel instead
+// of converting from seconds.
+void ChangeSongLengthInSamples(const char* filePath, ogg_int64_t numSamples);
+
+// Like ChangeSongLength(const char*, double, OggPageIndex&), but sets the length to an exact number of samples.
+void ChangeSongLengthInSamples(const char* filePath, ogg_int64_t numSamples, OggPageIndex& index);
+
+// Reads the page layout of a simple Ogg Vorbis file by walking every page header.
+// ogglength::OggVorbisError is thrown under the same conditions as ChangeSongLength().
+OggPageLayout GetPageLayout(const char* filePath);
+
+// What VerifyPages() found.
+struct OggVerifyResult
+{
+	ogg_int64_t badPageOffset; // Byte offset of the first bad page, or -1 if every page is fine
+	std::string problem; // What is wrong with the bad page. Empty if every page is fine.
+	ogg_int64_t numPages; // Number of good pages before the bad one, or in the file
+	ogg_int64_t numBytes; // Number of bytes read from the file
+
+	OggVerifyResult() : badPageOffset(-1), problem(), numPages(0), numBytes(0)
+	{
+	}
+
+	bool Ok() const { return badPageOffset < 0; }
+};
+
+// Reads every page of an Ogg file front to back and checks that each has a good checksum, that page sequence numbers
+// have no gaps, that each logical bitstream starts with a beginning of stream page and ends with an end of stream
+// page, and that nothing but whole pages is in the file. Stops at the first bad page. Safe to call from multiple
+// threads at once. Throws ogglength::OggVorbisError if the file can't be opened or read.
+OggVerifyResult VerifyPages(const char* filePath);
+
 // Represents an error while opening or reading an Ogg Vorbis file.
 class OggVorbisError : public std::runtime_error
 {
@@ -40,8 +262,9 @@ struct _OggVorbisFile
 {
 	OggVorbis_File file; // Vorbis file handle
 	bool opened; // Whether the file has actually been opened yet and the handle is valid
+	boost::shared_ptr<OggVorbisFileSource> source; // What libvorbisfile reads from. Outlives the handle.
 
-	explicit _OggVorbisFile() : file(), opened(false)
+	explicit _OggVorbisFile() : file(), opened(false), source()
 	{
 	}
 
@@ -65,7 +288,7 @@ private:
 	boost::shared_ptr<_OggVorbisFile> m_handle; // reference counting made easy
 
 public:
-	// Opens the given file as an Ogg Vorbis file.
+	// Opens the given file as an Ogg Vorbis file through the current I/O backend.
 	// Throws ogglength::OggVorbisError if an error occurs.
 	explicit OggVorbisFile(const char* filePath);
 
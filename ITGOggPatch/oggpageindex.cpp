@@ -0,0 +1,323 @@
+#include "stdafx.h"
+#include "oggpageindex.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+namespace fs = boost::filesystem;
+
+namespace ogglength
+{
+
+namespace
+{
+
+// Index file format, all integers little-endian base 128 varints:
+//   "OGPI" format version
+//   number of entries
+//   for each entry: path length, path bytes, inode, size, modification time (zigzag), sample rate, number of pages,
+//                   then for each page the offset minus the previous page's offset and the granule position minus
+//                   the previous page's granule position (zigzag)
+// Deltas keep most numbers to one or two bytes.
+const unsigned char s_indexMagic[4] = { 'O', 'G', 'P', 'I' };
+const boost::uint64_t s_indexFormatVersion = 2; // 1 could leave out the page the reported length is taken from
+
+void AppendVarint(vector<unsigned char>& bytes, boost::uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		bytes.push_back(static_cast<unsigned char>(value | 0x80));
+		value >>= 7;
+	}
+	bytes.push_back(static_cast<unsigned char>(value));
+}
+
+// Zigzag encoding maps signed numbers with small magnitude to small unsigned numbers.
+void AppendSignedVarint(vector<unsigned char>& bytes, boost::int64_t value)
+{
+	AppendVarint(bytes, (static_cast<boost::uint64_t>(value) << 1) ^ static_cast<boost::uint64_t>(value >> 63));
+}
+
+// Reads varints out of a byte vector. Throws lhcutilities::IoError if the data runs out.
+class VarintReader
+{
+private:
+	const vector<unsigned char>& m_bytes;
+	vector<unsigned char>::size_type m_position;
+
+public:
+	explicit VarintReader(const vector<unsigned char>& bytes) : m_bytes(bytes), m_position(0)
+	{
+	}
+
+	boost::uint64_t Read()
+	{
+		boost::uint64_t value = 0;
+		for(unsigned int shift = 0; shift < 64; shift += 7)
+		{
+			if(m_position >= m_bytes.size())
+			{
+				throw IoError("Unexpected end of index.");
+			}
+			unsigned char byte = m_bytes[m_position++];
+			value |= static_cast<boost::uint64_t>(byte & 0x7F) << shift;
+			if((byte & 0x80) == 0)
+			{
+				return value;
+			}
+		}
+		throw IoError("Invalid number in index.");
+	}
+
+	boost::int64_t ReadSigned()
+	{
+		boost::uint64_t value = Read();
+		return static_cast<boost::int64_t>(value >> 1) ^ -static_cast<boost::int64_t>(value & 1);
+	}
+
+	string ReadString()
+	{
+		boost::uint64_t length = Read();
+		if(length > m_bytes.size() - m_position)
+		{
+			throw IoError("Unexpected end of index.");
+		}
+		string value(m_bytes.begin() + m_position, m_bytes.begin() + m_position + length);
+		m_position += length;
+		return value;
+	}
+
+	// Skips the given number of bytes, returning false if they aren't equal to expected.
+	bool Expect(const unsigned char* expected, size_t length)
+	{
+		if(length > m_bytes.size() - m_position)
+		{
+			return false;
+		}
+		for(size_t byteIndex = 0; byteIndex < length; byteIndex++)
+		{
+			if(m_bytes[m_position++] != expected[byteIndex])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+} // end anonymous namespace
+
+// 64 KB apart is about a second of audio at typical bitrates - close enough for seeking and small enough that an
+// index of a whole library loads quickly.
+const ogg_int64_t OggPageIndex::s_seekPointSpacing = 65536;
+
+OggPageIndex::OggPageIndex(const string& indexPath) : m_indexPath(indexPath), m_entries(), m_modified(false),
+	m_mutex()
+{
+	Load();
+}
+
+void OggPageIndex::Load()
+{
+	if(!fs::exists(m_indexPath))
+	{
+		return;
+	}
+
+	try
+	{
+		ScopedFile file(OpenOrDie(m_indexPath.c_str(), "rb"));
+		SeekOrDie(file.get(), 0, Seek_End);
+		long fileSize = TellOrDie(file.get());
+		SeekOrDie(file.get(), 0, Seek_Set);
+		vector<unsigned char> bytes = ReadBytesOrDie(file.get(), fileSize);
+
+		VarintReader reader(bytes);
+		if(!reader.Expect(s_indexMagic, sizeof(s_indexMagic)) || reader.Read() != s_indexFormatVersion)
+		{
+			return; // Not an index we understand. It will be overwritten on save.
+		}
+
+		boost::uint64_t numEntries = reader.Read();
+		for(boost::uint64_t entryIndex = 0; entryIndex < numEntries; entryIndex++)
+		{
+			string key = reader.ReadString();
+			Entry entry;
+			entry.identity.inode = reader.Read();
+			entry.identity.size = reader.Read();
+			entry.identity.modificationTime = reader.ReadSigned();
+			entry.layout.sampleRate = static_cast<ogg_uint32_t>(reader.Read());
+
+			boost::uint64_t numPages = reader.Read();
+			ogg_int64_t offset = 0;
+			ogg_int64_t granulePosition = 0;
+			for(boost::uint64_t pageIndex = 0; pageIndex < numPages; pageIndex++)
+			{
+				offset += static_cast<ogg_int64_t>(reader.Read());
+				granulePosition += reader.ReadSigned();
+				entry.layout.pages.push_back(OggPageEntry(offset, granulePosition));
+			}
+
+			if(!entry.layout.pages.empty() && entry.layout.sampleRate != 0)
+			{
+				m_entries[key] = entry;
+			}
+		}
+	}
+	catch(IoError&)
+	{
+		// A damaged index is no worse than no index.
+		m_entries.clear();
+	}
+}
+
+string OggPageIndex::GetKey(const string& filePath)
+{
+	return fs::system_complete(filePath).string();
+}
+
+OggPageLayout OggPageIndex::Compact(const OggPageLayout& layout)
+{
+	OggPageLayout compacted;
+	compacted.sampleRate = layout.sampleRate;
+
+	// The reported length comes from the last page with a granule position, which isn't the last page if that one
+	// has none. Keep it so that a compacted layout reports the same length as the full one.
+	vector<OggPageEntry>::size_type lastTimedPage = layout.pages.size();
+	for(vector<OggPageEntry>::size_type pageIndex = layout.pages.size(); pageIndex > 0; pageIndex--)
+	{
+		if(layout.pages[pageIndex - 1].granulePosition != -1)
+		{
+			lastTimedPage = pageIndex - 1;
+			break;
+		}
+	}
+
+	// The first three pages hold the Vorbis headers in almost every file; decoding needs them, so keep them.
+	ogg_int64_t lastKeptOffset = 0;
+	for(vector<OggPageEntry>::size_type pageIndex = 0; pageIndex < layout.pages.size(); pageIndex++)
+	{
+		const OggPageEntry& page = layout.pages[pageIndex];
+		if(pageIndex < 3 || pageIndex == layout.pages.size() - 1 || pageIndex == lastTimedPage
+			|| page.offset - lastKeptOffset >= s_seekPointSpacing)
+		{
+			compacted.pages.push_back(page);
+			lastKeptOffset = page.offset;
+		}
+	}
+
+	return compacted;
+}
+
+bool OggPageIndex::Find(const string& filePath, OggPageLayout& layoutOut) const
+{
+	string key = GetKey(filePath);
+	Entry entry;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		map<string, Entry>::const_iterator entryIt = m_entries.find(key);
+		if(entryIt == m_entries.end())
+		{
+			return false;
+		}
+		entry = entryIt->second; // Compacted, so only a handful of pages
+	}
+
+	try
+	{
+		if(GetFileIdentityOrDie(filePath.c_str()) != entry.identity)
+		{
+			return false; // Stale
+		}
+	}
+	catch(IoError&)
+	{
+		return false;
+	}
+
+	layoutOut = entry.layout;
+	return true;
+}
+
+void OggPageIndex::Update(const string& filePath, const OggPageLayout& layout)
+{
+	string key = GetKey(filePath);
+	Entry entry;
+	entry.identity = GetFileIdentityOrDie(filePath.c_str());
+	entry.layout = Compact(layout);
+
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_entries[key] = entry;
+	m_modified = true;
+}
+
+size_t OggPageIndex::Size() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_entries.size();
+}
+
+void OggPageIndex::Save()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(!m_modified)
+	{
+		return;
+	}
+
+	vector<unsigned char> bytes(s_indexMagic, s_indexMagic + sizeof(s_indexMagic));
+	AppendVarint(bytes, s_indexFormatVersion);
+	AppendVarint(bytes, m_entries.size());
+	for(map<string, Entry>::const_iterator entryIt = m_entries.begin(); entryIt != m_entries.end(); ++entryIt)
+	{
+		const Entry& entry = entryIt->second;
+		AppendVarint(bytes, entryIt->first.size());
+		bytes.insert(bytes.end(), entryIt->first.begin(), entryIt->first.end());
+		AppendVarint(bytes, entry.identity.inode);
+		AppendVarint(bytes, entry.identity.size);
+		AppendSignedVarint(bytes, entry.identity.modificationTime);
+		AppendVarint(bytes, entry.layout.sampleRate);
+
+		AppendVarint(bytes, entry.layout.pages.size());
+		ogg_int64_t previousOffset = 0;
+		ogg_int64_t previousGranulePosition = 0;
+		for(vector<OggPageEntry>::size_type pageIndex = 0; pageIndex < entry.layout.pages.size(); pageIndex++)
+		{
+			const OggPageEntry& page = entry.layout.pages[pageIndex];
+			AppendVarint(bytes, static_cast<boost::uint64_t>(page.offset - previousOffset));
+			AppendSignedVarint(bytes, page.granulePosition - previousGranulePosition);
+			previousOffset = page.offset;
+			previousGranulePosition = page.granulePosition;
+		}
+	}
+
+	// Write to a temporary file and rename it over the old index so that a crash can't leave half an index.
+	ReplaceFileContentsOrDie(m_indexPath.c_str(), bytes);
+
+	m_modified = false;
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
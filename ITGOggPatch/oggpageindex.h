@@ -0,0 +1,92 @@
+#ifndef __OGGPAGEINDEX_H__
+#define __OGGPAGEINDEX_H__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include "ogglength.h"
+#include "utilities.h"
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// A persistent index of the page layouts of Ogg Vorbis files, so that repeated operations on a file can jump
+// straight to the page they need instead of walking every page header again.
+//
+// Entries are keyed by absolute path and are only used while the file's inode, size, and modification time still
+// match what they were when the entry was made. The index is loaded when constructed and written by Save().
+// A missing or unreadable index file is treated as an empty index; it's only a cache.
+// Safe to use from several threads at once. The lock is only held while looking up or storing an entry, not while
+// the file is read.
+class OggPageIndex
+{
+private:
+	struct Entry
+	{
+		lhcutilities::FileIdentity identity;
+		OggPageLayout layout;
+
+		Entry() : identity(), layout()
+		{
+		}
+	};
+
+	std::string m_indexPath;
+	std::map<std::string, Entry> m_entries;
+	bool m_modified; // Whether there are changes that Save() needs to write
+	mutable boost::mutex m_mutex; // Guards m_entries and m_modified
+
+	// Not copyable
+	OggPageIndex(const OggPageIndex&);
+	OggPageIndex& operator=(const OggPageIndex&);
+
+	void Load();
+	static std::string GetKey(const std::string& filePath);
+
+	// Reduces a full page layout to the pages worth storing: the header pages, a page every s_seekPointSpacing
+	// bytes, the last page with a granule position, and the end of stream page.
+	static OggPageLayout Compact(const OggPageLayout& layout);
+	static const ogg_int64_t s_seekPointSpacing;
+
+public:
+	// Loads the index stored at indexPath, or starts an empty one if there is no index there yet.
+	explicit OggPageIndex(const std::string& indexPath);
+
+	// Gets the stored page layout of the given file. Returns false if there is none or the file has changed since it
+	// was stored.
+	bool Find(const std::string& filePath, OggPageLayout& layoutOut) const;
+
+	// Stores the page layout of the given file, along with the file's current identity.
+	// Throws lhcutilities::IoError if the file can't be stat'ed.
+	void Update(const std::string& filePath, const OggPageLayout& layout);
+
+	// Gets the number of files in the index.
+	size_t Size() const;
+
+	// Writes the index to its file if anything changed. The file is replaced atomically so an interrupted
+	// save doesn't lose the old index. Throws lhcutilities::IoError if there is an error.
+	void Save();
+};
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
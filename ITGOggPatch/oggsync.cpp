@@ -0,0 +1,323 @@
+#include "stdafx.h"
+#include "oggsync.h"
+#include "oggcrc.h"
+#include <cstddef>
+#include <cstring>
+#include <ogg/ogg.h>
+
+// SSE2 is always there on x86-64 and can be assumed on 32-bit x86 only if the compiler was told to.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OGGSYNC_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only used if the CPU running the program has it. gcc and clang can compile a single function for AVX2 and
+// check the CPU at run time; MSVC builds get SSE2.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(OGGSYNC_SSE2)
+#define OGGSYNC_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace ogglength
+{
+
+namespace
+{
+
+const size_t s_capturePatternSize = 4;
+const size_t s_minHeaderSize = 27;
+
+bool IsCapturePattern(const unsigned char* p)
+{
+	return p[0] == 'O' && p[1] == 'g' && p[2] == 'g' && p[3] == 'S';
+}
+
+const unsigned char* FindCapturePatternScalar(const unsigned char* begin, const unsigned char* end)
+{
+	if(static_cast<size_t>(end - begin) < s_capturePatternSize)
+	{
+		return end;
+	}
+
+	// memchr is fast at finding the 'O's to check
+	const unsigned char* lastStart = end - s_capturePatternSize;
+	const unsigned char* p = begin;
+	while(p <= lastStart)
+	{
+		p = static_cast<const unsigned char*>(memchr(p, 'O', lastStart - p + 1));
+		if(p == NULL)
+		{
+			return end;
+		}
+		if(IsCapturePattern(p))
+		{
+			return p;
+		}
+		p++;
+	}
+	return end;
+}
+
+const unsigned char* FindLastCapturePatternScalar(const unsigned char* begin, const unsigned char* end)
+{
+	if(static_cast<size_t>(end - begin) < s_capturePatternSize)
+	{
+		return end;
+	}
+
+	for(const unsigned char* p = end - s_capturePatternSize; ; p--)
+	{
+		if(IsCapturePattern(p))
+		{
+			return p;
+		}
+		if(p == begin)
+		{
+			return end;
+		}
+	}
+}
+
+#if defined(OGGSYNC_SSE2)
+
+unsigned int LowestSetBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+unsigned int HighestSetBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return index;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
+
+// Returns a mask with bit i set if a capture pattern starts at p + i, for i from 0 to 15. Reads p to p + 18.
+unsigned int CapturePatternMaskSse2(const unsigned char* p)
+{
+	__m128i o = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8('O'));
+	__m128i g1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1)), _mm_set1_epi8('g'));
+	__m128i g2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2)), _mm_set1_epi8('g'));
+	__m128i s = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 3)), _mm_set1_epi8('S'));
+	return static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(o, g1), _mm_and_si128(g2, s))));
+}
+
+const unsigned char* FindCapturePatternSse2(const unsigned char* begin, const unsigned char* end)
+{
+	const size_t blockSize = 16;
+	const unsigned char* p = begin;
+	while(static_cast<size_t>(end - p) >= blockSize + s_capturePatternSize - 1)
+	{
+		unsigned int mask = CapturePatternMaskSse2(p);
+		if(mask != 0)
+		{
+			return p + LowestSetBit(mask);
+		}
+		p += blockSize;
+	}
+	return FindCapturePatternScalar(p, end);
+}
+
+const unsigned char* FindLastCapturePatternSse2(const unsigned char* begin, const unsigned char* end)
+{
+	const size_t blockSize = 16;
+	if(static_cast<size_t>(end - begin) < s_capturePatternSize)
+	{
+		return end;
+	}
+
+	// Blocks are checked from the back. Capture patterns can start anywhere before startsEnd.
+	const unsigned char* startsEnd = end - (s_capturePatternSize - 1);
+	while(static_cast<size_t>(startsEnd - begin) >= blockSize)
+	{
+		const unsigned char* block = startsEnd - blockSize;
+		unsigned int mask = CapturePatternMaskSse2(block);
+		if(mask != 0)
+		{
+			return block + HighestSetBit(mask);
+		}
+		startsEnd = block;
+	}
+
+	const unsigned char* restEnd = startsEnd + (s_capturePatternSize - 1);
+	const unsigned char* found = FindLastCapturePatternScalar(begin, restEnd);
+	return found == restEnd ? end : found;
+}
+
+#endif // OGGSYNC_SSE2
+
+#if defined(OGGSYNC_AVX2)
+
+// Like CapturePatternMaskSse2() but for 32 starting positions. Reads p to p + 34.
+__attribute__((target("avx2"))) unsigned int CapturePatternMaskAvx2(const unsigned char* p)
+{
+	__m256i o = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_set1_epi8('O'));
+	__m256i g1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1)),
+		_mm256_set1_epi8('g'));
+	__m256i g2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2)),
+		_mm256_set1_epi8('g'));
+	__m256i s = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 3)),
+		_mm256_set1_epi8('S'));
+	return static_cast<unsigned int>(
+		_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(o, g1), _mm256_and_si256(g2, s))));
+}
+
+__attribute__((target("avx2"))) const unsigned char* FindCapturePatternAvx2(const unsigned char* begin,
+	const unsigned char* end)
+{
+	const size_t blockSize = 32;
+	const unsigned char* p = begin;
+	while(static_cast<size_t>(end - p) >= blockSize + s_capturePatternSize - 1)
+	{
+		unsigned int mask = CapturePatternMaskAvx2(p);
+		if(mask != 0)
+		{
+			return p + LowestSetBit(mask);
+		}
+		p += blockSize;
+	}
+	return FindCapturePatternSse2(p, end);
+}
+
+__attribute__((target("avx2"))) const unsigned char* FindLastCapturePatternAvx2(const unsigned char* begin,
+	const unsigned char* end)
+{
+	const size_t blockSize = 32;
+	if(static_cast<size_t>(end - begin) < s_capturePatternSize)
+	{
+		return end;
+	}
+
+	// Blocks are checked from the back. Capture patterns can start anywhere before startsEnd.
+	const unsigned char* startsEnd = end - (s_capturePatternSize - 1);
+	while(static_cast<size_t>(startsEnd - begin) >= blockSize)
+	{
+		const unsigned char* block = startsEnd - blockSize;
+		unsigned int mask = CapturePatternMaskAvx2(block);
+		if(mask != 0)
+		{
+			return block + HighestSetBit(mask);
+		}
+		startsEnd = block;
+	}
+
+	const unsigned char* restEnd = startsEnd + (s_capturePatternSize - 1);
+	const unsigned char* found = FindLastCapturePatternSse2(begin, restEnd);
+	return found == restEnd ? end : found;
+}
+
+bool CpuHasAvx2()
+{
+	// Needed because this runs from a static initializer, possibly before libgcc's own.
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+// Checked once at startup so the searches don't have to.
+const bool s_haveAvx2 = CpuHasAvx2();
+
+#endif // OGGSYNC_AVX2
+
+} // end anonymous namespace
+
+const unsigned char* FindCapturePattern(const unsigned char* begin, const unsigned char* end)
+{
+#if defined(OGGSYNC_AVX2)
+	if(s_haveAvx2)
+	{
+		return FindCapturePatternAvx2(begin, end);
+	}
+#endif
+#if defined(OGGSYNC_SSE2)
+	return FindCapturePatternSse2(begin, end);
+#else
+	return FindCapturePatternScalar(begin, end);
+#endif
+}
+
+const unsigned char* FindLastCapturePattern(const unsigned char* begin, const unsigned char* end)
+{
+#if defined(OGGSYNC_AVX2)
+	if(s_haveAvx2)
+	{
+		return FindLastCapturePatternAvx2(begin, end);
+	}
+#endif
+#if defined(OGGSYNC_SSE2)
+	return FindLastCapturePatternSse2(begin, end);
+#else
+	return FindLastCapturePatternScalar(begin, end);
+#endif
+}
+
+size_t SumSegmentSizes(const unsigned char* segmentSizes, size_t numSegments)
+{
+	size_t sum = 0;
+	for(size_t segmentIndex = 0; segmentIndex < numSegments; segmentIndex++)
+	{
+		sum += segmentSizes[segmentIndex];
+	}
+	return sum;
+}
+
+size_t GetValidPageSize(const unsigned char* data, size_t available)
+{
+	if(available < s_minHeaderSize || !IsCapturePattern(data) || data[4] != 0)
+	{
+		return 0;
+	}
+
+	size_t numSegments = data[26];
+	size_t headerSize = s_minHeaderSize + numSegments;
+	if(available < headerSize)
+	{
+		return 0;
+	}
+	size_t bodySize = SumSegmentSizes(data + s_minHeaderSize, numSegments);
+	if(available < headerSize + bodySize)
+	{
+		return 0;
+	}
+
+	ogg_uint32_t storedChecksum = static_cast<ogg_uint32_t>(data[22]) | (static_cast<ogg_uint32_t>(data[23]) << 8)
+		| (static_cast<ogg_uint32_t>(data[24]) << 16) | (static_cast<ogg_uint32_t>(data[25]) << 24);
+	if(ComputePageChecksum(data, headerSize, data + headerSize, bodySize) != storedChecksum)
+	{
+		return 0;
+	}
+	return headerSize + bodySize;
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
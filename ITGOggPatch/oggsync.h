@@ -0,0 +1,43 @@
+#ifndef __OGGSYNC_H__
+#define __OGGSYNC_H__
+
+#include <cstddef>
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// Finds the first "OggS" capture pattern that lies entirely within [begin, end). Returns end if there is none.
+// Compares 32 or 16 bytes at a time with AVX2 or SSE2 when the CPU has them.
+const unsigned char* FindCapturePattern(const unsigned char* begin, const unsigned char* end);
+
+// Finds the last "OggS" capture pattern that lies entirely within [begin, end). Returns end if there is none.
+const unsigned char* FindLastCapturePattern(const unsigned char* begin, const unsigned char* end);
+
+// Adds up the segment table of an Ogg page to get the size of the data part of the page.
+std::size_t SumSegmentSizes(const unsigned char* segmentSizes, std::size_t numSegments);
+
+// Returns the size of the Ogg page starting at data if the whole page is within the available bytes, it is a
+// version 0 page, and its checksum is right. Returns 0 otherwise. A capture pattern found by the functions above is
+// only a page if this says so, because "OggS" can turn up in compressed audio.
+std::size_t GetValidPageSize(const unsigned char* data, std::size_t available);
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
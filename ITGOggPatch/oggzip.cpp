@@ -0,0 +1,438 @@
+#include "stdafx.h"
+#include "oggzip.h"
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include "utilities.h"
+
+using namespace std;
+using namespace lhcutilities;
+
+namespace ogglength
+{
+
+namespace
+{
+
+// For details of the zip format, see http://www.pkware.com/documents/casestudies/APPNOTE.TXT
+
+const ogg_uint32_t s_localHeaderSignature = 0x04034b50;
+const ogg_uint32_t s_dataDescriptorSignature = 0x08074b50;
+const ogg_uint32_t s_centralHeaderSignature = 0x02014b50;
+const ogg_uint32_t s_endSignature = 0x06054b50;
+const ogg_uint32_t s_zip64EndLocatorSignature = 0x07064b50;
+const ogg_uint32_t s_zip64EndSignature = 0x06064b50;
+const size_t s_localHeaderSize = 30; // Not counting the name and extra field
+const size_t s_centralHeaderSize = 46; // Not counting the name, extra field, and comment
+const size_t s_endSize = 22; // Not counting the comment
+const size_t s_maxCommentSize = 65535;
+const size_t s_zip64EndLocatorSize = 20;
+const size_t s_zip64EndSize = 56; // Not counting the extensible data
+const unsigned int s_zip64ExtraFieldId = 0x0001;
+const ogg_uint32_t s_zip64Placeholder = 0xffffffff; // In a 32-bit field whose value is in the Zip64 extra field
+
+// The zip CRC-32 is the Ogg one bit-reversed, with the register started at all ones and inverted at the end.
+// Polynomials here are stored the same reversed way, with the x^0 coefficient in bit 31.
+const ogg_uint32_t s_zipCrcPolynomial = 0xedb88320;
+
+vector<unsigned char> ReadBytesAtOrDie(OggFile& file, ogg_int64_t offset, size_t numBytes)
+{
+	vector<unsigned char> bytes(numBytes);
+	if(numBytes > 0 && file.ReadAt(offset, &(bytes[0]), numBytes) < numBytes)
+	{
+		throw IoError("Unexpected end of file.");
+	}
+	return bytes;
+}
+
+// Fields too big for the central directory header are 0xffffffff there, and their real values are in the Zip64
+// extra field, in this order, for only the fields that didn't fit.
+void ReadZip64ExtraField(const vector<unsigned char>& directory, size_t begin, size_t size, ZipEntry& entry)
+{
+	size_t end = begin + size;
+	size_t position = begin;
+	while(position + 4 <= end)
+	{
+		unsigned int fieldId = GetFromBytes<ogg_uint16_t>(directory, position);
+		size_t fieldSize = GetFromBytes<ogg_uint16_t>(directory, position + 2);
+		size_t fieldBegin = position + 4;
+		if(fieldBegin + fieldSize > end)
+		{
+			break;
+		}
+
+		if(fieldId == s_zip64ExtraFieldId)
+		{
+			ogg_int64_t* values[] = { &entry.uncompressedSize, &entry.compressedSize, &entry.localHeaderOffset };
+			size_t valuePosition = fieldBegin;
+			for(size_t valueIndex = 0; valueIndex < sizeof(values) / sizeof(values[0]); valueIndex++)
+			{
+				if(*values[valueIndex] != s_zip64Placeholder)
+				{
+					continue;
+				}
+				if(valuePosition + 8 > fieldBegin + fieldSize)
+				{
+					throw IoError("The zip file's central directory is damaged.");
+				}
+				*values[valueIndex] = static_cast<ogg_int64_t>(GetFromBytes<boost::uint64_t>(directory, valuePosition));
+				valuePosition += 8;
+			}
+		}
+		position = fieldBegin + fieldSize;
+	}
+}
+
+// Continues the zip CRC-32 register over the given bytes, without the inversions at the start and end.
+ogg_uint32_t UpdateRawZipCrc(ogg_uint32_t crc, const unsigned char* data, size_t size)
+{
+	for(size_t byteIndex = 0; byteIndex < size; byteIndex++)
+	{
+		crc ^= data[byteIndex];
+		for(int bitIndex = 0; bitIndex < 8; bitIndex++)
+		{
+			crc = (crc & 1) != 0 ? (crc >> 1) ^ s_zipCrcPolynomial : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+// Multiplies two polynomials modulo the CRC-32 polynomial.
+ogg_uint32_t MultiplyModCrcPolynomial(ogg_uint32_t a, ogg_uint32_t b)
+{
+	ogg_uint32_t product = 0;
+	for(ogg_uint32_t bit = 0x80000000u; bit != 0; bit >>= 1)
+	{
+		if((a & bit) != 0)
+		{
+			product ^= b;
+		}
+		b = (b & 1) != 0 ? (b >> 1) ^ s_zipCrcPolynomial : b >> 1;
+	}
+	return product;
+}
+
+// Gets x^(8 * numBytes) modulo the CRC-32 polynomial. Running numBytes zero bytes through a raw CRC register
+// multiplies it by this.
+ogg_uint32_t GetZeroBytesMultiplier(boost::uint64_t numBytes)
+{
+	ogg_uint32_t multiplier = 0x80000000u; // 1
+	ogg_uint32_t power = 0x00800000u; // x^8
+	while(numBytes > 0)
+	{
+		if((numBytes & 1) != 0)
+		{
+			multiplier = MultiplyModCrcPolynomial(multiplier, power);
+		}
+		power = MultiplyModCrcPolynomial(power, power);
+		numBytes >>= 1;
+	}
+	return multiplier;
+}
+
+// Gets what to xor the zip CRC-32 of dataSize bytes of data with when the numBytes bytes at offset change from
+// oldBytes to newBytes, without looking at the rest of the data. The CRCs of two messages of the same length xor to
+// the raw CRC of the messages xored together, where the unchanged bytes are zero. Zeros before the change leave the
+// raw CRC at zero and each zero after it multiplies the raw CRC by x^8.
+ogg_uint32_t GetCrcChange(const unsigned char* oldBytes, const unsigned char* newBytes, size_t numBytes,
+	ogg_int64_t offset, ogg_int64_t dataSize)
+{
+	vector<unsigned char> difference(numBytes);
+	for(size_t byteIndex = 0; byteIndex < numBytes; byteIndex++)
+	{
+		difference[byteIndex] = oldBytes[byteIndex] ^ newBytes[byteIndex];
+	}
+	ogg_uint32_t crc = UpdateRawZipCrc(0, &(difference[0]), numBytes);
+	return MultiplyModCrcPolynomial(crc,
+		GetZeroBytesMultiplier(static_cast<boost::uint64_t>(dataSize - offset) - numBytes));
+}
+
+// An entry of a zip archive opened by a ZipIoBackend. Offsets are from the start of the entry's data.
+class ZipEntryFile : public OggFile
+{
+private:
+	boost::shared_ptr<OggFile> m_archive;
+	ZipEntry m_entry;
+	bool m_writable;
+	ogg_int64_t m_dataOffset;
+	ogg_int64_t m_localCrcOffset; // -1 if the local header leaves the CRC to the data descriptor
+	ogg_int64_t m_descriptorCrcOffset; // -1 if there is no data descriptor
+
+public:
+	ZipEntryFile(boost::shared_ptr<OggFile> archive, const ZipEntry& entry, bool writable) : m_archive(archive),
+		m_entry(entry), m_writable(writable), m_dataOffset(0), m_localCrcOffset(-1), m_descriptorCrcOffset(-1)
+	{
+		// The local header has its own copy of the name and extra field, which can differ from the central
+		// directory's.
+		vector<unsigned char> localHeader = ReadBytesAtOrDie(*m_archive, m_entry.localHeaderOffset,
+			s_localHeaderSize);
+		if(GetFromBytes<ogg_uint32_t>(localHeader) != s_localHeaderSignature)
+		{
+			throw IoError("The file's local header in the zip file is damaged.");
+		}
+		m_dataOffset = m_entry.localHeaderOffset + static_cast<ogg_int64_t>(s_localHeaderSize)
+			+ GetFromBytes<ogg_uint16_t>(localHeader, 26) + GetFromBytes<ogg_uint16_t>(localHeader, 28);
+
+		if(!m_writable)
+		{
+			return;
+		}
+
+		// The central directory's CRC is the one that counts. Read it again in case the entry was patched since the
+		// directory was read.
+		m_entry.crc = GetFromBytes<ogg_uint32_t>(ReadBytesAtOrDie(*m_archive, m_entry.centralHeaderOffset + 16, 4));
+		if(GetFromBytes<ogg_uint32_t>(localHeader, 14) == m_entry.crc)
+		{
+			m_localCrcOffset = m_entry.localHeaderOffset + 14;
+		}
+		else if(!m_entry.HasDataDescriptor())
+		{
+			throw IoError("The file's local header in the zip file does not match the central directory.");
+		}
+
+		if(m_entry.HasDataDescriptor())
+		{
+			// The data descriptor may or may not start with a signature.
+			ogg_int64_t descriptorOffset = m_dataOffset + m_entry.compressedSize;
+			vector<unsigned char> descriptor = ReadBytesAtOrDie(*m_archive, descriptorOffset, 8);
+			if(GetFromBytes<ogg_uint32_t>(descriptor) == m_entry.crc)
+			{
+				m_descriptorCrcOffset = descriptorOffset;
+			}
+			else if(GetFromBytes<ogg_uint32_t>(descriptor) == s_dataDescriptorSignature
+				&& GetFromBytes<ogg_uint32_t>(descriptor, 4) == m_entry.crc)
+			{
+				m_descriptorCrcOffset = descriptorOffset + 4;
+			}
+			else
+			{
+				throw IoError("The file's data descriptor in the zip file is damaged.");
+			}
+		}
+	}
+
+	ogg_int64_t Size()
+	{
+		return m_entry.uncompressedSize;
+	}
+
+	size_t ReadAt(ogg_int64_t offset, void* buffer, size_t numBytes)
+	{
+		if(offset < 0 || offset >= m_entry.uncompressedSize)
+		{
+			return 0;
+		}
+		size_t numToRead = static_cast<size_t>(min(static_cast<ogg_int64_t>(numBytes),
+			m_entry.uncompressedSize - offset));
+		return m_archive->ReadAt(m_dataOffset + offset, buffer, numToRead);
+	}
+
+	void WriteAt(ogg_int64_t offset, const void* data, size_t numBytes)
+	{
+		if(!m_writable)
+		{
+			throw IoError("The file was opened read-only.");
+		}
+		if(offset < 0 || offset + static_cast<ogg_int64_t>(numBytes) > m_entry.uncompressedSize)
+		{
+			throw IoError("A file in a zip file can't be made longer.");
+		}
+		if(numBytes == 0)
+		{
+			return;
+		}
+
+		vector<unsigned char> oldBytes = ReadBytesAtOrDie(*m_archive, m_dataOffset + offset, numBytes);
+		m_archive->WriteAt(m_dataOffset + offset, data, numBytes);
+		m_entry.crc ^= GetCrcChange(&(oldBytes[0]), static_cast<const unsigned char*>(data), numBytes, offset,
+			m_entry.uncompressedSize);
+
+		vector<unsigned char> crcBytes;
+		AppendBytes(crcBytes, m_entry.crc);
+		if(m_localCrcOffset >= 0)
+		{
+			m_archive->WriteAt(m_localCrcOffset, &(crcBytes[0]), crcBytes.size());
+		}
+		if(m_descriptorCrcOffset >= 0)
+		{
+			m_archive->WriteAt(m_descriptorCrcOffset, &(crcBytes[0]), crcBytes.size());
+		}
+		m_archive->WriteAt(m_entry.centralHeaderOffset + 16, &(crcBytes[0]), crcBytes.size());
+	}
+
+	void Close()
+	{
+		m_archive->Close();
+	}
+};
+
+} // end anonymous namespace
+
+vector<ZipEntry> ReadZipDirectory(OggFile& archive)
+{
+	// The end of central directory record is at the end of the archive, followed only by a comment.
+	ogg_int64_t archiveSize = archive.Size();
+	if(archiveSize < static_cast<ogg_int64_t>(s_endSize))
+	{
+		throw IoError("File does not appear to be a zip file.");
+	}
+	size_t tailSize = static_cast<size_t>(min(archiveSize, static_cast<ogg_int64_t>(s_endSize + s_maxCommentSize)));
+	ogg_int64_t tailOffset = archiveSize - static_cast<ogg_int64_t>(tailSize);
+	vector<unsigned char> tail = ReadBytesAtOrDie(archive, tailOffset, tailSize);
+
+	size_t endPosition = tailSize;
+	for(size_t position = tailSize - s_endSize + 1; position-- > 0; )
+	{
+		if(GetFromBytes<ogg_uint32_t>(tail, position) == s_endSignature
+			&& position + s_endSize + GetFromBytes<ogg_uint16_t>(tail, position + 20) <= tailSize)
+		{
+			endPosition = position;
+			break;
+		}
+	}
+	if(endPosition == tailSize)
+	{
+		throw IoError("File does not appear to be a zip file.");
+	}
+
+	boost::uint64_t numEntries = GetFromBytes<ogg_uint16_t>(tail, endPosition + 10);
+	boost::uint64_t directorySize = GetFromBytes<ogg_uint32_t>(tail, endPosition + 12);
+	boost::uint64_t directoryOffset = GetFromBytes<ogg_uint32_t>(tail, endPosition + 16);
+
+	// Archives too big for those fields have a Zip64 end of central directory record as well, found through a
+	// locator right before the normal record.
+	ogg_int64_t endOffset = tailOffset + static_cast<ogg_int64_t>(endPosition);
+	if(endOffset >= static_cast<ogg_int64_t>(s_zip64EndLocatorSize))
+	{
+		vector<unsigned char> locator = ReadBytesAtOrDie(archive,
+			endOffset - static_cast<ogg_int64_t>(s_zip64EndLocatorSize), s_zip64EndLocatorSize);
+		if(GetFromBytes<ogg_uint32_t>(locator) == s_zip64EndLocatorSignature)
+		{
+			vector<unsigned char> zip64End = ReadBytesAtOrDie(archive,
+				static_cast<ogg_int64_t>(GetFromBytes<boost::uint64_t>(locator, 8)), s_zip64EndSize);
+			if(GetFromBytes<ogg_uint32_t>(zip64End) != s_zip64EndSignature)
+			{
+				throw IoError("The zip file's central directory is damaged.");
+			}
+			numEntries = GetFromBytes<boost::uint64_t>(zip64End, 32);
+			directorySize = GetFromBytes<boost::uint64_t>(zip64End, 40);
+			directoryOffset = GetFromBytes<boost::uint64_t>(zip64End, 48);
+		}
+	}
+
+	if(directoryOffset > static_cast<boost::uint64_t>(archiveSize)
+		|| directorySize > static_cast<boost::uint64_t>(archiveSize) - directoryOffset)
+	{
+		throw IoError("The zip file's central directory is damaged.");
+	}
+	vector<unsigned char> directory = ReadBytesAtOrDie(archive, static_cast<ogg_int64_t>(directoryOffset),
+		static_cast<size_t>(directorySize));
+
+	vector<ZipEntry> entries;
+	size_t position = 0;
+	for(boost::uint64_t entryIndex = 0; entryIndex < numEntries; entryIndex++)
+	{
+		if(position + s_centralHeaderSize > directory.size()
+			|| GetFromBytes<ogg_uint32_t>(directory, position) != s_centralHeaderSignature)
+		{
+			throw IoError("The zip file's central directory is damaged.");
+		}
+
+		ZipEntry entry;
+		entry.flags = GetFromBytes<ogg_uint16_t>(directory, position + 8);
+		entry.method = GetFromBytes<ogg_uint16_t>(directory, position + 10);
+		entry.crc = GetFromBytes<ogg_uint32_t>(directory, position + 16);
+		entry.compressedSize = GetFromBytes<ogg_uint32_t>(directory, position + 20);
+		entry.uncompressedSize = GetFromBytes<ogg_uint32_t>(directory, position + 24);
+		entry.localHeaderOffset = GetFromBytes<ogg_uint32_t>(directory, position + 42);
+		entry.centralHeaderOffset = static_cast<ogg_int64_t>(directoryOffset + position);
+
+		size_t nameSize = GetFromBytes<ogg_uint16_t>(directory, position + 28);
+		size_t extraSize = GetFromBytes<ogg_uint16_t>(directory, position + 30);
+		size_t commentSize = GetFromBytes<ogg_uint16_t>(directory, position + 32);
+		size_t nameBegin = position + s_centralHeaderSize;
+		if(nameBegin + nameSize + extraSize + commentSize > directory.size())
+		{
+			throw IoError("The zip file's central directory is damaged.");
+		}
+		entry.name.assign(directory.begin() + nameBegin, directory.begin() + nameBegin + nameSize);
+		ReadZip64ExtraField(directory, nameBegin + nameSize, extraSize, entry);
+
+		entries.push_back(entry);
+		position = nameBegin + nameSize + extraSize + commentSize;
+	}
+	return entries;
+}
+
+ZipIoBackend::ZipIoBackend(IoBackend* archiveBackend) : m_defaultBackend(),
+	m_archiveBackend(archiveBackend != NULL ? archiveBackend : &m_defaultBackend), m_mutex(), m_entries()
+{
+}
+
+vector<ZipEntry> ZipIoBackend::AddArchive(const string& archivePath)
+{
+	boost::shared_ptr<OggFile> archive = m_archiveBackend->Open(archivePath.c_str(), false);
+	vector<ZipEntry> entries = ReadZipDirectory(*archive);
+	archive->Close();
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	for(vector<ZipEntry>::size_type entryIndex = 0; entryIndex < entries.size(); entryIndex++)
+	{
+		m_entries[GetEntryPath(archivePath, entries[entryIndex])] = make_pair(archivePath, entries[entryIndex]);
+	}
+	return entries;
+}
+
+string ZipIoBackend::GetEntryPath(const string& archivePath, const ZipEntry& entry)
+{
+	return archivePath + "/" + entry.name;
+}
+
+boost::shared_ptr<OggFile> ZipIoBackend::Open(const char* filePath, bool writable)
+{
+	pair<string, ZipEntry> entry;
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		map<string, pair<string, ZipEntry> >::const_iterator entryIt = m_entries.find(filePath);
+		if(entryIt == m_entries.end())
+		{
+			return m_archiveBackend->Open(filePath, writable);
+		}
+		entry = entryIt->second;
+	}
+
+	if(entry.second.IsEncrypted())
+	{
+		throw IoError("The file is encrypted in the zip file.");
+	}
+	if(!entry.second.IsStored())
+	{
+		throw IoError("The file is compressed in the zip file.");
+	}
+	return boost::shared_ptr<OggFile>(new ZipEntryFile(m_archiveBackend->Open(entry.first.c_str(), writable),
+		entry.second, writable));
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
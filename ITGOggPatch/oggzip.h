@@ -0,0 +1,95 @@
+#ifndef __OGGZIP_H__
+#define __OGGZIP_H__
+
+#include <ogg/ogg.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "oggio.h"
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// An entry in the central directory of a zip archive.
+struct ZipEntry
+{
+	std::string name; // Path of the entry within the archive, with forward slashes
+	unsigned int flags; // General purpose bit flags
+	unsigned int method; // Compression method. 0 means stored without compression.
+	ogg_uint32_t crc; // CRC-32 of the uncompressed data
+	ogg_int64_t compressedSize;
+	ogg_int64_t uncompressedSize;
+	ogg_int64_t localHeaderOffset; // Byte offset of the entry's local file header
+	ogg_int64_t centralHeaderOffset; // Byte offset of the entry's header in the central directory
+
+	ZipEntry() : name(), flags(0), method(0), crc(0), compressedSize(0), uncompressedSize(0), localHeaderOffset(0),
+		centralHeaderOffset(0)
+	{
+	}
+
+	bool IsStored() const { return method == 0; }
+	bool IsEncrypted() const { return (flags & 0x1) != 0; }
+	bool HasDataDescriptor() const { return (flags & 0x8) != 0; } // The CRC and sizes also follow the data
+	bool IsDirectory() const { return !name.empty() && name[name.size() - 1] == '/'; }
+};
+
+// Reads the central directory of a zip archive, including Zip64 archives, in the order it lists the entries.
+// Throws lhcutilities::IoError if the file can't be read or isn't a zip archive.
+std::vector<ZipEntry> ReadZipDirectory(OggFile& archive);
+
+// Opens the entries of zip archives as files of their own, so that the ogglength functions can check and patch .ogg
+// files in a song pack without extracting it. An entry's path is the archive's path and the entry's name joined
+// with a slash, like Pack.zip/Song/song.ogg. Only entries stored without compression or encryption can be opened.
+// Writing to an entry patches its bytes in place and updates its CRC-32 in the local header or data descriptor and
+// in the central directory after each write, without reading the rest of the entry. Entries can't grow.
+// Paths of entries that weren't added are opened as normal files with the archive backend.
+class ZipIoBackend : public IoBackend
+{
+private:
+	PreadIoBackend m_defaultBackend;
+	IoBackend* m_archiveBackend;
+	mutable boost::mutex m_mutex;
+	std::map<std::string, std::pair<std::string, ZipEntry> > m_entries; // Entry path -> (archive path, entry)
+
+	// Not copyable
+	ZipIoBackend(const ZipIoBackend&);
+	ZipIoBackend& operator=(const ZipIoBackend&);
+
+public:
+	// Archives are opened with archiveBackend, or with a PreadIoBackend if it is NULL. The archive backend must
+	// outlive this backend.
+	explicit ZipIoBackend(IoBackend* archiveBackend);
+
+	// Reads an archive's central directory so that its entries can be opened, and returns its entries.
+	// Throws lhcutilities::IoError if the archive can't be read or isn't a zip archive.
+	std::vector<ZipEntry> AddArchive(const std::string& archivePath);
+
+	// Gets the path that an entry of an archive is opened with.
+	static std::string GetEntryPath(const std::string& archivePath, const ZipEntry& entry);
+
+	boost::shared_ptr<OggFile> Open(const char* filePath, bool writable);
+};
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
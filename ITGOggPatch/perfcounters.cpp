@@ -0,0 +1,196 @@
+#include "stdafx.h"
+#include "perfcounters.h"
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+namespace lhcutilities
+{
+
+const char* GetPerfCounterName(PerfCounter counter)
+{
+	switch(counter)
+	{
+	case perf_cycles:
+		return "Cycles";
+	case perf_instructions:
+		return "Instructions";
+	case perf_cache_misses:
+		return "Cache misses";
+	case perf_branch_misses:
+		return "Branch misses";
+	case perf_context_switches:
+		return "Context switches";
+	default:
+		return "Unknown";
+	}
+}
+
+#ifdef __linux__
+namespace
+{
+
+// glibc has no wrapper for perf_event_open.
+int OpenPerfEvent(PerfCounter counter, int groupFd)
+{
+	struct perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attributes.exclude_hv = 1;
+	attributes.exclude_kernel = 1;
+
+	switch(counter)
+	{
+	case perf_cycles:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case perf_instructions:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case perf_cache_misses:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case perf_branch_misses:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	default:
+		// Context switches happen in the kernel, so leaving the kernel out would never count any.
+		attributes.type = PERF_TYPE_SOFTWARE;
+		attributes.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+		attributes.exclude_kernel = 0;
+		break;
+	}
+
+	// The calling thread only, on any CPU
+	return static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, groupFd, 0));
+}
+
+} // end anonymous namespace
+#endif
+
+PerfCounterGroup::PerfCounterGroup() : m_leaderFd(-1), m_numOpen(0), m_error()
+{
+	for(int counter = 0; counter < num_perf_counters; counter++)
+	{
+		m_fds[counter] = -1;
+		m_readOrder[counter] = perf_cycles;
+	}
+
+#ifdef __linux__
+	// Whichever counter opens first leads the group and the rest join it, so losing one counter doesn't lose them all.
+	for(int counter = 0; counter < num_perf_counters; counter++)
+	{
+		int fd = OpenPerfEvent(static_cast<PerfCounter>(counter), m_leaderFd);
+		if(fd < 0)
+		{
+			if(m_error.empty())
+			{
+				m_error = string(GetPerfCounterName(static_cast<PerfCounter>(counter))) + ": " + strerror(errno);
+				if(errno == EACCES || errno == EPERM)
+				{
+					m_error += ", see /proc/sys/kernel/perf_event_paranoid";
+				}
+				else if(errno == ENOENT || errno == EOPNOTSUPP)
+				{
+					m_error += ", the CPU or virtual machine doesn't have it";
+				}
+			}
+			continue;
+		}
+
+		m_fds[counter] = fd;
+		if(m_leaderFd < 0)
+		{
+			m_leaderFd = fd;
+		}
+		m_readOrder[m_numOpen] = static_cast<PerfCounter>(counter);
+		m_numOpen++;
+	}
+#else
+	m_error = "Performance counters are only supported on Linux.";
+#endif
+}
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+#ifdef __linux__
+	for(int counter = 0; counter < num_perf_counters; counter++)
+	{
+		if(m_fds[counter] >= 0)
+		{
+			close(m_fds[counter]);
+		}
+	}
+#endif
+}
+
+bool PerfCounterGroup::Read(PerfCounts& countsOut) const
+{
+#ifdef __linux__
+	if(m_leaderFd < 0)
+	{
+		return false;
+	}
+
+	// Number of counters, time enabled, time running, then a value for each counter in the order they joined
+	vector<boost::uint64_t> buffer(3 + num_perf_counters);
+	ssize_t bytesRead;
+	do
+	{
+		bytesRead = read(m_leaderFd, &(buffer[0]), buffer.size() * sizeof(buffer[0]));
+	} while(bytesRead < 0 && errno == EINTR);
+	if(bytesRead < static_cast<ssize_t>((3 + m_numOpen) * sizeof(buffer[0]))
+		|| buffer[0] != static_cast<boost::uint64_t>(m_numOpen))
+	{
+		return false;
+	}
+
+	boost::uint64_t timeEnabled = buffer[1];
+	boost::uint64_t timeRunning = buffer[2];
+	for(int readIndex = 0; readIndex < m_numOpen; readIndex++)
+	{
+		boost::uint64_t value = buffer[3 + readIndex];
+		if(timeRunning > 0 && timeRunning < timeEnabled)
+		{
+			value = static_cast<boost::uint64_t>(static_cast<double>(value) * timeEnabled / timeRunning);
+		}
+		countsOut.values[m_readOrder[readIndex]] = value;
+	}
+	return true;
+#else
+	(void)countsOut;
+	return false;
+#endif
+}
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,92 @@
+#ifndef __PERFCOUNTERS_H__
+#define __PERFCOUNTERS_H__
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// The counters a PerfCounterGroup counts
+enum PerfCounter
+{
+	perf_cycles,
+	perf_instructions,
+	perf_cache_misses,
+	perf_branch_misses,
+	perf_context_switches,
+	num_perf_counters
+};
+
+// Gets a name for a counter to show people, like "Cache misses".
+const char* GetPerfCounterName(PerfCounter counter);
+
+// Values of the counters in a PerfCounterGroup. Counters that aren't available stay at 0.
+struct PerfCounts
+{
+	boost::uint64_t values[num_perf_counters];
+
+	PerfCounts()
+	{
+		for(int counter = 0; counter < num_perf_counters; counter++)
+		{
+			values[counter] = 0;
+		}
+	}
+};
+
+// CPU performance counters for the thread that creates the group, opened with perf_event_open as one group so that
+// they all count over exactly the same stretches of time. Only the thread's own code is counted, not the kernel's,
+// since that is all an unprivileged process is normally allowed; context switches are the exception if the kernel
+// allows it. Counters the kernel or CPU won't provide are left out rather than failing. Linux only; on other
+// systems nothing is available.
+class PerfCounterGroup
+{
+private:
+	int m_fds[num_perf_counters]; // -1 for counters that couldn't be opened
+	int m_leaderFd; // -1 if no counter could be opened
+	PerfCounter m_readOrder[num_perf_counters]; // Order of the counters in a group read
+	int m_numOpen;
+	std::string m_error;
+
+	// Not copyable
+	PerfCounterGroup(const PerfCounterGroup&);
+	PerfCounterGroup& operator=(const PerfCounterGroup&);
+
+public:
+	// Opens the counters and starts them counting. Never throws.
+	PerfCounterGroup();
+	~PerfCounterGroup();
+
+	bool Available(PerfCounter counter) const { return m_fds[counter] >= 0; }
+	bool AnyAvailable() const { return m_leaderFd >= 0; }
+
+	// Why the first counter that couldn't be opened couldn't be. Empty if all of them were opened.
+	const std::string& Error() const { return m_error; }
+
+	// Reads the counts since the group was opened, scaled up for any time the kernel gave the counters to other
+	// groups. Must be called from the thread that opened the group. Returns false if nothing could be read.
+	bool Read(PerfCounts& countsOut) const;
+};
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,282 @@
+#include "stdafx.h"
+#include "unixsocket.h"
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <boost/shared_ptr.hpp>
+#include "utilities.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Not on every Unix. Callers there should ignore SIGPIPE.
+#endif
+#endif
+
+using namespace std;
+
+namespace lhcutilities
+{
+
+#ifndef _WIN32
+
+namespace
+{
+
+// Fills in a socket address for the given path. Throws lhcutilities::IoError if the path is too long to fit.
+sockaddr_un GetSocketAddress(const string& path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path))
+	{
+		throw IoError("Socket path " + path + " is too long.");
+	}
+	strcpy(address.sun_path, path.c_str());
+	return address;
+}
+
+IoError SocketError(const string& what)
+{
+	return IoError(what + ": " + strerror(errno));
+}
+
+int CreateSocketOrDie()
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		throw SocketError("Could not create socket");
+	}
+	return fd;
+}
+
+// Returns true if something is listening on the socket at the given path.
+bool SomeoneIsListening(const sockaddr_un& address)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		return false;
+	}
+	bool connected = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+	close(fd);
+	return connected;
+}
+
+} // end anonymous namespace
+
+bool UnixSocketsSupported()
+{
+	return true;
+}
+
+UnixSocket::~UnixSocket()
+{
+	if(m_fd >= 0)
+	{
+		close(m_fd);
+	}
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Listen(const string& path)
+{
+	sockaddr_un address = GetSocketAddress(path);
+
+	// A socket file stays behind if its owner was killed. Replace it, but not if its owner is still alive.
+	if(SomeoneIsListening(address))
+	{
+		throw IoError("Something is already listening on " + path + ".");
+	}
+	unlink(path.c_str());
+
+	boost::shared_ptr<UnixSocket> listener(new UnixSocket(CreateSocketOrDie()));
+	if(bind(listener->m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		throw SocketError("Could not bind socket to " + path);
+	}
+	if(listen(listener->m_fd, SOMAXCONN) != 0)
+	{
+		throw SocketError("Could not listen on " + path);
+	}
+	return listener;
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Connect(const string& path)
+{
+	sockaddr_un address = GetSocketAddress(path);
+	boost::shared_ptr<UnixSocket> connection(new UnixSocket(CreateSocketOrDie()));
+	if(connect(connection->m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		throw SocketError("Could not connect to " + path);
+	}
+	return connection;
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Accept()
+{
+	while(true)
+	{
+		int fd = accept(m_fd, NULL, NULL);
+		if(fd >= 0)
+		{
+			return boost::shared_ptr<UnixSocket>(new UnixSocket(fd));
+		}
+		else if(errno == EINTR || errno == ECONNABORTED)
+		{
+			continue;
+		}
+		else if(errno == EINVAL)
+		{
+			// Shut down
+			return boost::shared_ptr<UnixSocket>();
+		}
+		else
+		{
+			throw SocketError("Error accepting connection");
+		}
+	}
+}
+
+bool UnixSocket::ReadLine(string& lineOut)
+{
+	while(true)
+	{
+		string::size_type newlinePosition = m_readBuffer.find('\n');
+		if(newlinePosition != string::npos)
+		{
+			lineOut.assign(m_readBuffer, 0, newlinePosition);
+			m_readBuffer.erase(0, newlinePosition + 1);
+			return true;
+		}
+
+		char buffer[4096];
+		ssize_t bytesRead = recv(m_fd, buffer, sizeof(buffer), 0);
+		if(bytesRead > 0)
+		{
+			m_readBuffer.append(buffer, bytesRead);
+		}
+		else if(bytesRead == 0)
+		{
+			// A last line without a newline still counts.
+			if(m_readBuffer.empty())
+			{
+				return false;
+			}
+			lineOut.swap(m_readBuffer);
+			m_readBuffer.clear();
+			return true;
+		}
+		else if(errno != EINTR)
+		{
+			throw SocketError("Error reading from socket");
+		}
+	}
+}
+
+void UnixSocket::WriteOrDie(const string& bytes)
+{
+	string::size_type bytesWritten = 0;
+	while(bytesWritten < bytes.size())
+	{
+		// MSG_NOSIGNAL keeps a client hanging up early from killing the whole process with SIGPIPE.
+		ssize_t sent = send(m_fd, bytes.data() + bytesWritten, bytes.size() - bytesWritten, MSG_NOSIGNAL);
+		if(sent < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			throw SocketError("Error writing to socket");
+		}
+		bytesWritten += sent;
+	}
+}
+
+void UnixSocket::Shutdown()
+{
+	ShutdownSocketFromSignalHandler(m_fd);
+}
+
+void UnixSocket::ShutdownReading()
+{
+	shutdown(m_fd, SHUT_RD);
+}
+
+void ShutdownSocketFromSignalHandler(int fd)
+{
+	shutdown(fd, SHUT_RDWR);
+}
+
+#else // No Unix domain sockets
+
+bool UnixSocketsSupported()
+{
+	return false;
+}
+
+UnixSocket::~UnixSocket()
+{
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Listen(const string&)
+{
+	throw IoError("Unix domain sockets are not supported on this platform.");
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Connect(const string&)
+{
+	throw IoError("Unix domain sockets are not supported on this platform.");
+}
+
+boost::shared_ptr<UnixSocket> UnixSocket::Accept()
+{
+	return boost::shared_ptr<UnixSocket>();
+}
+
+bool UnixSocket::ReadLine(string&)
+{
+	return false;
+}
+
+void UnixSocket::WriteOrDie(const string&)
+{
+	throw IoError("Unix domain sockets are not supported on this platform.");
+}
+
+void UnixSocket::Shutdown()
+{
+}
+
+void UnixSocket::ShutdownReading()
+{
+}
+
+void ShutdownSocketFromSignalHandler(int)
+{
+}
+
+#endif
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
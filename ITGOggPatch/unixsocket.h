@@ -0,0 +1,88 @@
+#ifndef __UNIXSOCKET_H__
+#define __UNIXSOCKET_H__
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// Returns true if Unix domain sockets are supported on this platform.
+bool UnixSocketsSupported();
+
+// A connected or listening Unix domain stream socket that is closed when destroyed. Lines can be read from it by
+// one thread while another writes to it. On platforms without Unix domain sockets, creating one throws
+// lhcutilities::IoError.
+class UnixSocket
+{
+private:
+	int m_fd;
+	std::string m_readBuffer; // Received bytes that haven't been returned by ReadLine() yet
+
+	// Not copyable
+	UnixSocket(const UnixSocket&);
+	UnixSocket& operator=(const UnixSocket&);
+
+	explicit UnixSocket(int fd) : m_fd(fd), m_readBuffer()
+	{
+	}
+
+public:
+	~UnixSocket();
+
+	// Creates a socket listening at the given path. A socket file left over at the path by a process that is no
+	// longer listening on it is replaced. Throws lhcutilities::IoError if the socket could not be created or
+	// another process is still listening at the path.
+	static boost::shared_ptr<UnixSocket> Listen(const std::string& path);
+
+	// Connects to the socket listening at the given path. Throws lhcutilities::IoError on failure.
+	static boost::shared_ptr<UnixSocket> Connect(const std::string& path);
+
+	// Waits for a connection to a listening socket and returns it. Returns NULL once the socket has been shut down.
+	// Throws lhcutilities::IoError on other errors.
+	boost::shared_ptr<UnixSocket> Accept();
+
+	// Reads up to the next newline. The newline is not included in lineOut. Returns false at the end of the stream.
+	// Throws lhcutilities::IoError if there was an error reading.
+	bool ReadLine(std::string& lineOut);
+
+	// Writes all of the given bytes. Throws lhcutilities::IoError if they could not be written, including when the
+	// other end has gone away.
+	void WriteOrDie(const std::string& bytes);
+
+	// Stops the socket from sending or receiving any more, waking up any thread blocked in Accept() or ReadLine().
+	// Safe to call from a signal handler through ShutdownSocketFromSignalHandler().
+	void Shutdown();
+
+	// Stops the socket from receiving any more, waking up any thread blocked in ReadLine(), but lets responses still
+	// be written.
+	void ShutdownReading();
+
+	// Gets the underlying file descriptor.
+	int Descriptor() const { return m_fd; }
+};
+
+// Does what UnixSocket::Shutdown() does, using only functions that are safe to call from a signal handler.
+void ShutdownSocketFromSignalHandler(int fd);
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
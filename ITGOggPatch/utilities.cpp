@@ -2,8 +2,13 @@
 #include "utilities.h"
 #include <exception>
 #include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
 
 using namespace std;
+namespace fs = boost::filesystem;
 
 namespace lhcutilities
 {
@@ -69,6 +74,72 @@ FILE* OpenOrDie(const char* filename, const char* mode)
 	#endif
 }
 
+void WriteBytesOrDie(FILE* file, const vector<unsigned char>& bytes)
+{
+	if(bytes.empty())
+	{
+		return;
+	}
+
+	size_t bytesWritten = fwrite(&bytes[0], 1, bytes.size(), file);
+	if(bytesWritten < bytes.size())
+	{
+		throw IoError("Error while writing.");
+	}
+}
+
+void WriteFileOrDie(const char* filename, const vector<unsigned char>& bytes)
+{
+	ScopedFile file(OpenOrDie(filename, "wb"));
+	WriteBytesOrDie(file.get(), bytes);
+	file.CloseOrDie();
+}
+
+void RenameOverOrDie(const char* fromFilename, const char* toFilename)
+{
+	try
+	{
+		fs::rename(fromFilename, toFilename);
+	}
+	catch(fs::filesystem_error&)
+	{
+		// Older versions of boost won't rename over an existing file on Windows.
+		fs::remove(toFilename);
+		fs::rename(fromFilename, toFilename);
+	}
+}
+
+void ReplaceFileContentsOrDie(const char* filename, const vector<unsigned char>& bytes)
+{
+	string tempPath = string(filename) + ".tmp";
+	WriteFileOrDie(tempPath.c_str(), bytes);
+	RenameOverOrDie(tempPath.c_str(), filename);
+}
+
+void ScopedFile::Reset(FILE* file)
+{
+	if(m_file != NULL)
+	{
+		fclose(m_file);
+	}
+	m_file = file;
+}
+
+void ScopedFile::CloseOrDie()
+{
+	if(m_file == NULL)
+	{
+		return;
+	}
+
+	int closeResult = fclose(m_file);
+	m_file = NULL;
+	if(closeResult != 0)
+	{
+		throw IoError("Error while closing file.");
+	}
+}
+
 void SeekOrDie(FILE* file, long offset, SeekOrigin origin)
 {
 	int seekSuccess = fseek(file, offset, static_cast<int>(origin));
@@ -89,6 +160,32 @@ long TellOrDie(FILE* file)
 	return seekPosition;
 }
 
+#ifdef _MSC_VER
+#pragma warning(disable:4996) // 'stat': The POSIX name for this item is deprecated.
+#endif
+FileIdentity GetFileIdentityOrDie(const char* filename)
+{
+	struct stat fileStatus;
+	if(stat(filename, &fileStatus) != 0)
+	{
+		throw IoError(string("Could not get information about file ") + filename + ".");
+	}
+
+	FileIdentity identity;
+	identity.inode = static_cast<boost::uint64_t>(fileStatus.st_ino);
+	identity.size = static_cast<boost::uint64_t>(fileStatus.st_size);
+	identity.modificationTime = static_cast<boost::int64_t>(fileStatus.st_mtime) * 1000000000;
+#ifdef __linux__
+	// Second granularity isn't enough to notice a file being patched twice in the same second.
+	identity.modificationTime += fileStatus.st_mtim.tv_nsec;
+#endif
+	return identity;
+
+	#ifdef _MSC_VER
+	#pragma warning(default:4996)
+	#endif
+}
+
 } // end namespace lhcutilities
 
 /*
@@ -4,6 +4,7 @@
 #include <vector>
 #include <cstdio>
 #include <stdexcept>
+#include <boost/cstdint.hpp>
 
 // Namespace lhcutilities contains various utility functions.
 // The code is not tied to ITG Ogg Patcher and is reusable.
@@ -46,6 +47,81 @@ long TellOrDie(FILE* file);
 // Like fopen but throws lhcutilities::IoError if there is an error.
 FILE* OpenOrDie(const char* filename, const char* mode);
 
+// Writes all the given bytes to file. Throws lhcutilities::IoError if there is an error.
+void WriteBytesOrDie(FILE* file, const std::vector<unsigned char>& bytes);
+
+// Creates or truncates the file and writes the given bytes to it. Throws lhcutilities::IoError if there is an error.
+void WriteFileOrDie(const char* filename, const std::vector<unsigned char>& bytes);
+
+// Renames fromFilename to toFilename, replacing toFilename if it exists.
+// Throws boost::filesystem::filesystem_error if there is an error.
+void RenameOverOrDie(const char* fromFilename, const char* toFilename);
+
+// Replaces the contents of the file with the given bytes by writing them to filename + ".tmp" and renaming that
+// over the file, so the file is never left half written. Throws lhcutilities::IoError if the temporary file can't
+// be written, or boost::filesystem::filesystem_error if it can't be renamed.
+void ReplaceFileContentsOrDie(const char* filename, const std::vector<unsigned char>& bytes);
+
+// Resource-managing class for a FILE*. The file is closed when the object goes out of scope.
+class ScopedFile
+{
+private:
+	FILE* m_file;
+
+	// Not copyable
+	ScopedFile(const ScopedFile&);
+	ScopedFile& operator=(const ScopedFile&);
+
+public:
+	// Takes ownership of file, which may be NULL.
+	explicit ScopedFile(FILE* file) : m_file(file)
+	{
+	}
+
+	~ScopedFile()
+	{
+		if(m_file != NULL)
+		{
+			fclose(m_file);
+		}
+	}
+
+	// Gets the underlying FILE*
+	FILE* get() const { return m_file; }
+
+	// Closes the current file, if any, and takes ownership of file instead.
+	void Reset(FILE* file);
+
+	// Closes the file now. Throws lhcutilities::IoError if there is an error, such as buffered writes failing.
+	void CloseOrDie();
+};
+
+// Identifies a particular version of a file on disk. If any of the fields change, the file has probably been
+// modified or replaced since the identity was taken.
+struct FileIdentity
+{
+	boost::uint64_t inode; // 0 on platforms that don't have inode numbers
+	boost::uint64_t size; // in bytes
+	boost::int64_t modificationTime; // nanoseconds since the epoch, or seconds * 1e9 if the platform only has seconds
+
+	FileIdentity() : inode(0), size(0), modificationTime(0)
+	{
+	}
+
+	bool operator==(const FileIdentity& other) const
+	{
+		return inode == other.inode && size == other.size && modificationTime == other.modificationTime;
+	}
+
+	bool operator!=(const FileIdentity& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Gets the identity of the file at the given path. Throws lhcutilities::IoError if the file cannot be stat'ed.
+FileIdentity GetFileIdentityOrDie(const char* filename);
+
 // Reads one T from the file. eofOut is set to true if eof is reached.
 // If end of file was reached while trying to read (the number of bytes read was greater than 0 but less than sizeof(T)),
 // lhcutilities::IoError is thrown.
@@ -0,0 +1,268 @@
+#include "stdafx.h"
+#include "vorbisdecoder.h"
+#include <vector>
+#include <list>
+#include <utility>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vorbis/codec.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include "ogglength.h"
+
+using namespace std;
+
+namespace ogglength
+{
+
+namespace
+{
+
+vector<unsigned char> GetPacketBytes(const ogg_packet& packet)
+{
+	return vector<unsigned char>(packet.packet, packet.packet + packet.bytes);
+}
+
+bool PacketHasBytes(const ogg_packet& packet, const vector<unsigned char>& bytes)
+{
+	return static_cast<vector<unsigned char>::size_type>(packet.bytes) == bytes.size()
+		&& (bytes.empty() || memcmp(packet.packet, &(bytes[0]), bytes.size()) == 0);
+}
+
+size_t HashHeaders(const ogg_packet& identificationHeader, const ogg_packet& setupHeader)
+{
+	size_t hash = boost::hash_range(identificationHeader.packet, identificationHeader.packet + identificationHeader.bytes);
+	boost::hash_range(hash, setupHeader.packet, setupHeader.packet + setupHeader.bytes);
+	return hash;
+}
+
+// Recently used setups, most recently used first. A library has only a handful of distinct encoder settings, so
+// this rarely fills up.
+class VorbisSetupCache
+{
+private:
+	typedef list<pair<size_t, boost::shared_ptr<VorbisSetup> > > SetupList;
+	SetupList m_setups;
+	boost::mutex m_mutex;
+
+	static const SetupList::size_type s_maxSetups;
+
+	// Finds the setup for the headers and moves it to the front. m_mutex must be held.
+	boost::shared_ptr<VorbisSetup> Find(size_t hash, const ogg_packet& identificationHeader,
+		const ogg_packet& setupHeader)
+	{
+		for(SetupList::iterator setupIt = m_setups.begin(); setupIt != m_setups.end(); ++setupIt)
+		{
+			if(setupIt->first == hash && setupIt->second->HasHeaders(identificationHeader, setupHeader))
+			{
+				m_setups.splice(m_setups.begin(), m_setups, setupIt);
+				return m_setups.front().second;
+			}
+		}
+		return boost::shared_ptr<VorbisSetup>();
+	}
+
+public:
+	VorbisSetupCache() : m_setups(), m_mutex()
+	{
+	}
+
+	boost::shared_ptr<VorbisSetup> Get(ogg_packet& identificationHeader, ogg_packet& commentHeader,
+		ogg_packet& setupHeader)
+	{
+		size_t hash = HashHeaders(identificationHeader, setupHeader);
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			boost::shared_ptr<VorbisSetup> cached = Find(hash, identificationHeader, setupHeader);
+			if(cached)
+			{
+				return cached;
+			}
+		}
+
+		// Parse without holding the lock so other threads' hits don't wait on it. If another thread parsed the
+		// same headers in the meantime, use theirs so there's only one copy.
+		boost::shared_ptr<VorbisSetup> parsed(new VorbisSetup(identificationHeader, commentHeader, setupHeader));
+
+		boost::mutex::scoped_lock lock(m_mutex);
+		boost::shared_ptr<VorbisSetup> cached = Find(hash, identificationHeader, setupHeader);
+		if(cached)
+		{
+			return cached;
+		}
+		m_setups.push_front(make_pair(hash, parsed));
+		if(m_setups.size() > s_maxSetups)
+		{
+			m_setups.pop_back();
+		}
+		return parsed;
+	}
+};
+
+const VorbisSetupCache::SetupList::size_type VorbisSetupCache::s_maxSetups = 64;
+
+VorbisSetupCache g_setupCache;
+
+// Decoders each thread has finished with, most recently used first
+typedef list<boost::shared_ptr<_VorbisDecoderState> > DecoderPool;
+boost::thread_specific_ptr<DecoderPool> g_decoderPool;
+const DecoderPool::size_type s_maxPooledDecoders = 4;
+
+DecoderPool& GetThreadDecoderPool()
+{
+	if(g_decoderPool.get() == NULL)
+	{
+		g_decoderPool.reset(new DecoderPool());
+	}
+	return *g_decoderPool;
+}
+
+} // end anonymous namespace
+
+VorbisSetup::VorbisSetup(ogg_packet& identificationHeader, ogg_packet& commentHeader, ogg_packet& setupHeader)
+	: m_info(), m_identificationHeader(GetPacketBytes(identificationHeader)),
+	m_setupHeader(GetPacketBytes(setupHeader))
+{
+	vorbis_info_init(&m_info);
+
+	// The comment header has to go through libvorbis for it to accept the setup header, but it is different for
+	// every file so it isn't kept.
+	vorbis_comment comment;
+	vorbis_comment_init(&comment);
+	int result = vorbis_synthesis_headerin(&m_info, &comment, &identificationHeader);
+	if(result == 0)
+	{
+		result = vorbis_synthesis_headerin(&m_info, &comment, &commentHeader);
+	}
+	if(result == 0)
+	{
+		result = vorbis_synthesis_headerin(&m_info, &comment, &setupHeader);
+	}
+	vorbis_comment_clear(&comment);
+
+	// libvorbis builds the decoding codebooks into the vorbis_info the first time a decoder is created with it. Get
+	// that over with now, before any other thread can see this setup, so it is never written to again.
+	vorbis_dsp_state dspState;
+	if(result == 0)
+	{
+		result = vorbis_synthesis_init(&dspState, &m_info);
+		if(result == 0)
+		{
+			vorbis_dsp_clear(&dspState);
+		}
+	}
+
+	if(result != 0)
+	{
+		vorbis_info_clear(&m_info);
+		throw OggVorbisError("Error opening Ogg Vorbis file.");
+	}
+}
+
+VorbisSetup::~VorbisSetup()
+{
+	vorbis_info_clear(&m_info);
+}
+
+bool VorbisSetup::HasHeaders(const ogg_packet& identificationHeader, const ogg_packet& setupHeader) const
+{
+	return PacketHasBytes(identificationHeader, m_identificationHeader) && PacketHasBytes(setupHeader, m_setupHeader);
+}
+
+boost::shared_ptr<VorbisSetup> GetVorbisSetup(ogg_packet& identificationHeader, ogg_packet& commentHeader,
+	ogg_packet& setupHeader)
+{
+	return g_setupCache.Get(identificationHeader, commentHeader, setupHeader);
+}
+
+struct _VorbisDecoderState
+{
+	boost::shared_ptr<VorbisSetup> setup; // Keeps the vorbis_info the decoder points to alive
+	vorbis_dsp_state dspState;
+	vorbis_block block;
+
+	explicit _VorbisDecoderState(const boost::shared_ptr<VorbisSetup>& setup_) : setup(setup_), dspState(), block()
+	{
+		if(vorbis_synthesis_init(&dspState, setup->Info()) != 0)
+		{
+			throw OggVorbisError("Error opening Ogg Vorbis file.");
+		}
+		vorbis_block_init(&dspState, &block);
+	}
+
+	~_VorbisDecoderState()
+	{
+		vorbis_block_clear(&block);
+		vorbis_dsp_clear(&dspState);
+	}
+
+private:
+	// Not copyable
+	_VorbisDecoderState(const _VorbisDecoderState&);
+	_VorbisDecoderState& operator=(const _VorbisDecoderState&);
+};
+
+PooledVorbisDecoder::PooledVorbisDecoder(const boost::shared_ptr<VorbisSetup>& setup) : m_state()
+{
+	DecoderPool& pool = GetThreadDecoderPool();
+	for(DecoderPool::iterator decoderIt = pool.begin(); decoderIt != pool.end(); ++decoderIt)
+	{
+		if((*decoderIt)->setup == setup)
+		{
+			m_state = *decoderIt;
+			pool.erase(decoderIt);
+			vorbis_synthesis_restart(&(m_state->dspState));
+			return;
+		}
+	}
+
+	m_state.reset(new _VorbisDecoderState(setup));
+}
+
+PooledVorbisDecoder::~PooledVorbisDecoder()
+{
+	try
+	{
+		DecoderPool& pool = GetThreadDecoderPool();
+		pool.push_front(m_state);
+		if(pool.size() > s_maxPooledDecoders)
+		{
+			pool.pop_back();
+		}
+	}
+	catch(std::bad_alloc&)
+	{
+		// Not pooling it is fine. It gets cleaned up when m_state goes away.
+	}
+}
+
+vorbis_dsp_state* PooledVorbisDecoder::DspState()
+{
+	return &(m_state->dspState);
+}
+
+vorbis_block* PooledVorbisDecoder::Block()
+{
+	return &(m_state->block);
+}
+
+} // end namespace ogglength
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
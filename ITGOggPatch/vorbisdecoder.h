@@ -0,0 +1,90 @@
+#ifndef __VORBISDECODER_H__
+#define __VORBISDECODER_H__
+
+#include <vector>
+#include <vorbis/codec.h>
+#include <boost/shared_ptr.hpp>
+
+// ogglength is reusable code.
+namespace ogglength
+{
+
+// The parsed headers of a Vorbis stream. Most files from the same encoder and settings have byte-for-byte the same
+// identification and setup headers, and parsing the codebooks in the setup header is the expensive part of opening a
+// file, so one VorbisSetup is shared by every stream with the same headers. Once created it is only read, so any
+// number of threads can decode with it at once.
+class VorbisSetup
+{
+private:
+	vorbis_info m_info;
+	std::vector<unsigned char> m_identificationHeader;
+	std::vector<unsigned char> m_setupHeader;
+
+	// Not copyable
+	VorbisSetup(const VorbisSetup&);
+	VorbisSetup& operator=(const VorbisSetup&);
+
+public:
+	// Parses the three Vorbis header packets. Throws ogglength::OggVorbisError if they aren't valid.
+	VorbisSetup(ogg_packet& identificationHeader, ogg_packet& commentHeader, ogg_packet& setupHeader);
+	~VorbisSetup();
+
+	// Gets the parsed headers. libvorbis takes a non-const pointer but does not change it after construction.
+	vorbis_info* Info() { return &m_info; }
+
+	// Returns true if this setup was parsed from the given identification and setup headers.
+	bool HasHeaders(const ogg_packet& identificationHeader, const ogg_packet& setupHeader) const;
+};
+
+// Gets the shared VorbisSetup for the given header packets, only parsing them if no recent stream had the same
+// identification and setup headers. Safe to call from multiple threads.
+// Throws ogglength::OggVorbisError if the headers aren't valid.
+boost::shared_ptr<VorbisSetup> GetVorbisSetup(ogg_packet& identificationHeader, ogg_packet& commentHeader,
+	ogg_packet& setupHeader);
+
+// Helper struct for PooledVorbisDecoder, not intended to be used by other code.
+struct _VorbisDecoderState;
+
+// A libvorbis decoder (vorbis_dsp_state and vorbis_block) for one stream. Each thread keeps the decoders it is done
+// with in a small pool, and a decoder for a stream with the same VorbisSetup as a pooled one is reset and reused
+// instead of being built again, which saves allocating the decoder's lookup tables and buffers for every file.
+class PooledVorbisDecoder
+{
+private:
+	boost::shared_ptr<_VorbisDecoderState> m_state;
+
+	// Not copyable
+	PooledVorbisDecoder(const PooledVorbisDecoder&);
+	PooledVorbisDecoder& operator=(const PooledVorbisDecoder&);
+
+public:
+	// Gets a decoder for the given setup from the calling thread's pool, or creates one.
+	// Throws ogglength::OggVorbisError if libvorbis can't create one.
+	explicit PooledVorbisDecoder(const boost::shared_ptr<VorbisSetup>& setup);
+
+	// Returns the decoder to the calling thread's pool.
+	~PooledVorbisDecoder();
+
+	vorbis_dsp_state* DspState();
+	vorbis_block* Block();
+};
+
+} // end namespace ogglength
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
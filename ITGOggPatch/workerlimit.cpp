@@ -0,0 +1,57 @@
+#include "stdafx.h"
+#include "workerlimit.h"
+
+namespace lhcutilities
+{
+
+WorkerLimit::WorkerLimit(unsigned int limit) : m_limit(limit), m_released(false), m_mutex(), m_changed()
+{
+}
+
+void WorkerLimit::Set(unsigned int limit)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_limit = limit;
+	m_changed.notify_all();
+}
+
+unsigned int WorkerLimit::Get()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_limit;
+}
+
+bool WorkerLimit::WaitForTurn(unsigned int workerIndex)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	while(!m_released && workerIndex >= m_limit)
+	{
+		m_changed.wait(lock);
+	}
+	return !m_released;
+}
+
+void WorkerLimit::Release()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_released = true;
+	m_changed.notify_all();
+}
+
+} // end namespace lhcutilities
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
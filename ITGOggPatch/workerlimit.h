@@ -0,0 +1,61 @@
+#ifndef __WORKERLIMIT_H__
+#define __WORKERLIMIT_H__
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// Lets a changing number of a fixed set of worker threads work at once, so a pool can be started at its largest size
+// and shrunk or grown while it runs without starting or stopping threads. Workers are numbered from 0, and worker n
+// works while n is less than the limit.
+class WorkerLimit
+{
+private:
+	unsigned int m_limit;
+	bool m_released;
+	boost::mutex m_mutex;
+	boost::condition_variable m_changed;
+
+	// Not copyable
+	WorkerLimit(const WorkerLimit&);
+	WorkerLimit& operator=(const WorkerLimit&);
+
+public:
+	explicit WorkerLimit(unsigned int limit);
+
+	// Changes the number of workers that can work. Workers over the new limit stop when they finish what they are on.
+	void Set(unsigned int limit);
+
+	unsigned int Get();
+
+	// Waits until the worker with the given number is under the limit. Returns false if Release() was called, in
+	// which case the worker should stop.
+	bool WaitForTurn(unsigned int workerIndex);
+
+	// Wakes every waiting worker and makes WaitForTurn() return false from now on.
+	void Release();
+};
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
@@ -0,0 +1,68 @@
+#ifndef __WORKQUEUE_H__
+#define __WORKQUEUE_H__
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Namespace lhcutilities contains various utility functions.
+// The code is not tied to ITG Ogg Patcher and is reusable.
+namespace lhcutilities
+{
+
+// A queue of work items that any number of threads can add to and take from. Taking from an empty queue waits
+// until something is added or the queue is closed.
+template<typename T>
+class WorkQueue
+{
+private:
+	std::deque<T> m_items;
+	bool m_closed;
+	boost::mutex m_mutex;
+	boost::condition_variable m_itemAddedOrClosed;
+
+	// Not copyable
+	WorkQueue(const WorkQueue&);
+	WorkQueue& operator=(const WorkQueue&);
+
+public:
+	WorkQueue() : m_items(), m_closed(false), m_mutex(), m_itemAddedOrClosed()
+	{
+	}
+
+	// Adds an item to the back of the queue. Returns false without adding it if the queue has been closed.
+	bool Push(const T& item);
+
+	// Takes the item at the front of the queue, waiting for one if the queue is empty. Returns false if the queue
+	// was closed and everything in it has already been taken.
+	bool Pop(T& itemOut);
+
+	// Closes the queue. Items already in it can still be taken, but no more can be added, and threads waiting
+	// for an item are woken up once it runs dry.
+	void Close();
+
+	// Gets the number of items waiting in the queue.
+	typename std::deque<T>::size_type Size();
+};
+
+} // end namespace lhcutilities
+
+#include "workqueue_templates.h" // template implementation
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
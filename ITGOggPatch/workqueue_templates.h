@@ -0,0 +1,80 @@
+#ifndef __WORKQUEUE_TEMPLATES_H__
+#define __WORKQUEUE_TEMPLATES_H__
+
+#include "workqueue.h"
+
+// Template implementation
+
+namespace lhcutilities
+{
+
+template<typename T>
+bool WorkQueue<T>::Push(const T& item)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if(m_closed)
+		{
+			return false;
+		}
+		m_items.push_back(item);
+	}
+	m_itemAddedOrClosed.notify_one();
+	return true;
+}
+
+template<typename T>
+bool WorkQueue<T>::Pop(T& itemOut)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	while(m_items.empty() && !m_closed)
+	{
+		m_itemAddedOrClosed.wait(lock);
+	}
+
+	if(m_items.empty())
+	{
+		return false;
+	}
+
+	itemOut = m_items.front();
+	m_items.pop_front();
+	return true;
+}
+
+template<typename T>
+void WorkQueue<T>::Close()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_closed = true;
+	}
+	m_itemAddedOrClosed.notify_all();
+}
+
+template<typename T>
+typename std::deque<T>::size_type WorkQueue<T>::Size()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_items.size();
+}
+
+} // end namespace lhcutilities
+
+#endif // end include guard
+
+/*
+ Copyright 2010 Greg Najda
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/